@@ -13,6 +13,8 @@ SOURCES += \
     supcliente.cpp \
     supcliente_main_qt.cpp \
     supcliente_qt.cpp \
+    supdados.cpp \
+    suphistory.cpp \
     supimg.cpp \
     suplogin.cpp
 
@@ -21,6 +23,7 @@ HEADERS += \
     supcliente.h \
     supcliente_qt.h \
     supdados.h \
+    suphistory.h \
     supimg.h \
     suplogin.h \
     tanques-param.h
@@ -34,6 +34,73 @@ static void myclosesocket(SOCKET x)
   closesocket(x);
 }
 
+/// A funcao para remover o arquivo de um socket local
+static void myunlink(const char* path)
+{
+  DeleteFileA(path);
+}
+
+/// As opcoes de envio pelos sockets TCP
+static const int MYSEND_FLAGS = 0;
+
+/// A funcao que permite reabrir imediatamente uma porta TCP em escuta.
+/// No Windows, a porta pode ser reaberta mesmo com conexoes anteriores
+/// em TIME_WAIT; SO_REUSEADDR permitiria abrir uma porta em uso.
+static void myreuseaddr(SOCKET)
+{
+}
+
+/// A identificacao do processo, informada a quem envia um socket (write_socket)
+static uint32_t mygetpid()
+{
+  return uint32_t(GetCurrentProcessId());
+}
+
+/// As funcoes de transferencia de um socket x para outro processo pelo socket
+/// local chan. No Windows, o socket eh duplicado para o processo de destino
+/// (WSADuplicateSocket) e a descricao da copia eh enviada como dados comuns.
+static mysocket_status mysendsocket(SOCKET chan, SOCKET x, uint32_t pid)
+{
+  WSAPROTOCOL_INFOW info;
+  if (WSADuplicateSocketW(x, DWORD(pid), &info) != 0) return mysocket_status::SOCK_ERROR;
+  const char* buff = (const char*)&info;
+  int falta_enviar = sizeof(info);
+  while (falta_enviar > 0)
+  {
+    int ultimo_envio = ::send(chan, buff, falta_enviar, 0);
+    if (ultimo_envio == SOCKET_ERROR) return mysocket_status::SOCK_ERROR;
+    buff += ultimo_envio;
+    falta_enviar -= ultimo_envio;
+  }
+  return mysocket_status::SOCK_OK;
+}
+static mysocket_status myrecvsocket(SOCKET chan, SOCKET& x)
+{
+  WSAPROTOCOL_INFOW info;
+  char* buff = (char*)&info;
+  int falta_receber = sizeof(info);
+  while (falta_receber > 0)
+  {
+    int ultima_leitura = ::recv(chan, buff, falta_receber, 0);
+    if (ultima_leitura == 0) return mysocket_status::SOCK_DISCONNECTED;
+    if (ultima_leitura == SOCKET_ERROR) return mysocket_status::SOCK_ERROR;
+    buff += ultima_leitura;
+    falta_receber -= ultima_leitura;
+  }
+  x = WSASocketW(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO,
+                 &info, 0, WSA_FLAG_OVERLAPPED);
+  if (x == INVALID_SOCKET) return mysocket_status::SOCK_ERROR;
+  return mysocket_status::SOCK_OK;
+}
+
+#ifdef MYSOCKET_USE_POLL
+/// A funcao de espera por eventos em um conjunto de sockets
+static int mypoll(pollfd* fds, unsigned long nfds, int milisec)
+{
+  return WSAPoll(fds, nfds, milisec);
+}
+#endif // MYSOCKET_USE_POLL
+
 //*/
 
 /// Descomente o bloco a seguir para compilar no Linux
@@ -62,6 +129,88 @@ static void myclosesocket(SOCKET x)
   close(x);
 }
 
+/// A funcao para remover o arquivo de um socket local
+static void myunlink(const char* path)
+{
+  unlink(path);
+}
+
+/// As opcoes de envio pelos sockets TCP: o envio para uma conexao fechada
+/// pelo outro lado retorna erro, em vez de encerrar o processo (SIGPIPE)
+static const int MYSEND_FLAGS = MSG_NOSIGNAL;
+
+/// A funcao que permite reabrir imediatamente uma porta TCP em escuta,
+/// mesmo com conexoes de um processo anterior em TIME_WAIT
+static void myreuseaddr(SOCKET x)
+{
+  int on = 1;
+  setsockopt(x, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+}
+
+/// A identificacao do processo, informada a quem envia um socket (write_socket)
+static uint32_t mygetpid()
+{
+  return uint32_t(getpid());
+}
+
+/// As funcoes de transferencia de um socket x para outro processo pelo socket
+/// local chan. No Linux, o descritor vai como dado auxiliar (SCM_RIGHTS) de
+/// uma mensagem de 1 byte; o identificador do processo nao eh necessario.
+static mysocket_status mysendsocket(SOCKET chan, SOCKET x, uint32_t)
+{
+  char byte = 0;
+  iovec iov;
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  char ctrl[CMSG_SPACE(sizeof(int))];
+  memset(ctrl, 0, sizeof(ctrl));
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = sizeof(ctrl);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &x, sizeof(int));
+  if (sendmsg(chan, &msg, MSG_NOSIGNAL) != 1) return mysocket_status::SOCK_ERROR;
+  return mysocket_status::SOCK_OK;
+}
+static mysocket_status myrecvsocket(SOCKET chan, SOCKET& x)
+{
+  char byte;
+  iovec iov;
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  char ctrl[CMSG_SPACE(sizeof(int))];
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl;
+  msg.msg_controllen = sizeof(ctrl);
+  ssize_t n = recvmsg(chan, &msg, 0);
+  if (n == 0) return mysocket_status::SOCK_DISCONNECTED;
+  if (n != 1) return mysocket_status::SOCK_ERROR;
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+  memcpy(&x, CMSG_DATA(cmsg), sizeof(int));
+  return mysocket_status::SOCK_OK;
+}
+
+#ifdef MYSOCKET_USE_POLL
+/// A funcao de espera por eventos em um conjunto de sockets
+static int mypoll(pollfd* fds, unsigned long nfds, int milisec)
+{
+  return poll(fds, nfds, milisec);
+}
+#endif // MYSOCKET_USE_POLL
+
 */
 
 /*********************************************
@@ -197,6 +346,49 @@ mysocket_status tcp_mysocket::connect(const std::string& name, const std::string
   return(mysocket_status::SOCK_OK);
 }
 
+/// Monta o endereco de um socket local (AF_UNIX)
+/// Retorna false se o caminho for vazio ou muito longo
+static bool local_address(const std::string& path, sockaddr_un& addr)
+{
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  return true;
+}
+
+/// Se conecta a um socket local (AF_UNIX) aberto
+/// Soh pode ser usado em sockets "virgens" ou explicitamente fechados
+/// Retorna mysocket_status::SOCK_OK, se tudo deu certo, ou mysocket_status::SOCK_ERROR
+mysocket_status tcp_mysocket::connect_local(const std::string& path)
+{
+  if (id != INVALID_SOCKET)
+  {
+    return(mysocket_status::SOCK_ERROR);
+  }
+
+  sockaddr_un addr;
+  if (!local_address(path, addr))
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  // Nos sockets locais, o protocolo eh sempre 0
+  id = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (id == INVALID_SOCKET)
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  if (::connect(id, (sockaddr*)&addr, (int)sizeof(addr)) != 0)
+  {
+    close();
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  return(mysocket_status::SOCK_OK);
+}
+
 /// Leh de um socket conectado
 /// Soh pode ser usado em socket para o qual tenha sido feito um "connect" antes
 /// Ou entao em um socket retornado pelo "accept" de um socket servidor
@@ -285,7 +477,7 @@ mysocket_status tcp_mysocket::write_bytes(const mybyte* buff, int len) const
     // buf: A pointer to a buffer containing the data to be transmitted.
     // len: length, in bytes, of the data in buffer pointed to by the buf parameter.
     // flags: A set of flags that specify the way in which the call is made.
-    ultimo_envio = ::send(id, (char*)buff, falta_enviar, 0);
+    ultimo_envio = ::send(id, (char*)buff, falta_enviar, MYSEND_FLAGS);
 
     if ( ultimo_envio == SOCKET_ERROR )
     {
@@ -302,6 +494,24 @@ mysocket_status tcp_mysocket::write_bytes(const mybyte* buff, int len) const
   return(mysocket_status::SOCK_OK);
 }
 
+/// Leh uma sequencia de inteiros de 16 bits sem sinal de um socket conectado,
+/// com uma unica chamada de leitura (em vez de uma chamada por inteiro).
+/// O ultimo parametro eh o tempo maximo (em milisegundos) para esperar
+/// por dados; se for <0, que eh o default, espera indefinidamente.
+/// Retorna os mesmos status que read_bytes
+mysocket_status tcp_mysocket::read_uint16_array(uint16_t* nums, int n, long milisec) const
+{
+  return read_bytes((mybyte*)nums,n*sizeof(uint16_t),milisec);
+}
+
+/// Escreve uma sequencia de inteiros de 16 bits sem sinal em um socket conectado,
+/// com uma unica chamada de envio (em vez de uma chamada por inteiro).
+/// Retorna os mesmos status que write_bytes
+mysocket_status tcp_mysocket::write_uint16_array(const uint16_t* nums, int n) const
+{
+  return write_bytes((const mybyte*)nums,n*sizeof(uint16_t));
+}
+
 /// Leh um inteiro com sinal (int8_t, int16_t, int32_t, int64_t) ou sem sinal
 /// (uint8_t, uint16_t, uint32_t, uint64_t) de um socket conectado.
 /// O ultimo parametro eh o tempo maximo (em milisegundos) para esperar
@@ -446,6 +656,51 @@ mysocket_status tcp_mysocket::write_string(const std::string& msg) const
   return mysocket_status::SOCK_OK;
 }
 
+/// Envia por este socket local (AF_UNIX) uma copia do socket S para o processo
+/// do outro lado, que primeiro informa a sua identificacao (read_socket)
+mysocket_status tcp_mysocket::write_socket(const mysocket& S, long milisec) const
+{
+  if (!connected() || S.closed())
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+  uint32_t pid;
+  mysocket_status iResult = read_uint32(pid, milisec);
+  if (iResult != mysocket_status::SOCK_OK)
+  {
+    return iResult;
+  }
+  return mysendsocket(id, S.id, pid);
+}
+
+/// Recebe por este socket local (AF_UNIX) a copia de um socket enviada
+/// por outro processo (write_socket)
+mysocket_status tcp_mysocket::read_socket(mysocket& S, long milisec) const
+{
+  if (!connected() || !S.closed())
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+  mysocket_status iResult = write_uint32(mygetpid());
+  if (iResult != mysocket_status::SOCK_OK)
+  {
+    return iResult;
+  }
+  if (milisec>=0)
+  {
+    // Com timeout
+    mysocket_queue f;
+    f.include(*this);
+    iResult=f.wait_read(milisec);
+    if (iResult==mysocket_status::SOCK_ERROR ||
+        iResult==mysocket_status::SOCK_TIMEOUT)
+    {
+      return iResult;
+    }
+  }
+  return myrecvsocket(id, S.id);
+}
+
 /// Sockets servidores
 
 /// Abre um novo socket para esperar conexoes
@@ -503,6 +758,9 @@ mysocket_status tcp_mysocket_server::listen(const std::string& port, int nconex)
     return mysocket_status::SOCK_ERROR;
   }
 
+  // Permite reabrir a porta logo apos o fim de outro servidor (servidor de reserva)
+  myreuseaddr(id);
+
   // Atribuicao do nome do socket
 
   // For a server to accept client connections, it must be bound to a network address within the system.
@@ -537,6 +795,47 @@ mysocket_status tcp_mysocket_server::listen(const std::string& port, int nconex)
   return mysocket_status::SOCK_OK;
 }
 
+/// Abre um novo socket local (AF_UNIX) para esperar conexoes
+/// Soh pode ser usado em sockets "virgens" ou explicitamente fechados
+/// Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
+mysocket_status tcp_mysocket_server::listen_local(const std::string& path, int nconex)
+{
+  if (id != INVALID_SOCKET)
+  {
+    return(mysocket_status::SOCK_ERROR);
+  }
+
+  sockaddr_un addr;
+  if (!local_address(path, addr))
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  // Nos sockets locais, o protocolo eh sempre 0
+  id = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (id == INVALID_SOCKET)
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  // O bind cria o arquivo do socket, e falha se ele jah existir.
+  // Um arquivo que tenha sobrado de uma execucao anterior eh removido.
+  myunlink(path.c_str());
+  if (bind(id, (sockaddr*)&addr, (int)sizeof(addr)) == SOCKET_ERROR)
+  {
+    close();
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  if (::listen(id, nconex) == SOCKET_ERROR)
+  {
+    close();
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  return mysocket_status::SOCK_OK;
+}
+
 /// Aceita uma conexao que chegou em um socket aberto
 /// Soh pode ser usado em socket para o qual tenha sido feito um "listen" antes
 /// O socket "a" passado como parametro, em caso de sucesso, estarah conectado
@@ -561,6 +860,179 @@ mysocket_status tcp_mysocket_server::accept(tcp_mysocket& a) const
   return mysocket_status::SOCK_OK;
 }
 
+/*********************************************
+ * Sockets de datagramas (DATAGRAM SOCKET)   *
+ *********************************************/
+
+/// Abre um socket para enviar datagramas ao endereco "name" e porta "port"
+/// Soh pode ser usado em sockets "virgens" ou explicitamente fechados
+/// Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
+mysocket_status udp_mysocket::open_sender(const std::string& name, const std::string& port)
+{
+  if (id != INVALID_SOCKET)
+  {
+    return(mysocket_status::SOCK_ERROR);
+  }
+
+  struct addrinfo hints, *result = nullptr;  // para getaddrinfo
+  int intResult;
+
+  memset(&hints, 0, sizeof (hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_protocol = IPPROTO_UDP;
+
+  // Resolve o endereco de destino
+  intResult = getaddrinfo(name.c_str(), port.c_str(), &hints, &result);
+  if (intResult != 0)
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  id = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if (id == INVALID_SOCKET)
+  {
+    freeaddrinfo(result);
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  // O envio para um endereco de difusao (broadcast) precisa ser autorizado
+  int on = 1;
+  if (::setsockopt(id, SOL_SOCKET, SO_BROADCAST, (const char*)&on, sizeof(on)) != 0)
+  {
+    freeaddrinfo(result);
+    close();
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  // O socket nao eh conectado ao destino: o endereco eh informado a cada envio
+  // Assim, a falta de um receptor no destino nao gera erro nos envios seguintes
+  memcpy(&dest, result->ai_addr, result->ai_addrlen);
+  dest_len = (int)result->ai_addrlen;
+  freeaddrinfo(result);
+
+  return mysocket_status::SOCK_OK;
+}
+
+/// Abre um socket para receber os datagramas enviados para a porta "port"
+/// Soh pode ser usado em sockets "virgens" ou explicitamente fechados
+/// Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
+mysocket_status udp_mysocket::open_receiver(const std::string& port, const std::string& group)
+{
+  if (id != INVALID_SOCKET)
+  {
+    return(mysocket_status::SOCK_ERROR);
+  }
+
+  struct addrinfo hints, *result = nullptr;  // para getaddrinfo, bind
+  int intResult;
+
+  memset(&hints, 0, sizeof (hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_protocol = IPPROTO_UDP;
+  hints.ai_flags = AI_PASSIVE;
+
+  // Resolve o endereco local (qualquer interface) e a porta
+  intResult = getaddrinfo(nullptr, port.c_str(), &hints, &result);
+  if (intResult != 0)
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  id = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if (id == INVALID_SOCKET)
+  {
+    freeaddrinfo(result);
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  // Permite que outros sockets do mesmo computador recebam da mesma porta
+  int on = 1;
+  ::setsockopt(id, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+
+  intResult = ::bind(id, result->ai_addr, (int)result->ai_addrlen);
+  freeaddrinfo(result);
+  if (intResult == SOCKET_ERROR)
+  {
+    close();
+    return mysocket_status::SOCK_ERROR;
+  }
+
+  // Entra no grupo (multicast), se houver
+  if (!group.empty())
+  {
+    hints.ai_flags = 0;
+    intResult = getaddrinfo(group.c_str(), nullptr, &hints, &result);
+    if (intResult != 0)
+    {
+      close();
+      return mysocket_status::SOCK_ERROR;
+    }
+    ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr = ((sockaddr_in*)result->ai_addr)->sin_addr;
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    freeaddrinfo(result);
+    // Um endereco que nao eh de grupo eh rejeitado pelo sistema operacional
+    if (::setsockopt(id, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&mreq, sizeof(mreq)) != 0)
+    {
+      close();
+      return mysocket_status::SOCK_ERROR;
+    }
+  }
+
+  return mysocket_status::SOCK_OK;
+}
+
+/// Envia um datagrama ao destino do open_sender
+/// Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
+mysocket_status udp_mysocket::write_datagram(const mybyte* buff, int len) const
+{
+  if (closed() || dest_len == 0 || len <= 0)
+  {
+    return(mysocket_status::SOCK_ERROR);
+  }
+  // O datagrama eh enviado inteiro ou nao eh enviado
+  if (::sendto(id, (const char*)buff, len, 0, (const sockaddr*)&dest, dest_len) != len)
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+  return(mysocket_status::SOCK_OK);
+}
+
+/// Recebe um datagrama
+/// Retorna mysocket_status::SOCK_OK, mysocket_status::SOCK_TIMEOUT ou mysocket_status::SOCK_ERROR
+mysocket_status udp_mysocket::read_datagram(mybyte* buff, int len, int& nread, long milisec) const
+{
+  nread = 0;
+  if (closed() || len <= 0)
+  {
+    return(mysocket_status::SOCK_ERROR);
+  }
+  if (milisec>=0)
+  {
+    // Com timeout
+    mysocket_queue f;
+    f.include(*this);
+    mysocket_status iResult=f.wait_read(milisec);
+    if (iResult==mysocket_status::SOCK_ERROR ||
+        iResult==mysocket_status::SOCK_TIMEOUT)
+    {
+      return iResult;
+    }
+  }
+
+  // Cada recv retorna um unico datagrama
+  int recebidos = ::recv(id, (char*)buff, len, 0);
+  if (recebidos == SOCKET_ERROR)
+  {
+    return mysocket_status::SOCK_ERROR;
+  }
+  nread = recebidos;
+  return(mysocket_status::SOCK_OK);
+}
+
 /*********************************************
  * A CLASSE mysocket_queue (FILA DE SOCKETS) *
  *********************************************/
@@ -575,6 +1047,10 @@ mysocket_queue::~mysocket_queue()
   clear();
 }
 
+#ifndef MYSOCKET_USE_POLL
+
+/// Implementacao da fila de sockets com select
+
 /// Limpa a lista de sockets
 void mysocket_queue::clear()
 {
@@ -669,3 +1145,115 @@ bool mysocket_queue::had_activity(const mysocket& a)
 {
   return(FD_ISSET(a.id,&set));
 }
+
+#else
+
+/// Implementacao da fila de sockets com poll
+
+/// Limpa a lista de sockets
+void mysocket_queue::clear()
+{
+  set.clear();
+  pos.clear();
+}
+
+/// Adiciona um socket a uma fila de sockets
+/// Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
+mysocket_status mysocket_queue::include(const mysocket& a)
+{
+  if (a.id == INVALID_SOCKET)
+  {
+    return(mysocket_status::SOCK_ERROR);
+  }
+  if (pos.find(a.id) == pos.end())
+  {
+    pollfd p;
+    p.fd = a.id;
+    p.events = 0;
+    p.revents = 0;
+    pos[a.id] = set.size();
+    set.push_back(p);
+  }
+  return(mysocket_status::SOCK_OK);
+}
+
+/// Retira um socket de uma fila de sockets
+/// Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
+mysocket_status mysocket_queue::exclude(const mysocket& a)
+{
+  auto itr = pos.find(a.id);
+  if (itr == pos.end())
+  {
+    return(mysocket_status::SOCK_ERROR);
+  }
+  // Move o ultimo elemento do vetor para a posicao do socket retirado
+  size_t i = itr->second;
+  pos.erase(itr);
+  if (i+1 < set.size())
+  {
+    set[i] = set.back();
+    pos[set[i].fd] = i;
+  }
+  set.pop_back();
+  return(mysocket_status::SOCK_OK);
+}
+
+/// Espera por eventos (POLLIN ou POLLOUT) em todos os sockets da fila
+/// Retorna:
+/// - mysocket_status::SOCK_OK, caso tenha ocorrido algum evento (sucesso);
+/// - mysocket_status::SOCK_TIMEOUT, se retornou por timeout; ou
+/// - mysocket_status::SOCK_ERROR, em caso de erro
+mysocket_status mysocket_queue::wait(short events, long milisec)
+{
+  for (auto& p : set)
+  {
+    p.events = events;
+    p.revents = 0;
+  }
+  int intResult = mypoll(set.data(), set.size(), (milisec >= 0 ? int(milisec) : -1));
+  if (intResult<0) return mysocket_status::SOCK_ERROR;
+  if (intResult==0) return mysocket_status::SOCK_TIMEOUT;
+  return mysocket_status::SOCK_OK;
+}
+
+/// Bloqueia ateh haver alguma atividade de leitura em socket da fila
+/// Retorna:
+/// - mysocket_status::SOCK_OK, caso haja dados a serem lidos (sucesso);
+/// - mysocket_status::SOCK_TIMEOUT, se retornou por timeout; ou
+/// - mysocket_status::SOCK_ERROR, em caso de erro
+mysocket_status mysocket_queue::wait_read(long milisec)
+{
+  return wait(POLLIN, milisec);
+}
+
+/// Bloqueia ateh haver alguma atividade de conexao em socket da fila
+/// Retorna:
+/// - mysocket_status::SOCK_OK, caso haja dados a serem lidos (sucesso);
+/// - mysocket_status::SOCK_TIMEOUT, se retornou por timeout; ou
+/// - mysocket_status::SOCK_ERROR, em caso de erro
+mysocket_status mysocket_queue::wait_connect(long milisec)
+{
+  return wait_read(milisec);
+}
+
+/// Bloqueia ateh haver alguma atividade de escrita em socket da fila
+/// Retorna:
+/// - mysocket_status::SOCK_OK, caso haja dados a serem lidos (sucesso);
+/// - mysocket_status::SOCK_TIMEOUT, se retornou por timeout; ou
+/// - mysocket_status::SOCK_ERROR, em caso de erro
+mysocket_status mysocket_queue::wait_write(long milisec)
+{
+  return wait(POLLOUT, milisec);
+}
+
+// Testa se houve atividade em um socket especifico da fila
+// Desconexao (POLLHUP) e erro (POLLERR) tambem contam como atividade,
+// como no select: a leitura seguinte vai retornar o status correspondente
+bool mysocket_queue::had_activity(const mysocket& a)
+{
+  auto itr = pos.find(a.id);
+  if (itr == pos.end()) return false;
+  return (set[itr->second].revents != 0);
+}
+
+#endif // MYSOCKET_USE_POLL
@@ -24,9 +24,17 @@
 #define _WIN32_WINNT 0x0A00  // Windows 10
 #endif // _WIN32_WINNT
 
+/// O select do Windows soh monitora ateh FD_SETSIZE sockets (64, por default).
+/// Deve ser definido antes de incluir winsock2.h
+#ifndef FD_SETSIZE
+#define FD_SETSIZE 1024
+#endif // FD_SETSIZE
+
 /// Os arquivos de inclusao para utilizacao dos sockets basicos
 #include <winsock2.h>
 #include <ws2tcpip.h>
+/// Os sockets locais (AF_UNIX) existem a partir do Windows 10 (build 17063)
+#include <afunix.h>
 
 /// O tipo que representa o socket basico do sistema operacional
 /// O Windows jah define um tipo SOCKET;
@@ -45,6 +53,8 @@
 
 // Os arquivos de inclusao para utilizacao dos sockets basicos
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
 
 // O tipo que representa o socket basico do sistema operacional
 typedef int SOCKET;
@@ -57,6 +67,22 @@ typedef int SOCKET;
 
 */
 
+/* #############################################################
+   ##  MECANISMO DE ESPERA DA FILA DE SOCKETS                 ##
+   ############################################################# */
+
+/// Por default, a fila de sockets (mysocket_queue) utiliza o select, que eh
+/// limitado a FD_SETSIZE sockets e percorre todo o conjunto a cada chamada.
+/// Descomente a linha a seguir para utilizar o poll (WSAPoll, no Windows),
+/// que nao tem limite de sockets. Indicado para servidores com muitos clientes.
+
+//#define MYSOCKET_USE_POLL
+
+#ifdef MYSOCKET_USE_POLL
+#include <vector>
+#include <unordered_map>
+#endif // MYSOCKET_USE_POLL
+
 /// Os status de retorno da classe mysocket
 enum class mysocket_status
 {
@@ -77,6 +103,7 @@ using mybyte = uint8_t;
 class mysocket_queue;
 class tcp_mysocket;
 class tcp_mysocket_server;
+class udp_mysocket;
 
 /* #############################################################
    ##  A classe base dos sockets                              ##
@@ -121,6 +148,7 @@ public:
   // As classes amigas
   friend class tcp_mysocket;
   friend class tcp_mysocket_server;
+  friend class udp_mysocket;
   friend class mysocket_queue;
 
 private:
@@ -151,6 +179,12 @@ public:
   // Retorna mysocket_status::SOCK_OK, se tudo deu certo, ou mysocket_status::SOCK_ERROR
   mysocket_status connect(const std::string& name, const std::string& port);
 
+  // Se conecta a um socket local (AF_UNIX) aberto no caminho "path"
+  // Mesma comunicacao orientada a conexao, sem passar pela pilha TCP/IP
+  // Soh pode ser usado em sockets "virgens" ou explicitamente fechados
+  // Retorna mysocket_status::SOCK_OK, se tudo deu certo, ou mysocket_status::SOCK_ERROR
+  mysocket_status connect_local(const std::string& path);
+
   // Leh uma sequencia de mybytes de um socket conectado
   // Soh pode ser usado em socket para o qual tenha sido feito um "connect" antes
   // Ou entao em um socket retornado pelo "accept" de um socket servidor
@@ -171,6 +205,18 @@ public:
   // - mysocket_status::SOCK_ERROR, em caso de erro
   mysocket_status write_bytes(const mybyte* buff, int len) const;
 
+  // Leh uma sequencia de inteiros de 16 bits sem sinal de um socket conectado,
+  // com uma unica chamada de leitura (em vez de uma chamada por inteiro).
+  // O ultimo parametro eh o tempo maximo (em milisegundos) para esperar
+  // por dados; se for <0, que eh o default, espera indefinidamente.
+  // Retorna os mesmos status que read_bytes
+  mysocket_status read_uint16_array(uint16_t* nums, int n, long milisec=-1) const;
+
+  // Escreve uma sequencia de inteiros de 16 bits sem sinal em um socket conectado,
+  // com uma unica chamada de envio (em vez de uma chamada por inteiro).
+  // Retorna os mesmos status que write_bytes
+  mysocket_status write_uint16_array(const uint16_t* nums, int n) const;
+
   // Leh um inteiro com sinal (int8_t, int16_t, int32_t, int64_t) ou sem sinal
   // (uint8_t, uint16_t, uint32_t, uint64_t) de um socket conectado.
   // O ultimo parametro eh o tempo maximo (em milisegundos) para esperar
@@ -221,6 +267,24 @@ public:
   // - mysocket_status::SOCK_ERROR, em caso de erro
   mysocket_status write_string(const std::string& msg) const;
 
+  // Envia por este socket local (AF_UNIX) conectado uma copia do socket S
+  // (conectado ou em escuta) para o processo do outro lado, que deve chamar
+  // read_socket. O socket S continua aberto neste processo: a conexao (ou a
+  // escuta) eh compartilhada pelos dois processos ateh que um deles feche a
+  // sua copia. Os dados que ainda nao foram lidos de S continuam em S.
+  // O ultimo parametro eh o tempo maximo (em milisegundos) para esperar
+  // pelo outro processo; se for <0, que eh o default, espera indefinidamente.
+  // Retorna os mesmos status que read_bytes
+  mysocket_status write_socket(const mysocket& S, long milisec=-1) const;
+
+  // Recebe por este socket local (AF_UNIX) conectado a copia de um socket
+  // enviada por outro processo (write_socket). S deve estar fechado e, em caso
+  // de sucesso, fica conectado (ou em escuta), como o socket enviado.
+  // O ultimo parametro eh o tempo maximo (em milisegundos) para esperar
+  // pelo outro processo; se for <0, que eh o default, espera indefinidamente.
+  // Retorna os mesmos status que read_bytes
+  mysocket_status read_socket(mysocket& S, long milisec=-1) const;
+
 private:
   // Desabilita o construtor por copia
   tcp_mysocket(const tcp_mysocket& S) = delete;
@@ -244,6 +308,12 @@ public:
   // Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
   mysocket_status listen(const std::string& port, int nconex=1);
 
+  // Abre um novo socket local (AF_UNIX) para esperar conexoes no caminho "path"
+  // Se jah existir um arquivo nesse caminho (de uma execucao anterior), ele eh removido
+  // Soh pode ser usado em sockets "virgens" ou explicitamente fechados
+  // Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
+  mysocket_status listen_local(const std::string& path, int nconex=1);
+
   // Aceita uma conexao que chegou em um socket aberto
   // Soh pode ser usado em socket para o qual tenha sido feito um "listen" antes
   // O socket "a" passado como parametro, em caso de sucesso, estarah conectado
@@ -259,6 +329,59 @@ private:
 
 };
 
+/* #############################################################
+   ##  A classe dos sockets de datagramas (UDP)               ##
+   ############################################################# */
+
+/// Os sockets de datagramas, sem conexao (somente IPv4)
+/// Um socket eh aberto para enviar (open_sender) ou para receber (open_receiver)
+class udp_mysocket: public mysocket
+{
+private:
+  // O endereco de destino dos datagramas enviados
+  sockaddr_storage dest;
+  int dest_len;
+
+public:
+  // Construtor default
+  udp_mysocket(): mysocket(), dest(), dest_len(0) {}
+
+  // Abre um socket para enviar datagramas ao endereco "name" e porta "port"
+  // O endereco pode ser de um computador, de difusao (broadcast) ou de grupo (multicast)
+  // Soh pode ser usado em sockets "virgens" ou explicitamente fechados
+  // Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
+  mysocket_status open_sender(const std::string& name, const std::string& port);
+
+  // Abre um socket para receber os datagramas enviados para a porta "port"
+  // Se "group" for um endereco de grupo (multicast), passa a receber os datagramas do grupo
+  // Varios sockets no mesmo computador podem receber da mesma porta
+  // (cada um recebe uma copia dos datagramas de difusao ou de grupo)
+  // Soh pode ser usado em sockets "virgens" ou explicitamente fechados
+  // Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
+  mysocket_status open_receiver(const std::string& port, const std::string& group="");
+
+  // Envia um datagrama com "len" mybytes ao destino do open_sender
+  // Retorna mysocket_status::SOCK_OK ou mysocket_status::SOCK_ERROR
+  mysocket_status write_datagram(const mybyte* buff, int len) const;
+
+  // Recebe um datagrama em um buffer de "len" mybytes
+  // O tamanho do datagrama recebido eh retornado em "nread"
+  // O buffer deve ter espaco para o maior datagrama esperado
+  // O ultimo parametro eh o tempo maximo (em milisegundos) para esperar
+  // por dados; se for <0, que eh o default, espera indefinidamente.
+  // Retorna:
+  // - mysocket_status::SOCK_OK, em caso de sucesso;
+  // - mysocket_status::SOCK_TIMEOUT, se retornou por timeout; ou
+  // - mysocket_status::SOCK_ERROR, em caso de erro
+  mysocket_status read_datagram(mybyte* buff, int len, int& nread, long milisec=-1) const;
+
+private:
+  // Desabilita o construtor por copia
+  udp_mysocket(const udp_mysocket& S) = delete;
+  // Desabilita a criacao do operator de atribuicao
+  void operator=(const udp_mysocket& S) = delete;
+};
+
 /* #############################################################
    ##  A fila de sockets                                      ##
    ############################################################# */
@@ -266,6 +389,7 @@ private:
 class mysocket_queue
 {
  private:
+#ifndef MYSOCKET_USE_POLL
   // Conjunto de sockets
   fd_set set;
 
@@ -273,6 +397,17 @@ class mysocket_queue
   // O select do Unix utiliza esse valor e soh monitora os sockets ateh essa id
   // O select do Windows ignora esse valor
   SOCKET nfds;
+#else
+  // Conjunto de sockets, no formato esperado pelo poll
+  std::vector<pollfd> set;
+
+  // A posicao de cada socket no vetor "set", para que had_activity
+  // nao precise percorrer todo o vetor
+  std::unordered_map<SOCKET,size_t> pos;
+
+  // Espera por eventos (POLLIN ou POLLOUT) em todos os sockets da fila
+  mysocket_status wait(short events, long milisec);
+#endif // MYSOCKET_USE_POLL
 
   // Desabilita a criacao do construtor por copia
   mysocket_queue(const mysocket_queue& S) = delete;
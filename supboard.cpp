@@ -0,0 +1,256 @@
+#include <new>
+#include "supboard.h"
+
+using namespace std;
+
+// Os campos do quadro sao lidos por outros processos: devem ser sem bloqueio
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "inteiros atomicos de 32 bits devem ser sem bloqueio");
+
+/// O nome do quadro do servidor da porta Porta (sem o prefixo do sistema operacional)
+static std::string board_name(const std::string& Porta)
+{
+  return std::string(SUP_BOARD_NAME) + "_" + Porta;
+}
+
+/// Funcoes dependentes do sistema operacional, que criam/abrem e removem/fecham
+/// o objeto de memoria compartilhada com o quadro.
+/// board_map retorna o endereco mapeado, ou nullptr em caso de erro. Ao criar,
+/// informa em created se o objeto foi criado agora ou se jah existia.
+static void* board_map(const std::string& name, bool create, intptr_t& handle, bool& created);
+static void board_unmap(const void* board, intptr_t handle, const std::string& name, bool remove);
+
+/// Descomente o bloco a seguir para compilar no Windows
+
+///*
+
+#include <windows.h>
+
+/// Cria (create==true, leitura e escrita) ou abre (somente leitura) o mapeamento
+static void* board_map(const std::string& name, bool create, intptr_t& handle, bool& created)
+{
+  const std::string N = "Local\\" + name;
+  HANDLE h;
+  if (create) h = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                     0, sizeof(SupBoardLayout), N.c_str());
+  else h = OpenFileMappingA(FILE_MAP_READ, FALSE, N.c_str());
+  if (h == NULL) return nullptr;
+  created = create && GetLastError() != ERROR_ALREADY_EXISTS;
+  void* p = MapViewOfFile(h, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ,
+                          0, 0, sizeof(SupBoardLayout));
+  if (p == NULL)
+  {
+    CloseHandle(h);
+    return nullptr;
+  }
+  handle = intptr_t(h);
+  return p;
+}
+
+/// Desfaz o mapeamento. O Windows remove o objeto quando o ultimo processo o fecha.
+static void board_unmap(const void* board, intptr_t handle, const std::string&, bool)
+{
+  UnmapViewOfFile(board);
+  CloseHandle(HANDLE(handle));
+}
+
+//*/
+
+/// Descomente o bloco a seguir para compilar no Linux
+
+/*
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+/// Cria (create==true, leitura e escrita) ou abre (somente leitura) o objeto.
+/// Um objeto com o mesmo nome que jah exista (deixado por um servidor que
+/// terminou sem remove-lo) eh reaberto, mas nao serah removido por este processo.
+static void* board_map(const std::string& name, bool create, intptr_t& handle, bool& created)
+{
+  const std::string N = "/" + name;
+  int fd;
+  created = false;
+  if (create)
+  {
+    fd = shm_open(N.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd >= 0) created = true;
+    else if (errno == EEXIST) fd = shm_open(N.c_str(), O_RDWR, 0);
+  }
+  else fd = shm_open(N.c_str(), O_RDONLY, 0);
+  if (fd < 0) return nullptr;
+  if (create && ftruncate(fd, sizeof(SupBoardLayout)) != 0)
+  {
+    ::close(fd);
+    if (created) shm_unlink(N.c_str());
+    return nullptr;
+  }
+  void* p = mmap(nullptr, sizeof(SupBoardLayout), create ? PROT_READ | PROT_WRITE : PROT_READ,
+                 MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+  {
+    ::close(fd);
+    if (created) shm_unlink(N.c_str());
+    return nullptr;
+  }
+  handle = fd;
+  return p;
+}
+
+/// Desfaz o mapeamento e, se remove==true, remove o nome do objeto.
+/// Os leitores que jah abriram o quadro continuam com ele mapeado.
+static void board_unmap(const void* board, intptr_t handle, const std::string& name, bool remove)
+{
+  munmap(const_cast<void*>(board), sizeof(SupBoardLayout));
+  ::close(int(handle));
+  if (remove) shm_unlink(("/" + name).c_str());
+}
+
+*/
+
+/* ========================================
+   CLASSE SUPBOARDWRITER
+   ======================================== */
+
+/// Cria (ou reabre) o quadro do servidor da porta Porta, com NPlants plantas
+bool SupBoardWriter::open(const std::string& Porta, uint32_t NPlants)
+{
+  close();
+  if (NPlants == 0 || NPlants > SUP_BOARD_MAX_PLANTS) return false;
+
+  name = board_name(Porta);
+  void* p = board_map(name, true, handle, created);
+  if (p == nullptr) return false;
+  board = new(p) SupBoardLayout;
+
+  // Os leitores nao aceitam o quadro enquanto ele estah sendo inicializado
+  board->magic.store(0, memory_order_relaxed);
+  board->version.store(SUP_BOARD_VERSION, memory_order_relaxed);
+  board->nplants.store(NPlants, memory_order_relaxed);
+  for (auto& P : board->slot)
+  {
+    P.lock.store(0, memory_order_relaxed);
+    for (auto& D : P.data) D.store(0, memory_order_relaxed);
+  }
+  board->magic.store(SUP_BOARD_MAGIC, memory_order_release);
+  return true;
+}
+
+/// Fecha o quadro e o remove, se ele foi criado por este processo.
+/// Os leitores que ainda o tiverem mapeado deixam de aceitar os estados.
+void SupBoardWriter::close()
+{
+  if (board == nullptr) return;
+  board->magic.store(0, memory_order_release);
+  board_unmap(board, handle, name, created);
+  board = nullptr;
+  handle = -1;
+  created = false;
+}
+
+/// Publica o estado de uma planta.
+/// Soh pode haver um escritor por planta (a thread do servidor).
+void SupBoardWriter::publish(uint32_t Plant, const SupState& S)
+{
+  if (board == nullptr || Plant >= board->nplants.load(memory_order_relaxed)) return;
+  SupBoardLayout::Slot& P = board->slot[Plant];
+
+  // Contador impar: escrita em andamento
+  uint32_t s = P.lock.load(memory_order_relaxed);
+  P.lock.store(s+1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  P.data[0].store(uint32_t(S.seq), memory_order_relaxed);
+  P.data[1].store(uint32_t(S.seq >> 32), memory_order_relaxed);
+  P.data[2].store(uint32_t(S.t_us), memory_order_relaxed);
+  P.data[3].store(uint32_t(S.t_us >> 32), memory_order_relaxed);
+  P.data[4].store(S.V1 | (uint32_t(S.V2) << 16), memory_order_relaxed);
+  P.data[5].store(S.H1 | (uint32_t(S.H2) << 16), memory_order_relaxed);
+  P.data[6].store(S.PumpInput | (uint32_t(S.PumpFlow) << 16), memory_order_relaxed);
+  P.data[7].store(S.ovfl, memory_order_relaxed);
+
+  // Contador par: escrita concluida
+  P.lock.store(s+2, memory_order_release);
+}
+
+/* ========================================
+   CLASSE SUPBOARDREADER
+   ======================================== */
+
+/// Abre o quadro criado pelo servidor da porta Porta
+bool SupBoardReader::open(const std::string& Porta)
+{
+  close();
+  bool created;
+  const void* p = board_map(board_name(Porta), false, handle, created);
+  if (p == nullptr) return false;
+  board = static_cast<const SupBoardLayout*>(p);
+  if (board->magic.load(memory_order_acquire) != SUP_BOARD_MAGIC ||
+      board->version.load(memory_order_relaxed) != SUP_BOARD_VERSION)
+  {
+    close();
+    return false;
+  }
+  return true;
+}
+
+/// Fecha o quadro
+void SupBoardReader::close()
+{
+  if (board == nullptr) return;
+  board_unmap(board, handle, std::string(), false);
+  board = nullptr;
+  handle = -1;
+}
+
+/// Numero de plantas publicadas (0 se o quadro nao estiver aberto ou tiver sido removido)
+uint32_t SupBoardReader::numPlants() const
+{
+  if (board == nullptr || board->magic.load(memory_order_acquire) != SUP_BOARD_MAGIC) return 0;
+  return board->nplants.load(memory_order_relaxed);
+}
+
+/// Numero de publicacoes do estado de uma planta
+uint32_t SupBoardReader::generation(uint32_t Plant) const
+{
+  if (Plant >= numPlants()) return 0;
+  return board->slot[Plant].lock.load(memory_order_acquire)/2;
+}
+
+/// Leh o ultimo estado publicado de uma planta.
+/// Os dados soh sao aceitos se o seqlock estava livre (par) antes da copia
+/// e nao mudou durante a copia; senao, a copia eh refeita.
+bool SupBoardReader::read(uint32_t Plant, SupState& S) const
+{
+  if (Plant >= numPlants()) return false;
+  const SupBoardLayout::Slot& P = board->slot[Plant];
+
+  uint32_t D[8];
+  for (int tries=0; tries<SUP_BOARD_MAX_TRIES; ++tries)
+  {
+    uint32_t s1 = P.lock.load(memory_order_acquire);
+    // Nenhum estado publicado ainda
+    if (s1 == 0) return false;
+    // Escrita em andamento
+    if (s1 & 1) continue;
+
+    for (int i=0; i<8; ++i) D[i] = P.data[i].load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (P.lock.load(memory_order_relaxed) != s1) continue;
+
+    S.seq = D[0] | (uint64_t(D[1]) << 32);
+    S.t_us = D[2] | (uint64_t(D[3]) << 32);
+    S.V1 = uint16_t(D[4]);
+    S.V2 = uint16_t(D[4] >> 16);
+    S.H1 = uint16_t(D[5]);
+    S.H2 = uint16_t(D[5] >> 16);
+    S.PumpInput = uint16_t(D[6]);
+    S.PumpFlow = uint16_t(D[6] >> 16);
+    S.ovfl = uint16_t(D[7]);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,135 @@
+#ifndef _SUP_BOARD_H_
+#define _SUP_BOARD_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "supdados.h"
+
+/// Inicio do nome do quadro de estados em memoria compartilhada, que eh
+/// seguido pela porta TCP do servidor, para que varios servidores possam
+/// funcionar no mesmo computador. Para a porta default, no Linux, eh o objeto
+/// "/suptanques_board_23456" (shm_open); no Windows, o mapeamento
+/// "Local\suptanques_board_23456".
+#define SUP_BOARD_NAME "suptanques_board"
+
+/// Numero maximo de plantas publicadas no quadro
+#define SUP_BOARD_MAX_PLANTS 16
+
+/// Numero maximo de tentativas de leitura de uma planta enquanto o
+/// servidor estah escrevendo nela (a escrita dura poucos nanosegundos)
+#define SUP_BOARD_MAX_TRIES 1000
+
+/// Identificacao do formato do quadro
+#define SUP_BOARD_MAGIC 0x53555042 // "SUPB"
+#define SUP_BOARD_VERSION 1
+
+/// O quadro de estados, como ele fica na memoria compartilhada.
+/// O estado de cada planta eh protegido por um seqlock: o servidor incrementa
+/// o contador "lock" antes (fica impar) e depois (fica par) de escrever os dados.
+/// O leitor copia os dados e soh os aceita se o contador era par e nao mudou
+/// durante a copia. Assim, o leitor nunca bloqueia o servidor nem faz chamadas
+/// ao sistema, e qualquer numero de leitores pode ler ao mesmo tempo.
+/// Soh sao usados inteiros atomicos de 32 bits, que sao sem bloqueio (lock-free)
+/// em todas as plataformas e podem ser lidos em memoria mapeada somente para leitura.
+struct SupBoardLayout
+{
+  // O estado de uma planta. Cada planta ocupa uma linha de cache propria,
+  // para que a escrita em uma planta nao atrase a leitura das outras.
+  struct alignas(64) Slot
+  {
+    // O seqlock: impar durante a escrita; lock/2 eh o numero de publicacoes
+    std::atomic<uint32_t> lock;
+    // Os dados: seq (2 palavras), t_us (2 palavras), V1|V2, H1|H2,
+    // PumpInput|PumpFlow e ovfl (palavra menos significativa primeiro)
+    std::atomic<uint32_t> data[8];
+  };
+  // SUP_BOARD_MAGIC, depois que o quadro foi inicializado pelo servidor
+  std::atomic<uint32_t> magic;
+  // SUP_BOARD_VERSION
+  std::atomic<uint32_t> version;
+  // Numero de plantas publicadas
+  std::atomic<uint32_t> nplants;
+  // As plantas
+  Slot slot[SUP_BOARD_MAX_PLANTS];
+};
+
+/// O servidor, que cria o quadro e publica os estados
+class SupBoardWriter
+{
+public:
+  // Construtor default
+  SupBoardWriter(): board(nullptr), handle(-1), name(), created(false) {}
+  // Destrutor
+  ~SupBoardWriter() {close();}
+
+  // Cria (ou reabre) o quadro do servidor da porta Porta, com NPlants plantas.
+  // Retorna false em caso de erro.
+  bool open(const std::string& Porta, uint32_t NPlants=1);
+  // Fecha o quadro. O quadro soh eh removido se tiver sido criado por este processo.
+  void close();
+  // Testa se o quadro estah aberto
+  bool isOpen() const {return board != nullptr;}
+
+  // Publica o estado de uma planta
+  void publish(uint32_t Plant, const SupState& S);
+
+private:
+  // Construtores e operadores de atribuicao suprimidos (nao existem na classe)
+  SupBoardWriter(const SupBoardWriter& other) = delete;
+  SupBoardWriter(SupBoardWriter&& other) = delete;
+  SupBoardWriter& operator=(const SupBoardWriter& other) = delete;
+  SupBoardWriter& operator=(SupBoardWriter&& other) = delete;
+
+  // O quadro mapeado na memoria
+  SupBoardLayout* board;
+  // O identificador do objeto de memoria compartilhada no sistema operacional
+  intptr_t handle;
+  // O nome do objeto
+  std::string name;
+  // Se o objeto foi criado por este processo (e nao reaberto)
+  bool created;
+};
+
+/// Um processo local que leh os estados publicados pelo servidor.
+/// Depois de aberto o quadro, as leituras nao fazem chamadas ao sistema.
+class SupBoardReader
+{
+public:
+  // Construtor default
+  SupBoardReader(): board(nullptr), handle(-1) {}
+  // Destrutor
+  ~SupBoardReader() {close();}
+
+  // Abre o quadro criado pelo servidor da porta Porta (somente leitura).
+  // Retorna false se o servidor nao criou o quadro ou em caso de erro.
+  bool open(const std::string& Porta=SUP_PORT);
+  // Fecha o quadro
+  void close();
+  // Testa se o quadro estah aberto
+  bool isOpen() const {return board != nullptr;}
+
+  // Numero de plantas publicadas
+  uint32_t numPlants() const;
+  // Numero de publicacoes do estado de uma planta.
+  // Permite testar se ha um estado novo sem copiar os dados.
+  uint32_t generation(uint32_t Plant) const;
+  // Leh o ultimo estado publicado de uma planta.
+  // Retorna false se a planta nao existir, se ainda nao houver estado publicado
+  // ou se o servidor estiver escrevendo continuamente (SUP_BOARD_MAX_TRIES).
+  bool read(uint32_t Plant, SupState& S) const;
+
+private:
+  // Construtores e operadores de atribuicao suprimidos (nao existem na classe)
+  SupBoardReader(const SupBoardReader& other) = delete;
+  SupBoardReader(SupBoardReader&& other) = delete;
+  SupBoardReader& operator=(const SupBoardReader& other) = delete;
+  SupBoardReader& operator=(SupBoardReader&& other) = delete;
+
+  // O quadro mapeado na memoria
+  const SupBoardLayout* board;
+  // O identificador do objeto de memoria compartilhada no sistema operacional
+  intptr_t handle;
+};
+
+#endif // _SUP_BOARD_H_
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <chrono>
+#include <algorithm>
 #include "supcliente.h"
 
 
@@ -8,13 +9,35 @@ SupCliente::SupCliente()
   : meuUsuario("")
   , encerrarCliente(true)
   , is_admin(false)
+  , pipelined(false)
   , last_S()
-  , start_t(time_t(-1))
-  , last_t(time_t(-1))
-  , timeRefresh(20)
+  , start_t()
+  , last_t()
+  , has_start(false)
+  , missed_samples(0)
+  , timeRefresh(20000)
+  , refreshWake(false)
+  , mtx_refresh()
+  , cv_refresh()
   , sock()
+  , server_addr()
+  , session_token(0)
+  , resuming(false)
   , mtx()
   , thr()
+  , pending()
+  , next_id(0)
+  , reader_on(false)
+  , mtx_pending()
+  , thr_reader()
+  , cmd_queue()
+  , queue_on(false)
+  , mtx_queue()
+  , cv_queue()
+  , thr_cmd()
+  , sock_viewer()
+  , viewer_plant(0)
+  , thr_viewer()
 {
   // Inicializa a biblioteca de sockets
   if (mysocket::init() != mysocket_status::SOCK_OK)
@@ -30,22 +53,26 @@ SupCliente::~SupCliente()
   // Nao pode chamar a funcao "desconectar" pois ela chama uma funcao virtual pura,
   // o que nao deve ocorrer no destrutor
 
-  // Testa se estah conectado
-  if (isConnected())
+  // Testa se estah conectado ao servidor
+  if (sock.connected())
   {
     // Envia o comando de logout para o servidor
-    sock.write_uint16(CMD_LOGOUT);
+    sendLogout();
     // Espera 1 segundo para dar tempo ao servidor de ler a msg de LOGOUT
     // antes de fechar o socket
     std::this_thread::sleep_for(std::chrono::seconds(1));
     // Fecha o socket e, consequentemente, deve
     // encerrar a thread de leitura de dados do socket
-    sock.close();
-    encerrarCliente = true;
+    closeSocket();
   }
+  encerrarCliente = true;
+  // Nao espera pelo fim do periodo de solicitacao de dados
+  wakeRefresh();
 
   // Aguarda pelo fim da thread de recepcao
   join_if_joinable();
+  // O socket do modo visualizador soh eh fechado depois do fim da sua thread
+  sock_viewer.close();
 
   // Encerra a biblioteca de sockets
   mysocket::end();
@@ -69,7 +96,7 @@ void SupCliente::conectar(const std::string& IP,
 
     // Conecta o socket
     // Em caso de erro, throw 102
-    iResult = sock.connect(IP, SUP_PORT);
+    iResult = connectAddress(sock, IP);
     if (iResult != mysocket_status::SOCK_OK) throw 102;
 
     // Envia o comando CMD_LOGIN.
@@ -95,14 +122,69 @@ void SupCliente::conectar(const std::string& IP,
     if (iResult != mysocket_status::SOCK_OK) throw 106;
     // Se a resposta nao for CMD_ADMIN_OK ou CMD_OK, throw 107
     if (cmd!=CMD_ADMIN_OK && cmd!=CMD_OK) throw 107;
+    // Eh administrador (de acordo com resposta do servidor)?
+    is_admin = (cmd==CMD_ADMIN_OK);
+
+    // Solicita o token da sessao, para retoma-la se a conexao for perdida
+    // Em caso de erro, throw 113
+    iResult = sock.write_uint16(CMD_GET_SESSION);
+    if (iResult != mysocket_status::SOCK_OK) throw 113;
+    // Leh a resposta CMD_SESSION e o token
+    // Em caso de erro ou se a resposta nao for CMD_SESSION, throw 114
+    {
+      uint16_t frame[5];
+      iResult = sock.read_uint16_array(frame, 5, 1000*SUP_TIMEOUT);
+      if (iResult != mysocket_status::SOCK_OK || frame[0]!=CMD_SESSION) throw 114;
+      session_token = get_uint64(frame+1);
+      server_addr = IP;
+    }
+
+    if (pipelined)
+    {
+      // Solicita ao servidor o protocolo com pipeline
+      // Em caso de erro, throw 109
+      iResult = sock.write_uint16(CMD_PIPELINE);
+      if (iResult != mysocket_status::SOCK_OK) throw 109;
+      // Leh a confirmacao, que ainda vem sem identificador de correlacao
+      // Em caso de erro ou se a resposta nao for CMD_OK, throw 110
+      iResult = sock.read_uint16(cmd, 1000*SUP_TIMEOUT);
+      if (iResult != mysocket_status::SOCK_OK || cmd!=CMD_OK) throw 110;
+    }
 
     // Armazena o nome do usuario
     meuUsuario = Login;
-    // Eh administrador (de acordo com resposta do servidor)?
-    is_admin = (cmd==CMD_ADMIN_OK);
     // Cliente em funcionamento
     encerrarCliente = false;
 
+    if (pipelined)
+    {
+      // Lanca a thread de leitura das respostas, antes da thread de
+      // solicitacao de dados, que vai depender dela
+      // Em caso de erro, throw 111
+      next_id = 0;
+      reader_on = true;
+      thr_reader = std::thread([this](){
+        this->reader_thread();
+      });
+      if (!thr_reader.joinable())
+      {
+        reader_on = false;
+        throw 111;
+      }
+    }
+
+    // Lanca a thread de atuacao, que executa os comandos assincronos
+    // Em caso de erro, throw 112
+    queue_on = true;
+    thr_cmd = std::thread([this](){
+      this->actuation_thread();
+    });
+    if (!thr_cmd.joinable())
+    {
+      queue_on = false;
+      throw 112;
+    }
+
     // Lanca a thread de solicitacao periodica de dados
     // Em caso de erro, throw 108
     thr = std::thread([this](){
@@ -114,8 +196,9 @@ void SupCliente::conectar(const std::string& IP,
   {
     // Encerra o cliente
     encerrarCliente = true;
+    session_token = 0;
     // Fecha o socket
-    sock.close();
+    closeSocket();
 
     // Msg de erro para debug
     std::string msg_err("Erro na conexao com o servidor ");
@@ -129,29 +212,86 @@ void SupCliente::conectar(const std::string& IP,
   virtExibirInterface();
 }
 
+/// Passa a receber o estado da planta pelo canal de difusao por UDP.
+/// Esta funcao soh pode ser chamada do programa principal,
+/// jah que ela lanca a thread do modo visualizador
+void SupCliente::conectarViewer(const std::string& Endereco, uint16_t Planta)
+{
+  mysocket_status iResult; //Variavel que armazena o resultado das operações com sockets
+  std::string Grupo, Porta;
+
+  try
+  {
+    // Soh conecta se nao estiver conectado
+    if (isConnected()) throw 121;
+
+    // Abre o socket de recepcao na porta, entrando no grupo, se houver
+    // Em caso de erro, throw 122
+    split_address(Endereco, Grupo, Porta, SUP_BCAST_PORT);
+    iResult = sock_viewer.open_receiver(Porta, Grupo);
+    if (iResult != mysocket_status::SOCK_OK) throw 122;
+
+    // O visualizador nao faz login: nao eh administrador
+    is_admin = false;
+    meuUsuario = "UDP " + Endereco;
+    viewer_plant = Planta;
+    // Cliente em funcionamento
+    encerrarCliente = false;
+
+    // Lanca a thread do modo visualizador
+    // Em caso de erro, throw 123
+    thr_viewer = std::thread([this](){
+      this->viewer_thread();
+    });
+    if (!thr_viewer.joinable()) throw 123;
+  }
+  catch (int err)
+  {
+    // Encerra o cliente
+    encerrarCliente = true;
+    // Fecha o socket
+    sock_viewer.close();
+
+    // Msg de erro para debug
+    std::string msg_err("Erro na recepcao da difusao ");
+    msg_err += Endereco + ": " + std::to_string(err);
+
+    // Exibe msg de erro
+    virtExibirErro(msg_err);
+  }
+
+  // Reexibe a interface
+  virtExibirInterface();
+}
+
 /// Desconecta do servidor.
 /// Esta funcao soh pode ser chamada do programa principal,
 /// jah que ela espera (join) pelo fim da thread do cliente.
 void SupCliente::desconectar()
 {
-  // Cliente encerrado
+  // Cliente encerrado: a sessao nao serah mais retomada
   encerrarCliente = true;
+  session_token = 0;
+  // Nao espera pelo fim do periodo de solicitacao de dados
+  wakeRefresh();
 
-  // Testa se estah conectado
-  if (isConnected())
+  // Testa se estah conectado ao servidor
+  if (sock.connected())
   {
     // Envia o comando de logout para o servidor
-    sock.write_uint16(CMD_LOGOUT);
+    sendLogout();
     // Espera 1 segundo para dar tempo ao servidor de ler a msg de LOGOUT
     // antes de fechar o socket
     std::this_thread::sleep_for(std::chrono::seconds(1));
     // Fecha o socket e, consequentemente, deve
     // encerrar a thread de leitura de dados do socket
-    sock.close();
+    closeSocket();
   }
 
   // Aguarda fim da thread
   join_if_joinable();
+  // O socket do modo visualizador soh eh fechado depois do fim da sua thread
+  sock_viewer.close();
 
   // Limpa o nome do usuario
   meuUsuario = "";
@@ -166,56 +306,26 @@ void SupCliente::desconectar()
 /// como sendo aberta (Open==true) ou fechada (Open==false)
 void SupCliente::setValvOpen(bool isV1, bool Open)
 {
-  // Comando enviado/recebido
-  mysocket_status iResult; //Variavel que armazena o resultado das operações com sockets
-  uint16_t cmd = (isV1 ? CMD_SET_V1 : CMD_SET_V2);
-  //uint16_t resp; ##Talvez precise de uma variavel resposta pra armazenar a leitura de (cmd) do servidor ao comando##
-
-  // Bloqueia o mutex para garantir exclusao mutua no envio pelo socket
-  // de comandos que ficam aguardando resposta, para evitar que a resposta
-  // de um comando seja recebida por outro comando em outra thread.
-  mtx.lock();
-
   try
   {
-    // Testa se estah conectado e eh administrador
-    if (!isConnected() || !isAdmin()) throw 201;
-
-    // Escreve o comando CMD_SET_V1 ou CMD_SET_V2
-    // Em caso de erro, throw 202
-    iResult = sock.write_uint16(cmd);
-    if (iResult != mysocket_status::SOCK_OK) throw 202;
-
-    // Escreve o parametro do comando (==0 se fechada !=0 se aberta)
-    // Em caso de erro, throw 203
-    iResult = sock.write_uint16(Open ? 1 : 0);
-    if (iResult != mysocket_status::SOCK_OK) throw 203;
-
-    // Leh a resposta (cmd) do servidor ao comando
-    // Em caso de erro, throw 204
-    iResult = sock.read_uint16(cmd, 1000*SUP_TIMEOUT);
-    if (iResult != mysocket_status::SOCK_OK) throw 204;
-    // Se resposta nao for CMD_OK, throw 205
-    if (cmd != CMD_OK) throw 205;
+    // Envia o comando e espera pela resposta
+    actuate((isV1 ? CMD_SET_V1 : CMD_SET_V2), (Open ? 1 : 0));
   }
   catch(int err)
   {
-    // Libera o mutex para sair da zona de exclusao mutua.
-    mtx.unlock();
-
     // Msg de erro para debug
     std::string msg_err = "Erro na atuacao sobre a valvula ";
     msg_err += (isV1 ? "1: " : "2: ");
     msg_err += std::to_string(err);
     virtExibirErro(msg_err);
 
-    // Desconecta do servidor (reexibe a interface desconectada)
-    desconectar();
+    // Conexao perdida: a sessao eh retomada pela thread de solicitacao de dados.
+    // Senao, desconecta do servidor (reexibe a interface desconectada),
+    // exceto se a sessao estiver sendo retomada em uma nova conexao.
+    if (lostSession(err)) wakeRefresh();
+    else if (!resuming) desconectar();
   }
 
-  // Libera o mutex para sair da zona de exclusao mutua.
-  mtx.unlock();
-
   // Nao reexibe a interface com novo estado.
   // Serah reexibida quando chegar o proximo dado do servidor, que
   // deverah conter o novo estado da valvula.
@@ -224,58 +334,230 @@ void SupCliente::setValvOpen(bool isV1, bool Open)
 /// Fixa a entrada da bomba: 0 a 65535
 void SupCliente::setPumpInput(uint16_t Input)
 {
-  mysocket_status iResult; //Variavel que armazena o resultado das operações com sockets
-  // Comando recebido
-  uint16_t cmd;
-  // Msg de erro para debug
-  std::string msg_err;
+  try
+  {
+    // Envia o comando e espera pela resposta
+    actuate(CMD_SET_PUMP, Input);
+  }
+  catch(int err)
+  {
+    // Msg de erro para debug
+    std::string msg_err = "Erro na atuacao sobre a bomba: "+ std::to_string(err);
+    virtExibirErro(msg_err);
 
-  // Bloqueia o mutex para garantir exclusao mutua no envio pelo socket
-  // de comandos que ficam aguardando resposta, para evitar que a resposta
-  // de um comando seja recebida por outro comando em outra thread.
-  mtx.lock();
+    // Conexao perdida: a sessao eh retomada pela thread de solicitacao de dados.
+    // Senao, desconecta do servidor (reexibe a interface desconectada),
+    // exceto se a sessao estiver sendo retomada em uma nova conexao.
+    if (lostSession(err)) wakeRefresh();
+    else if (!resuming) desconectar();
+  }
+
+  // Nao reexibe a interface com novo estado.
+  // Serah reexibida quando chegar o proximo dado do servidor, que
+  // deverah conter o novo estado da bomba.
+}
 
+/// Envia um comando do controlador de nivel do servidor
+bool SupCliente::setLevelControl(uint16_t Cmd, uint16_t Param)
+{
+  if (Cmd < CMD_SET_PID || Cmd > CMD_SET_PID_KT) return false;
   try
   {
-    // Testa se estah conectado e eh administrador
-    if (!isConnected() || !isAdmin()) throw 301;
+    // Envia o comando e espera pela resposta
+    actuate(Cmd, Param);
+  }
+  catch(int err)
+  {
+    // Msg de erro para debug
+    std::string msg_err = "Erro na atuacao sobre o controlador de nivel: "+ std::to_string(err);
+    virtExibirErro(msg_err);
 
-    // Escreve o comando CMD_SET_PUMP
-    // Em caso de erro, throw 302
-    iResult = sock.write_uint16(CMD_SET_PUMP);
-    if (iResult != mysocket_status::SOCK_OK) throw 302;
+    // Conexao perdida: a sessao eh retomada pela thread de solicitacao de dados.
+    // Senao, desconecta do servidor (reexibe a interface desconectada),
+    // exceto se a sessao estiver sendo retomada em uma nova conexao.
+    if (lostSession(err)) wakeRefresh();
+    else if (!resuming) desconectar();
+    return false;
+  }
+  return true;
+}
 
-    // Escreve o paramentro do comando CMD_SET_PUMP (Input = 0 a 65535)
-    // Em caso de erro, throw 303
-    iResult = sock.write_uint16(Input);
-    if (iResult != mysocket_status::SOCK_OK) throw 303;
+/// Envia um comando de atuacao (CMD_SET_V1, CMD_SET_V2, CMD_SET_PUMP ou CMD_SET_PID...)
+/// com seu parametro e espera pela resposta do servidor.
+/// Em caso de erro, gera excecao com o codigo do erro:
+/// 2xx para as valvulas, 3xx para a bomba e 4xx para o controlador de nivel.
+void SupCliente::actuate(uint16_t cmd, uint16_t param)
+{
+  mysocket_status iResult; //Variavel que armazena o resultado das operações com sockets
+  // Base dos codigos de erro
+  const int errBase = (cmd==CMD_SET_PUMP ? 300 :
+                       cmd>=CMD_SET_PID && cmd<=CMD_SET_PID_KT ? 400 : 200);
+
+  // Testa se estah conectado e eh administrador
+  if (!isConnected() || !isAdmin()) throw errBase+1;
 
-    // Leh a resposta do servidor ao comando
-    // Em caso de erro, throw 304
+  if (pipelined)
+  {
+    // Envia o comando; a resposta serah entregue pela thread de leitura.
+    // Nao precisa esperar pelas respostas de outros comandos pendentes.
+    std::future<SupReply> F = request(cmd, &param, 1);
+    // Espera a resposta (com timeout)
+    // Em caso de erro, throw x04
+    // Tambem eh x04 se a conexao foi perdida antes da resposta
+    if (F.wait_for(std::chrono::seconds(SUP_TIMEOUT)) != std::future_status::ready) throw errBase+4;
+    SupReply R = F.get();
+    if (R.lost) throw errBase+4;
+    // Se resposta nao for CMD_OK, throw x05
+    if (R.cmd != CMD_OK) throw errBase+5;
+  }
+  else
+  {
+    // Bloqueia o mutex para garantir exclusao mutua no envio pelo socket
+    // de comandos que ficam aguardando resposta, para evitar que a resposta
+    // de um comando seja recebida por outro comando em outra thread.
+    // O mutex eh liberado ao sair do bloco, inclusive em caso de erro.
+    std::lock_guard<std::mutex> lock(mtx);
+
+    // Escreve o comando e o parametro do comando, em um unico envio
+    // Em caso de erro, throw x02
+    uint16_t msg[2] = {cmd, param};
+    iResult = sock.write_uint16_array(msg, 2);
+    if (iResult != mysocket_status::SOCK_OK) throw errBase+2;
+
+    // Leh a resposta (cmd) do servidor ao comando
+    // Em caso de erro, throw x04
     iResult = sock.read_uint16(cmd, 1000*SUP_TIMEOUT);
-    if (iResult != mysocket_status::SOCK_OK) throw 304;
-    // Se resposta nao for CMD_OK, throw 305
-    if (cmd != CMD_OK) throw 305;
+    if (iResult != mysocket_status::SOCK_OK) throw errBase+4;
+    // Se resposta nao for CMD_OK, throw x05
+    if (cmd != CMD_OK) throw errBase+5;
   }
-  catch(int err)
+}
+
+/// Coloca um comando de atuacao na fila da thread de atuacao.
+/// Retorna imediatamente o "future" onde serah entregue o resultado:
+/// true se o servidor confirmou o comando ou false em caso de erro.
+std::future<bool> SupCliente::queueActuation(uint16_t cmd, uint16_t param)
+{
+  AsyncCmd C;
+  C.cmd = cmd;
+  C.param = param;
+  std::future<bool> F = C.result.get_future();
+
+  // Soh administradores conectados podem atuar na planta.
+  // Nesse caso, nao desconecta: apenas informa o insucesso.
+  if (!isConnected() || !isAdmin())
   {
-    // Libera o mutex para sair da zona de exclusao mutua.
-    mtx.unlock();
+    C.result.set_value(false);
+    virtAtuacaoConcluida(cmd, param, false);
+    return F;
+  }
 
-    // Msg de erro para debug
-    msg_err = "Erro na atuacao sobre a bomba: "+ std::to_string(err);
-    virtExibirErro(msg_err);
+  mtx_queue.lock();
+  if (!queue_on)
+  {
+    // A thread de atuacao nao estah mais em execucao
+    mtx_queue.unlock();
+    C.result.set_value(false);
+    virtAtuacaoConcluida(cmd, param, false);
+    return F;
+  }
+  cmd_queue.push_back(std::move(C));
+  mtx_queue.unlock();
+
+  // Acorda a thread de atuacao
+  cv_queue.notify_one();
+  return F;
+}
+
+/// Thread de atuacao: envia, um de cada vez, os comandos colocados na fila
+/// pelas funcoes assincronas e espera pelas respostas, sem bloquear quem
+/// solicitou a atuacao (geralmente, a interface).
+void SupCliente::actuation_thread(void)
+{
+  // O comando que estah sendo executado
+  AsyncCmd C;
+  // Resultado do comando
+  bool ok;
+
+  while (!encerrarCliente && isConnected())
+  {
+    // Espera que haja algum comando na fila.
+    // O timeout serve apenas para testar periodicamente se o cliente foi encerrado.
+    std::unique_lock<std::mutex> lock(mtx_queue);
+    if (!cv_queue.wait_for(lock, std::chrono::seconds(1),
+                           [this](){return !cmd_queue.empty();})) continue;
+    C = std::move(cmd_queue.front());
+    cmd_queue.pop_front();
+    lock.unlock();
+
+    try
+    {
+      // Envia o comando e espera pela resposta
+      actuate(C.cmd, C.param);
+      ok = true;
+    }
+    catch(int err)
+    {
+      ok = false;
+
+      // Msg de erro para debug
+      std::string msg_err = (C.cmd==CMD_SET_PUMP ? "Erro na atuacao sobre a bomba: " :
+                             C.cmd==CMD_SET_V1 ? "Erro na atuacao sobre a valvula 1: " :
+                             C.cmd==CMD_SET_V2 ? "Erro na atuacao sobre a valvula 2: " :
+                                                 "Erro na atuacao sobre o controlador de nivel: ");
+      msg_err += std::to_string(err);
+      virtExibirErro(msg_err);
+
+      // Conexao perdida: a sessao eh retomada pela thread de solicitacao de dados
+      if (lostSession(err)) wakeRefresh();
+      // Nao pode chamar "desconectar" pq "desconectar" faz join nas threads.
+      // Como esta funcao eh executada em uma thread, fecha a conexao da
+      // mesma forma que a thread de solicitacao de dados.
+      // Se a sessao estiver sendo retomada, nao mexe na nova conexao.
+      else if (isConnected() && !resuming)
+      {
+        // Envia o comando de logout para o servidor
+        sendLogout();
+        // Espera 1 segundo para dar tempo ao servidor de ler a msg de LOGOUT
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        // Fecha o socket
+        closeSocket();
+      }
+      // Reexibe a interface
+      virtExibirInterface();
+    }
 
-    // Desconecta do servidor (reexibe a interface desconectada)
-    desconectar();
+    // Entrega o resultado a quem solicitou a atuacao
+    C.result.set_value(ok);
+    virtAtuacaoConcluida(C.cmd, C.param, ok);
   }
 
-  // Libera o mutex para sair da zona de exclusao mutua.
-  mtx.unlock();
+  // Nao aceita novos comandos e informa o insucesso dos que ainda estao na fila
+  mtx_queue.lock();
+  queue_on = false;
+  for (auto& Q : cmd_queue) Q.result.set_value(false);
+  cmd_queue.clear();
+  mtx_queue.unlock();
+}
 
-  // Nao reexibe a interface com novo estado.
-  // Serah reexibida quando chegar o proximo dado do servidor, que
-  // deverah conter o novo estado da bomba.
+/// Altera o periodo de solicitacao de novos dados (em milisegundos)
+/// O novo periodo vale imediatamente, mesmo que a thread esteja
+/// esperando pelo fim de um periodo anterior mais longo.
+void SupCliente::setTimeRefresh(int T)
+{
+  if (T<SUP_MIN_REFRESH || T>SUP_MAX_REFRESH) return;
+  timeRefresh = T;
+  wakeRefresh();
+}
+
+/// Acorda a thread de solicitacao de dados, caso esteja esperando
+/// pelo proximo periodo
+void SupCliente::wakeRefresh()
+{
+  mtx_refresh.lock();
+  refreshWake = true;
+  mtx_refresh.unlock();
+  cv_refresh.notify_all();
 }
 
 /// Armazena o ultimo estado atual da planta.
@@ -285,10 +567,22 @@ void SupCliente::storeState(const SupState& LastS)
 {
   // Armazena o estado
   last_S = LastS;
-  // Armazena o instante de recebimento de dados
-  last_t = std::time(nullptr);
+  // Armazena o instante da amostra no servidor, se houver, ou
+  // o instante de recebimento de dados, caso contrario
+  if (LastS.seq != 0)
+  {
+    last_t = std::chrono::steady_clock::time_point(std::chrono::microseconds(LastS.t_us));
+  }
+  else
+  {
+    last_t = std::chrono::steady_clock::now();
+  }
   // Inicializa o instante inicial, se for o primeiro ponto
-  if (start_t == time_t(-1)) start_t = last_t;
+  if (!has_start)
+  {
+    start_t = last_t;
+    has_start = true;
+  }
 }
 
 /// Limpa todos os estados armazenados da planta
@@ -299,7 +593,26 @@ void SupCliente::clearState()
   last_S = SupState();
   // Limpa o instante em que iniciou a coleta de dados
   // e o instante de leitura do ultimo estado.
-  start_t = last_t = time_t(-1);
+  start_t = last_t = std::chrono::steady_clock::time_point();
+  has_start = false;
+  missed_samples = 0;
+}
+
+/// Armazena e exibe um estado recebido.
+/// Descarta amostras repetidas ou mais antigas que a ultima recebida
+/// (o servidor envia a mesma amostra a pedidos muito proximos, e os
+/// datagramas do canal de difusao podem chegar fora de ordem)
+void SupCliente::receiveState(const SupState& S)
+{
+  if (S.seq == 0 || S.seq > last_S.seq)
+  {
+    // Contabiliza as amostras geradas pelo servidor que nao foram recebidas
+    if (last_S.seq != 0 && S.seq > last_S.seq+1) missed_samples += S.seq-last_S.seq-1;
+    // Armazena os dados
+    storeState(S);
+    // Reexibe a interface
+    virtExibirInterface();
+  }
 }
 
 /// Thread de solicitacao periodica de dados
@@ -310,66 +623,79 @@ void SupCliente::main_thread(void)
   uint16_t cmd;
   // Estado recebido
   SupState S;
+  // Resposta recebida ao comando CMD_GET_DATA_EXT: comando seguido dos dados
+  uint16_t frame[SUP_DATA_EXT_FRAME_LEN];
 
   while (!encerrarCliente && isConnected())
   {
-
-    // Bloqueia o mutex para garantir exclusao mutua no envio pelo socket
-    // de comandos que ficam aguardando resposta, para evitar que a resposta
-    // de um comando seja recebida por outro comando em outra thread.
-    mtx.lock();
-
     try
     {
-      // Escreve o comando CMD_GET_DATA
-      // Em caso de erro, throw 401
-      iResult = sock.write_uint16(CMD_GET_DATA);
-      if (iResult != mysocket_status::SOCK_OK) throw 401;
-
-      // Leh a resposta do servidor ao pedido de dados (com timeout)
-      // Em caso de erro, throw 402
-      iResult = sock.read_uint16(cmd, 1000*SUP_TIMEOUT);
-      if (iResult != mysocket_status::SOCK_OK) throw 402;
-      // Se resposta nao for CMD_OK, throw 403
-      if (cmd != CMD_DATA) throw 403;
-      // Leh os dados (com timeout)
-      // Em caso de erro, throw 404
-      iResult = sock.read_uint16(S.V1, 1000*SUP_TIMEOUT);
-      if (iResult != mysocket_status::SOCK_OK) throw 404;
-      
-      iResult = sock.read_uint16(S.V2, 1000*SUP_TIMEOUT);
-      if (iResult != mysocket_status::SOCK_OK) throw 404;
-
-      iResult = sock.read_uint16(S.H1, 1000*SUP_TIMEOUT);
-      if (iResult != mysocket_status::SOCK_OK) throw 404;
-
-      iResult = sock.read_uint16(S.H2, 1000*SUP_TIMEOUT);
-      if (iResult != mysocket_status::SOCK_OK) throw 404;
-
-      iResult = sock.read_uint16(S.PumpInput, 1000*SUP_TIMEOUT);
-      if (iResult != mysocket_status::SOCK_OK) throw 404;
-
-      iResult = sock.read_uint16(S.PumpFlow, 1000*SUP_TIMEOUT);
-      if (iResult != mysocket_status::SOCK_OK) throw 404;
-
-      iResult = sock.read_uint16(S.ovfl, 1000*SUP_TIMEOUT);
-      if (iResult != mysocket_status::SOCK_OK) throw 404;
+      if (pipelined)
+      {
+        // Envia o comando CMD_GET_DATA_EXT; a resposta serah entregue pela
+        // thread de leitura. Os comandos de atuacao nao ficam bloqueados
+        // esperando por esta resposta.
+        std::future<SupReply> F = request(CMD_GET_DATA_EXT);
+        // Espera a resposta do servidor ao pedido de dados (com timeout)
+        // Em caso de erro, throw 402
+        if (F.wait_for(std::chrono::seconds(SUP_TIMEOUT)) != std::future_status::ready) throw 402;
+        SupReply R = F.get();
+        // Se resposta nao for CMD_DATA_EXT, throw 403
+        if (R.cmd != CMD_DATA_EXT) throw 403;
+        S = R.S;
+      }
+      else
+      {
+        // Bloqueia o mutex para garantir exclusao mutua no envio pelo socket
+        // de comandos que ficam aguardando resposta, para evitar que a resposta
+        // de um comando seja recebida por outro comando em outra thread.
+        // O mutex eh liberado ao sair do bloco, inclusive em caso de erro.
+        std::lock_guard<std::mutex> lock(mtx);
+
+        // Escreve o comando CMD_GET_DATA_EXT
+        // Em caso de erro, throw 401
+        iResult = sock.write_uint16(CMD_GET_DATA_EXT);
+        if (iResult != mysocket_status::SOCK_OK) throw 401;
+
+        // Leh a resposta do servidor ao pedido de dados (com timeout)
+        // Em caso de erro, throw 402
+        iResult = sock.read_uint16(cmd, 1000*SUP_TIMEOUT);
+        if (iResult != mysocket_status::SOCK_OK) throw 402;
+        // Se resposta nao for CMD_DATA_EXT, throw 403
+        if (cmd != CMD_DATA_EXT) throw 403;
+        // Leh os dados (com timeout), todos em uma unica leitura
+        // Em caso de erro, throw 404
+        frame[0] = cmd;
+        iResult = sock.read_uint16_array(frame+1, SUP_DATA_EXT_FRAME_LEN-1, 1000*SUP_TIMEOUT);
+        if (iResult != mysocket_status::SOCK_OK) throw 404;
+        S.fromFrameExt(frame);
+      }
 
-      // Libera o mutex para sair da zona de exclusao mutua
-      mtx.unlock();
+      // Armazena e exibe os dados, se for uma amostra nova
+      receiveState(S);
 
-      // Armazena os dados
-      storeState(S);
-      // Reexibe a interface
-      virtExibirInterface();
-
-      // Espera "timeRefresh" segundos
-      std::this_thread::sleep_for(std::chrono::seconds(timeRefresh));
+      // Espera "timeRefresh" milisegundos, a menos que seja acordada antes
+      std::unique_lock<std::mutex> lock(mtx_refresh);
+      cv_refresh.wait_for(lock, std::chrono::milliseconds(timeRefresh),
+                          [this](){return refreshWake;});
+      refreshWake = false;
     }
     catch(int err)
     {
-      // Libera o mutex para sair da zona de exclusao mutua
-      mtx.unlock();
+      // Tenta retomar a sessao em uma nova conexao, sem logout: no mesmo
+      // servidor ou no servidor de reserva que assumiu a porta
+      if (!encerrarCliente && session_token != 0)
+      {
+        resuming = true;
+        closeSocket();
+        bool ok = retomarSessao();
+        resuming = false;
+        if (ok)
+        {
+          virtExibirErro("Conexao perdida: sessao retomada");
+          continue;
+        }
+      }
 
       // Nao pode chamar "desconectar" pq "desconectar" faz join na thread.
       // Como esta funcao main_thread eh executada na thread,
@@ -379,13 +705,13 @@ void SupCliente::main_thread(void)
       if (isConnected())
       {
         // Envia o comando de logout para o servidor
-        sock.write_uint16(CMD_LOGOUT);
+        sendLogout();
         // Espera 1 segundo para dar tempo ao servidor de ler a msg de LOGOUT
         std::this_thread::sleep_for(std::chrono::seconds(1));
         // antes de fechar o socket
         /* ACRESCENTAR -> acho que ja foi acrescentado oq era necessario*/ 
         // Fecha o socket
-        sock.close();
+        closeSocket();
       }
 
       // Testa se o usuario desconectou na interface.
@@ -406,3 +732,494 @@ void SupCliente::main_thread(void)
   } // Fim do while (!encerrarCliente && isConnected())
 }
 
+/// Envia o comando de logout para o servidor.
+/// No modo com pipeline, o comando precisa ser seguido de um identificador
+/// de correlacao, mesmo que nao haja resposta.
+void SupCliente::sendLogout()
+{
+  uint16_t msg[2] = {CMD_LOGOUT, 0};
+  // Bloqueia o mutex durante o envio, como nos demais comandos
+  std::lock_guard<std::mutex> lock(mtx);
+  sock.write_uint16_array(msg, (pipelined ? 2 : 1));
+}
+
+/// Fecha o socket de comunicacao com o servidor.
+/// O mutex impede que o socket seja fechado durante um envio por outra thread.
+void SupCliente::closeSocket()
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  sock.close();
+}
+
+/// Conecta o socket S: local (AF_UNIX), se o endereco for "unix:caminho",
+/// ou TCP, caso contrario, na porta informada ("IP:porta") ou na SUP_PORT
+mysocket_status SupCliente::connectAddress(tcp_mysocket& S, const std::string& Endereco)
+{
+  if (Endereco.compare(0, sizeof(SUP_LOCAL_PREFIX)-1, SUP_LOCAL_PREFIX) == 0)
+  {
+    return S.connect_local(Endereco.substr(sizeof(SUP_LOCAL_PREFIX)-1));
+  }
+  std::string Host, Porta;
+  split_address(Endereco, Host, Porta, SUP_PORT);
+  return S.connect(Host, Porta);
+}
+
+/// Retoma a sessao em uma nova conexao (CMD_RESUME), tentando a cada
+/// SUP_RESUME_RETRY ms durante ateh SUP_RESUME_WINDOW ms.
+/// Se o servidor nao reconhecer a sessao, desiste imediatamente.
+/// O estado recebido continua valendo: o servidor de reserva continua a
+/// sequencia e a referencia de tempo das amostras.
+bool SupCliente::retomarSessao()
+{
+  mysocket_status iResult; //Variavel que armazena o resultado das operações com sockets
+  // Comando recebido
+  uint16_t cmd;
+
+  // A thread de leitura termina com o fechamento do socket
+  if (thr_reader.joinable()) thr_reader.join();
+
+  auto t_end = std::chrono::steady_clock::now() + std::chrono::milliseconds(SUP_RESUME_WINDOW);
+  while (!encerrarCliente && session_token != 0 && std::chrono::steady_clock::now() < t_end)
+  {
+    tcp_mysocket S;
+    try
+    {
+      if (connectAddress(S, server_addr) != mysocket_status::SOCK_OK) throw 1;
+      // O comando e o token, em um unico envio
+      uint16_t msg[5];
+      msg[0] = CMD_RESUME;
+      put_uint64(msg+1, session_token);
+      if (S.write_uint16_array(msg, 5) != mysocket_status::SOCK_OK) throw 2;
+      if (S.write_string(meuUsuario) != mysocket_status::SOCK_OK) throw 2;
+      iResult = S.read_uint16(cmd, 1000*SUP_TIMEOUT);
+      if (iResult != mysocket_status::SOCK_OK) throw 3;
+      // Sessao desconhecida: nao adianta tentar novamente
+      if (cmd!=CMD_ADMIN_OK && cmd!=CMD_OK)
+      {
+        session_token = 0;
+        return false;
+      }
+      if (pipelined)
+      {
+        if (S.write_uint16(CMD_PIPELINE) != mysocket_status::SOCK_OK) throw 4;
+        iResult = S.read_uint16(cmd, 1000*SUP_TIMEOUT);
+        if (iResult != mysocket_status::SOCK_OK || cmd!=CMD_OK) throw 5;
+      }
+    }
+    catch (int)
+    {
+      // Servidor (ainda) inacessivel: tenta novamente
+      S.close();
+      std::this_thread::sleep_for(std::chrono::milliseconds(SUP_RESUME_RETRY));
+      continue;
+    }
+
+    // A nova conexao substitui a conexao perdida
+    mtx.lock();
+    sock.swap(S);
+    mtx.unlock();
+    if (pipelined)
+    {
+      // Relanca a thread de leitura das respostas
+      mtx_pending.lock();
+      reader_on = true;
+      mtx_pending.unlock();
+      thr_reader = std::thread([this](){
+        this->reader_thread();
+      });
+      if (!thr_reader.joinable())
+      {
+        reader_on = false;
+        closeSocket();
+        break;
+      }
+    }
+    return true;
+  }
+  session_token = 0;
+  return false;
+}
+
+/// Envia um comando, com seus parametros, acrescentando um novo identificador
+/// de correlacao (modo com pipeline).
+/// Retorna o "future" onde a thread de leitura vai entregar a resposta.
+/// Em caso de erro no envio, ou se a thread de leitura jah tiver encerrado,
+/// a resposta eh entregue imediatamente como CMD_ERROR.
+std::future<SupReply> SupCliente::request(uint16_t cmd, const uint16_t* param, int nparam,
+                                          std::function<void(const SupReply&)> done)
+{
+  // Comando, identificador e ateh max_param parametros, em um unico envio
+  uint16_t msg[2+max_param];
+  // O comando que vai aguardar resposta
+  PendingCmd P;
+  P.done = std::move(done);
+  std::future<SupReply> F = P.result.get_future();
+
+  if (nparam<0 || nparam>max_param)
+  {
+    P.deliver(SupReply());
+    return F;
+  }
+
+  mtx_pending.lock();
+  if (!reader_on)
+  {
+    // A thread de leitura nao estah mais em execucao: nao haverah resposta
+    mtx_pending.unlock();
+    P.deliver(lostReply());
+    return F;
+  }
+  uint16_t id = next_id++;
+  pending[id] = std::move(P);
+  mtx_pending.unlock();
+
+  msg[0] = cmd;
+  msg[1] = id;
+  for (int i=0; i<nparam; ++i) msg[2+i] = param[i];
+
+  // Bloqueia o mutex apenas durante o envio, para que os bytes de
+  // comandos enviados por threads diferentes nao se misturem
+  mtx.lock();
+  mysocket_status iResult = sock.write_uint16_array(msg, 2+nparam);
+  mtx.unlock();
+
+  if (iResult != mysocket_status::SOCK_OK)
+  {
+    // Erro no envio: entrega imediatamente uma resposta de erro
+    mtx_pending.lock();
+    auto itr = pending.find(id);
+    if (itr != pending.end())
+    {
+      P = std::move(itr->second);
+      pending.erase(itr);
+      mtx_pending.unlock();
+      P.deliver(lostReply());
+    }
+    else mtx_pending.unlock();
+  }
+  return F;
+}
+
+/// Solicita um bloco do historico de niveis armazenado no servidor.
+/// Soh eh possivel no modo com pipeline, pois a resposta pode chegar
+/// enquanto outros comandos aguardam resposta.
+void SupCliente::requestHistory(uint16_t Level, uint64_t Index,
+                                std::function<void(const SupReply&)> Done)
+{
+  if (!pipelined || !isConnected())
+  {
+    Done(SupReply());
+    return;
+  }
+  uint16_t param[5];
+  param[0] = Level;
+  put_uint64(param+1, Index);
+  request(CMD_GET_HISTORY, param, 5, std::move(Done));
+}
+
+/// Testa se um comando eh de atuacao
+static bool is_actuation(uint16_t Cmd)
+{
+  return Cmd==CMD_SET_V1 || Cmd==CMD_SET_V2 || Cmd==CMD_SET_PUMP ||
+         (Cmd>=CMD_SET_PID && Cmd<=CMD_SET_PID_KT);
+}
+
+/// Envia um comando de atuacao sem esperar pela resposta.
+/// Soh eh possivel no modo com pipeline.
+std::future<SupReply> SupCliente::requestActuation(uint16_t Cmd, uint16_t Param)
+{
+  if (!pipelined || !isConnected() || !isAdmin() || !is_actuation(Cmd)) return readyFailure();
+  return request(Cmd, &Param, 1);
+}
+
+/// Envia um comando de atuacao sem esperar pela resposta, que eh entregue a Done.
+/// Soh eh possivel no modo com pipeline.
+void SupCliente::requestActuation(uint16_t Cmd, uint16_t Param,
+                                  std::function<void(const SupReply&)> Done)
+{
+  if (!pipelined || !isConnected() || !isAdmin() || !is_actuation(Cmd))
+  {
+    Done(SupReply());
+    return;
+  }
+  request(Cmd, &Param, 1, std::move(Done));
+}
+
+/// Solicita o estado atual da planta sem esperar pela resposta.
+/// Soh eh possivel no modo com pipeline.
+std::future<SupReply> SupCliente::requestState()
+{
+  if (!pipelined || !isConnected()) return readyFailure();
+  return request(CMD_GET_DATA_EXT);
+}
+
+/// Solicita os eventos do fluxo de replicacao sem esperar pela resposta.
+/// Soh eh possivel no modo com pipeline, pois o servidor retem a resposta
+/// enquanto nao houver eventos novos.
+std::future<SupReply> SupCliente::requestReplication(uint64_t Pos)
+{
+  if (!pipelined || !isConnected() || !isAdmin()) return readyFailure();
+  uint16_t param[4];
+  put_uint64(param, Pos);
+  return request(CMD_REPLICATE, param, 4);
+}
+
+/// Solicita uma previsao sem esperar pela resposta.
+/// Soh eh possivel no modo com pipeline, pois o servidor soh responde quando
+/// a simulacao termina.
+std::future<SupReply> SupCliente::requestWhatIf(uint16_t Horizon, uint16_t Period,
+                                                const std::vector<uint16_t>& Events)
+{
+  if (!pipelined || !isConnected() ||
+      Events.size()%3 != 0 || Events.size() > 3*size_t(SUP_WHATIF_MAX_EVENTS))
+  {
+    return readyFailure();
+  }
+  uint16_t param[max_param];
+  param[0] = Horizon;
+  param[1] = Period;
+  param[2] = uint16_t(Events.size()/3);
+  std::copy(Events.begin(), Events.end(), param+3);
+  return request(CMD_WHATIF, param, 3+int(Events.size()));
+}
+
+/// Solicita uma varredura sem esperar pela resposta.
+/// Soh eh possivel no modo com pipeline, como a previsao.
+std::future<SupReply> SupCliente::requestSweep(const SupSweep& W)
+{
+  if (!pipelined || !isConnected() || !W.valid()) return readyFailure();
+  uint16_t param[SUP_SWEEP_FRAME_LEN];
+  W.toFrame(param);
+  return request(CMD_SWEEP, param, SUP_SWEEP_FRAME_LEN);
+}
+
+/// Solicita a configuracao do controlador de nivel sem esperar pela resposta.
+/// Soh eh possivel no modo com pipeline.
+std::future<SupReply> SupCliente::requestPID()
+{
+  if (!pipelined || !isConnected()) return readyFailure();
+  return request(CMD_GET_PID);
+}
+
+/// Encerra com erro (resposta CMD_ERROR) todos os comandos que aguardam resposta
+void SupCliente::failPending()
+{
+  // As respostas sao entregues fora da exclusao mutua, pois as funcoes
+  // que as recebem podem enviar novos comandos
+  std::map<uint16_t, PendingCmd> failed;
+  mtx_pending.lock();
+  failed.swap(pending);
+  mtx_pending.unlock();
+  for (auto& P : failed) P.second.deliver(lostReply());
+}
+
+/// Uma resposta de erro que nao veio do servidor, entregue aos comandos
+/// pendentes quando a conexao eh perdida antes da resposta
+SupReply SupCliente::lostReply()
+{
+  SupReply R;
+  R.lost = true;
+  return R;
+}
+
+/// Um "future" com a resposta de erro (CMD_ERROR) jah entregue, retornado
+/// pelos pedidos que nao podem ser enviados
+std::future<SupReply> SupCliente::readyFailure()
+{
+  std::promise<SupReply> P;
+  P.set_value(SupReply());
+  return P.get_future();
+}
+
+/// Thread de leitura das respostas (modo com pipeline).
+/// Cada resposta eh entregue ao comando pendente que tem o mesmo
+/// identificador de correlacao.
+void SupCliente::reader_thread(void)
+{
+  mysocket_status iResult; //Variavel que armazena o resultado das operações com sockets
+  // Comando de resposta e identificador de correlacao
+  uint16_t head[2];
+  // Resposta aos comandos CMD_GET_DATA e CMD_GET_DATA_EXT: comando seguido dos dados
+  uint16_t frame[SUP_DATA_EXT_FRAME_LEN];
+  // Resposta a ser entregue
+  SupReply R;
+
+  // Comando pendente que vai receber a resposta
+  PendingCmd P;
+  // Numero de intervalos na resposta CMD_HISTORY
+  uint16_t nhist;
+  // Posicao e numero de eventos na resposta CMD_REPLICA, seguidos dos eventos
+  uint16_t rhead[5];
+  std::vector<uint16_t> revents;
+  // Periodo e numero de pontos na resposta CMD_WHATIF_RESULT
+  uint16_t whead[2];
+  // Numero de candidatos na resposta CMD_SWEEP_RESULT
+  uint16_t nsweep;
+
+  while (!encerrarCliente && isConnected())
+  {
+    // Espera pela proxima resposta.
+    // O timeout curto serve apenas para testar periodicamente se o cliente foi encerrado.
+    iResult = sock.read_uint16_array(head, 2, 1000);
+    if (iResult == mysocket_status::SOCK_TIMEOUT) continue;
+    if (iResult != mysocket_status::SOCK_OK) break;
+
+    R = SupReply();
+    R.cmd = head[0];
+    if (R.cmd == CMD_DATA)
+    {
+      // Leh os dados que seguem a resposta CMD_DATA
+      frame[0] = CMD_DATA;
+      iResult = sock.read_uint16_array(frame+1, SUP_DATA_FRAME_LEN-1, 1000*SUP_TIMEOUT);
+      if (iResult != mysocket_status::SOCK_OK) break;
+      R.S.fromFrame(frame);
+    }
+    else if (R.cmd == CMD_DATA_EXT)
+    {
+      // Leh os dados que seguem a resposta CMD_DATA_EXT
+      frame[0] = CMD_DATA_EXT;
+      iResult = sock.read_uint16_array(frame+1, SUP_DATA_EXT_FRAME_LEN-1, 1000*SUP_TIMEOUT);
+      if (iResult != mysocket_status::SOCK_OK) break;
+      R.S.fromFrameExt(frame);
+    }
+    else if (R.cmd == CMD_HISTORY)
+    {
+      // Leh o numero de intervalos e os dados de cada intervalo
+      iResult = sock.read_uint16(nhist, 1000*SUP_TIMEOUT);
+      if (iResult != mysocket_status::SOCK_OK || nhist > SUP_HISTORY_BLOCK) break;
+      R.hist.resize(SUP_HISTORY_BUCKET_LEN*nhist);
+      if (nhist > 0)
+      {
+        iResult = sock.read_uint16_array(R.hist.data(), int(R.hist.size()), 1000*SUP_TIMEOUT);
+        if (iResult != mysocket_status::SOCK_OK) break;
+      }
+    }
+    else if (R.cmd == CMD_REPLICA)
+    {
+      // Leh a nova posicao, o numero de eventos e os eventos
+      iResult = sock.read_uint16_array(rhead, 5, 1000*SUP_TIMEOUT);
+      if (iResult != mysocket_status::SOCK_OK || rhead[4] > SUP_REPL_MAX_EVENTS) break;
+      R.pos = get_uint64(rhead);
+      revents.resize(SUP_REPL_EVENT_LEN*rhead[4]);
+      if (rhead[4] > 0)
+      {
+        iResult = sock.read_uint16_array(revents.data(), int(revents.size()), 1000*SUP_TIMEOUT);
+        if (iResult != mysocket_status::SOCK_OK) break;
+      }
+      R.events.resize(rhead[4]);
+      for (size_t i=0; i<R.events.size(); ++i)
+      {
+        R.events[i].fromFrame(revents.data() + SUP_REPL_EVENT_LEN*i);
+      }
+    }
+    else if (R.cmd == CMD_WHATIF_RESULT)
+    {
+      // Leh o periodo, o numero de pontos e os pontos
+      iResult = sock.read_uint16_array(whead, 2, 1000*SUP_TIMEOUT);
+      if (iResult != mysocket_status::SOCK_OK || whead[1] > SUP_WHATIF_MAX_POINTS) break;
+      R.period = whead[0];
+      R.points.resize(SUP_WHATIF_POINT_LEN*whead[1]);
+      if (whead[1] > 0)
+      {
+        iResult = sock.read_uint16_array(R.points.data(), int(R.points.size()), 1000*SUP_TIMEOUT);
+        if (iResult != mysocket_status::SOCK_OK) break;
+      }
+    }
+    else if (R.cmd == CMD_SWEEP_RESULT)
+    {
+      // Leh o numero de candidatos e os resumos
+      iResult = sock.read_uint16(nsweep, 1000*SUP_TIMEOUT);
+      if (iResult != mysocket_status::SOCK_OK || nsweep > SUP_SWEEP_MAX_CANDIDATES) break;
+      R.sweep.resize(SUP_SWEEP_SUMMARY_LEN*nsweep);
+      if (nsweep > 0)
+      {
+        iResult = sock.read_uint16_array(R.sweep.data(), int(R.sweep.size()), 1000*SUP_TIMEOUT);
+        if (iResult != mysocket_status::SOCK_OK) break;
+      }
+    }
+    else if (R.cmd == CMD_PID)
+    {
+      // Leh a configuracao do controlador de nivel
+      R.pid.resize(SUP_PID_FRAME_LEN);
+      iResult = sock.read_uint16_array(R.pid.data(), SUP_PID_FRAME_LEN, 1000*SUP_TIMEOUT);
+      if (iResult != mysocket_status::SOCK_OK) break;
+    }
+    else if (R.cmd != CMD_OK && R.cmd != CMD_ERROR)
+    {
+      // Resposta invalida: nao eh possivel continuar lendo o fluxo de dados
+      break;
+    }
+
+    // Entrega a resposta ao comando que estah esperando por ela.
+    // A entrega eh feita fora da exclusao mutua, pois a funcao que
+    // recebe a resposta pode enviar novos comandos.
+    mtx_pending.lock();
+    auto itr = pending.find(head[1]);
+    if (itr != pending.end())
+    {
+      P = std::move(itr->second);
+      pending.erase(itr);
+      mtx_pending.unlock();
+      P.deliver(R);
+    }
+    else mtx_pending.unlock();
+  }
+
+  // Nao aceita novos comandos e encerra os que ainda aguardam resposta.
+  // A thread de solicitacao de dados vai receber CMD_ERROR e fechar a conexao.
+  mtx_pending.lock();
+  reader_on = false;
+  mtx_pending.unlock();
+  failPending();
+  // Nao espera pelo fim do periodo de solicitacao de dados
+  wakeRefresh();
+}
+
+/// Thread do modo visualizador: recebe os datagramas do canal de difusao.
+/// Nao envia nada ao servidor: o custo do servidor nao depende
+/// do numero de visualizadores.
+void SupCliente::viewer_thread(void)
+{
+  mysocket_status iResult; //Variavel que armazena o resultado das operações com sockets
+  // Datagrama recebido: um inteiro a mais, para detectar datagramas maiores
+  uint16_t frame[SUP_BCAST_FRAME_LEN+1];
+  int nread;
+  // Estado recebido
+  SupState S;
+  // Tempo sem receber estados da planta (em milisegundos)
+  long semDados = 0;
+
+  while (!encerrarCliente)
+  {
+    // Espera um datagrama, no maximo SUP_VIEWER_POLL ms para testar o encerramento
+    iResult = sock_viewer.read_datagram((mybyte*)frame, sizeof(frame), nread, SUP_VIEWER_POLL);
+    if (iResult == mysocket_status::SOCK_ERROR)
+    {
+      if (!encerrarCliente)
+      {
+        virtExibirErro("Erro na recepcao da difusao");
+        virtExibirInterface();
+      }
+      break;
+    }
+    // Soh aceita os datagramas do SupTanques para a planta escolhida
+    if (iResult == mysocket_status::SOCK_OK &&
+        nread == int(SUP_BCAST_FRAME_LEN*sizeof(uint16_t)) &&
+        frame[0] == CMD_STATE_BCAST && frame[1] == viewer_plant &&
+        frame[2] == CMD_DATA_EXT)
+    {
+      S.fromFrameExt(frame+2);
+      receiveState(S);
+      semDados = 0;
+    }
+    else if (iResult == mysocket_status::SOCK_TIMEOUT)
+    {
+      // Avisa uma unica vez que o servidor parou de difundir
+      semDados += SUP_VIEWER_POLL;
+      if (semDados >= 1000*SUP_TIMEOUT && semDados < 1000*SUP_TIMEOUT+SUP_VIEWER_POLL)
+      {
+        virtExibirErro("Nenhum estado recebido nos ultimos " + std::to_string(SUP_TIMEOUT) + " segundos");
+      }
+    }
+  }
+}
@@ -2,14 +2,67 @@
 #define _SUP_CLIENTE_H_
 
 #include <string>
-#include <ctime>
+#include <chrono>
 #include "supdados.h"
 #include <thread>
 #include "mysocket.h"
 #include <mutex>
 #include <cstdint>
+#include <future>
+#include <map>
+#include <deque>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <atomic>
 /* ACRESCENTAR */
 
+/// Limites do periodo de solicitacao de novos dados (em milisegundos)
+#define SUP_MIN_REFRESH 20
+#define SUP_MAX_REFRESH 200000
+
+/// Intervalo maximo (em milisegundos) entre os testes de encerramento
+/// da thread do modo visualizador, enquanto espera pelos datagramas
+#define SUP_VIEWER_POLL 200
+
+/// A retomada da sessao quando a conexao eh perdida (ver CMD_RESUME):
+/// tempo maximo (em milisegundos) de tentativas e intervalo entre elas.
+/// O prazo deve ser suficiente para que o servidor de reserva assuma a porta.
+#define SUP_RESUME_WINDOW 10000
+#define SUP_RESUME_RETRY 250
+
+/// A resposta do servidor a um comando, entregue pela thread de leitura
+/// ao comando que estah esperando por ela (modo com pipeline)
+struct SupReply
+{
+  // O comando de resposta: CMD_OK, CMD_ERROR, CMD_DATA, CMD_DATA_EXT, CMD_HISTORY,
+  // CMD_REPLICA, CMD_WHATIF_RESULT, CMD_SWEEP_RESULT ou CMD_PID.
+  // Tambem eh CMD_ERROR quando a conexao foi perdida antes da resposta.
+  uint16_t cmd=CMD_ERROR;
+  // true se a resposta nao veio do servidor, pois a conexao foi perdida
+  // (ou estah sendo retomada) antes que a resposta chegasse
+  bool lost=false;
+  // O estado da planta, se a resposta for CMD_DATA ou CMD_DATA_EXT
+  SupState S;
+  // Os intervalos do bloco do historico, se a resposta for CMD_HISTORY:
+  // SUP_HISTORY_BUCKET_LEN inteiros por intervalo (posicao no bloco,
+  // minimo e maximo de H1, minimo e maximo de H2)
+  std::vector<uint16_t> hist;
+  // A nova posicao no fluxo de replicacao e os eventos, se a resposta for CMD_REPLICA
+  uint64_t pos=0;
+  std::vector<SupReplEvent> events;
+  // O periodo (s) e os pontos da previsao, se a resposta for CMD_WHATIF_RESULT:
+  // SUP_WHATIF_POINT_LEN inteiros por ponto (H1 e H2 sem ruido e indicadores)
+  uint16_t period=0;
+  std::vector<uint16_t> points;
+  // Os resumos dos candidatos, se a resposta for CMD_SWEEP_RESULT:
+  // SUP_SWEEP_SUMMARY_LEN inteiros por candidato, na ordem de SupSweep::candidate
+  std::vector<uint16_t> sweep;
+  // O controlador de nivel, se a resposta for CMD_PID: SUP_PID_FRAME_LEN inteiros
+  // (tanque controlado, nivel desejado, kp, ki, kd, kt e entrada atual da bomba)
+  std::vector<uint16_t> pid;
+};
+
 class SupCliente
 {
 // Funcoes protegidas
@@ -20,25 +73,60 @@ protected:
   virtual ~SupCliente();
 
   // Funcoes de consulta
-  // Cliente conectado (true) ou desconectado (false)
-  bool isConnected() const {return sock.connected();}
+  // Cliente conectado (true) ou desconectado (false).
+  // No modo visualizador, o cliente estah conectado ao canal de difusao.
+  // Enquanto a sessao estiver sendo retomada, o cliente continua conectado.
+  bool isConnected() const {return sock.connected() || sock_viewer.connected() || resuming;}
+  // Cliente no modo visualizador: recebe o estado pelo canal de difusao por UDP
+  bool isViewer() const {return sock_viewer.connected();}
   // Cliente administrador (true) ou visualizador (false)
   bool isAdmin() const {return is_admin;}
+  // Protocolo com pipeline (true) ou um comando por vez (false)
+  bool isPipelined() const {return pipelined;}
   // Ultimo estado da planta
   const SupState& lastState() const {return last_S;}
   // Instante de leitura do ultimo dado apos inicio das leituras
-  int deltaT() const {return last_t-start_t;}
+  // (em segundos). Medido pelo relogio do servidor, com resolucao de
+  // microsegundos, se o servidor enviar o instante da amostra.
+  double deltaT() const {return std::chrono::duration<double>(last_t-start_t).count();}
+  // Numero de amostras geradas pelo servidor que nao foram recebidas
+  // por este cliente (lacunas na sequencia das amostras)
+  uint64_t missedSamples() const {return missed_samples;}
 
-  // Conectar com o servidor
+  // Conectar com o servidor.
+  // Se a conexao for perdida, a sessao eh retomada automaticamente em uma nova
+  // conexao com o mesmo endereco (no mesmo servidor ou no servidor de reserva
+  // que assumiu a porta), durante ateh SUP_RESUME_WINDOW ms.
   void conectar(const std::string& IP,
                 const std::string& Login,
                 const std::string& Senha);
 
-  // Desconectar do servidor
+  // Receber o estado da planta Planta pelo canal de difusao por UDP (modo
+  // visualizador: somente leitura, sem conexao com o servidor e sem login).
+  // Endereco "[grupo][:porta]": se houver, o grupo (multicast) para o qual o
+  // servidor difunde; senao, recebe os datagramas enviados ao computador ou de
+  // difusao (broadcast). A porta default eh SUP_BCAST_PORT.
+  void conectarViewer(const std::string& Endereco, uint16_t Planta=0);
+
+  // Desconectar do servidor (ou do canal de difusao)
   void desconectar();
 
-  // Espera pelo fim da thread de solicitacao de dados
-  void join_if_joinable() {if (thr.joinable()) thr.join();}
+  // Escolhe o protocolo com pipeline (true) ou um comando por vez (false).
+  // No modo com pipeline, cada comando leva um identificador de correlacao
+  // e as respostas sao lidas por uma unica thread, de modo que varios
+  // comandos podem estar aguardando resposta ao mesmo tempo.
+  // Soh tem efeito se o cliente nao estiver conectado.
+  void setPipelined(bool P) {if (!isConnected()) pipelined=P;}
+
+  // Espera pelo fim das threads de solicitacao, de leitura de dados, de atuacao
+  // e do modo visualizador
+  void join_if_joinable()
+  {
+    if (thr.joinable()) thr.join();
+    if (thr_reader.joinable()) thr_reader.join();
+    if (thr_cmd.joinable()) thr_cmd.join();
+    if (thr_viewer.joinable()) thr_viewer.join();
+  }
 
   // As funcoes de comunicacao com o servidor
   // Fixa o estado da valvula 1: aberta (true) ou fechada (false)
@@ -47,10 +135,59 @@ protected:
   void setV2Open(bool Open) {setValvOpen(false,Open);}
   // Fixa a entrada da bomba: 0 a 65535
   void setPumpInput(uint16_t Input);
+  // Envia um comando do controlador de nivel do servidor (CMD_SET_PID,
+  // CMD_SET_PID_SP, CMD_SET_PID_KP, ..., CMD_SET_PID_KT). Retorna true se OK.
+  bool setLevelControl(uint16_t Cmd, uint16_t Param);
+
+  // As versoes assincronas das funcoes de atuacao.
+  // Colocam o comando na fila da thread de atuacao e retornam imediatamente,
+  // sem bloquear a interface esperando pela resposta do servidor.
+  // O "future" retornado recebe true (comando confirmado) ou false (erro).
+  // O resultado tambem eh informado pela funcao virtual virtAtuacaoConcluida.
+  std::future<bool> setV1OpenAsync(bool Open) {return queueActuation(CMD_SET_V1, Open ? 1 : 0);}
+  std::future<bool> setV2OpenAsync(bool Open) {return queueActuation(CMD_SET_V2, Open ? 1 : 0);}
+  std::future<bool> setPumpInputAsync(uint16_t Input) {return queueActuation(CMD_SET_PUMP, Input);}
+
+  // Solicita um bloco do historico de niveis armazenado no servidor
+  // (nivel de resolucao Level e indice do bloco Index; ver SUP_HISTORY_BLOCK).
+  // Retorna imediatamente. A funcao Done eh chamada uma unica vez com a resposta,
+  // que eh CMD_ERROR se houver erro ou se o cliente nao usar o protocolo com pipeline.
+  // Done pode ser chamada pela thread de leitura, ou imediatamente em caso de erro.
+  void requestHistory(uint16_t Level, uint64_t Index,
+                      std::function<void(const SupReply&)> Done);
+
+  // Os comandos do modo com pipeline para uso direto pela interface.
+  // Enviam o comando e retornam imediatamente, sem esperar pelas respostas
+  // de outros comandos pendentes. A resposta eh entregue no "future":
+  // CMD_ERROR se houver erro ou se o cliente nao usar o protocolo com pipeline.
+  // Envia um comando de atuacao (CMD_SET_V1, CMD_SET_V2, CMD_SET_PUMP
+  // ou um dos comandos CMD_SET_PID...)
+  std::future<SupReply> requestActuation(uint16_t Cmd, uint16_t Param);
+  // Idem, entregando a resposta a funcao Done, como requestHistory
+  void requestActuation(uint16_t Cmd, uint16_t Param,
+                        std::function<void(const SupReply&)> Done);
+  // Solicita o estado atual da planta (resposta CMD_DATA_EXT)
+  std::future<SupReply> requestState();
+  // Solicita os eventos do fluxo de replicacao do servidor seguintes a
+  // posicao Pos (resposta CMD_REPLICA; soh para administradores).
+  // O servidor pode reter a resposta por ateh SUP_REPL_WAIT ms.
+  std::future<SupReply> requestReplication(uint64_t Pos);
+  // Solicita a previsao da evolucao dos niveis durante Horizon segundos, com um
+  // ponto a cada Period segundos, se forem executadas as atuacoes Events
+  // (3 inteiros por atuacao: instante em s, comando e parametro; no maximo
+  // SUP_WHATIF_MAX_EVENTS). A planta nao eh alterada. Resposta CMD_WHATIF_RESULT.
+  std::future<SupReply> requestWhatIf(uint16_t Horizon, uint16_t Period,
+                                      const std::vector<uint16_t>& Events);
+  // Solicita a varredura W: a simulacao de cada candidato da grade, com o resumo
+  // do resultado (resposta CMD_SWEEP_RESULT). A planta nao eh alterada.
+  std::future<SupReply> requestSweep(const SupSweep& W);
+  // Solicita a configuracao do controlador de nivel do servidor (resposta CMD_PID)
+  std::future<SupReply> requestPID();
 
   // As funcoes de gerenciamento da interface.
-  // Altera o periodo de solicitacao de novos dados
-  void setTimeRefresh(int T) {if (T>=10 && T<=200) timeRefresh=T;}
+  // Altera o periodo de solicitacao de novos dados (em milisegundos)
+  // Deve estar entre SUP_MIN_REFRESH e SUP_MAX_REFRESH
+  void setTimeRefresh(int T);
   // As funcoes virtuais de gerenciamento dos dados armazenados na interface,
   // que serao complementadas nas classes derivadas de acordo com a interface em uso.
   // Armazena o ultimo estado da planta
@@ -63,8 +200,9 @@ protected:
   // O nome do usuario do cliente
   std::string meuUsuario;
 
-  // Indica se a interface encerrou o cliente
-  bool encerrarCliente;
+  // Indica se a interface encerrou o cliente.
+  // Atomico: eh alterado pela interface e testado pelas threads do cliente.
+  std::atomic<bool> encerrarCliente;
 
 // Funcoes privadas
 private:
@@ -82,6 +220,12 @@ private:
   // Redesenha toda a interface (chegada de dados, desconexao, etc)
   virtual void virtExibirInterface() const = 0;
 
+  // Informa o resultado de um comando de atuacao assincrono.
+  // Eh chamada pela thread de atuacao. Nao precisa ser implementada
+  // nas interfaces que nao usam as funcoes assincronas.
+  // Parametros: comando (Cmd), parametro (Param) e resultado (Ok) da atuacao.
+  virtual void virtAtuacaoConcluida(uint16_t /*Cmd*/, uint16_t /*Param*/, bool /*Ok*/) const {}
+
   // Funcao auxiliar para evitar repeticao de codigo.
   // Fixa o estado da valvula 1 (isV1==true) ou 2 (isV1==false)
   // como sendo aberta (Open==true) ou fechada (Open==false)
@@ -89,30 +233,152 @@ private:
 
   // Thread de solicitacao periodica de dados
   void main_thread(void);
+  // Armazena e exibe um estado recebido, descartando amostras repetidas
+  // ou mais antigas que a ultima recebida
+  void receiveState(const SupState& S);
+  // Acorda a thread de solicitacao de dados, caso esteja esperando
+  // pelo proximo periodo (alteracao do periodo ou encerramento do cliente)
+  void wakeRefresh();
+
+  // Envia o comando de logout para o servidor
+  void sendLogout();
+  // Fecha o socket de comunicacao com o servidor
+  void closeSocket();
+
+  // Conecta o socket S ao endereco "unix:caminho" (socket local) ou "IP[:porta]"
+  static mysocket_status connectAddress(tcp_mysocket& S, const std::string& Endereco);
+  // Retoma a sessao em uma nova conexao, depois que a conexao foi perdida
+  // (e o socket fechado). Eh chamada pela thread de solicitacao de dados.
+  // Retorna true se OK.
+  bool retomarSessao();
+  // Testa se o erro Err de uma atuacao (x02 ou x04: envio ou resposta) pode ter
+  // sido causado pela perda da conexao, com uma sessao que ainda pode ser retomada.
+  // No modo com pipeline, uma resposta perdida (SupReply::lost) gera o erro x04.
+  bool lostSession(int Err) const
+  {
+    return !encerrarCliente && session_token != 0 && (Err%100==2 || Err%100==4);
+  }
+
+  // Envia um comando de atuacao e espera pela resposta do servidor.
+  // Em caso de erro, gera excecao com o codigo do erro.
+  void actuate(uint16_t cmd, uint16_t param);
+  // Coloca um comando de atuacao na fila da thread de atuacao
+  std::future<bool> queueActuation(uint16_t cmd, uint16_t param);
+  // Thread de atuacao: executa os comandos assincronos, um de cada vez
+  void actuation_thread(void);
+
+  // As funcoes do modo com pipeline.
+  // Envia um comando, com seus parametros, acrescentando um novo identificador
+  // de correlacao. Retorna o "future" onde serah entregue a resposta.
+  // Se a funcao done for fornecida, a resposta eh entregue a ela, e nao ao "future".
+  std::future<SupReply> request(uint16_t cmd, const uint16_t* param=nullptr, int nparam=0,
+                                std::function<void(const SupReply&)> done=nullptr);
+  // Thread de leitura das respostas, que sao entregues aos comandos pendentes
+  void reader_thread(void);
+  // Encerra com erro todos os comandos que aguardam resposta
+  void failPending();
+  // Uma resposta de erro que nao veio do servidor (conexao perdida)
+  static SupReply lostReply();
+  // Um "future" com a resposta de erro jah entregue, para os pedidos que
+  // nao podem ser enviados
+  static std::future<SupReply> readyFailure();
+
+  // Thread do modo visualizador: recebe os datagramas do canal de difusao
+  void viewer_thread(void);
 
 // Dados privados
 private:
   // Cliente eh administrador
   bool is_admin;
+  // Cliente usa o protocolo com pipeline
+  bool pipelined;
 
   // Ultimo estado lido da planta
   SupState last_S;
   // Instante de tempo da primeira leitura de estado da planta
-  std::time_t start_t;
+  // Quando o servidor envia o instante da amostra (SupState::t_us), este eh
+  // usado no lugar do instante de recebimento, contado a partir de time_point()
+  std::chrono::steady_clock::time_point start_t;
   // Instante de tempo da ultima leitura de estado da planta
-  std::time_t last_t;
-  // Periodo de solicitacao de novos dados
+  std::chrono::steady_clock::time_point last_t;
+  // Jah houve leitura (start_t eh valido)
+  bool has_start;
+  // Numero de amostras do servidor que nao foram recebidas
+  uint64_t missed_samples;
+  // Periodo de solicitacao de novos dados (em milisegundos)
   int timeRefresh;
+  // A espera da thread entre solicitacoes de dados deve ser interrompida
+  bool refreshWake;
+  // Exclusao mutua e sinalizacao para interromper a espera entre solicitacoes
+  std::mutex mtx_refresh;
+  std::condition_variable cv_refresh;
 
   // Socket de comunicacaco
   tcp_mysocket sock;
+  // O endereco do servidor e o token da sessao (0 se a sessao nao puder ser retomada)
+  std::string server_addr;
+  uint64_t session_token;
+  // A sessao estah sendo retomada (o socket estah fechado).
+  // Atomico: eh testado pelas outras threads, em isConnected.
+  std::atomic<bool> resuming;
 
   // Exclusao mutua para nao enviar novo comando antes de
-  // receber a resposta do comando anterior
+  // receber a resposta do comando anterior. Todos os envios pelo
+  // socket e o seu fechamento sao feitos com este mutex bloqueado.
   std::mutex mtx;
 
   // Identificador da thread de solicitacao periodica de dados
   std::thread thr;
+
+  // Os dados do modo com pipeline.
+  // Numero maximo de parametros de um comando (o maior eh CMD_WHATIF)
+  static const int max_param = 3+3*SUP_WHATIF_MAX_EVENTS;
+  // Um comando que aguarda resposta: a resposta eh entregue para a funcao
+  // done, se houver, ou para a promessa result
+  struct PendingCmd
+  {
+    std::promise<SupReply> result;
+    std::function<void(const SupReply&)> done;
+    // Entrega a resposta
+    void deliver(const SupReply& R) {if (done) done(R); else result.set_value(R);}
+  };
+  // Os comandos que aguardam resposta, indexados pelo identificador de correlacao
+  std::map<uint16_t, PendingCmd> pending;
+  // O proximo identificador de correlacao a ser usado
+  uint16_t next_id;
+  // A thread de leitura estah em execucao (aceita novos comandos).
+  // Atomico: eh alterado pela thread de leitura e testado pelas outras.
+  std::atomic<bool> reader_on;
+  // Exclusao mutua no acesso aos comandos pendentes
+  std::mutex mtx_pending;
+  // Identificador da thread de leitura das respostas
+  std::thread thr_reader;
+
+  // Os dados das atuacoes assincronas.
+  // Um comando de atuacao na fila e a promessa do seu resultado
+  struct AsyncCmd
+  {
+    uint16_t cmd=0, param=0;
+    std::promise<bool> result;
+  };
+  // A fila de comandos de atuacao
+  std::deque<AsyncCmd> cmd_queue;
+  // A thread de atuacao estah em execucao (aceita novos comandos)
+  bool queue_on;
+  // Exclusao mutua no acesso a fila de comandos
+  std::mutex mtx_queue;
+  // Sinaliza a chegada de novos comandos na fila
+  std::condition_variable cv_queue;
+  // Identificador da thread de atuacao
+  std::thread thr_cmd;
+
+  // Os dados do modo visualizador.
+  // Socket de recepcao do canal de difusao
+  udp_mysocket sock_viewer;
+  // A planta cujos estados sao exibidos (os datagramas das outras sao descartados)
+  uint16_t viewer_plant;
+  // Identificador da thread do modo visualizador
+  std::thread thr_viewer;
 };
 
 #endif // _SUP_CLIENTE_H_
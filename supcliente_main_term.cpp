@@ -1,3 +1,5 @@
+#include <iostream>
+#include <string>
 #include "supcliente_term.h"
 
 /// ==============================
@@ -9,6 +11,78 @@ int main(int argc, char *argv[])
   // O objeto que implementa o cliente SupTanques
   SupClienteTerm ST_Client;
 
+  // O modo de saida continua, nao interativo:
+  //   --stream csv|jsonl|bin IP Login Senha [periodo_ms]
+  if (argc > 1 && std::string(argv[1]) == "--stream")
+  {
+    SupStreamFormat F = SupStreamFormat::NONE;
+    if (argc > 2)
+    {
+      std::string fmt = argv[2];
+      if (fmt == "csv") F = SupStreamFormat::CSV;
+      else if (fmt == "jsonl") F = SupStreamFormat::JSONL;
+      else if (fmt == "bin") F = SupStreamFormat::BINARY;
+    }
+    int periodo = SUP_MIN_REFRESH;
+    if (argc > 6)
+    {
+      try
+      {
+        periodo = std::stoi(argv[6]);
+      }
+      catch(...)
+      {
+        periodo = 0;
+      }
+    }
+    if (F == SupStreamFormat::NONE || argc < 6 || argc > 7 ||
+        periodo < SUP_MIN_REFRESH || periodo > SUP_MAX_REFRESH)
+    {
+      std::cerr << "Uso: " << argv[0] << " --stream csv|jsonl|bin IP Login Senha [periodo_ms]\n"
+                << "periodo_ms entre " << SUP_MIN_REFRESH << " e " << SUP_MAX_REFRESH
+                << " (default " << SUP_MIN_REFRESH << ")\n";
+      return 1;
+    }
+    return ST_Client.stream(F, argv[3], argv[4], argv[5], periodo);
+  }
+
+  // O modo de execucao em lote, nao interativo:
+  //   --script arquivo IP Login Senha
+  if (argc > 1 && std::string(argv[1]) == "--script")
+  {
+    if (argc != 6)
+    {
+      std::cerr << "Uso: " << argv[0] << " --script arquivo IP Login Senha\n";
+      return 1;
+    }
+    return ST_Client.script(argv[2], argv[3], argv[4], argv[5]);
+  }
+
+  // O modo visualizador, somente leitura, pelo canal de difusao por UDP:
+  //   --viewer [grupo][:porta] [planta]
+  if (argc > 1 && std::string(argv[1]) == "--viewer")
+  {
+    int planta = 0;
+    if (argc > 3)
+    {
+      try
+      {
+        planta = std::stoi(argv[3]);
+      }
+      catch(...)
+      {
+        planta = -1;
+      }
+    }
+    if (argc > 4 || planta < 0 || planta > UINT16_MAX)
+    {
+      std::cerr << "Uso: " << argv[0] << " --viewer [grupo][:porta] [planta]\n"
+                << "porta default " << SUP_BCAST_PORT << ", planta default 0\n";
+      return 1;
+    }
+    return ST_Client.viewer(argc > 2 ? argv[2] : "", uint16_t(planta));
+  }
+
   // Lanca o laco (menu) da interface
   ST_Client.main();
 
@@ -1,4 +1,5 @@
 #include <QMessageBox>
+#include <QTimer>
 #include <cmath>          // pow, round
 #include <chrono>         // std::chrono::seconds
 #include "tanques-param.h"
@@ -20,11 +21,26 @@ SupClienteQt::SupClienteQt(QWidget *parent)
   , loginWindow(new SupLogin(this))
   , statusMsg(new QLabel(this))
   , image(new SupImg(this))
+  , batch()
+  , batchClear(false)
+  , mtx_batch()
+  , dirty(false)
+  , uiState()
+  , lastRedraw()
 {
   ui->setupUi(this);
 
   // A imagem
   ui->horizontalLayout->insertWidget(0,image);
+  // Os blocos do historico do servidor exibidos com zoom no grafico
+  // sao solicitados pela thread de desenho e entregues pela thread de leitura
+  image->setHistoryFetcher([this](const SupImg::HistoryRequest& Q)
+  {
+    requestHistory(Q.level, Q.index, [img=image,Q](const SupReply& R)
+    {
+      img->addHistoryBlock(Q, R.cmd==CMD_HISTORY, R.hist);
+    });
+  });
 
   // Os titulos das secoes do supervisorio
   ui->labelActuators->setStyleSheet("background-color: white");
@@ -126,10 +142,8 @@ SupClienteQt::SupClienteQt(QWidget *parent)
           this, &SupClienteQt::slotExibirErro);
   connect(this, &SupClienteQt::signExibirInterface,
           this, &SupClienteQt::slotExibirInterface);
-  connect(this, &SupClienteQt::signStoreState,
-          this, &SupClienteQt::slotStoreState);
-  connect(this, &SupClienteQt::signClearState,
-          this, &SupClienteQt::slotClearState);
+  connect(this, &SupClienteQt::signAtuacaoConcluida,
+          this, &SupClienteQt::slotAtuacaoConcluida);
 
   // Os sinais da SupLogin
   connect(loginWindow, &SupLogin::signConectar,
@@ -146,12 +160,19 @@ SupClienteQt::SupClienteQt(QWidget *parent)
     setWindowIcon(QIcon(pixIcon));
   }
 
+  // Usa o protocolo com pipeline: os comandos de atuacao nao precisam
+  // esperar pela resposta de uma solicitacao de dados em andamento
+  setPipelined(true);
+
   // Exibe a interface
   slotExibirInterface();
 }
 
 SupClienteQt::~SupClienteQt()
 {
+  // A imagem soh eh destruida depois deste objeto: a thread de desenho
+  // nao deve mais fazer solicitacoes ao cliente
+  image->setHistoryFetcher(nullptr);
   delete ui;
 }
 
@@ -169,7 +190,13 @@ void SupClienteQt::virtExibirErro(const std::string& msg) const
 /// Reexibe interface
 void SupClienteQt::virtExibirInterface() const
 {
-  emit signExibirInterface();
+  requestRedraw();
+}
+
+/// Informa o resultado de um comando de atuacao assincrono
+void SupClienteQt::virtAtuacaoConcluida(uint16_t Cmd, uint16_t Param, bool Ok) const
+{
+  emit signAtuacaoConcluida(Cmd, Param, Ok);
 }
 
 /// As funcoes virtuais de armazenamento de dados.
@@ -181,8 +208,11 @@ void SupClienteQt::storeState(const SupState& lastS)
 {
   // Chama a funcao da classe base
   SupCliente::storeState(lastS);
-  // Acrescenta o ponto no grafico.
-  emit signStoreState(lastS);
+  // Acumula o ponto para o grafico; o ultimo ponto eh exibido no proximo redesenho.
+  // O instante eh calculado aqui, pois deltaT() muda a cada novo estado.
+  mtx_batch.lock();
+  batch.push_back(SupImg::Sample{deltaT(), lastS});
+  mtx_batch.unlock();
 }
 
 /// Limpa todos os estados armazenados da planta
@@ -190,8 +220,13 @@ void SupClienteQt::clearState()
 {
   // Chama a funcao da classe base
   SupCliente::clearState();
-  // Limpa o grafico.
-  emit signClearState();
+  // Descarta os pontos ainda nao incluidos no grafico
+  // e limpa o grafico no proximo redesenho.
+  mtx_batch.lock();
+  batch.clear();
+  batchClear = true;
+  mtx_batch.unlock();
+  requestRedraw();
 }
 
 
@@ -220,25 +255,28 @@ void SupClienteQt::on_actionQuit_triggered()
 
 void SupClienteQt::on_buttonV1_clicked(bool open)
 {
-  // Chama funcao que altera estado da valvula 1.
-  // Jah exibe msg de erro em caso de insucesso.
-  setV1Open(open);
+  // Chama funcao assincrona que altera estado da valvula 1.
+  // Nao bloqueia a interface esperando pela resposta do servidor.
+  // O resultado chega pelo sinal signAtuacaoConcluida.
+  setV1OpenAsync(open);
 }
 
 void SupClienteQt::on_buttonV2_clicked(bool open)
 {
-  // Chama funcao que altera estado da valvula 2.
-  // Jah exibe msg de erro em caso de insucesso.
-  setV2Open(open);
+  // Chama funcao assincrona que altera estado da valvula 2.
+  // Nao bloqueia a interface esperando pela resposta do servidor.
+  // O resultado chega pelo sinal signAtuacaoConcluida.
+  setV2OpenAsync(open);
 }
 
 void SupClienteQt::on_sliderPump_valueChanged(int value)
 {
-  // Chama funcao que altera entrada da bomba.
-  // Jah exibe msg de erro em caso de insucesso.
+  // Chama funcao assincrona que altera entrada da bomba.
+  // Nao bloqueia a interface esperando pela resposta do servidor.
+  // O resultado chega pelo sinal signAtuacaoConcluida.
 
   // Talvez precise tratar value, pois ele eh int, nao uint_16
-  setPumpInput(uint16_t(value));
+  setPumpInputAsync(uint16_t(value));
 
   // Exibe valores nos displays LCD
   ui->lcdPumpVal->display(value);
@@ -253,7 +291,7 @@ void SupClienteQt::on_showLevel_toggled(bool checked)
 
 void SupClienteQt::on_spinRefresh_valueChanged(int arg1)
 {
-  // Altera o intervalo entre solicitacoes de dados
+  // Altera o intervalo entre solicitacoes de dados (em milisegundos)
   setTimeRefresh(arg1);
 }
 
@@ -273,6 +311,34 @@ void SupClienteQt::slotExibirErro(const std::string& msg)
 
 void SupClienteQt::slotExibirInterface()
 {
+  // Limita a frequencia de redesenho: se o ultimo foi muito recente,
+  // o redesenho eh adiado. Enquanto isso, dirty continua true e a thread
+  // do cliente nao emite novos sinais.
+  auto now = std::chrono::steady_clock::now();
+  auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                lastRedraw + std::chrono::milliseconds(SupUIFramePeriod) - now);
+  if (wait.count() > 0)
+  {
+    QTimer::singleShot(int(wait.count()), this, &SupClienteQt::slotExibirInterface);
+    return;
+  }
+  lastRedraw = now;
+  // Os dados que chegarem a partir daqui exigem um novo redesenho
+  dirty = false;
+
+  // Inclui no grafico, de uma soh vez, os pontos recebidos desde o ultimo redesenho
+  std::vector<SupImg::Sample> points;
+  bool clr;
+  mtx_batch.lock();
+  points.swap(batch);
+  clr = batchClear;
+  batchClear = false;
+  mtx_batch.unlock();
+  if (clr) image->clear();
+  image->addPoints(points);
+  // O ultimo estado recebido, se houver um novo
+  if (!points.empty()) uiState = points.back().S;
+
   // Guarda o estado do cliente na ultima vez que foi chamada essa funcao:
   //   =0 se eh a primeira vez que a funcao eh chamada;
   //   >0 se estava conectado;
@@ -330,7 +396,7 @@ void SupClienteQt::slotExibirInterface()
     }
 
     // Exibe nos visualizadores o ultimo estado lido da planta.
-    const SupState& lastStatus = lastState();
+    const SupState& lastStatus = uiState;
     
     showValves(lastStatus.V1, lastStatus.V2);
     showPump(lastStatus.PumpInput);
@@ -348,6 +414,9 @@ void SupClienteQt::slotExibirInterface()
       // Memoriza que estah desconectado;
       estavaConectado = -1;
 
+      // Descarta o ultimo estado exibido
+      uiState = SupState();
+
       // Habilita opcao conectar
       ui->actionLogin->setEnabled(true);
       // Desabilita opcao desconectar
@@ -387,16 +456,31 @@ void SupClienteQt::slotExibirInterface()
   }
 }
 
-/// Inclui o ultimo estado atual da planta (que jah estah armazenado) na imagem
-void SupClienteQt::slotStoreState(const SupState& lastS)
+/// Trata o resultado de um comando de atuacao assincrono
+void SupClienteQt::slotAtuacaoConcluida(uint16_t Cmd, uint16_t Param, bool Ok)
 {
-  image->addPoint(deltaT(), lastS);
+  // Em caso de sucesso, nao faz nada: o novo estado serah exibido
+  // quando chegar o proximo dado do servidor.
+  if (Ok) return;
+
+  // Em caso de erro, a msg jah foi exibida pela thread de atuacao.
+  // Os widgets voltam a exibir o ultimo estado conhecido da planta,
+  // desfazendo a alteracao feita pelo usuario que nao foi aceita.
+  const SupState& lastStatus = uiState;
+  if (Cmd == CMD_SET_PUMP) showPump(lastStatus.PumpInput);
+  else showValves(lastStatus.V1, lastStatus.V2);
+  statusBar()->showMessage(QString("Command not accepted: ") +
+                           (Cmd==CMD_SET_PUMP ? "pump input " + QString::number(Param) :
+                            QString(Cmd==CMD_SET_V1 ? "valve 1 " : "valve 2 ") +
+                            (Param!=0 ? "open" : "closed")), 5000);
 }
 
-/// Limpa todos os pontos (que jah foram apagados) da imagem
-void SupClienteQt::slotClearState()
+/// Solicita um redesenho da interface.
+/// Soh emite o sinal se nao houver um redesenho pendente: varias solicitacoes
+/// entre dois redesenhos resultam em um unico redesenho.
+void SupClienteQt::requestRedraw() const
 {
-  image->clear();
+  if (!dirty.exchange(true)) emit signExibirInterface();
 }
 
 void SupClienteQt::showValves(uint16_t V1, uint16_t V2)
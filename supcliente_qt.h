@@ -6,6 +6,14 @@
 #include "supimg.h"
 #include "supcliente.h"
 #include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <chrono>
+
+/// Intervalo minimo entre dois redesenhos da interface (em milisegundos).
+/// Os dados recebidos durante este intervalo sao exibidos juntos no proximo redesenho.
+#define SupUIFramePeriod 16
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class SupClienteQt; }
@@ -26,6 +34,8 @@ private:
   void virtExibirErro(const std::string& msg) const override;
   // Redesenha toda a interface (chegada de dados, desconexao, etc)
   void virtExibirInterface() const override;
+  // Informa o resultado de um comando de atuacao assincrono
+  void virtAtuacaoConcluida(uint16_t Cmd, uint16_t Param, bool Ok) const override;
 
   // Armazena o ultimo estado atual da planta
   void storeState(const SupState& lastS) override;
@@ -45,11 +55,8 @@ signals:
   void signExibirErro(const std::string& msg) const;
   // Sinaliza a necessidade de exibir dados recebidos
   void signExibirInterface() const;
-
-  // Sinaliza a necessidade de incluir o ultimo ponto (que jah estah armazenado) na imagem
-  void signStoreState(const SupState& lastS) const;
-  // Sinaliza a necessidade de limpar todos os pontos (qhe jah foram apagados) da imagem
-  void signClearState() const;
+  // Sinaliza a conclusao de um comando de atuacao assincrono
+  void signAtuacaoConcluida(uint16_t Cmd, uint16_t Param, bool Ok) const;
 
 private slots:
   void on_actionLogin_triggered();
@@ -67,14 +74,11 @@ private slots:
   // Exibe uma janela pop-up com mensagem de erro
   void slotExibirErro(const std::string& msg);
 
-  // Redesenha a interface
+  // Redesenha a interface, exibindo os dados recebidos desde o ultimo redesenho
   void slotExibirInterface();
 
-  // Inclui o ultimo estado atual da planta (que jah estah armazenado) na imagem
-  void slotStoreState(const SupState& lastS);
-
-  // Limpa todos os pontos (que jah foram apagados) da imagem
-  void slotClearState();
+  // Trata o resultado de um comando de atuacao assincrono
+  void slotAtuacaoConcluida(uint16_t Cmd, uint16_t Param, bool Ok);
 
 // As funcoes privadas da classe
 private:
@@ -84,6 +88,9 @@ private:
   void showPump(uint16_t PInput);
   void showFlow(uint16_t Flow);
 
+  // Solicita um redesenho da interface, se jah nao houver um pendente
+  void requestRedraw() const;
+
 // Os dados privados da classe
 private:
   Ui::SupClienteQt *ui;
@@ -97,5 +104,20 @@ private:
   // A imagem para exibicao do grafico
   SupImg* image;
 
+  // Os dados recebidos pela thread do cliente e ainda nao exibidos.
+  // A thread nao emite um sinal por amostra: acumula os pontos do grafico
+  // e soh emite um sinal se nao houver um redesenho pendente (dirty==false).
+  // Os pontos para o grafico recebidos desde o ultimo redesenho (o ultimo
+  // eh o estado exibido) e se o grafico deve ser limpo antes de inclui-los
+  std::vector<SupImg::Sample> batch;
+  bool batchClear;
+  std::mutex mtx_batch;
+  // Hah um redesenho pendente
+  mutable std::atomic<bool> dirty;
+  // O ultimo estado exibido na interface
+  SupState uiState;
+  // O instante do ultimo redesenho
+  std::chrono::steady_clock::time_point lastRedraw;
+
 };
 #endif // SUPCLIENTE_QT_H
@@ -1,9 +1,65 @@
 #include <iostream>
+#include <sstream>
+#include <fstream>
+#include <future>
 #include <cmath>      /* round */
+#include <iomanip>    /* setprecision */
+#include <charconv>   /* to_chars */
+#include <cstring>    /* memcpy */
+#include <thread>     /* sleep_for */
+#include "tanques-param.h"
 #include "supcliente_term.h"
 
+/// Descomente o bloco a seguir para compilar no Windows
+
+///*
+
+#include <windows.h>
+
+#include <io.h>
+#include <fcntl.h>
+
+/// Habilita o processamento das sequencias de escape ANSI no console
+static void enableAnsi()
+{
+  HANDLE h = GetStdHandle(STD_OUTPUT_HANDLE);
+  DWORD mode = 0;
+  if (h != INVALID_HANDLE_VALUE && GetConsoleMode(h, &mode))
+  {
+    SetConsoleMode(h, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+  }
+}
+
+/// Coloca a saida padrao em modo binario (sem conversao de '\n' em "\r\n")
+static void binaryStdout()
+{
+  _setmode(_fileno(stdout), _O_BINARY);
+}
+
+//*/
+
+/// Descomente o bloco a seguir para compilar no Linux
+
+/*
+
+/// Os terminais do Linux jah processam as sequencias de escape ANSI
+static void enableAnsi()
+{
+}
+
+/// No Linux, a saida padrao nao tem modo texto
+static void binaryStdout()
+{
+}
+
+*/
+
 using namespace std;
 
+/// Os caracteres das sparklines, do nivel mais baixo ao mais alto
+static const char sparkChars[] = " .:-=+*#%@";
+static const int numSparkChars = sizeof(sparkChars)-1;
+
 void SupClienteTerm::main()
 {
   // Parametros da conexao com servidor
@@ -11,6 +67,7 @@ void SupClienteTerm::main()
   // Variaveis auxiliares para entrada de dados
   string ST;
   uint16_t input; // Entrada da bomba: 0 a 65535
+  int periodo;    // Periodo de amostragem (em ms)
   double perc;    // Entrada % da bomba: 0 a 100.0
   int opcao;
   bool opcaoValida;
@@ -31,12 +88,20 @@ void SupClienteTerm::main()
     {
       cout << "NAO CONECTADO\n";
       cout << " 1 - Conectar cliente ao servidor\n";
+      cout << " 2 - Protocolo com pipeline: " << (isPipelined() ? "SIM" : "NAO")
+           << " (alternar)\n";
       cout << "=================\n";
     }
     else // Cliente estah conectado
     {
       cout << "USUARIO: " << meuUsuario << endl;
       cout << "11 - Alterar o periodo de amostragem dos dados\n";
+      cout << "12 - Painel de monitoramento (tela cheia)\n";
+      if (isPipelined())
+      {
+        cout << "13 - Previsao dos niveis\n";
+        cout << "14 - Varredura da entrada da bomba\n";
+      }
       if (isAdmin())
       {
         cout << "=================\n";
@@ -45,6 +110,7 @@ void SupClienteTerm::main()
         cout << "23 - Abrir a valvula do tanque 2\n";
         cout << "24 - Fechar a valvula do tanque 1\n";
         cout << "25 - Fechar a valvula do tanque 2\n";
+        cout << "26 - Controlador de nivel do servidor\n";
       }
       cout << "=================\n";
       cout << "98 - Desconectar cliente do servidor\n";
@@ -74,14 +140,15 @@ void SupClienteTerm::main()
       if (opcao==99) continue;
       if (!isConnected())
       {
-        if (opcao==1) continue;
+        if (opcao==1 || opcao==2) continue;
       }
       else // Estah conectado
       {
         // Opcoes validas quando estah conectado
-        if (opcao==11 || opcao==98) continue;
+        if (opcao==11 || opcao==12 || opcao==98) continue;
+        if ((opcao==13 || opcao==14) && isPipelined()) continue;
         // Opcoes validas quando estah conectado como administrador
-        if (isAdmin() && opcao>=21 && opcao<=25) continue;
+        if (isAdmin() && opcao>=21 && opcao<=26) continue;
       }
       // Opcao invalida
       opcaoValida = false;
@@ -114,22 +181,39 @@ void SupClienteTerm::main()
       // Jah reexibe interface em qualquer caso e exibe msg em caso de erro
       conectar(IP, Login, Senha);
       break;
+    case 2:
+      // Alterna entre o protocolo com pipeline e um comando por vez
+      setPipelined(!isPipelined());
+      break;
     case 11:
       do
       {
-        cout << "Periodo de amostragem (em s) [10 a 200]: ";
+        cout << "Periodo de amostragem (em ms) [" << SUP_MIN_REFRESH
+             << " a " << SUP_MAX_REFRESH << "]: ";
         getline(cin,ST);
         try
         {
-          input = stoi(ST);
+          periodo = stoi(ST);
         }
         catch(...)
         {
-          input = 0;
+          periodo = 0;
         }
       }
-      while (input<20 || input>200);
-      setTimeRefresh(input);
+      while (periodo<SUP_MIN_REFRESH || periodo>SUP_MAX_REFRESH);
+      setTimeRefresh(periodo);
+      break;
+    case 12:
+      // Retorna quando o usuario teclar ENTER
+      dashboard();
+      break;
+    case 13:
+      // Jah exibe msg em caso de erro
+      whatIf();
+      break;
+    case 14:
+      // Jah exibe msg em caso de erro
+      sweep();
       break;
     case 21:
       do
@@ -166,6 +250,10 @@ void SupClienteTerm::main()
       // Jah exibe msg em caso de erro
       setV2Open(false);
       break;
+    case 26:
+      // Jah exibe msg em caso de erro
+      levelControl();
+      break;
     case 98:
     case 99:
       desconectar();
@@ -180,12 +268,196 @@ void SupClienteTerm::main()
   while (opcao!=99);
 }
 
+/// Funcoes auxiliares para as perguntas da previsao e da varredura.
+/// Repetem a pergunta ateh que a resposta seja um numero entre Min e Max.
+static double perguntarReal(const char* Texto, double Min, double Max)
+{
+  string ST;
+  double x;
+  do
+  {
+    cout << Texto << " [" << Min << " a " << Max << "]: ";
+    getline(cin,ST);
+    try
+    {
+      x = stod(ST);
+    }
+    catch(...)
+    {
+      x = Min-1.0;
+    }
+  }
+  while (x<Min || x>Max);
+  return x;
+}
+/// Resposta sim (true) ou nao (false)
+static bool perguntarSimNao(const char* Texto)
+{
+  string ST;
+  cout << Texto << " [s/n]: ";
+  getline(cin,ST);
+  return (!ST.empty() && (ST[0]=='s' || ST[0]=='S'));
+}
+
+/// Espera pela resposta de uma previsao ou varredura, que soh eh enviada
+/// quando a simulacao termina. Retorna false em caso de erro (jah exibido).
+bool SupClienteTerm::esperarPrevisao(std::future<SupReply>& F, uint16_t Cmd, SupReply& R) const
+{
+  if (F.wait_for(chrono::seconds(SUP_TERM_WHATIF_WAIT)) != future_status::ready)
+  {
+    virtExibirErro("Resposta nao recebida do servidor");
+    return false;
+  }
+  R = F.get();
+  if (R.cmd != Cmd)
+  {
+    virtExibirErro("Erro na simulacao no servidor");
+    return false;
+  }
+  return true;
+}
+
+/// A previsao da evolucao dos niveis: as atuacoes previstas sao executadas
+/// no inicio da simulacao (instante 0), em uma copia dos tanques no servidor.
+/// Os niveis da tabela sao os reais, sem o ruido dos sensores.
+void SupClienteTerm::whatIf()
+{
+  const double perc = perguntarReal("Entrada % da bomba", 0.0, 100.0);
+  const bool v1 = perguntarSimNao("Valvula 1 aberta");
+  const bool v2 = perguntarSimNao("Valvula 2 aberta");
+  const int minutos = int(perguntarReal("Horizonte (em minutos)", 1, 1000));
+
+  // Um ponto a cada "periodo" segundos, no maximo SUP_TERM_WHATIF_ROWS pontos
+  const unsigned horizonte = 60*unsigned(minutos);
+  const unsigned periodo = (horizonte + SUP_TERM_WHATIF_ROWS-2)/(SUP_TERM_WHATIF_ROWS-1);
+  vector<uint16_t> Ev = {0, CMD_SET_PUMP, uint16_t(round(UINT16_MAX*perc/100.0)),
+                         0, CMD_SET_V1, uint16_t(v1 ? 1 : 0),
+                         0, CMD_SET_V2, uint16_t(v2 ? 1 : 0)};
+  future<SupReply> F = requestWhatIf(uint16_t(horizonte), uint16_t(periodo), Ev);
+  SupReply R;
+  if (!esperarPrevisao(F, CMD_WHATIF_RESULT, R)) return;
+
+  cout << "\n=================\n";
+  cout << "   t(s)  H1(cm)  H2(cm)  V1 V2 TRANSB\n";
+  for (size_t i=0; i+SUP_WHATIF_POINT_LEN<=R.points.size(); i+=SUP_WHATIF_POINT_LEN)
+  {
+    const uint16_t* P = R.points.data() + i;
+    cout << setw(7) << (i/SUP_WHATIF_POINT_LEN)*R.period
+         << fixed << setprecision(1) << setw(8) << (100.0*MaxTankLevelMeasurement*P[0])/UINT16_MAX
+         << setw(8) << (100.0*MaxTankLevelMeasurement*P[1])/UINT16_MAX
+         << setw(4) << ((P[2] & 1) ? 'A' : 'F') << setw(3) << ((P[2] & 2) ? 'A' : 'F')
+         << setw(7) << ((P[2] & 4) ? "SIM" : "NAO") << endl;
+  }
+  cout << "=================\n";
+}
+
+/// A varredura da entrada da bomba: simula valores igualmente espacados da
+/// entrada da bomba, com as valvulas abertas ou fechadas durante todo o
+/// horizonte, e imprime quando cada um atinge o nivel alvo e se transborda
+void SupClienteTerm::sweep()
+{
+  SupSweep W;
+  W.tank = uint16_t(perguntarReal("Tanque do nivel alvo", 1, 2));
+  const double alvo = perguntarReal("Nivel alvo (em cm)", 0.0, 100.0*MaxTankLevelMeasurement);
+  W.level = uint16_t(round(UINT16_MAX*alvo/(100.0*MaxTankLevelMeasurement)));
+  W.horizon = uint16_t(60*int(perguntarReal("Horizonte (em minutos)", 1, 1000)));
+  const double perc1 = perguntarReal("Entrada % da bomba inicial", 0.0, 100.0);
+  const double perc2 = perguntarReal("Entrada % da bomba final", perc1, 100.0);
+  W.pump_count = uint16_t(perguntarReal("Numero de valores da bomba", (perc2>perc1 ? 2 : 1),
+                                        (perc2>perc1 ? SUP_SWEEP_MAX_CANDIDATES : 1)));
+  W.pump_first = uint16_t(round(UINT16_MAX*perc1/100.0));
+  if (W.pump_count > 1)
+  {
+    W.pump_step = uint16_t(floor(UINT16_MAX*(perc2-perc1)/100.0/(W.pump_count-1)));
+  }
+  // Valvula aberta no instante 0 ou nunca aberta
+  W.v1_first = (perguntarSimNao("Valvula 1 aberta") ? 0 : W.horizon);
+  W.v2_first = (perguntarSimNao("Valvula 2 aberta") ? 0 : W.horizon);
+
+  future<SupReply> F = requestSweep(W);
+  SupReply R;
+  if (!esperarPrevisao(F, CMD_SWEEP_RESULT, R)) return;
+
+  cout << "\n=================\n";
+  cout << " BOMBA(%)  ALVO(s) TRANSB(s)  H1(cm)  H2(cm)\n";
+  for (size_t k=0; (k+1)*SUP_SWEEP_SUMMARY_LEN<=R.sweep.size(); ++k)
+  {
+    const uint16_t* P = R.sweep.data() + SUP_SWEEP_SUMMARY_LEN*k;
+    uint16_t pump, t1, t2;
+    W.candidate(k, pump, t1, t2);
+    cout << fixed << setprecision(1) << setw(9) << (100.0*pump)/UINT16_MAX;
+    if (P[0] == SUP_SWEEP_NEVER) cout << setw(9) << "-";
+    else cout << setw(9) << P[0];
+    if (P[1] == SUP_SWEEP_NEVER) cout << setw(10) << "-";
+    else cout << setw(10) << P[1];
+    cout << setw(8) << (100.0*MaxTankLevelMeasurement*P[2])/UINT16_MAX
+         << setw(8) << (100.0*MaxTankLevelMeasurement*P[3])/UINT16_MAX << endl;
+  }
+  cout << "=================\n";
+}
+
+/// O controlador de nivel do servidor.
+/// O nivel desejado e os ganhos sao enviados antes do comando que liga o
+/// controlador, que parte sem salto na entrada atual da bomba.
+void SupClienteTerm::levelControl()
+{
+  // A configuracao atual, que soh pode ser consultada no modo com pipeline
+  if (isPipelined())
+  {
+    future<SupReply> F = requestPID();
+    SupReply R;
+    if (F.wait_for(chrono::seconds(SUP_TIMEOUT)) == future_status::ready) R = F.get();
+    if (R.cmd == CMD_PID && R.pid.size() == SUP_PID_FRAME_LEN)
+    {
+      cout << "\n=================\n";
+      if (R.pid[0] == 0) cout << "Controlador desligado\n";
+      else cout << "Controlando o nivel do tanque " << R.pid[0] << ": "
+                << fixed << setprecision(1) << (100.0*MaxTankLevelMeasurement*R.pid[1])/UINT16_MAX << " cm\n";
+      cout << setprecision(3) << "kp=" << double(R.pid[2])/SUP_PID_GAIN_SCALE
+           << " ki=" << double(R.pid[3])/SUP_PID_GAIN_SCALE
+           << " kd=" << double(R.pid[4])/SUP_PID_GAIN_SCALE
+           << " kt=" << double(R.pid[5])/SUP_PID_GAIN_SCALE << endl;
+      cout << "Entrada % da bomba: " << setprecision(1) << (100.0*R.pid[6])/UINT16_MAX << endl;
+      cout << "=================\n";
+    }
+  }
+
+  const uint16_t tanque = uint16_t(perguntarReal("Tanque controlado (0 para desligar)", 0, 2));
+  if (tanque != 0)
+  {
+    const double maxK = double(UINT16_MAX)/SUP_PID_GAIN_SCALE;
+    const double alvo = perguntarReal("Nivel desejado (em cm)", 0.0, 100.0*MaxTankLevelMeasurement);
+    const uint16_t P[5] = {uint16_t(round(UINT16_MAX*alvo/(100.0*MaxTankLevelMeasurement))),
+                           uint16_t(round(SUP_PID_GAIN_SCALE*perguntarReal("Ganho proporcional kp", 0.0, maxK))),
+                           uint16_t(round(SUP_PID_GAIN_SCALE*perguntarReal("Ganho integral ki (por s)", 0.0, maxK))),
+                           uint16_t(round(SUP_PID_GAIN_SCALE*perguntarReal("Ganho derivativo kd (em s)", 0.0, maxK))),
+                           uint16_t(round(SUP_PID_GAIN_SCALE*perguntarReal("Ganho do anti-windup kt (por s)", 0.0, maxK)))};
+    // CMD_SET_PID_SP, CMD_SET_PID_KP, ..., CMD_SET_PID_KT
+    for (int i=0; i<5; ++i)
+    {
+      if (!setLevelControl(uint16_t(CMD_SET_PID_SP+i), P[i])) return;
+    }
+  }
+  // Jah exibe msg em caso de erro
+  setLevelControl(CMD_SET_PID, tanque);
+}
+
 /// As funcoes virtuais de exibicao de dados que sao chamadas pela thread.
 /// Imprime mensagem de texto no console.
 
 /// Exibe informacao de erro
 void SupClienteTerm::virtExibirErro(const std::string& msg) const
 {
+  // No painel, a mensagem eh exibida em uma linha da tela
+  {
+    lock_guard<mutex> lock(mtx_screen);
+    if (dash_on)
+    {
+      dash_msg = msg;
+      dashboardRedraw();
+      return;
+    }
+  }
   cerr << "\n=================\n";
   cerr << msg;
   cerr << "\n=================\n";
@@ -194,14 +466,544 @@ void SupClienteTerm::virtExibirErro(const std::string& msg) const
 /// Reexibe a interface
 void SupClienteTerm::virtExibirInterface() const
 {
+  // No modo de saida continua, a saida padrao soh contem os registros,
+  // e no modo de execucao em lote, o relatorio do script
+  if (stream_fmt != SupStreamFormat::NONE || script_on) return;
+  // No painel, soh redesenha o que mudou
+  {
+    lock_guard<mutex> lock(mtx_screen);
+    if (dash_on)
+    {
+      dashboardRedraw();
+      return;
+    }
+  }
   if (!isConnected())
   {
     cout << "\nNAO CONECTADO";
   }
   else
   {
-    cout << "\nt=" << deltaT() << " segundos\n";
+    cout << "\nt=" << fixed << setprecision(3) << deltaT() << " segundos"
+         << " (amostra " << lastState().seq << ", perdidas " << missedSamples() << ")\n";
     lastState().print();
   }
   cout << endl;
 }
+
+/// Armazena o ultimo estado atual da planta
+void SupClienteTerm::storeState(const SupState& lastS)
+{
+  // Chama a funcao da classe base
+  SupCliente::storeState(lastS);
+  // No modo de saida continua, escreve o registro
+  if (stream_fmt != SupStreamFormat::NONE)
+  {
+    cout.write(streamBuf, formatRecord(lastS));
+    cout.flush();
+    if (!cout) stream_fail = true;
+    return;
+  }
+  // Guarda os niveis para as sparklines
+  lock_guard<mutex> lock(mtx_screen);
+  sparkH1.push_back(lastS.H1);
+  sparkH2.push_back(lastS.H2);
+  if (sparkH1.size() > SUP_TERM_SPARK_LEN) sparkH1.pop_front();
+  if (sparkH2.size() > SUP_TERM_SPARK_LEN) sparkH2.pop_front();
+}
+
+/// Limpa todos os estados armazenados da planta
+void SupClienteTerm::clearState()
+{
+  // Chama a funcao da classe base
+  SupCliente::clearState();
+  // Limpa as sparklines
+  lock_guard<mutex> lock(mtx_screen);
+  sparkH1.clear();
+  sparkH2.clear();
+}
+
+/// O painel de monitoramento em tela cheia
+void SupClienteTerm::dashboard()
+{
+  string ST;
+
+  enableAnsi();
+  {
+    lock_guard<mutex> lock(mtx_screen);
+    dash_on = true;
+    dash_msg.clear();
+    // Limpa o terminal e esconde o cursor.
+    // A tela vazia faz o primeiro redesenho enviar todas as linhas.
+    cout << "\x1b[2J\x1b[?25l" << flush;
+    screen.clear();
+    dashboardRedraw();
+  }
+  // Os redesenhos seguintes sao feitos pela thread, a cada dado recebido
+  getline(cin,ST);
+  {
+    lock_guard<mutex> lock(mtx_screen);
+    dash_on = false;
+    // Limpa o terminal e volta a exibir o cursor
+    cout << "\x1b[2J\x1b[H\x1b[?25h" << flush;
+    screen.clear();
+  }
+}
+
+/// Monta a tela do painel
+std::vector<std::string> SupClienteTerm::dashboardFrame() const
+{
+  vector<string> F;
+  ostringstream L;
+
+  // Acrescenta a linha atual, completada com espacos ateh SUP_TERM_COLS
+  auto endLine = [&F,&L]()
+  {
+    string S = L.str();
+    S.resize(SUP_TERM_COLS, ' ');
+    F.push_back(S);
+    L.str("");
+  };
+  // Uma sparkline com as ultimas amostras de um nivel
+  auto sparkline = [](const deque<uint16_t>& H) -> string
+  {
+    string S(SUP_TERM_SPARK_LEN, ' ');
+    size_t i0 = SUP_TERM_SPARK_LEN - H.size();
+    for (size_t i=0; i<H.size(); ++i)
+    {
+      S[i0+i] = sparkChars[(H[i]*(numSparkChars-1) + UINT16_MAX/2)/UINT16_MAX];
+    }
+    return S;
+  };
+
+  L << fixed;
+  L << " SUPTANQUES - PAINEL DE MONITORAMENTO";
+  endLine();
+  L << string(SUP_TERM_COLS-2, '=');
+  endLine();
+  if (!isConnected())
+  {
+    L << " NAO CONECTADO";
+    endLine();
+  }
+  else
+  {
+    const SupState& S = lastState();
+    L << " Usuario: " << meuUsuario << (isAdmin() ? " (admin)" : " (viewer)")
+      << "   t=" << setprecision(1) << setw(9) << deltaT() << " s"
+      << "   amostra " << S.seq << ", perdidas " << missedSamples();
+    endLine();
+    endLine();
+    L << " H1 " << setprecision(1) << setw(5) << (100.0*MaxTankLevelMeasurement*S.H1)/UINT16_MAX
+      << " cm |" << sparkline(sparkH1) << '|';
+    endLine();
+    L << " H2 " << setprecision(1) << setw(5) << (100.0*MaxTankLevelMeasurement*S.H2)/UINT16_MAX
+      << " cm |" << sparkline(sparkH2) << '|';
+    endLine();
+    endLine();
+    L << " V1 " << (S.V1!=0 ? "ABERTA " : "FECHADA")
+      << "   V2 " << (S.V2!=0 ? "ABERTA " : "FECHADA")
+      << "   Bomba " << setprecision(0) << setw(3) << (100.0*S.PumpInput)/UINT16_MAX << '%'
+      << "   Vazao " << setprecision(1) << setw(4)
+      << (60000.0*MaxPumpFlowMeasurement*S.PumpFlow)/UINT16_MAX << " l/min"
+      << (S.ovfl!=0 ? "   OVERFLOW" : "");
+    endLine();
+  }
+  L << string(SUP_TERM_COLS-2, '=');
+  endLine();
+  L << ' ' << dash_msg.substr(0, SUP_TERM_COLS-2);
+  endLine();
+  L << " Tecle ENTER para " << (isViewer() ? "sair" : "voltar ao menu");
+  endLine();
+  return F;
+}
+
+/// Envia ao terminal as diferencas entre a tela anterior e a nova.
+/// Em cada linha, soh o trecho entre o primeiro e o ultimo caractere
+/// alterados eh reenviado, precedido do posicionamento do cursor.
+void SupClienteTerm::dashboardRedraw() const
+{
+  vector<string> F = dashboardFrame();
+  ostringstream out;
+  bool changed = false;
+
+  // A tela anterior pode ter mais linhas (por exemplo, ao desconectar)
+  size_t nRows = max(F.size(), screen.size());
+  F.resize(nRows, string(SUP_TERM_COLS, ' '));
+  screen.resize(nRows, string());
+  for (size_t r=0; r<nRows; ++r)
+  {
+    const string& Old = screen[r];
+    const string& New = F[r];
+    // Uma linha que nao estava na tela eh enviada inteira
+    size_t c0 = 0, c1 = New.size();
+    if (Old.size() == New.size())
+    {
+      while (c0<c1 && Old[c0]==New[c0]) ++c0;
+      while (c1>c0 && Old[c1-1]==New[c1-1]) --c1;
+    }
+    if (c0 == c1) continue;
+    changed = true;
+    // As linhas e colunas do terminal comecam em 1
+    out << "\x1b[" << r+1 << ';' << c0+1 << 'H' << New.substr(c0, c1-c0);
+  }
+  screen.swap(F);
+  if (!changed) return;
+  // O cursor fica abaixo do painel, onde o ENTER serah ecoado
+  out << "\x1b[" << nRows+1 << ";1H";
+  // Uma unica escrita por redesenho
+  cout << out.str() << flush;
+}
+
+/// Modo de saida continua, nao interativo
+int SupClienteTerm::stream(SupStreamFormat F, const std::string& IP,
+                           const std::string& Login, const std::string& Senha,
+                           int Periodo)
+{
+  if (F == SupStreamFormat::NONE) return 1;
+  stream_fmt = F;
+  stream_fail = false;
+  if (F == SupStreamFormat::BINARY) binaryStdout();
+  // O cabecalho do CSV
+  if (F == SupStreamFormat::CSV)
+  {
+    cout << "seq,t_us,V1,V2,H1,H2,PumpInput,PumpFlow,ovfl\n" << flush;
+  }
+
+  // Em caso de erro, a msg jah foi exibida (em cerr)
+  conectar(IP, Login, Senha);
+  if (!isConnected())
+  {
+    stream_fmt = SupStreamFormat::NONE;
+    return 1;
+  }
+  setTimeRefresh(Periodo);
+
+  // Os registros sao escritos pela thread, a cada estado recebido.
+  // Termina quando o servidor desconectar ou a saida padrao for fechada.
+  while (isConnected() && !stream_fail)
+  {
+    this_thread::sleep_for(chrono::milliseconds(100));
+  }
+  bool fail = stream_fail;
+  desconectar();
+  join_if_joinable();
+  stream_fmt = SupStreamFormat::NONE;
+  return (fail ? 1 : 0);
+}
+
+/// Modo visualizador, nao interativo
+int SupClienteTerm::viewer(const std::string& Endereco, uint16_t Planta)
+{
+  // Em caso de erro, a msg jah foi exibida (em cerr)
+  conectarViewer(Endereco, Planta);
+  if (!isConnected()) return 1;
+  // Os redesenhos sao feitos pela thread, a cada estado recebido
+  dashboard();
+  desconectar();
+  return 0;
+}
+
+/// Formata um estado no buffer de saida.
+/// Usa apenas o buffer preexistente: nenhuma alocacao de memoria por registro.
+size_t SupClienteTerm::formatRecord(const SupState& S)
+{
+  // Os campos, na mesma ordem do cabecalho do CSV
+  static const char* names[] = {"seq","t_us","V1","V2","H1","H2","PumpInput","PumpFlow","ovfl"};
+  const uint64_t values[] = {S.seq, S.t_us, S.V1, S.V2, S.H1, S.H2, S.PumpInput, S.PumpFlow, S.ovfl};
+  const size_t nFields = sizeof(values)/sizeof(values[0]);
+
+  char* p = streamBuf;
+  char* const end = streamBuf + sizeof(streamBuf);
+  // Acrescenta um texto e um numero ao buffer
+  auto text = [&p](const char* T)
+  {
+    while (*T != '\0') *p++ = *T++;
+  };
+  auto number = [&p,end](uint64_t V)
+  {
+    p = to_chars(p, end, V).ptr;
+  };
+
+  switch (stream_fmt)
+  {
+  case SupStreamFormat::CSV:
+    for (size_t i=0; i<nFields; ++i)
+    {
+      if (i > 0) *p++ = ',';
+      number(values[i]);
+    }
+    *p++ = '\n';
+    break;
+  case SupStreamFormat::JSONL:
+    for (size_t i=0; i<nFields; ++i)
+    {
+      text(i==0 ? "{\"" : ",\"");
+      text(names[i]);
+      text("\":");
+      number(values[i]);
+    }
+    text("}\n");
+    break;
+  case SupStreamFormat::BINARY:
+    {
+      uint16_t frame[SUP_DATA_EXT_FRAME_LEN];
+      S.toFrameExt(frame);
+      memcpy(p, frame, sizeof(frame));
+      p += sizeof(frame);
+    }
+    break;
+  default:
+    break;
+  }
+  return p - streamBuf;
+}
+
+/// Leh e valida o script do modo de execucao em lote
+bool SupClienteTerm::parseScript(const std::string& Arquivo, std::vector<ScriptCmd>& Cmds)
+{
+  ifstream arq(Arquivo);
+  if (!arq.is_open())
+  {
+    cerr << "Erro na abertura do script " << Arquivo << endl;
+    return false;
+  }
+
+  string linha;
+  int nLinha = 0;
+  Cmds.clear();
+  while (getline(arq, linha))
+  {
+    ++nLinha;
+    // Descarta o comentario e o '\r' final, caso o arquivo venha do Windows
+    size_t pos = linha.find('#');
+    if (pos != string::npos) linha.erase(pos);
+    if (!linha.empty() && linha.back()=='\r') linha.pop_back();
+
+    istringstream iss(linha);
+    string nome, arg;
+    if (!(iss >> nome)) continue; // Linha vazia
+
+    ScriptCmd C;
+    C.line = nLinha;
+    C.text = linha.substr(linha.find_first_not_of(" \t"));
+    C.text.erase(C.text.find_last_not_of(" \t")+1);
+    bool valido = false;
+    if (nome == "pump")
+    {
+      double perc;
+      if (iss >> perc && perc>=0.0 && perc<=100.0)
+      {
+        C.type = ScriptCmd::Type::ACTUATE;
+        C.cmd = CMD_SET_PUMP;
+        C.param = round(UINT16_MAX*perc/100.0);
+        valido = true;
+      }
+    }
+    else if (nome == "v1" || nome == "v2")
+    {
+      if (iss >> arg && (arg == "open" || arg == "close"))
+      {
+        C.type = ScriptCmd::Type::ACTUATE;
+        C.cmd = (nome == "v1" ? CMD_SET_V1 : CMD_SET_V2);
+        C.param = (arg == "open" ? 1 : 0);
+        valido = true;
+      }
+    }
+    else if (nome == "wait")
+    {
+      if (iss >> C.ms && C.ms >= 0)
+      {
+        C.type = ScriptCmd::Type::WAIT;
+        valido = true;
+      }
+    }
+    else if (nome == "expect")
+    {
+      if (iss >> arg && (arg == "h1" || arg == "h2") &&
+          iss >> C.op && (C.op == "<" || C.op == "<=" || C.op == ">" || C.op == ">=") &&
+          iss >> C.value)
+      {
+        C.type = ScriptCmd::Type::EXPECT;
+        C.tank = (arg == "h1" ? 1 : 2);
+        // O timeout eh opcional
+        if (iss >> C.ms) valido = (C.ms >= 0);
+        else
+        {
+          valido = iss.eof();
+          C.ms = 0;
+        }
+      }
+    }
+    // Nao pode haver nada apos os argumentos
+    if (valido && !iss.eof())
+    {
+      iss >> arg;
+      if (!iss.fail()) valido = false;
+    }
+    if (!valido)
+    {
+      cerr << "Script " << Arquivo << ", linha " << nLinha << ": comando invalido: " << C.text << endl;
+      return false;
+    }
+    Cmds.push_back(C);
+  }
+  return true;
+}
+
+/// Modo de execucao em lote, nao interativo
+int SupClienteTerm::script(const std::string& Arquivo, const std::string& IP,
+                           const std::string& Login, const std::string& Senha)
+{
+  typedef chrono::steady_clock clk;
+
+  // Valida todo o script antes de conectar
+  vector<ScriptCmd> Cmds;
+  if (!parseScript(Arquivo, Cmds)) return 1;
+
+  // As atuacoes sao enviadas sem esperar pelas respostas de outras
+  script_on = true;
+  setPipelined(true);
+  // Em caso de erro, a msg jah foi exibida (em cerr)
+  conectar(IP, Login, Senha);
+  if (!isConnected())
+  {
+    script_on = false;
+    return 1;
+  }
+  // Os estados sao lidos pelo script; a thread de solicitacao de dados
+  // nao precisa fazer leituras periodicas
+  setTimeRefresh(SUP_MAX_REFRESH);
+
+  // O inicio da execucao e o tempo gasto em esperas e verificacoes
+  // aguardando a planta, que nao eh sobrecarga do cliente
+  const clk::time_point t0 = clk::now();
+  double tPlanta = 0.0;
+  int nAtuacoes = 0, nVerificacoes = 0, nLeituras = 0;
+  bool ok = true;
+  // O instante atual em ms, a partir do inicio da execucao
+  auto agora = [t0]() -> double
+  {
+    return chrono::duration<double,milli>(clk::now()-t0).count();
+  };
+  // Imprime uma linha do relatorio
+  auto relatorio = [&agora](const ScriptCmd& C, const string& Msg)
+  {
+    cout << '[' << setw(10) << agora() << " ms] linha " << C.line
+         << ": " << C.text << " -> " << Msg << endl;
+  };
+  // As atuacoes enviadas que aguardam resposta
+  vector<pair<const ScriptCmd*, future<SupReply>>> pendentes;
+  // Confere as respostas das atuacoes enviadas
+  auto confere = [&pendentes,&relatorio]() -> bool
+  {
+    bool todas = true;
+    for (auto& P : pendentes)
+    {
+      if (P.second.wait_for(chrono::seconds(SUP_TIMEOUT)) != future_status::ready ||
+          P.second.get().cmd != CMD_OK)
+      {
+        relatorio(*P.first, "FALHOU (atuacao nao confirmada)");
+        todas = false;
+      }
+    }
+    pendentes.clear();
+    return todas;
+  };
+
+  cout << fixed << setprecision(3);
+  for (const ScriptCmd& C : Cmds)
+  {
+    if (!ok || !isConnected()) break;
+    switch (C.type)
+    {
+    case ScriptCmd::Type::ACTUATE:
+      pendentes.emplace_back(&C, requestActuation(C.cmd, C.param));
+      ++nAtuacoes;
+      relatorio(C, "enviado");
+      break;
+    case ScriptCmd::Type::WAIT:
+      {
+        double t = agora();
+        this_thread::sleep_for(chrono::milliseconds(C.ms));
+        tPlanta += agora()-t;
+        relatorio(C, "OK");
+      }
+      break;
+    case ScriptCmd::Type::EXPECT:
+      {
+        ++nVerificacoes;
+        // O estado deve refletir todas as atuacoes anteriores
+        if (!confere())
+        {
+          ok = false;
+          break;
+        }
+        const double limite = agora() + C.ms;
+        while (true)
+        {
+          future<SupReply> F = requestState();
+          if (F.wait_for(chrono::seconds(SUP_TIMEOUT)) != future_status::ready)
+          {
+            relatorio(C, "FALHOU (sem resposta do servidor)");
+            ok = false;
+            break;
+          }
+          SupReply R = F.get();
+          if (R.cmd != CMD_DATA_EXT)
+          {
+            relatorio(C, "FALHOU (erro na leitura do estado)");
+            ok = false;
+            break;
+          }
+          ++nLeituras;
+          double h = (100.0*MaxTankLevelMeasurement*(C.tank==1 ? R.S.H1 : R.S.H2))/UINT16_MAX;
+          bool cond = (C.op == "<" ? h < C.value :
+                       C.op == "<=" ? h <= C.value :
+                       C.op == ">" ? h > C.value : h >= C.value);
+          ostringstream msg;
+          msg << fixed << setprecision(1) << "h" << C.tank << '=' << h << " cm";
+          if (cond)
+          {
+            relatorio(C, "OK (" + msg.str() + ")");
+            break;
+          }
+          if (agora() >= limite)
+          {
+            relatorio(C, "FALHOU (" + msg.str() + ")");
+            ok = false;
+            break;
+          }
+          // Espera a planta evoluir antes da proxima leitura
+          double t = agora();
+          this_thread::sleep_for(chrono::milliseconds(SUP_TERM_SCRIPT_POLL));
+          tPlanta += agora()-t;
+        }
+      }
+      break;
+    }
+  }
+  // Confere as respostas das ultimas atuacoes
+  if (!confere()) ok = false;
+  if (ok && !isConnected())
+  {
+    cerr << "Conexao perdida durante o script\n";
+    ok = false;
+  }
+  const double tTotal = agora();
+
+  // O relatorio dos tempos
+  cout << "=================\n";
+  cout << "Script " << Arquivo << (ok ? ": OK\n" : ": FALHOU\n");
+  cout << Cmds.size() << " comandos, " << nAtuacoes << " atuacoes, "
+       << nVerificacoes << " verificacoes (" << nLeituras << " leituras do estado)\n";
+  cout << "Tempo total: " << tTotal << " ms\n";
+  cout << "Esperando pela planta: " << tPlanta << " ms\n";
+  cout << "Sobrecarga (comunicacao e processamento): " << tTotal-tPlanta << " ms\n";
+  cout << defaultfloat;
+
+  desconectar();
+  join_if_joinable();
+  script_on = false;
+  return (ok ? 0 : 2);
+}
@@ -1,8 +1,44 @@
 #ifndef _SUP_CLIENT_TERM_H_
 #define _SUP_CLIENT_TERM_H_
 
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <string>
+#include <atomic>
 #include "supcliente.h"
 
+/// Largura da tela do painel de monitoramento (caracteres)
+#define SUP_TERM_COLS 80
+/// Numero de amostras exibidas nas sparklines do painel
+#define SUP_TERM_SPARK_LEN 60
+
+/// Tamanho do buffer de formatacao de um registro no modo de saida continua
+#define SUP_TERM_RECORD_LEN 512
+
+/// Intervalo entre leituras do estado enquanto uma verificacao
+/// do modo de execucao em lote aguarda a condicao (em milisegundos)
+#define SUP_TERM_SCRIPT_POLL 10
+
+/// Numero maximo de linhas da tabela da previsao dos niveis
+#define SUP_TERM_WHATIF_ROWS 31
+/// Tempo maximo de espera (em segundos) pela resposta de uma previsao ou varredura
+#define SUP_TERM_WHATIF_WAIT 60
+
+/// Os formatos do modo de saida continua (stream)
+/// CSV: uma linha por estado, com cabecalho
+/// JSONL: um objeto JSON por linha
+/// BINARY: o quadro da resposta CMD_DATA_EXT (SUP_DATA_EXT_FRAME_LEN uint16_t,
+///         na ordem de bytes do computador)
+/// Em todos os formatos, os valores sao os brutos do protocolo (sem conversao de unidades).
+enum class SupStreamFormat
+{
+  NONE,
+  CSV,
+  JSONL,
+  BINARY
+};
+
 /* *******************************
    * CLASS SUPCLIENTE_TERM     *
    ******************************* */
@@ -11,13 +47,53 @@ class SupClienteTerm: public SupCliente
 {
 public:
   // Construtor default
-  SupClienteTerm(): SupCliente() {}
+  SupClienteTerm(): SupCliente()
+    , mtx_screen()
+    , dash_on(false)
+    , screen()
+    , dash_msg()
+    , sparkH1()
+    , sparkH2()
+    , stream_fmt(SupStreamFormat::NONE)
+    , stream_fail(false)
+    , streamBuf()
+    , script_on(false)
+  {}
   // Destrutor
   ~SupClienteTerm() {}
 
   // Laco principal da interface, executado na funcao main
   void main(void);
 
+  // Modo de saida continua, nao interativo: conecta ao servidor e escreve
+  // na saida padrao cada estado recebido, no formato F, ateh a desconexao.
+  // Retorna o codigo de saida do programa (0 se OK).
+  int stream(SupStreamFormat F, const std::string& IP,
+             const std::string& Login, const std::string& Senha,
+             int Periodo);
+
+  // Modo de execucao em lote, nao interativo: executa as atuacoes, esperas
+  // e verificacoes do arquivo Arquivo em uma unica conexao, com o protocolo
+  // com pipeline, e informa os tempos de execucao.
+  // Uma linha por comando ('#' inicia um comentario):
+  //   pump <0.0 a 100.0>             entrada % da bomba
+  //   v1 open|close, v2 open|close   estado das valvulas
+  //   wait <ms>                      espera
+  //   expect h1|h2 <|<=|>|>= <cm> [timeout_ms]
+  //                                  verifica o nivel, esperando ateh o timeout
+  // As atuacoes sao enviadas sem esperar pela resposta; as respostas sao
+  // conferidas antes de cada verificacao e no fim do script.
+  // Retorna o codigo de saida do programa: 0 se OK, 1 se erro no arquivo ou
+  // na conexao, 2 se alguma atuacao ou verificacao falhou.
+  int script(const std::string& Arquivo, const std::string& IP,
+             const std::string& Login, const std::string& Senha);
+
+  // Modo visualizador, nao interativo: recebe o estado da planta Planta pelo
+  // canal de difusao por UDP (ver SupCliente::conectarViewer) e o exibe no
+  // painel de monitoramento, ateh o usuario teclar ENTER.
+  // Retorna o codigo de saida do programa (0 se OK).
+  int viewer(const std::string& Endereco, uint16_t Planta);
+
 private:
   // Construtores e operadores de atribuicao suprimidos (nao existem na classe)
   SupClienteTerm(const SupClienteTerm& other) = delete;
@@ -33,7 +109,78 @@ private:
   void virtExibirInterface() const override;
 
   // As funcoes virtuais de armazenamento de dados.
-  // Nao precisam ser complementadas na interface console.
+  // Complementadas para guardar as ultimas amostras das sparklines.
+  // Armazena o ultimo estado atual da planta
+  void storeState(const SupState& lastS) override;
+  // Limpa todos os estados armazenados da planta
+  void clearState() override;
+
+  // O painel de monitoramento em tela cheia.
+  // Mantem uma copia da tela e, a cada redesenho, soh envia ao terminal os
+  // caracteres que mudaram, com sequencias ANSI de posicionamento do cursor.
+  // Retorna quando o usuario tecla ENTER.
+  void dashboard();
+  // Monta a tela do painel: SUP_TERM_COLS caracteres por linha
+  std::vector<std::string> dashboardFrame() const;
+  // Envia ao terminal as diferencas entre a tela anterior e a nova
+  // Deve ser chamada com mtx_screen travado
+  void dashboardRedraw() const;
+
+  // A previsao da evolucao dos niveis, simulada pelo servidor (CMD_WHATIF).
+  // Pergunta as atuacoes e o horizonte, espera pela resposta e imprime os pontos.
+  void whatIf();
+  // A varredura de valores da entrada da bomba (CMD_SWEEP).
+  // Pergunta o alvo e a grade, espera pela resposta e imprime os resumos.
+  void sweep();
+  // O controlador de nivel do servidor (CMD_SET_PID...). Exibe a configuracao
+  // atual (com pipeline), pergunta a nova e a envia ao servidor.
+  void levelControl();
+  // Espera pela resposta Cmd de uma previsao ou varredura. Retorna true se OK.
+  bool esperarPrevisao(std::future<SupReply>& F, uint16_t Cmd, SupReply& R) const;
+
+  // Os dados do painel, compartilhados entre a thread e o programa principal
+  mutable std::mutex mtx_screen;
+  // O painel estah sendo exibido
+  bool dash_on;
+  // A tela atualmente exibida no terminal
+  mutable std::vector<std::string> screen;
+  // A ultima mensagem de erro, exibida no painel
+  mutable std::string dash_msg;
+  // As ultimas amostras dos niveis
+  std::deque<uint16_t> sparkH1, sparkH2;
+
+  // O modo de saida continua
+  // O formato (NONE fora do modo de saida continua)
+  SupStreamFormat stream_fmt;
+  // Houve erro na escrita da saida padrao
+  std::atomic<bool> stream_fail;
+  // O buffer de formatacao de um registro, alocado uma unica vez
+  char streamBuf[SUP_TERM_RECORD_LEN];
+  // Formata um estado no buffer e retorna o numero de bytes
+  size_t formatRecord(const SupState& S);
+
+  // O modo de execucao em lote
+  // Um comando do script
+  struct ScriptCmd
+  {
+    enum class Type {ACTUATE, WAIT, EXPECT};
+    Type type = Type::WAIT;
+    // Numero e texto da linha no arquivo (para o relatorio)
+    int line = 0;
+    std::string text;
+    // A atuacao: comando (CMD_SET_V1, CMD_SET_V2 ou CMD_SET_PUMP) e parametro
+    uint16_t cmd = 0, param = 0;
+    // A espera ou o timeout da verificacao (em milisegundos)
+    int ms = 0;
+    // A verificacao: tanque (1 ou 2), comparacao e nivel (em cm)
+    int tank = 1;
+    std::string op;
+    double value = 0.0;
+  };
+  // Leh e valida o script. Em caso de erro, exibe a msg e retorna false.
+  static bool parseScript(const std::string& Arquivo, std::vector<ScriptCmd>& Cmds);
+  // O script estah sendo executado
+  bool script_on;
 };
 
 #endif // _SUP_CLIENT_TERM_H_
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <cstring>
+#include <algorithm>
 #include "tanques-param.h"
 #include "supdados.h"
 
@@ -38,3 +40,185 @@ void SupState::print() const
   std::cout << std::setw(0) << std::defaultfloat;
 }
 
+/// Monta a resposta ao comando CMD_GET_DATA: CMD_DATA seguido dos dados
+void SupState::toFrame(uint16_t* frame) const
+{
+  frame[0] = CMD_DATA;
+  frame[1] = V1;
+  frame[2] = V2;
+  frame[3] = H1;
+  frame[4] = H2;
+  frame[5] = PumpInput;
+  frame[6] = PumpFlow;
+  frame[7] = ovfl;
+}
+
+/// Extrai os dados da resposta ao comando CMD_GET_DATA
+/// Nao testa frame[0], que deve ser testado por quem recebeu a resposta
+void SupState::fromFrame(const uint16_t* frame)
+{
+  V1 = frame[1];
+  V2 = frame[2];
+  H1 = frame[3];
+  H2 = frame[4];
+  PumpInput = frame[5];
+  PumpFlow = frame[6];
+  ovfl = frame[7];
+}
+
+/// Funcoes auxiliares para transmitir um inteiro de 64 bits
+/// como 4 inteiros de 16 bits (na ordem de bytes da maquina,
+/// como todos os demais inteiros enviados pelo socket)
+void put_uint64(uint16_t* dest, uint64_t num)
+{
+  memcpy(dest, &num, sizeof(num));
+}
+uint64_t get_uint64(const uint16_t* src)
+{
+  uint64_t num;
+  memcpy(&num, src, sizeof(num));
+  return num;
+}
+
+/// Funcoes auxiliares para transmitir uma string de ateh 12 caracteres
+/// em 6 inteiros de 16 bits, completada com zeros
+void put_string12(uint16_t* dest, const std::string& S)
+{
+  char buf[12] = {};
+  memcpy(buf, S.data(), std::min<size_t>(S.size(), sizeof(buf)));
+  memcpy(dest, buf, sizeof(buf));
+}
+std::string get_string12(const uint16_t* src)
+{
+  char buf[12];
+  memcpy(buf, src, sizeof(buf));
+  return std::string(buf, strnlen(buf, sizeof(buf)));
+}
+
+/// Monta um evento do fluxo de replicacao: tipo, parametro, login e senha
+void SupReplEvent::toFrame(uint16_t* frame) const
+{
+  frame[0] = type;
+  frame[1] = param;
+  put_string12(frame+2, login);
+  put_string12(frame+8, password);
+}
+
+/// Extrai um evento do fluxo de replicacao
+void SupReplEvent::fromFrame(const uint16_t* frame)
+{
+  type = frame[0];
+  param = frame[1];
+  login = get_string12(frame+2);
+  password = get_string12(frame+8);
+}
+
+/// Numero de candidatos: o produto dos numeros de valores da grade
+size_t SupSweep::numCandidates() const
+{
+  return size_t(pump_count)*v1_count*v2_count;
+}
+
+/// A varredura eh valida se o alvo existe, se o numero de candidatos estah
+/// entre 1 e SUP_SWEEP_MAX_CANDIDATES e se o ultimo valor da bomba nao passa de 65535
+bool SupSweep::valid() const
+{
+  if (tank != 1 && tank != 2) return false;
+  if (numCandidates() == 0 || numCandidates() > SUP_SWEEP_MAX_CANDIDATES) return false;
+  return uint32_t(pump_first) + uint32_t(pump_step)*(pump_count-1) <= UINT16_MAX;
+}
+
+/// Os valores do candidato K. Os instantes das valvulas que passam de 65535
+/// sao limitados a 65535 (a valvula nunca eh aberta).
+void SupSweep::candidate(size_t K, uint16_t& Pump, uint16_t& T1, uint16_t& T2) const
+{
+  const size_t i2 = K % v2_count;
+  const size_t i1 = (K / v2_count) % v1_count;
+  const size_t ip = K / (size_t(v1_count)*v2_count);
+  Pump = uint16_t(pump_first + pump_step*ip);
+  T1 = uint16_t(std::min<size_t>(v1_first + v1_step*i1, UINT16_MAX));
+  T2 = uint16_t(std::min<size_t>(v2_first + v2_step*i2, UINT16_MAX));
+}
+
+/// Monta os parametros do comando CMD_SWEEP
+void SupSweep::toFrame(uint16_t* frame) const
+{
+  frame[0] = horizon;
+  frame[1] = tank;
+  frame[2] = level;
+  frame[3] = pump_first;
+  frame[4] = pump_step;
+  frame[5] = pump_count;
+  frame[6] = v1_first;
+  frame[7] = v1_step;
+  frame[8] = v1_count;
+  frame[9] = v2_first;
+  frame[10] = v2_step;
+  frame[11] = v2_count;
+}
+
+/// Extrai os parametros do comando CMD_SWEEP
+void SupSweep::fromFrame(const uint16_t* frame)
+{
+  horizon = frame[0];
+  tank = frame[1];
+  level = frame[2];
+  pump_first = frame[3];
+  pump_step = frame[4];
+  pump_count = frame[5];
+  v1_first = frame[6];
+  v1_step = frame[7];
+  v1_count = frame[8];
+  v2_first = frame[9];
+  v2_step = frame[10];
+  v2_count = frame[11];
+}
+
+/// Separa um endereco "IP[:porta]" no IP e na porta
+void split_address(const std::string& Endereco, std::string& IP,
+                   std::string& Porta, const std::string& Default)
+{
+  size_t pos = Endereco.find(':');
+  if (pos == std::string::npos || Endereco.find(':', pos+1) != std::string::npos)
+  {
+    IP = Endereco;
+    Porta = Default;
+  }
+  else
+  {
+    IP = Endereco.substr(0, pos);
+    Porta = Endereco.substr(pos+1);
+  }
+}
+
+/// Monta a resposta ao comando CMD_GET_DATA_EXT: CMD_DATA_EXT seguido
+/// da identificacao da amostra e dos dados
+void SupState::toFrameExt(uint16_t* frame) const
+{
+  frame[0] = CMD_DATA_EXT;
+  put_uint64(frame+1, seq);
+  put_uint64(frame+5, t_us);
+  // Os dados, na mesma ordem da resposta CMD_DATA
+  frame[9] = V1;
+  frame[10] = V2;
+  frame[11] = H1;
+  frame[12] = H2;
+  frame[13] = PumpInput;
+  frame[14] = PumpFlow;
+  frame[15] = ovfl;
+}
+
+/// Extrai a identificacao da amostra e os dados da resposta ao comando CMD_GET_DATA_EXT
+/// Nao testa frame[0], que deve ser testado por quem recebeu a resposta
+void SupState::fromFrameExt(const uint16_t* frame)
+{
+  seq = get_uint64(frame+1);
+  t_us = get_uint64(frame+5);
+  V1 = frame[9];
+  V2 = frame[10];
+  H1 = frame[11];
+  H2 = frame[12];
+  PumpInput = frame[13];
+  PumpFlow = frame[14];
+  ovfl = frame[15];
+}
@@ -4,10 +4,23 @@
 /// Porta de comunicacao cliente-servidor.
 #define SUP_PORT "23456"
 
+/// Caminho do socket local (AF_UNIX) do servidor, para clientes no mesmo computador.
+/// Relativo ao diretorio em que o servidor eh executado.
+/// O cliente se conecta a ele usando o endereco "unix:" seguido do caminho.
+#define SUP_LOCAL_PATH "suptanques.sock"
+#define SUP_LOCAL_PREFIX "unix:"
+
+/// Porta default do canal de difusao do estado por UDP (somente leitura).
+/// O servidor pode enviar cada amostra do estado, em um datagrama, para um
+/// endereco de um computador, de difusao (broadcast) ou de grupo (multicast).
+/// Os clientes visualizadores recebem os datagramas sem conexao e sem login.
+#define SUP_BCAST_PORT "23457"
+
 /// Timeout (em segundos) para esperar o envio pelo socket
 /// de um parametro ou resposta de um comando enviado anteriormente
 #define SUP_TIMEOUT 10
 #include <cstdint>
+#include <string>
 
 /// Os comandos do SupTanques.
 enum SupCommands: uint16_t
@@ -21,9 +34,137 @@ enum SupCommands: uint16_t
   CMD_SET_V1=1007,
   CMD_SET_V2=1008,
   CMD_SET_PUMP=1009,
-  CMD_LOGOUT=1010
+  CMD_LOGOUT=1010,
+  // Passa a enviar um identificador de correlacao (uint16_t) apos cada
+  // comando, que eh devolvido pelo servidor apos o comando de resposta.
+  // Permite ter varios comandos aguardando resposta na mesma conexao.
+  CMD_PIPELINE=1011,
+  // Solicitacao de dados com resposta estendida: CMD_DATA_EXT seguido do
+  // numero de sequencia e do instante da amostra no servidor, e depois
+  // dos mesmos dados da resposta CMD_DATA
+  CMD_GET_DATA_EXT=1012,
+  CMD_DATA_EXT=1013,
+  // Solicitacao de um bloco do historico de niveis armazenado no servidor.
+  // Parametros: nivel de resolucao L e indice do bloco (4 inteiros de 16 bits).
+  // Resposta: CMD_HISTORY, numero N de intervalos com dados e, para cada um,
+  // posicao no bloco, minimo e maximo de H1, minimo e maximo de H2
+  CMD_GET_HISTORY=1014,
+  CMD_HISTORY=1015,
+  // Datagrama do canal de difusao do estado por UDP: CMD_STATE_BCAST,
+  // identificador da planta e depois a resposta CMD_DATA_EXT completa
+  // (com o numero de sequencia e o instante da amostra)
+  CMD_STATE_BCAST=1016,
+  // Solicitacao do fluxo de replicacao (somente administradores, modo com pipeline).
+  // Parametro: posicao P no fluxo do servidor (4 inteiros de 16 bits), ateh a
+  // qual o solicitante jah aplicou os eventos (0 se nenhum).
+  // Resposta: CMD_REPLICA, nova posicao (4 inteiros de 16 bits), numero N de
+  // eventos e N eventos de SUP_REPL_EVENT_LEN inteiros (ver SupReplEvent).
+  // Se nao houver eventos depois de P, a resposta eh retida pelo servidor ateh
+  // que surja um novo evento, no maximo por SUP_REPL_WAIT ms (resposta com N=0).
+  // Se P for desconhecida pelo servidor, a resposta eh uma copia completa da
+  // lista de usuarios: CMD_USER_CLEAR seguido de um CMD_USER_ADD por usuario.
+  CMD_REPLICATE=1017,
+  CMD_REPLICA=1018,
+  // Os tipos de evento do fluxo de replicacao, alem das atuacoes
+  // (CMD_SET_V1, CMD_SET_V2 e CMD_SET_PUMP, com o parametro do comando):
+  // inclusao (parametro: administrador ou nao) e remocao de um usuario,
+  // e inicio de uma copia completa da lista de usuarios
+  CMD_USER_ADD=1019,
+  CMD_USER_DEL=1020,
+  CMD_USER_CLEAR=1021,
+  // Solicitacao do token da sessao, logo apos o login (sem pipeline).
+  // Resposta: CMD_SESSION seguido do token (4 inteiros de 16 bits)
+  CMD_GET_SESSION=1022,
+  CMD_SESSION=1023,
+  // Retomada de uma sessao em uma nova conexao, no lugar de CMD_LOGIN.
+  // Parametros: o token da sessao (4 inteiros de 16 bits) e o login do usuario.
+  // Resposta: CMD_ADMIN_OK, CMD_OK ou CMD_ERROR, como em CMD_LOGIN. Se a sessao
+  // ainda estiver conectada, a conexao eh fechada sem resposta (o cliente tenta novamente).
+  // A sessao pode ser retomada no mesmo servidor ou no servidor de reserva
+  // que assumiu a porta; ela termina com CMD_LOGOUT ou com um novo login.
+  CMD_RESUME=1024,
+  // Transforma a conexao (de um administrador, sem pipeline) no canal do
+  // servidor de reserva (hot standby). O servidor ativo passa a enviar por
+  // ela, sem solicitacao, o fluxo de replicacao (respostas CMD_REPLICA, sem
+  // identificador) e, a cada SUP_STANDBY_PERIOD ms, CMD_STANDBY_STATE: o
+  // estado dos tanques, a identificacao da ultima amostra e as sessoes.
+  // Quando a conexao termina, o servidor de reserva assume a porta.
+  CMD_STANDBY=1025,
+  CMD_STANDBY_STATE=1026,
+  // Transferencia do servidor para um novo processo no mesmo computador
+  // (reinicio sem interrupcao). Soh administradores sem pipeline, pelo socket
+  // local. Resposta: CMD_OK, seguido do estado dos tanques, das sessoes, das
+  // conexoes dos clientes e dos sockets de conexoes (ver SupServidor::sendHandoff).
+  // O novo processo confirma com CMD_OK e o servidor anterior termina,
+  // fechando a conexao; os clientes continuam conectados ao novo processo.
+  CMD_HANDOFF=1027,
+  // Previsao da evolucao dos niveis (modo com pipeline), simulada pelo servidor
+  // em uma copia dos tanques, sem alterar a planta. Parametros: horizonte T (s),
+  // periodo P (s) entre os pontos, numero N de atuacoes previstas e, para cada
+  // uma, instante (s a partir do estado atual), comando (CMD_SET_V1, CMD_SET_V2
+  // ou CMD_SET_PUMP) e parametro.
+  // Resposta (quando a simulacao termina): CMD_WHATIF_RESULT, P, numero M de
+  // pontos e, para cada ponto (instantes 0, P, 2P...), H1 e H2 sem ruido e os
+  // indicadores (bit 0: V1 aberta, bit 1: V2 aberta, bit 2: transbordando)
+  CMD_WHATIF=1028,
+  CMD_WHATIF_RESULT=1029,
+  // Varredura de uma grade de atuacoes candidatas (modo com pipeline), cada uma
+  // simulada pelo servidor em uma copia dos tanques, sem alterar a planta.
+  // Parametros: a varredura (SUP_SWEEP_FRAME_LEN inteiros, ver SupSweep).
+  // Resposta (quando todas as simulacoes terminam): CMD_SWEEP_RESULT, numero N
+  // de candidatos e, para cada um, o resumo (SUP_SWEEP_SUMMARY_LEN inteiros):
+  // instante (s) em que o nivel alvo foi atingido, instante (s) do primeiro
+  // transbordamento (UINT16_MAX se nao ocorreu), H1 e H2 finais sem ruido
+  CMD_SWEEP=1030,
+  CMD_SWEEP_RESULT=1031,
+  // O controlador PID de nivel do servidor, que atua na entrada da bomba a cada
+  // passo da simulacao. Comandos de atuacao (somente administradores), com um
+  // parametro e resposta CMD_OK ou CMD_ERROR:
+  // liga o controlador do nivel do tanque 1 ou 2, ou desliga (0). Enquanto
+  // ligado, um comando CMD_SET_PUMP desliga o controlador (operacao manual).
+  CMD_SET_PID=1032,
+  // nivel desejado (0 a 65535, na escala dos niveis)
+  CMD_SET_PID_SP=1033,
+  // ganhos proporcional, integral (por s) e derivativo (em s), e ganho (por s)
+  // do anti-windup (0: sem anti-windup), multiplicados por SUP_PID_GAIN_SCALE
+  CMD_SET_PID_KP=1034,
+  CMD_SET_PID_KI=1035,
+  CMD_SET_PID_KD=1036,
+  CMD_SET_PID_KT=1037,
+  // Consulta do controlador. Resposta: CMD_PID seguido de tanque controlado
+  // (0: desligado), nivel desejado, kp, ki, kd, kt e entrada atual da bomba
+  CMD_GET_PID=1038,
+  CMD_PID=1039
 };
 
+/// O historico de niveis armazenado no servidor.
+/// Periodo de armazenamento do historico no servidor (em milisegundos)
+#define SUP_HISTORY_PERIOD 1000
+/// Numero de intervalos em um bloco do historico.
+/// No nivel de resolucao L, cada intervalo dura SUP_HISTORY_PERIOD*2^L ms
+/// e o bloco de indice I comeca no instante I*SUP_HISTORY_BLOCK*SUP_HISTORY_PERIOD*2^L ms
+#define SUP_HISTORY_BLOCK 256
+/// Maior nivel de resolucao do historico
+#define SUP_HISTORY_MAX_LEVEL 20
+/// Numero de inteiros de 16 bits de cada intervalo na resposta CMD_HISTORY
+#define SUP_HISTORY_BUCKET_LEN 5
+
+/// A previsao da evolucao dos niveis (CMD_WHATIF).
+/// Numero maximo de atuacoes previstas em uma solicitacao
+#define SUP_WHATIF_MAX_EVENTS 16
+/// Numero maximo de pontos da resposta CMD_WHATIF_RESULT (T/P+1)
+#define SUP_WHATIF_MAX_POINTS 400
+/// Numero de inteiros de 16 bits de cada ponto na resposta CMD_WHATIF_RESULT
+#define SUP_WHATIF_POINT_LEN 3
+
+/// O controlador de nivel do servidor (CMD_SET_PID...).
+/// Escala dos ganhos nos comandos: o ganho eh o parametro dividido pela escala.
+/// Os ganhos sao normalizados: o erro eh uma fracao do nivel maximo e a saida,
+/// uma fracao da entrada maxima da bomba.
+#define SUP_PID_GAIN_SCALE 1000
+/// Numero de inteiros de 16 bits da resposta CMD_PID, sem o proprio comando
+#define SUP_PID_FRAME_LEN 7
+
 /// O estado atual da planta.
 struct SupState
 {
@@ -38,8 +179,123 @@ struct SupState
   // Estah transbordando: sim (diferente de 0) ou nao (0)
   uint16_t ovfl=0;
 
+  // Identificacao da amostra, preenchida pelo servidor
+  // (soh eh transmitida na resposta estendida CMD_DATA_EXT)
+  // Numero de sequencia da amostra: cresce a cada nova leitura dos
+  // sensores no servidor; 0 se desconhecido
+  uint64_t seq=0;
+  // Instante da amostra no servidor (em microsegundos desde que o
+  // servidor foi ligado pela primeira vez)
+  uint64_t t_us=0;
+
   // Impressao em console do estado da planta
   void print() const;
+
+  // Conversao de/para a resposta ao comando CMD_GET_DATA, que eh enviada
+  // em um unico bloco: CMD_DATA seguido de V1, V2, H1, H2, PumpInput, PumpFlow, ovfl
+  void toFrame(uint16_t* frame) const;
+  void fromFrame(const uint16_t* frame);
+
+  // Conversao de/para a resposta ao comando CMD_GET_DATA_EXT, que eh enviada
+  // em um unico bloco: CMD_DATA_EXT seguido de seq (4 inteiros de 16 bits),
+  // t_us (4 inteiros de 16 bits), V1, V2, H1, H2, PumpInput, PumpFlow, ovfl
+  void toFrameExt(uint16_t* frame) const;
+  void fromFrameExt(const uint16_t* frame);
 };
 
+/// Numero de inteiros de 16 bits da resposta ao comando CMD_GET_DATA,
+/// incluindo o proprio comando CMD_DATA
+#define SUP_DATA_FRAME_LEN 8
+
+/// Numero de inteiros de 16 bits da resposta ao comando CMD_GET_DATA_EXT,
+/// incluindo o proprio comando CMD_DATA_EXT
+#define SUP_DATA_EXT_FRAME_LEN 16
+
+/// Numero de inteiros de 16 bits de um datagrama do canal de difusao,
+/// incluindo o proprio comando CMD_STATE_BCAST e o identificador da planta
+#define SUP_BCAST_FRAME_LEN (2+SUP_DATA_EXT_FRAME_LEN)
+
+/// O fluxo de replicacao de um servidor.
+/// Tempo maximo (em milisegundos) que o servidor retem uma solicitacao
+/// CMD_REPLICATE sem eventos novos. Menor que SUP_TIMEOUT, para que o
+/// solicitante nao considere a conexao perdida.
+#define SUP_REPL_WAIT 5000
+/// Numero de inteiros de 16 bits de um evento do fluxo de replicacao
+#define SUP_REPL_EVENT_LEN 14
+/// Numero maximo de eventos em uma resposta CMD_REPLICA
+#define SUP_REPL_MAX_EVENTS 80
+
+/// Um evento do fluxo de replicacao: uma atuacao ou uma alteracao na lista de usuarios
+struct SupReplEvent
+{
+  // O tipo do evento (CMD_SET_V1, CMD_SET_V2, CMD_SET_PUMP, CMD_USER_ADD,
+  // CMD_USER_DEL ou CMD_USER_CLEAR) e o seu parametro
+  uint16_t type=0;
+  uint16_t param=0;
+  // O usuario incluido ou removido (de 6 a 12 caracteres)
+  std::string login, password;
+
+  // Conversao de/para o formato transmitido: tipo, parametro, login e senha
+  // (cada um com 12 bytes, completados com zeros)
+  void toFrame(uint16_t* frame) const;
+  void fromFrame(const uint16_t* frame);
+};
+
+/// A varredura de atuacoes candidatas (CMD_SWEEP).
+/// Numero maximo de candidatos em uma varredura
+#define SUP_SWEEP_MAX_CANDIDATES 256
+/// Numero de inteiros de 16 bits dos parametros do comando CMD_SWEEP
+#define SUP_SWEEP_FRAME_LEN 12
+/// Numero de inteiros de 16 bits do resumo de cada candidato na resposta CMD_SWEEP_RESULT
+#define SUP_SWEEP_SUMMARY_LEN 4
+/// Instante de um evento que nao ocorreu no resumo de um candidato
+#define SUP_SWEEP_NEVER UINT16_MAX
+
+/// Uma varredura: a grade de atuacoes candidatas e o objetivo.
+/// Cada candidato fixa a entrada da bomba no instante 0 e abre cada valvula
+/// em um instante (fechada antes dele; nunca aberta se o instante nao for
+/// menor que o horizonte). A grade eh o produto dos valores da bomba e dos
+/// instantes das valvulas, cada um dado pelo primeiro valor, passo e numero de
+/// valores. O candidato K tem os indices (K/(n1*n2), (K/n2)%n1, K%n2).
+struct SupSweep
+{
+  // Horizonte da simulacao (s)
+  uint16_t horizon=0;
+  // O nivel alvo: tanque (1 ou 2) e nivel (0 a 65535). O alvo eh atingido
+  // quando o nivel cruza o alvo, subindo ou descendo a partir do nivel inicial.
+  uint16_t tank=1, level=0;
+  // A entrada da bomba (0 a 65535) e os instantes (s) de abertura das valvulas
+  uint16_t pump_first=0, pump_step=0, pump_count=1;
+  uint16_t v1_first=0, v1_step=0, v1_count=1;
+  uint16_t v2_first=0, v2_step=0, v2_count=1;
+
+  // Numero de candidatos
+  size_t numCandidates() const;
+  // Testa se a varredura eh valida: alvo, numero de candidatos e valores da bomba
+  bool valid() const;
+  // Os valores do candidato K: entrada da bomba e instantes de abertura de V1 e V2
+  void candidate(size_t K, uint16_t& Pump, uint16_t& T1, uint16_t& T2) const;
+
+  // Conversao de/para os parametros do comando CMD_SWEEP, na ordem dos campos
+  void toFrame(uint16_t* frame) const;
+  void fromFrame(const uint16_t* frame);
+};
+
+/// Funcoes auxiliares para transmitir um inteiro de 64 bits
+/// como 4 inteiros de 16 bits (na ordem de bytes da maquina,
+/// como todos os demais inteiros enviados pelo socket)
+void put_uint64(uint16_t* dest, uint64_t num);
+uint64_t get_uint64(const uint16_t* src);
+
+/// Funcoes auxiliares para transmitir uma string de ateh 12 caracteres
+/// (login ou senha) como 6 inteiros de 16 bits, completada com zeros
+void put_string12(uint16_t* dest, const std::string& S);
+std::string get_string12(const uint16_t* src);
+
+/// Separa um endereco "IP[:porta]" no IP e na porta.
+/// Se a porta nao for informada, usa a porta Default.
+/// Um endereco com mais de um ':' (IPv6) eh considerado sem porta.
+void split_address(const std::string& Endereco, std::string& IP,
+                   std::string& Porta, const std::string& Default);
+
 #endif // _SUP_DADOS_H_
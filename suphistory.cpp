@@ -0,0 +1,156 @@
+#include <algorithm>
+#include "suphistory.h"
+
+/// Construtor default
+SupHistory::SupHistory()
+  : vt()
+  , vh1()
+  , vh2()
+  , levels()
+{
+}
+
+/// Acrescenta um ponto ao final do historico
+void SupHistory::push_back(double T, float H1, float H2)
+{
+  vt.push_back(T);
+  vh1.push_back(H1);
+  vh2.push_back(H2);
+  update_levels();
+}
+
+/// Atualiza a piramide com o ultimo ponto acrescentado.
+/// O ponto eh incluido no ultimo bloco de cada nivel (ou inicia um novo bloco).
+/// Um nivel k soh eh criado quando o historico passa a ter mais de 2^(k-1) pontos;
+/// nesse momento, seu primeiro bloco comeca com o primeiro bloco do nivel k-1.
+void SupHistory::update_levels()
+{
+  const size_t n = vt.size();
+  const size_t last = n-1;
+  const float H1 = vh1[last], H2 = vh2[last];
+
+  for (size_t k=1; (size_t(1) << (k-1)) < n; ++k)
+  {
+    if (levels.size() < k)
+    {
+      Level L;
+      if (k == 1)
+      {
+        L.min1.push_back(vh1[0]);
+        L.max1.push_back(vh1[0]);
+        L.min2.push_back(vh2[0]);
+        L.max2.push_back(vh2[0]);
+      }
+      else
+      {
+        const Level& P = levels[k-2];
+        L.min1.push_back(P.min1[0]);
+        L.max1.push_back(P.max1[0]);
+        L.min2.push_back(P.min2[0]);
+        L.max2.push_back(P.max2[0]);
+      }
+      levels.push_back(L);
+    }
+
+    Level& L = levels[k-1];
+    size_t block = last >> k;
+    if (block == L.min1.size())
+    {
+      // Novo bloco
+      L.min1.push_back(H1);
+      L.max1.push_back(H1);
+      L.min2.push_back(H2);
+      L.max2.push_back(H2);
+    }
+    else
+    {
+      // Inclui o ponto no ultimo bloco
+      L.min1[block] = std::min(L.min1[block], H1);
+      L.max1[block] = std::max(L.max1[block], H1);
+      L.min2[block] = std::min(L.min2[block], H2);
+      L.max2[block] = std::max(L.max2[block], H2);
+    }
+  }
+}
+
+/// Remove os N pontos mais antigos.
+/// Como os blocos da piramide sao alinhados com o primeiro ponto,
+/// a piramide eh reconstruida. Para que o custo seja pequeno, deve ser
+/// chamada raramente, removendo muitos pontos de uma vez.
+void SupHistory::trim_front(size_t N)
+{
+  if (N >= vt.size())
+  {
+    clear();
+    return;
+  }
+  std::vector<double> old_t(vt.begin()+N, vt.end());
+  std::vector<float> old_h1(vh1.begin()+N, vh1.end());
+  std::vector<float> old_h2(vh2.begin()+N, vh2.end());
+  clear();
+  vt.reserve(old_t.size());
+  vh1.reserve(old_t.size());
+  vh2.reserve(old_t.size());
+  for (size_t i=0; i<old_t.size(); ++i) push_back(old_t[i], old_h1[i], old_h2[i]);
+}
+
+/// Remove todos os pontos
+void SupHistory::clear()
+{
+  vt.clear();
+  vh1.clear();
+  vh2.clear();
+  levels.clear();
+}
+
+/// Indice do primeiro ponto com instante maior ou igual a T
+size_t SupHistory::lower_bound(double T) const
+{
+  return lower_bound(T, 0);
+}
+
+/// Indice do primeiro ponto com instante maior ou igual a T,
+/// buscando apenas a partir do indice First
+size_t SupHistory::lower_bound(double T, size_t First) const
+{
+  if (First >= vt.size()) return vt.size();
+  return std::lower_bound(vt.begin()+First, vt.end(), T) - vt.begin();
+}
+
+/// Minimo e maximo de cada nivel entre os pontos de indices [A, B).
+/// O intervalo eh coberto pelos maiores blocos alinhados que cabem nele.
+void SupHistory::minmax(size_t A, size_t B,
+                        float& Min1, float& Max1, float& Min2, float& Max2) const
+{
+  Min1 = Max1 = vh1[A];
+  Min2 = Max2 = vh2[A];
+  while (A < B)
+  {
+    // O maior nivel k cujo bloco comeca em A e termina ateh B
+    size_t k = 0;
+    while (k < levels.size() &&
+           (A & ((size_t(2) << k) - 1)) == 0 &&
+           A + (size_t(2) << k) <= B)
+    {
+      ++k;
+    }
+
+    if (k == 0)
+    {
+      Min1 = std::min(Min1, vh1[A]);
+      Max1 = std::max(Max1, vh1[A]);
+      Min2 = std::min(Min2, vh2[A]);
+      Max2 = std::max(Max2, vh2[A]);
+    }
+    else
+    {
+      const Level& L = levels[k-1];
+      size_t block = A >> k;
+      Min1 = std::min(Min1, L.min1[block]);
+      Max1 = std::max(Max1, L.max1[block]);
+      Min2 = std::min(Min2, L.min2[block]);
+      Max2 = std::max(Max2, L.max2[block]);
+    }
+    A += (size_t(1) << k);
+  }
+}
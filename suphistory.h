@@ -0,0 +1,66 @@
+#ifndef _SUP_HISTORY_H_
+#define _SUP_HISTORY_H_
+
+#include <vector>
+#include <cstddef>
+
+/// O historico dos niveis dos tanques, armazenado por colunas
+/// (um vetor para os instantes e um vetor para cada nivel).
+/// Alem dos dados, mantem uma piramide de minimos e maximos: no nivel k,
+/// cada bloco guarda o minimo e o maximo de 2^k pontos consecutivos.
+/// Assim, o minimo e o maximo de qualquer intervalo de pontos sao obtidos
+/// consultando O(log N) blocos, independentemente do tamanho do intervalo.
+class SupHistory
+{
+public:
+  // Construtor default
+  SupHistory();
+
+  // Numero de pontos armazenados
+  size_t size() const {return vt.size();}
+  bool empty() const {return vt.empty();}
+
+  // Os dados do i-esimo ponto
+  double t(size_t i) const {return vt[i];}
+  float h1(size_t i) const {return vh1[i];}
+  float h2(size_t i) const {return vh2[i];}
+
+  // Acrescenta um ponto ao final do historico
+  // Os instantes T devem ser crescentes
+  void push_back(double T, float H1, float H2);
+
+  // Remove os N pontos mais antigos
+  void trim_front(size_t N);
+
+  // Remove todos os pontos
+  void clear();
+
+  // Indice do primeiro ponto com instante maior ou igual a T
+  // (igual a size() se nao houver)
+  size_t lower_bound(double T) const;
+  // Idem, buscando apenas a partir do indice First
+  size_t lower_bound(double T, size_t First) const;
+
+  // Minimo e maximo de cada nivel entre os pontos de indices [A, B)
+  // Deve ser A < B <= size()
+  void minmax(size_t A, size_t B,
+              float& Min1, float& Max1, float& Min2, float& Max2) const;
+
+private:
+  // Os dados
+  std::vector<double> vt;
+  std::vector<float> vh1, vh2;
+
+  // Um nivel da piramide de minimos e maximos
+  struct Level
+  {
+    std::vector<float> min1, max1, min2, max2;
+  };
+  // levels[k-1] eh o nivel k, com blocos de 2^k pontos
+  std::vector<Level> levels;
+
+  // Atualiza a piramide com o ultimo ponto acrescentado
+  void update_levels();
+};
+
+#endif // _SUP_HISTORY_H_
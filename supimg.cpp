@@ -3,20 +3,80 @@
 #include <QFont>
 #include <QPolygonF>
 #include <QResizeEvent>
-#include <cmath>          // round
+#include <QWheelEvent>
+#include <QMouseEvent>
+#include <QPixmap>
+#include <QMetaObject>
+#include <cmath>          // round, ceil, floor, fabs, pow, log2, isnan, NAN
+#include <algorithm>      // max, min, clamp
+#include <chrono>
+#include <cstring>        // memmove, memset
 #include "tanques-param.h"
 #include "supimg.h"
 
+// A margem da imagem (pixels)
+static const int imgMarginPx = 50;
+// O tamanho da fonte (pixels)
+static const int fontSizePx = imgMarginPx/2;
+
+// A variacao relativa do periodo de amostragem que exige mudar a escala do grafico
+static const double graphRescaleTol = 0.25;
+
 SupImg::SupImg(QWidget *parent)
   : QLabel(parent)
+  , newSamples()
+  , reqClear(false)
+  , reqLevel(true)
+  , reqWidthPx(600)
+  , reqHeightPx(600)
+  , reqLive(true)
+  , reqViewT0(0.0)
+  , reqViewSpan(0.0)
+  , shownT0(0.0)
+  , shownSpan(0.0)
+  , hasOrigin(false)
+  , timeOrigin(0.0)
+  , histGen(0)
+  , newBlocks()
+  , hasWork(true)
+  , render_on(true)
+  , readyFrame()
+  , framePosted(false)
+  , mtx_render()
+  , cv_render()
+  , thr_render()
+  , fetcher()
+  , mtx_fetch()
+  , dragging(false)
+  , dragX(0.0)
+  , dragT0(0.0)
+  , dragSpan(0.0)
+  , widthPx(0)
+  , heightPx(0)
+  , live(true)
+  , viewT0(0.0)
+  , viewSpan(0.0)
+  , origin_ok(false)
+  , origin(0.0)
+  , gen(0)
+  , lruOrder()
+  , lruBlocks()
+  , inFlight()
+  , toFetch()
   , displayLevel(true)
   , V1Open(false)
   , V2Open(false)
   , overflow(false)
-  , deltaT(10)
-  , points()
+  , deltaT(10.0)
+  , hist()
   , alert()
   , img()
+  , graphStatic()
+  , graphPlot()
+  , graphT0(0.0)
+  , graphSpan(0.0)
+  , graphPxPerSec(0.0)
+  , graphLeftPx(0)
 {
   setSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::MinimumExpanding);
   setGeometry(0,0,600,600);
@@ -27,7 +87,7 @@ SupImg::SupImg(QWidget *parent)
   setScaledContents(false);
   setStyleSheet("background-color: white");
 
-  alert = QPixmap(61,53);
+  alert = QImage(61,53,QImage::Format_ARGB32_Premultiplied);
   alert.fill(QColor(0,255,255,0));  // Fundo ciano transparente
 
   // Os elementos para desenho
@@ -62,116 +122,438 @@ SupImg::SupImg(QWidget *parent)
   painter.drawEllipse(QPoint(30,42), 3,3);
 
   painter.end();
+
+  // As dimensoes iniciais da imagem
+  reqWidthPx = width();
+  reqHeightPx = height();
+
+  // Lanca a thread de desenho
+  thr_render = std::thread( [this]()
+  {
+    this->render_thread();
+  } );
+}
+
+/// Destrutor
+SupImg::~SupImg()
+{
+  // Encerra a thread de desenho
+  mtx_render.lock();
+  render_on = false;
+  mtx_render.unlock();
+  cv_render.notify_all();
+  if (thr_render.joinable()) thr_render.join();
 }
 
 /// Escolhe desenho do nivel atual dos tanques (true) ou o grafico (false)
 void SupImg::setDisplayMode(bool show_level)
 {
-  if (displayLevel != show_level)
+  std::lock_guard<std::mutex> lock(mtx_render);
+  if (reqLevel != show_level)
   {
-    displayLevel = show_level;
+    reqLevel = show_level;
 
     // Redesenha a imagem
-    drawImg();
+    hasWork = true;
+    cv_render.notify_one();
   }
 }
 
 void SupImg::clear()
 {
-  points.clear();
-  drawImg();
+  std::lock_guard<std::mutex> lock(mtx_render);
+  // Os pontos ainda nao desenhados tambem sao descartados
+  newSamples.clear();
+  reqClear = true;
+  // Os blocos do historico do servidor tambem sao descartados,
+  // inclusive os que ainda vao chegar, e volta a exibir o historico local
+  newBlocks.clear();
+  ++histGen;
+  hasOrigin = false;
+  reqLive = true;
+  hasWork = true;
+  cv_render.notify_one();
 }
 
-/// Adiciona um ponto ao historico de dados recebidos
-void SupImg::addPoint(int T, const SupState& S)
+/// Adiciona um ponto ao historico de dados recebidos.
+/// O ponto soh eh desenhado no proximo quadro.
+void SupImg::addPoint(double T, const SupState& S)
 {
-  V1Open = (S.V1 != 0);
-  V2Open = (S.V2 != 0);
-  overflow = (S.ovfl != 0);
-
-  Point P;
-  P.t = T;
-  P.h1 = MaxTankLevelMeasurement*S.H1/UINT16_MAX;
-  P.h2 = MaxTankLevelMeasurement*S.H2/UINT16_MAX;
-  if (!points.empty())
-  {
-    int last_deltaT = T - points.back().t;
-    if (points.size()>1) deltaT = (2*deltaT + last_deltaT)/3;
-    else deltaT = last_deltaT;
+  std::lock_guard<std::mutex> lock(mtx_render);
+  newSamples.push_back(Sample{T,S});
+  // O instante da amostra no servidor permite relacionar o historico
+  // local com o historico do servidor
+  if (S.seq != 0)
+  {
+    timeOrigin = S.t_us/1.0E6 - T;
+    hasOrigin = true;
   }
-  points.push_back(P);
-  if (points.size() > NumMaxGraphPoints) points.pop_front();
+  hasWork = true;
+  cv_render.notify_one();
+}
 
-  // Redesenha a imagem
-  drawImg();
+/// Adiciona varios pontos ao historico de dados recebidos,
+/// com uma unica notificacao da thread de desenho.
+void SupImg::addPoints(const std::vector<Sample>& P)
+{
+  if (P.empty()) return;
+  std::lock_guard<std::mutex> lock(mtx_render);
+  newSamples.insert(newSamples.end(), P.begin(), P.end());
+  // O ultimo ponto com instante no servidor fixa a origem
+  for (auto itr=P.rbegin(); itr!=P.rend(); ++itr)
+  {
+    if (itr->S.seq != 0)
+    {
+      timeOrigin = itr->S.t_us/1.0E6 - itr->t;
+      hasOrigin = true;
+      break;
+    }
+  }
+  hasWork = true;
+  cv_render.notify_one();
 }
 
+/// Solicita que a imagem seja redesenhada.
+/// Soh desenha o que mudou desde o ultimo quadro.
 void SupImg::drawImg()
 {
-  if (points.empty())
+  std::lock_guard<std::mutex> lock(mtx_render);
+  hasWork = true;
+  cv_render.notify_one();
+}
+
+/// Fixa a funcao que solicita ao servidor um bloco do historico
+void SupImg::setHistoryFetcher(std::function<void(const HistoryRequest&)> F)
+{
+  // Espera terminar alguma solicitacao em andamento
+  std::lock_guard<std::mutex> lock(mtx_fetch);
+  fetcher = F;
+}
+
+/// Entrega um bloco do historico do servidor
+void SupImg::addHistoryBlock(const HistoryRequest& Req, bool Ok, const std::vector<uint16_t>& Data)
+{
+  std::lock_guard<std::mutex> lock(mtx_render);
+  // Descarta blocos solicitados antes do ultimo clear
+  if (Req.gen != histGen) return;
+  newBlocks.push_back(IncomingBlock{Req, Ok, Data});
+  hasWork = true;
+  cv_render.notify_one();
+}
+
+/// A thread de desenho.
+/// Espera por alguma solicitacao e desenha um novo quadro, no maximo
+/// um a cada SupImgFramePeriod milisegundos. Todas as solicitacoes
+/// recebidas nesse intervalo sao atendidas por um unico quadro.
+void SupImg::render_thread()
+{
+  // Os pontos a serem desenhados neste quadro
+  std::vector<Sample> samples;
+  // Os blocos do historico do servidor recebidos
+  std::vector<IncomingBlock> blocks;
+  // As demais solicitacoes a serem atendidas neste quadro
+  bool clr, level, lv;
+  int w, h;
+  double t0, span;
+  // O instante do ultimo quadro desenhado
+  auto last_frame = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> lock(mtx_render);
+  while (true)
   {
-    img = QPixmap(width(),height());
-    img.fill(Qt::white);
-    setPixmap(img);
-    return;
-  }
+    // Espera alguma solicitacao
+    cv_render.wait(lock, [this](){return !render_on || hasWork;});
+    if (!render_on) break;
+    // Espera completar o intervalo minimo desde o ultimo quadro
+    cv_render.wait_until(lock, last_frame + std::chrono::milliseconds(SupImgFramePeriod),
+                         [this](){return !render_on;});
+    if (!render_on) break;
 
-  // Os limites no eixo horizontal (X) e vertical (Y), em unidades fisicas
-  double minX, maxX;
-  double /*minY=0.0,*/ maxY;
+    // Recebe as solicitacoes
+    samples.clear();
+    samples.swap(newSamples);
+    blocks.clear();
+    blocks.swap(newBlocks);
+    clr = reqClear;
+    level = reqLevel;
+    w = reqWidthPx;
+    h = reqHeightPx;
+    lv = reqLive;
+    t0 = reqViewT0;
+    span = reqViewSpan;
+    origin_ok = hasOrigin;
+    origin = timeOrigin;
+    reqClear = false;
+    hasWork = false;
+    lock.unlock();
 
-  // As dimensoes da imagem (pixels)
-  int imgWidthPx, imgHeightPx;
-  // A margem da imagem (pixels)
-  const int imgMarginPx = 50;
-  // O tamanho da fonte (pixels)
-  const int fontSizePx = imgMarginPx/2;
-
-  if (displayLevel)
-  {
-    //
-    // DIMENSIONA IMAGEM PARA OS TANQUES
-    //
-
-    // Limites do desenho
-    minX = 0.0;
-    maxX = Tank1Width + Tank2Width;
-    maxY = TankHeight;
-    // Dimensoes da imagem
-    if ((width()-2*imgMarginPx)/maxX >= (height()-2*imgMarginPx)/maxY)
+    // Os pontos anteriores, a mudanca de modo, a mudanca de dimensoes e
+    // a mudanca do intervalo de tempo exibido exigem redesenhar tudo
+    bool full = (img.isNull() || clr || level != displayLevel ||
+                 w != widthPx || h != heightPx || lv != live ||
+                 (!lv && (t0 != viewT0 || span != viewSpan)));
+    if (clr)
     {
-      // A janela eh mais larga que alta
-      imgHeightPx = height();
-      imgWidthPx = std::round((imgHeightPx-2*imgMarginPx)*(maxX/maxY) + 2*imgMarginPx);
+      hist.clear();
+      lruOrder.clear();
+      lruBlocks.clear();
+      inFlight.clear();
+      ++gen;
     }
-    else
+    displayLevel = level;
+    widthPx = w;
+    heightPx = h;
+    live = lv;
+    viewT0 = t0;
+    viewSpan = span;
+    for (const Sample& P : samples)
+    {
+      if (storePoint(P)) full = true;
+    }
+    // Os blocos recebidos do servidor: soh mudam o grafico com zoom.
+    // Um bloco com erro nao muda o grafico: eh solicitado de novo no proximo desenho
+    for (const IncomingBlock& B : blocks)
+    {
+      storeBlock(B);
+      if (!live && B.ok) full = true;
+    }
+    // Com zoom, os novos pontos sempre exigem redesenhar tudo
+    if (!live && !samples.empty()) full = true;
+
+    // Desenha o novo quadro, se algo mudou
+    if (full || !samples.empty())
     {
-      // A janela eh mais alta que larga
-      imgWidthPx = width();
-      imgHeightPx = std::round((imgWidthPx-2*imgMarginPx)*(maxY/maxX) + 2*imgMarginPx);
+      if (hist.empty())
+      {
+        drawBlank();
+      }
+      else if (displayLevel)
+      {
+        drawLevel();
+      }
+      else
+      {
+        // Soh desenha os novos segmentos das curvas, a menos que a escala
+        // do grafico tenha que mudar: o historico nao cabe mais no grafico
+        // ou, no inicio do grafico, mudanca significativa do periodo de amostragem
+        const size_t n = hist.size();
+        if (!full && live && n > 2 &&
+            hist.t(n-1) <= graphT0 + graphSpan &&
+            (n >= NumMaxGraphPoints ||
+             std::fabs((NumMaxGraphPoints-1)*deltaT - graphSpan) <= graphRescaleTol*graphSpan))
+        {
+          size_t nseg = std::min(samples.size(), n-1);
+          for (size_t i=n-nseg; i<n; ++i) drawGraphSegment(i);
+        }
+        else
+        {
+          drawGraph();
+        }
+        composeGraph();
+      }
+      last_frame = std::chrono::steady_clock::now();
+    }
+
+    // Solicita os blocos do historico do servidor que faltaram no desenho
+    if (!toFetch.empty())
+    {
+      std::lock_guard<std::mutex> lock_fetch(mtx_fetch);
+      for (const HistoryRequest& R : toFetch)
+      {
+        if (fetcher) fetcher(R);
+        else inFlight.erase(blockKey(R.level, R.index));
+      }
+      toFetch.clear();
+    }
+
+    lock.lock();
+    // O intervalo de tempo exibido, para o zoom. Com zoom, eh mantido
+    // pela thread principal, que pode jah ter alterado o intervalo.
+    if (live && !displayLevel && graphSpan > 0.0)
+    {
+      shownT0 = graphT0 + graphLeftPx/graphPxPerSec;
+      shownSpan = graphSpan;
+    }
+    if (full || !samples.empty())
+    {
+      // Entrega o quadro pronto para ser exibido pela thread principal.
+      // Se o quadro anterior ainda nao foi exibido, ele eh apenas substituido.
+      readyFrame = img;
+      if (!framePosted)
+      {
+        framePosted = true;
+        QMetaObject::invokeMethod(this, [this](){ this->showFrame(); }, Qt::QueuedConnection);
+      }
     }
   }
-  else
+}
+
+/// Exibe no QLabel o ultimo quadro pronto (executada na thread principal)
+void SupImg::showFrame()
+{
+  QImage frame;
+  mtx_render.lock();
+  frame = readyFrame;
+  framePosted = false;
+  mtx_render.unlock();
+
+  setPixmap(QPixmap::fromImage(frame));
+}
+
+/// Acrescenta um ponto ao historico de dados
+bool SupImg::storePoint(const Sample& P)
+{
+  V1Open = (P.S.V1 != 0);
+  V2Open = (P.S.V2 != 0);
+  overflow = (P.S.ovfl != 0);
+
+  if (!hist.empty())
   {
-    //
-    // DIMENSIONA IMAGEM PARA O GRAFICO
-    //
+    double last_deltaT = P.t - hist.t(hist.size()-1);
+    if (hist.size()>1) deltaT = (2.0*deltaT + last_deltaT)/3.0;
+    else deltaT = last_deltaT;
+  }
+  hist.push_back(P.t,
+                 MaxTankLevelMeasurement*P.S.H1/UINT16_MAX,
+                 MaxTankLevelMeasurement*P.S.H2/UINT16_MAX);
+  if (hist.size() > NumMaxHistoryPoints)
+  {
+    hist.trim_front(NumMaxHistoryPoints/4);
+    return true;
+  }
+  return false;
+}
 
-    // Limites do desenho
-    // Nao precisa testar se points.empty(), pois essa condicao jah eh testada antes e encerra a funcao
-    minX = points.front().t;
-    if (points.size() < NumMaxGraphPoints)
+/// Retorna o bloco do historico do servidor, se estiver na cache.
+/// Senao, agenda a sua solicitacao ao servidor (se jah nao tiver sido solicitado).
+const SupImg::HistBlock* SupImg::findBlock(uint16_t level, uint64_t index)
+{
+  uint64_t key = blockKey(level, index);
+  auto itr = lruBlocks.find(key);
+  if (itr != lruBlocks.end())
+  {
+    // Passa a ser o bloco usado mais recentemente
+    lruOrder.splice(lruOrder.begin(), lruOrder, itr->second.first);
+    return &itr->second.second;
+  }
+  if (inFlight.insert(key).second)
+  {
+    toFetch.push_back(HistoryRequest{level, index, gen});
+  }
+  return nullptr;
+}
+
+/// Armazena um bloco recebido do servidor na cache.
+/// Um bloco com erro (por exemplo, conexao perdida) nao eh armazenado:
+/// serah solicitado de novo na proxima vez em que for necessario.
+void SupImg::storeBlock(const IncomingBlock& B)
+{
+  uint64_t key = blockKey(B.req.level, B.req.index);
+  inFlight.erase(key);
+  if (!B.ok || lruBlocks.count(key) > 0) return;
+
+  HistBlock H;
+  H.min1.assign(SUP_HISTORY_BLOCK, NAN);
+  H.max1.assign(SUP_HISTORY_BLOCK, NAN);
+  H.min2.assign(SUP_HISTORY_BLOCK, NAN);
+  H.max2.assign(SUP_HISTORY_BLOCK, NAN);
+  for (size_t i=0; i+SUP_HISTORY_BUCKET_LEN<=B.data.size(); i+=SUP_HISTORY_BUCKET_LEN)
+  {
+    uint16_t pos = B.data[i];
+    if (pos >= SUP_HISTORY_BLOCK) continue;
+    H.min1[pos] = MaxTankLevelMeasurement*B.data[i+1]/UINT16_MAX;
+    H.max1[pos] = MaxTankLevelMeasurement*B.data[i+2]/UINT16_MAX;
+    H.min2[pos] = MaxTankLevelMeasurement*B.data[i+3]/UINT16_MAX;
+    H.max2[pos] = MaxTankLevelMeasurement*B.data[i+4]/UINT16_MAX;
+  }
+
+  // Descarta o bloco usado ha mais tempo, se necessario
+  if (lruBlocks.size() >= SupImgCacheBlocks)
+  {
+    lruBlocks.erase(lruOrder.back());
+    lruOrder.pop_back();
+  }
+  lruOrder.push_front(key);
+  lruBlocks.emplace(key, std::make_pair(lruOrder.begin(), std::move(H)));
+}
+
+/// Minimo e maximo dos niveis, no historico do servidor, entre os instantes
+/// Ts0 e Ts1 (em segundos no servidor), no nivel de resolucao "level".
+/// Os blocos que nao estao na cache sao solicitados ao servidor.
+bool SupImg::serverMinMax(double Ts0, double Ts1, uint16_t level,
+                          float& Min1, float& Max1, float& Min2, float& Max2)
+{
+  // Duracao de um intervalo (em segundos)
+  const double bucket = (SUP_HISTORY_PERIOD/1000.0)*double(uint64_t(1) << level);
+  if (Ts1 <= 0.0) return false;
+  uint64_t g0 = uint64_t(std::max(0.0, std::floor(Ts0/bucket)));
+  uint64_t g1 = uint64_t(std::ceil(Ts1/bucket));
+
+  bool found = false;
+  const HistBlock* B = nullptr;
+  uint64_t lastIndex = UINT64_MAX;
+  for (uint64_t g=g0; g<g1; ++g)
+  {
+    uint64_t index = g/SUP_HISTORY_BLOCK;
+    size_t pos = g%SUP_HISTORY_BLOCK;
+    if (index != lastIndex)
+    {
+      B = findBlock(level, index);
+      lastIndex = index;
+    }
+    if (B == nullptr || std::isnan(B->min1[pos])) continue;
+    if (!found)
     {
-      maxX = points.back().t + (NumMaxGraphPoints-points.size())*deltaT;
+      Min1 = B->min1[pos]; Max1 = B->max1[pos];
+      Min2 = B->min2[pos]; Max2 = B->max2[pos];
+      found = true;
     }
     else
     {
-      maxX = points.back().t;
+      Min1 = std::min(Min1, B->min1[pos]); Max1 = std::max(Max1, B->max1[pos]);
+      Min2 = std::min(Min2, B->min2[pos]); Max2 = std::max(Max2, B->max2[pos]);
     }
-    maxY = MaxTankLevelMeasurement;
-    // Dimensoes da imagem
-    imgWidthPx = width();
-    imgHeightPx = height();
+  }
+  return found;
+}
+
+/// Desenha uma imagem vazia
+void SupImg::drawBlank()
+{
+  img = QImage(widthPx,heightPx,QImage::Format_ARGB32_Premultiplied);
+  img.fill(Qt::white);
+}
+
+/// Desenha o nivel atual dos tanques
+void SupImg::drawLevel()
+{
+  // Os limites no eixo horizontal (X) e vertical (Y), em unidades fisicas
+  double minX, maxX;
+  double /*minY=0.0,*/ maxY;
+
+  // As dimensoes da imagem (pixels)
+  int imgWidthPx, imgHeightPx;
+
+  //
+  // DIMENSIONA IMAGEM PARA OS TANQUES
+  //
+
+  // Limites do desenho
+  minX = 0.0;
+  maxX = Tank1Width + Tank2Width;
+  maxY = TankHeight;
+  // Dimensoes da imagem
+  if ((widthPx-2*imgMarginPx)/maxX >= (heightPx-2*imgMarginPx)/maxY)
+  {
+    // A janela eh mais larga que alta
+    imgHeightPx = heightPx;
+    imgWidthPx = std::round((imgHeightPx-2*imgMarginPx)*(maxX/maxY) + 2*imgMarginPx);
+  }
+  else
+  {
+    // A janela eh mais alta que larga
+    imgWidthPx = widthPx;
+    imgHeightPx = std::round((imgWidthPx-2*imgMarginPx)*(maxY/maxX) + 2*imgMarginPx);
   }
 
   // A funcao que converte de X para coordenada horizontal
@@ -196,7 +578,7 @@ void SupImg::drawImg()
   };
 
   // Cria e preenche a imagem
-  img = QPixmap(imgWidthPx,imgHeightPx);
+  img = QImage(imgWidthPx,imgHeightPx,QImage::Format_ARGB32_Premultiplied);
   img.fill(Qt::white);
 
   // Os elementos para desenho
@@ -206,93 +588,137 @@ void SupImg::drawImg()
   // Inicia o desenho na imagem
   painter.begin(&img);
 
-  if (displayLevel)
-  {
-    //
-    // DESENHA OS TANQUES
-    //
+  //
+  // DESENHA OS TANQUES
+  //
+
+  // Os fluidos (conteudo dos tanques)
+  // Nao precisa testar se hist.empty(), pois essa condicao jah eh testada antes e encerra a funcao
+  Point P = point(hist.size()-1);
+  pen.setWidth(0);
+  pen.setColor(Qt::cyan);
+  painter.setPen(pen);
+  painter.fillRect(convX(0.0),convY(P.h1),
+                   convDeltaX(Tank1Width),convDeltaY(P.h1),Qt::cyan);
+  painter.fillRect(convX(Tank1Width),convY(P.h2),
+                   convDeltaX(Tank2Width),convDeltaY(P.h2),Qt::cyan);
 
-    // Os fluidos (conteudo dos tanques)
-    // Nao precisa testar se points.empty(), pois essa condicao jah eh testada antes e encerra a funcao
-    Point P = points.back();
-    pen.setWidth(0);
+  // As paredes dos tanques
+  pen.setWidth(3);
+  pen.setColor(Qt::black);
+  painter.setPen(pen);
+  // Tanque 1
+  painter.drawLine(convX(0.0),convY(0.0), convX(0.0),convY(TankHeight));
+  painter.drawLine(convX(0.0),convY(0.0), convX(Tank1Width),convY(0.0));
+  painter.drawLine(convX(Tank1Width),convY(0.0), convX(Tank1Width),convY(TankHeight));
+  // Tanque 2
+  painter.drawLine(convX(Tank1Width),convY(0.0), convX(Tank1Width+Tank2Width),convY(0.0));
+  painter.drawLine(convX(Tank1Width+Tank2Width),convY(0.0), convX(Tank1Width+Tank2Width),convY(TankHeight));
+
+  // As aberturas: orificios e valvulas
+  pen.setWidth(3);
+  // O triangulo para desenhar os escoamentos pelos orificios
+  QPolygonF triangle(3);
+  // A dimensao das aberturas (pixels)
+  const int holePx = 20;
+  // O orificio entre os tanques
+  if ( (convY(P.h1)<=convY(Hole12Height)-holePx &&
+        convY(P.h2)<=convY(Hole12Height)-holePx) )
+  {
+    // Os dois niveis estao acima da borda superior do orificio
     pen.setColor(Qt::cyan);
     painter.setPen(pen);
-    painter.fillRect(convX(0.0),convY(P.h1),
-                     convDeltaX(Tank1Width),convDeltaY(P.h1),Qt::cyan);
-    painter.fillRect(convX(Tank1Width),convY(P.h2),
-                     convDeltaX(Tank2Width),convDeltaY(P.h2),Qt::cyan);
-
-    // As paredes dos tanques
-    pen.setWidth(3);
-    pen.setColor(Qt::black);
+  }
+  else if ( (P.h1<=Hole12Height &&
+             P.h2<=Hole12Height) )
+  {
+    // Os dois niveis estao abaixo da borda inferior do orificio
+    pen.setColor(Qt::white);
     painter.setPen(pen);
-    // Tanque 1
-    painter.drawLine(convX(0.0),convY(0.0), convX(0.0),convY(TankHeight));
-    painter.drawLine(convX(0.0),convY(0.0), convX(Tank1Width),convY(0.0));
-    painter.drawLine(convX(Tank1Width),convY(0.0), convX(Tank1Width),convY(TankHeight));
-    // Tanque 2
-    painter.drawLine(convX(Tank1Width),convY(0.0), convX(Tank1Width+Tank2Width),convY(0.0));
-    painter.drawLine(convX(Tank1Width+Tank2Width),convY(0.0), convX(Tank1Width+Tank2Width),convY(TankHeight));
-
-    // As aberturas: orificios e valvulas
-    pen.setWidth(3);
-    // O triangulo para desenhar os escoamentos pelos orificios
-    QPolygonF triangle(3);
-    // A dimensao das aberturas (pixels)
-    const int holePx = 20;
-    // O orificio entre os tanques
-    if ( (convY(P.h1)<=convY(Hole12Height)-holePx &&
-          convY(P.h2)<=convY(Hole12Height)-holePx) )
+  }
+  else
+  {
+    // Um nivel acima e outro abaixo do orificio
+    pen.setColor(Qt::cyan);
+    painter.setPen(pen);
+    painter.setBrush(Qt::cyan);
+
+    double ySup,yInf;
+    if (P.h1>P.h2)
     {
-      // Os dois niveis estao acima da borda superior do orificio
-      pen.setColor(Qt::cyan);
-      painter.setPen(pen);
+      // Escoamento de T1 para T2
+      ySup = std::max(convY(P.h1), convY(Hole12Height)-holePx);
+      yInf = std::min(convY(P.h2), convY(Hole12Height));
+      triangle[0] = QPointF(convX(Tank1Width)+holePx,yInf);
     }
-    else if ( (P.h1<=Hole12Height &&
-               P.h2<=Hole12Height) )
+    else
     {
-      // Os dois niveis estao abaixo da borda inferior do orificio
-      pen.setColor(Qt::white);
-      painter.setPen(pen);
+      // Escoamento de T2 para T1
+      ySup = std::max(convY(P.h2), convY(Hole12Height)-holePx);
+      yInf = std::min(convY(P.h1), convY(Hole12Height));
+      triangle[0] = QPointF(convX(Tank1Width)-holePx, yInf);
     }
-    else
+    triangle[1] = QPointF(convX(Tank1Width), yInf);
+    triangle[2] = QPointF(convX(Tank1Width), ySup);
+    painter.drawPolygon(triangle);
+  }
+  painter.drawLine(convX(Tank1Width), convY(Hole12Height),
+                   convX(Tank1Width), convY(Hole12Height)-holePx);
+  // O orificio de transbordamento
+  if (P.h1>OverflowHeight)
+  {
+    pen.setColor(Qt::cyan);
+    painter.setPen(pen);
+    painter.setBrush(Qt::cyan);
+    triangle[0] = QPointF(convX(0.0)-holePx, convY(OverflowHeight));
+    triangle[1] = QPointF(convX(0.0), convY(OverflowHeight));
+    triangle[2] = QPointF(convX(0.0), std::max(convY(P.h1),convY(OverflowHeight)-holePx));
+    painter.drawPolygon(triangle);
+  }
+  else
+  {
+    pen.setColor(Qt::white);
+    painter.setPen(pen);
+  }
+  painter.drawLine(convX(0.0), convY(OverflowHeight),
+                   convX(0.0), convY(OverflowHeight)-holePx);
+  if (overflow)
+  {
+    // Desenha o icone de advertencia de transbordamento
+    painter.drawImage(QPointF(convX(0.0)+imgMarginPx/2, convY(OverflowHeight)), alert);
+  }
+  // A valvula 1
+  if (V1Open)
+  {
+    if (P.h1>0.0)
     {
-      // Um nivel acima e outro abaixo do orificio
       pen.setColor(Qt::cyan);
       painter.setPen(pen);
       painter.setBrush(Qt::cyan);
-
-      double ySup,yInf;
-      if (P.h1>P.h2)
-      {
-        // Escoamento de T1 para T2
-        ySup = std::max(convY(P.h1), convY(Hole12Height)-holePx);
-        yInf = std::min(convY(P.h2), convY(Hole12Height));
-        triangle[0] = QPointF(convX(Tank1Width)+holePx,yInf);
-      }
-      else
-      {
-        // Escoamento de T2 para T1
-        ySup = std::max(convY(P.h2), convY(Hole12Height)-holePx);
-        yInf = std::min(convY(P.h1), convY(Hole12Height));
-        triangle[0] = QPointF(convX(Tank1Width)-holePx, yInf);
-      }
-      triangle[1] = QPointF(convX(Tank1Width), yInf);
-      triangle[2] = QPointF(convX(Tank1Width), ySup);
+      triangle[0] = QPointF(convX(Tank1Width/2.0)-holePx/2.0, convY(0.0));
+      triangle[1] = QPointF(convX(Tank1Width/2.0)+holePx/2.0, convY(0.0));
+      triangle[2] = QPointF(convX(Tank1Width/2.0), convY(0.0)+holePx);
       painter.drawPolygon(triangle);
     }
-    painter.drawLine(convX(Tank1Width), convY(Hole12Height),
-                     convX(Tank1Width), convY(Hole12Height)-holePx);
-    // O orificio de transbordamento
-    if (P.h1>OverflowHeight)
+    else
+    {
+      pen.setColor(Qt::white);
+      painter.setPen(pen);
+    }
+    painter.drawLine(convX(Tank1Width/2.0)-holePx/2.0, convY(0.0),
+                     convX(Tank1Width/2.0)+holePx/2.0, convY(0.0));
+  }
+  // A valvula 2
+  if (V2Open)
+  {
+    if (P.h2>0.0)
     {
       pen.setColor(Qt::cyan);
       painter.setPen(pen);
       painter.setBrush(Qt::cyan);
-      triangle[0] = QPointF(convX(0.0)-holePx, convY(OverflowHeight));
-      triangle[1] = QPointF(convX(0.0), convY(OverflowHeight));
-      triangle[2] = QPointF(convX(0.0), std::max(convY(P.h1),convY(OverflowHeight)-holePx));
+      triangle[0] = QPointF(convX(Tank1Width+Tank2Width/2.0)-holePx/2.0, convY(0.0));
+      triangle[1] = QPointF(convX(Tank1Width+Tank2Width/2.0)+holePx/2.0, convY(0.0));
+      triangle[2] = QPointF(convX(Tank1Width+Tank2Width/2.0), convY(0.0)+holePx);
       painter.drawPolygon(triangle);
     }
     else
@@ -300,194 +726,492 @@ void SupImg::drawImg()
       pen.setColor(Qt::white);
       painter.setPen(pen);
     }
-    painter.drawLine(convX(0.0), convY(OverflowHeight),
-                     convX(0.0), convY(OverflowHeight)-holePx);
-    if (overflow)
+    painter.drawLine(convX(Tank1Width+Tank2Width/2.0)-holePx/2.0, convY(0.0),
+                     convX(Tank1Width+Tank2Width/2.0)+holePx/2.0, convY(0.0));
+  }
+
+  // Os titulos dos tanques
+  QFont font = painter.font();
+  font.setPixelSize(fontSizePx);
+  painter.setFont(font);
+  pen.setWidth(1);
+  pen.setColor(Qt::black);
+  painter.setPen(pen);
+  // Tanque 1
+  painter.drawText(QRectF(convX(0.0),convY(TankHeight)-imgMarginPx,
+                          convDeltaX(Tank1Width), imgMarginPx),
+                   Qt::AlignCenter,
+                   "Tank 1");
+  // Tanque 2
+  painter.drawText(QRectF(convX(Tank1Width),convY(TankHeight)-imgMarginPx,
+                          convDeltaX(Tank2Width), imgMarginPx),
+                   Qt::AlignCenter,
+                   "Tank 2");
+
+  // Conclui o desenho
+  painter.end();
+}
+
+/// Redesenha as camadas do grafico a partir de todos os pontos.
+/// Fixa a escala do eixo horizontal, que soh eh alterada na proxima
+/// chamada desta funcao. Com zoom, os periodos anteriores ao historico
+/// local sao desenhados a partir dos blocos do historico do servidor.
+void SupImg::drawGraph()
+{
+  // As dimensoes da imagem (pixels)
+  const int imgWidthPx = widthPx;
+  const int imgHeightPx = heightPx;
+  // A largura da area das curvas (pixels)
+  const int plotWidthPx = imgWidthPx-1 - 2*imgMarginPx;
+  // O limite no eixo vertical (Y), em unidades fisicas
+  const double maxY = MaxTankLevelMeasurement;
+
+  //
+  // ESCALA DO EIXO HORIZONTAL
+  //
+
+  // Sem zoom, o grafico exibe todo o historico, a partir do primeiro ponto. Inicialmente,
+  // cabem NumMaxGraphPoints pontos; o intervalo eh dobrado ateh caber todo o historico.
+  // Com zoom, exibe o intervalo escolhido.
+  // Nao precisa testar se hist.empty(), pois essa condicao jah eh testada antes
+  const size_t n = hist.size();
+  if (live)
+  {
+    graphT0 = hist.t(0);
+    graphSpan = (NumMaxGraphPoints-1)*deltaT;
+    if (graphSpan <= 0.0) graphSpan = (NumMaxGraphPoints-1)*1.0;
+    while (hist.t(n-1)-graphT0 > graphSpan) graphSpan *= 2.0;
+    graphPxPerSec = plotWidthPx/graphSpan;
+    graphLeftPx = std::max(0, int(std::ceil((hist.t(n-1)-graphT0)*graphPxPerSec)) - plotWidthPx);
+  }
+  else
+  {
+    graphT0 = viewT0;
+    graphSpan = viewSpan;
+    graphPxPerSec = plotWidthPx/graphSpan;
+    graphLeftPx = 0;
+  }
+
+  // Os limites no eixo horizontal (X) usados na camada estatica
+  const double minX = 0.0, maxX = graphSpan;
+
+  // A funcao que converte de X para coordenada horizontal
+  auto convX = [&](double X) -> double
+  {
+    return imgMarginPx + ((X-minX)/(maxX-minX))*plotWidthPx;
+  };
+  // A funcao que converte de Y para coordenada vertical
+  auto convY = [&](double Y) -> double
+  {
+    return imgHeightPx-1-imgMarginPx - (Y/maxY)*(imgHeightPx-1 - 2*imgMarginPx);
+  };
+
+  //
+  // DESENHA A CAMADA ESTATICA
+  //
+
+  // Cria e preenche a imagem
+  graphStatic = QImage(imgWidthPx,imgHeightPx,QImage::Format_ARGB32_Premultiplied);
+  graphStatic.fill(Qt::white);
+
+  // Os elementos para desenho
+  QPen pen;
+  QPainter painter;
+
+  // Inicia o desenho na camada estatica
+  painter.begin(&graphStatic);
+
+  // Os eixos
+  pen.setWidth(2);
+  pen.setColor(Qt::black);
+  painter.setPen(pen);
+  // Eixo horixontal
+  painter.drawLine(convX(minX),convY(0.0), convX(maxX),convY(0.0));
+  // Eixo vertical
+  painter.drawLine(convX(minX),convY(0.0), convX(minX),convY(maxY));
+
+  // A indicacao das alturas dos orificios (linha tracejada no grafico)
+  pen.setStyle(Qt::DashLine);
+  pen.setWidth(1);
+  painter.setPen(pen);
+  // O orificio entre os tanques
+  painter.drawLine(convX(minX),convY(Hole12Height), convX(maxX),convY(Hole12Height));
+  // O orificio de transbordamento
+  painter.drawLine(convX(minX),convY(OverflowHeight), convX(maxX),convY(OverflowHeight));
+
+  // Os titulos dos eixos
+  pen.setStyle(Qt::SolidLine);
+  QFont font = painter.font();
+  font.setPixelSize(fontSizePx);
+  painter.setFont(font);
+  pen.setWidth(1);
+  pen.setColor(Qt::black);
+  painter.setPen(pen);
+  // Eixo horixontal
+  painter.drawText(QRectF(convX(maxX)+imgMarginPx/5.0, convY(0.0)-imgMarginPx/2.0,
+                          4.0*imgMarginPx/5.0, imgMarginPx),
+                   Qt::AlignVCenter|Qt::AlignLeft,
+                   "t");
+  // Eixo vertical
+  painter.drawText(QRectF(convX(minX)-imgMarginPx/2.0, 0.0,
+                          imgMarginPx, 4.0*imgMarginPx/5.0),
+                   Qt::AlignHCenter|Qt::AlignBottom,
+                   "h");
+  // Os limites dos eixos que nao mudam quando o grafico avanca no tempo
+  font.setPixelSize(2*fontSizePx/3);
+  painter.setFont(font);
+  // Eixo vertical
+  painter.drawText(QRectF(0, convY(0.0)-imgMarginPx,
+                          4.0*imgMarginPx/5.0, imgMarginPx),
+                   Qt::AlignBottom|Qt::AlignRight,
+                   QString::number(0.0));
+  painter.drawText(QRectF(0, convY(maxY),
+                          4.0*imgMarginPx/5.0, imgMarginPx),
+                   Qt::AlignTop|Qt::AlignRight,
+                   QString::number(100.0*maxY)); // maxY em m; 100*maxY em cm
+  painter.drawText(QRectF(0, 0,
+                          4.0*imgMarginPx/5.0, 4.0*imgMarginPx/5.0),
+                   Qt::AlignBottom|Qt::AlignRight,
+                   "cm");
+  // Eixo horizontal
+  painter.drawText(QRectF(convX(maxX)+imgMarginPx/5.0, convY(0.0)+imgMarginPx/5.0,
+                          4.0*imgMarginPx/5.0, 4.0*imgMarginPx/5.0),
+                   Qt::AlignTop|Qt::AlignLeft,
+                   "min");
+  // Legenda das curvas
+  // H1
+  pen.setColor(Qt::blue);
+  painter.setPen(pen);
+  painter.drawText(QRectF(convX((maxX+minX)/2.0)-3.0*imgMarginPx, 0.0,
+                          3.0*imgMarginPx, 4.0*imgMarginPx/5.0),
+                   Qt::AlignRight|Qt::AlignBottom,
+                   "h1 ");
+  // H2
+  pen.setColor(Qt::red);
+  painter.setPen(pen);
+  painter.drawText(QRectF(convX((maxX+minX)/2.0), 0.0,
+                          3.0*imgMarginPx, 4.0*imgMarginPx/5.0),
+                   Qt::AlignLeft|Qt::AlignBottom,
+                   " h2");
+
+  // Conclui o desenho da camada estatica
+  painter.end();
+
+  //
+  // DESENHA A CAMADA DAS CURVAS
+  //
+
+  graphPlot = QImage(imgWidthPx,imgHeightPx,QImage::Format_ARGB32_Premultiplied);
+  graphPlot.fill(Qt::transparent);
+
+  // O historico do servidor soh eh usado com zoom
+  const bool useServer = (!live && origin_ok);
+
+  if (n > 1 || useServer)
+  {
+    // A funcao que converte um instante para coordenada horizontal
+    auto convT = [&](double T) -> double
+    {
+      return imgMarginPx + (T-graphT0)*graphPxPerSec - graphLeftPx;
+    };
+
+    // As curvas sao desenhadas como duas polilinhas, com no maximo 4 vertices
+    // por coluna de pixels: o primeiro ponto, o minimo, o maximo e o ultimo
+    // ponto da coluna. Assim, o custo depende da largura da imagem, e nao do
+    // tamanho do historico, e nenhum pico eh perdido.
+    QPolygonF curve1, curve2;
+    curve1.reserve(4*(plotWidthPx+1));
+    curve2.reserve(4*(plotWidthPx+1));
+    // Nas colunas anteriores ao primeiro ponto local, as curvas vem do
+    // historico do servidor, no nivel de resolucao em que cada intervalo
+    // nao eh maior do que uma coluna de pixels
+    const double tFirst = hist.t(0);
+    uint16_t histLevel = 0;
+    const double bucketsPerPx = (1.0/graphPxPerSec)/(SUP_HISTORY_PERIOD/1000.0);
+    if (bucketsPerPx > 1.0)
     {
-      // Desenha o icone de advertencia de transbordamento
-      painter.drawPixmap(convX(0.0)+imgMarginPx/2, convY(OverflowHeight), alert);
+      histLevel = uint16_t(std::min(double(SUP_HISTORY_MAX_LEVEL), std::floor(std::log2(bucketsPerPx))));
     }
-    // A valvula 1
-    if (V1Open)
+    // O primeiro ponto na primeira coluna visivel
+    size_t a = hist.lower_bound(graphT0 + graphLeftPx/graphPxPerSec);
+    // Inclui o ponto anterior, para ligar a curva ateh a borda esquerda
+    if (a > 0) --a;
+    for (int col=0; col<=plotWidthPx && (a<n || useServer); ++col)
     {
-      if (P.h1>0.0)
-      {
-        pen.setColor(Qt::cyan);
-        painter.setPen(pen);
-        painter.setBrush(Qt::cyan);
-        triangle[0] = QPointF(convX(Tank1Width/2.0)-holePx/2.0, convY(0.0));
-        triangle[1] = QPointF(convX(Tank1Width/2.0)+holePx/2.0, convY(0.0));
-        triangle[2] = QPointF(convX(Tank1Width/2.0), convY(0.0)+holePx);
-        painter.drawPolygon(triangle);
-      }
-      else
+      // O intervalo de tempo da coluna: [c0, c1)
+      const double c0 = graphT0 + (graphLeftPx+col)/graphPxPerSec;
+      const double c1 = graphT0 + (graphLeftPx+col+1)/graphPxPerSec;
+      // Os pontos da coluna: [a, b)
+      size_t b = (a<n ? hist.lower_bound(c1, a) : n);
+      // O trecho da coluna anterior ao historico local
+      float min1, max1, min2, max2;
+      if (useServer && c0 < tFirst &&
+          serverMinMax(c0+origin, std::min(c1,tFirst)+origin, histLevel,
+                       min1, max1, min2, max2))
       {
-        pen.setColor(Qt::white);
-        painter.setPen(pen);
+        if (b > a)
+        {
+          float m1, M1, m2, M2;
+          hist.minmax(a, b, m1, M1, m2, M2);
+          min1 = std::min(min1, m1); max1 = std::max(max1, M1);
+          min2 = std::min(min2, m2); max2 = std::max(max2, M2);
+        }
+        const double x = imgMarginPx + col;
+        curve1.append(QPointF(x, convY(min1)));
+        curve1.append(QPointF(x, convY(max1)));
+        curve2.append(QPointF(x, convY(min2)));
+        curve2.append(QPointF(x, convY(max2)));
+        a = b;
+        continue;
       }
-      painter.drawLine(convX(Tank1Width/2.0)-holePx/2.0, convY(0.0),
-                       convX(Tank1Width/2.0)+holePx/2.0, convY(0.0));
-    }
-    // A valvula 2
-    if (V2Open)
-    {
-      if (P.h2>0.0)
+      if (b == a) continue;
+      if (b == a+1)
       {
-        pen.setColor(Qt::cyan);
-        painter.setPen(pen);
-        painter.setBrush(Qt::cyan);
-        triangle[0] = QPointF(convX(Tank1Width+Tank2Width/2.0)-holePx/2.0, convY(0.0));
-        triangle[1] = QPointF(convX(Tank1Width+Tank2Width/2.0)+holePx/2.0, convY(0.0));
-        triangle[2] = QPointF(convX(Tank1Width+Tank2Width/2.0), convY(0.0)+holePx);
-        painter.drawPolygon(triangle);
+        // Um unico ponto: eh desenhado no seu instante exato
+        curve1.append(QPointF(convT(hist.t(a)), convY(hist.h1(a))));
+        curve2.append(QPointF(convT(hist.t(a)), convY(hist.h2(a))));
       }
       else
       {
-        pen.setColor(Qt::white);
-        painter.setPen(pen);
+        hist.minmax(a, b, min1, max1, min2, max2);
+        const double x = imgMarginPx + col;
+        curve1.append(QPointF(x, convY(hist.h1(a))));
+        curve1.append(QPointF(x, convY(min1)));
+        curve1.append(QPointF(x, convY(max1)));
+        curve1.append(QPointF(x, convY(hist.h1(b-1))));
+        curve2.append(QPointF(x, convY(hist.h2(a))));
+        curve2.append(QPointF(x, convY(min2)));
+        curve2.append(QPointF(x, convY(max2)));
+        curve2.append(QPointF(x, convY(hist.h2(b-1))));
       }
-      painter.drawLine(convX(Tank1Width+Tank2Width/2.0)-holePx/2.0, convY(0.0),
-                       convX(Tank1Width+Tank2Width/2.0)+holePx/2.0, convY(0.0));
+      a = b;
     }
 
-    // Os titulos dos tanques
-    QFont font = painter.font();
-    font.setPixelSize(fontSizePx);
-    painter.setFont(font);
+    painter.begin(&graphPlot);
+    // As curvas soh sao desenhadas entre os limites do eixo horizontal
+    painter.setClipRect(imgMarginPx, 0, plotWidthPx+1, imgHeightPx);
+
+    // As curvas dos niveis dos tanques
+    pen.setStyle(Qt::SolidLine);
     pen.setWidth(1);
-    pen.setColor(Qt::black);
+    // O nivel H1
+    pen.setColor(Qt::blue);
     painter.setPen(pen);
-    // Tanque 1
-    painter.drawText(QRectF(convX(0.0),convY(TankHeight)-imgMarginPx,
-                            convDeltaX(Tank1Width), imgMarginPx),
-                     Qt::AlignCenter,
-                     "Tank 1");
-    // Tanque 2
-    painter.drawText(QRectF(convX(Tank1Width),convY(TankHeight)-imgMarginPx,
-                            convDeltaX(Tank2Width), imgMarginPx),
-                     Qt::AlignCenter,
-                     "Tank 2");
+    painter.drawPolyline(curve1);
+    // O nivel H2
+    pen.setColor(Qt::red);
+    painter.setPen(pen);
+    painter.drawPolyline(curve2);
+
+    painter.end();
   }
-  else
-  {
-    //
-    // DESENHA O GRAFICO
-    //
+}
 
-    // Os eixos
-    pen.setWidth(2);
-    pen.setColor(Qt::black);
-    painter.setPen(pen);
-    // Eixo horixontal
-    painter.drawLine(convX(minX),convY(0.0), convX(maxX),convY(0.0));
-    // Eixo vertical
-    painter.drawLine(convX(minX),convY(0.0), convX(minX),convY(maxY));
+/// Desenha na camada das curvas apenas o segmento entre os pontos i-1 e i.
+/// Se o ponto i estiver alem da borda direita do grafico, as curvas anteriores
+/// sao deslocadas para a esquerda de um numero inteiro de pixels.
+void SupImg::drawGraphSegment(size_t i)
+{
+  // Precisa de i>=1, o que jah foi testado antes
+  const Point P0 = point(i-1);
+  const Point P1 = point(i);
 
-    // A indicacao das alturas dos orificios (linha tracejada no grafico)
-    pen.setStyle(Qt::DashLine);
-    pen.setWidth(1);
-    painter.setPen(pen);
-    // O orificio entre os tanques
-    painter.drawLine(convX(minX),convY(Hole12Height), convX(maxX),convY(Hole12Height));
-    // O orificio de transbordamento
-    painter.drawLine(convX(minX),convY(OverflowHeight), convX(maxX),convY(OverflowHeight));
+  // As dimensoes da imagem (pixels)
+  const int imgHeightPx = graphPlot.height();
+  // A largura da area das curvas (pixels)
+  const int plotWidthPx = graphPlot.width()-1 - 2*imgMarginPx;
+  // O limite no eixo vertical (Y), em unidades fisicas
+  const double maxY = MaxTankLevelMeasurement;
 
-    // As curvas dos niveis dos tanques
-    pen.setStyle(Qt::SolidLine);
-    pen.setWidth(1);
-    if (points.size() > 1)
+  // Desloca as curvas, se necessario
+  int newLeftPx = int(std::ceil((P1.t-graphT0)*graphPxPerSec)) - plotWidthPx;
+  if (newLeftPx > graphLeftPx)
+  {
+    int shiftPx = newLeftPx - graphLeftPx;
+    QRect plotRect(imgMarginPx, 0, plotWidthPx+1, imgHeightPx);
+    if (shiftPx < plotRect.width())
     {
-      // O nivel H1
-      pen.setColor(Qt::blue);
-      painter.setPen(pen);
-      for (unsigned i=1; i<points.size(); ++i)
-      {
-        painter.drawLine(convX(points[i-1].t),convY(points[i-1].h1), convX(points[i].t),convY(points[i].h1));
-      }
-
-      // O nivel H2
-      pen.setColor(Qt::red);
-      painter.setPen(pen);
-      for (unsigned i=1; i<points.size(); ++i)
+      // Desloca cada linha da imagem e limpa a faixa que ficou exposta na direita
+      // (4 bytes por pixel no formato ARGB32; transparente eh 0)
+      const int keepBytes = 4*(plotRect.width()-shiftPx);
+      for (int y=0; y<imgHeightPx; ++y)
       {
-        painter.drawLine(convX(points[i-1].t),convY(points[i-1].h2), convX(points[i].t),convY(points[i].h2));
+        uchar* line = graphPlot.scanLine(y) + 4*plotRect.left();
+        memmove(line, line + 4*shiftPx, keepBytes);
+        memset(line + keepBytes, 0, 4*shiftPx);
       }
     }
-
-    // Os titulos dos eixos
-    QFont font = painter.font();
-    font.setPixelSize(fontSizePx);
-    painter.setFont(font);
-    pen.setWidth(1);
-    pen.setColor(Qt::black);
-    painter.setPen(pen);
-    // Eixo horixontal
-    painter.drawText(QRectF(convX(maxX)+imgMarginPx/5.0, convY(0.0)-imgMarginPx/2.0,
-                            4.0*imgMarginPx/5.0, imgMarginPx),
-                     Qt::AlignVCenter|Qt::AlignLeft,
-                     "t");
-    // Eixo vertical
-    painter.drawText(QRectF(convX(minX)-imgMarginPx/2.0, 0.0,
-                            imgMarginPx, 4.0*imgMarginPx/5.0),
-                     Qt::AlignHCenter|Qt::AlignBottom,
-                     "h");
-    // Os limites dos eixos
-    font.setPixelSize(2*fontSizePx/3);
-    painter.setFont(font);
-    // Eixo horixontal
-    painter.drawText(QRectF(0, convY(0.0)-imgMarginPx,
-                            4.0*imgMarginPx/5.0, imgMarginPx),
-                     Qt::AlignBottom|Qt::AlignRight,
-                     QString::number(0.0));
-    painter.drawText(QRectF(0, convY(maxY),
-                            4.0*imgMarginPx/5.0, imgMarginPx),
-                     Qt::AlignTop|Qt::AlignRight,
-                     QString::number(100.0*maxY)); // maxY em m; 100*maxY em cm
-    painter.drawText(QRectF(0, 0,
-                            4.0*imgMarginPx/5.0, 4.0*imgMarginPx/5.0),
-                     Qt::AlignBottom|Qt::AlignRight,
-                     "cm");
-    // Eixo vertical
-    painter.drawText(QRectF(convX(minX), convY(0.0)+imgMarginPx/5.0,
-                            imgMarginPx, 4.0*imgMarginPx/5.0),
-                     Qt::AlignTop|Qt::AlignLeft,
-                     QString::number(int(round(minX/60.0)))); // minX em s; minX/60 em min
-    painter.drawText(QRectF(convX(maxX)-imgMarginPx, convY(0.0)+imgMarginPx/5.0,
-                            imgMarginPx, 4.0*imgMarginPx/5.0),
-                     Qt::AlignTop|Qt::AlignRight,
-                     QString::number(int(round(maxX/60.0)))); // maxX em s; maxX/60 em min
-    painter.drawText(QRectF(convX(maxX)+imgMarginPx/5.0, convY(0.0)+imgMarginPx/5.0,
-                            4.0*imgMarginPx/5.0, 4.0*imgMarginPx/5.0),
-                     Qt::AlignTop|Qt::AlignLeft,
-                     "min");
-    // Legenda das curvas
-    // H1
-    pen.setColor(Qt::blue);
-    painter.setPen(pen);
-    painter.drawText(QRectF(convX((maxX+minX)/2.0)-3.0*imgMarginPx, 0.0,
-                            3.0*imgMarginPx, 4.0*imgMarginPx/5.0),
-                     Qt::AlignRight|Qt::AlignBottom,
-                     "h1 ");
-    // H2
-    pen.setColor(Qt::red);
-    painter.setPen(pen);
-    painter.drawText(QRectF(convX((maxX+minX)/2.0), 0.0,
-                            3.0*imgMarginPx, 4.0*imgMarginPx/5.0),
-                     Qt::AlignLeft|Qt::AlignBottom,
-                     " h2");
+    else
+    {
+      graphPlot.fill(Qt::transparent);
+    }
+    graphLeftPx = newLeftPx;
   }
 
-  // Conclui o desenho
-  painter.end();
+  // As funcoes que convertem para coordenadas da imagem
+  auto convT = [&](double T) -> double
+  {
+    return imgMarginPx + (T-graphT0)*graphPxPerSec - graphLeftPx;
+  };
+  auto convY = [&](double Y) -> double
+  {
+    return imgHeightPx-1-imgMarginPx - (Y/maxY)*(imgHeightPx-1 - 2*imgMarginPx);
+  };
 
-  // Exibe a imagem no QLabel
-  setPixmap(img);
+  // Desenha o novo segmento das duas curvas
+  QPen pen;
+  QPainter painter(&graphPlot);
+  painter.setClipRect(imgMarginPx, 0, plotWidthPx+1, imgHeightPx);
+  pen.setWidth(1);
+  pen.setColor(Qt::blue);
+  painter.setPen(pen);
+  painter.drawLine(QPointF(convT(P0.t),convY(P0.h1)), QPointF(convT(P1.t),convY(P1.h1)));
+  pen.setColor(Qt::red);
+  painter.setPen(pen);
+  painter.drawLine(QPointF(convT(P0.t),convY(P0.h2)), QPointF(convT(P1.t),convY(P1.h2)));
+}
+
+/// Compoe a imagem exibida a partir das camadas do grafico.
+/// Soh os limites do eixo do tempo, que mudam quando o grafico avanca,
+/// sao desenhados novamente.
+void SupImg::composeGraph()
+{
+  // As dimensoes da imagem (pixels)
+  const int imgWidthPx = graphStatic.width();
+  const int imgHeightPx = graphStatic.height();
+  // A largura da area das curvas (pixels)
+  const int plotWidthPx = imgWidthPx-1 - 2*imgMarginPx;
+
+  // Os limites atuais do eixo horizontal (em segundos)
+  const double minX = graphT0 + graphLeftPx/graphPxPerSec;
+  const double maxX = minX + graphSpan;
+
+  // As coordenadas das extremidades do eixo horizontal
+  const double x0 = imgMarginPx, x1 = imgMarginPx + plotWidthPx;
+  const double y0 = imgHeightPx-1-imgMarginPx;
+
+  // A imagem exibida comeca como uma copia da camada estatica
+  img = graphStatic;
+
+  QPen pen;
+  QPainter painter;
+  painter.begin(&img);
+  // As curvas
+  painter.drawImage(0, 0, graphPlot);
+  // Os limites do eixo horizontal
+  QFont font = painter.font();
+  font.setPixelSize(2*fontSizePx/3);
+  painter.setFont(font);
+  pen.setWidth(1);
+  pen.setColor(Qt::black);
+  painter.setPen(pen);
+  painter.drawText(QRectF(x0, y0+imgMarginPx/5.0,
+                          imgMarginPx, 4.0*imgMarginPx/5.0),
+                   Qt::AlignTop|Qt::AlignLeft,
+                   QString::number(int(round(minX/60.0)))); // minX em s; minX/60 em min
+  painter.drawText(QRectF(x1-imgMarginPx, y0+imgMarginPx/5.0,
+                          imgMarginPx, 4.0*imgMarginPx/5.0),
+                   Qt::AlignTop|Qt::AlignRight,
+                   QString::number(int(round(maxX/60.0)))); // maxX em s; maxX/60 em min
+  painter.end();
 }
 
 void SupImg::resizeEvent(QResizeEvent* event)
 {
   if (event->size() != event->oldSize())
   {
-    drawImg();
+    // A thread de desenho redesenha tudo com as novas dimensoes
+    std::lock_guard<std::mutex> lock(mtx_render);
+    reqWidthPx = event->size().width();
+    reqHeightPx = event->size().height();
+    hasWork = true;
+    cv_render.notify_one();
+  }
+}
+
+/// Solicita a exibicao do intervalo de tempo [T0, T0+Span] no grafico
+void SupImg::requestView(double T0, double Span)
+{
+  // Deve ser chamada com mtx_render travado
+  shownT0 = T0;
+  shownSpan = Span;
+  reqLive = false;
+  reqViewT0 = T0;
+  reqViewSpan = Span;
+  hasWork = true;
+  cv_render.notify_one();
+}
+
+/// A roda do mouse altera o zoom, mantendo fixo o instante sob o cursor
+void SupImg::wheelEvent(QWheelEvent* event)
+{
+  // A largura da area das curvas (pixels)
+  const int plotWidthPx = width()-1 - 2*imgMarginPx;
+
+  std::lock_guard<std::mutex> lock(mtx_render);
+  // Nao ha zoom na exibicao do nivel atual dos tanques
+  if (reqLevel || shownSpan <= 0.0 || plotWidthPx <= 0)
+  {
+    event->ignore();
+    return;
+  }
+  // A posicao relativa do cursor no eixo horizontal e o instante correspondente
+  const double f = std::clamp((event->position().x()-imgMarginPx)/plotWidthPx, 0.0, 1.0);
+  const double T = shownT0 + f*shownSpan;
+  // Cada passo da roda (120) reduz ou aumenta o intervalo de 20%
+  const double span = std::clamp(shownSpan*std::pow(0.8, event->angleDelta().y()/120.0),
+                                 SupImgMinSpan, SupImgMaxSpan);
+  requestView(T - f*span, span);
+  event->accept();
+}
+
+/// Inicia o arrasto do grafico com o botao esquerdo
+void SupImg::mousePressEvent(QMouseEvent* event)
+{
+  std::lock_guard<std::mutex> lock(mtx_render);
+  if (event->button() != Qt::LeftButton || reqLevel || shownSpan <= 0.0)
+  {
+    event->ignore();
+    return;
   }
+  dragging = true;
+  dragX = event->position().x();
+  dragT0 = shownT0;
+  dragSpan = shownSpan;
+  event->accept();
+}
+
+/// Desloca o eixo do tempo durante o arrasto
+void SupImg::mouseMoveEvent(QMouseEvent* event)
+{
+  // A largura da area das curvas (pixels)
+  const int plotWidthPx = width()-1 - 2*imgMarginPx;
+
+  if (!dragging || plotWidthPx <= 0)
+  {
+    event->ignore();
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mtx_render);
+  const double dT = (event->position().x()-dragX)/plotWidthPx*dragSpan;
+  requestView(dragT0 - dT, dragSpan);
+  event->accept();
+}
+
+/// Conclui o arrasto do grafico
+void SupImg::mouseReleaseEvent(QMouseEvent* event)
+{
+  if (event->button() == Qt::LeftButton) dragging = false;
+  event->accept();
+}
+
+/// O duplo clique volta a exibir todo o historico local
+void SupImg::mouseDoubleClickEvent(QMouseEvent* event)
+{
+  std::lock_guard<std::mutex> lock(mtx_render);
+  dragging = false;
+  reqLive = true;
+  hasWork = true;
+  cv_render.notify_one();
+  event->accept();
 }
@@ -2,19 +2,53 @@
 #define SUP_IMG_H
 
 #include <QLabel>
+#include <QImage>
 #include "supdados.h"
-#include <deque>
+#include "suphistory.h"
+#include <vector>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
-/// Numero maximo de pontos a serem exibidos no grafico.
+/// Numero de pontos que cabem no grafico quando ele comeca a ser exibido.
+/// Quando o historico nao cabe mais, o intervalo de tempo exibido eh dobrado.
 #define NumMaxGraphPoints 181 // Se 1pt cada 20s, entao 0 a 180 = 60min = 1h
 
+/// Numero maximo de pontos armazenados no historico.
+/// Quando eh atingido, o quarto mais antigo do historico eh descartado.
+#define NumMaxHistoryPoints 604800 // 1pt cada 1s durante 7 dias
+
+/// Limites do intervalo de tempo exibido no grafico com zoom (em segundos)
+#define SupImgMinSpan 10.0
+#define SupImgMaxSpan (28*24*3600.0) // 4 semanas
+
+/// Numero de blocos do historico do servidor mantidos em memoria.
+/// Quando eh atingido, o bloco usado ha mais tempo eh descartado.
+#define SupImgCacheBlocks 64
+
+/// Intervalo minimo entre dois quadros desenhados (em milisegundos).
+/// Os pontos recebidos durante este intervalo sao desenhados juntos no proximo quadro.
+#define SupImgFramePeriod 16
+
 /// A imagem do supervisorio
 /// Vai exibir o desenho do nivel atual dos tanques ou o grafico dos niveis
+/// O desenho eh feito em um QImage por uma thread de desenho, e nao pela
+/// thread principal do Qt. As funcoes publicas apenas registram o que mudou
+/// e acordam a thread de desenho; o quadro pronto eh exibido depois no QLabel.
+/// No grafico, a roda do mouse altera o zoom e arrastar desloca o eixo do tempo;
+/// o duplo clique volta a exibir todo o historico local, acompanhando os novos pontos.
+/// Os periodos anteriores ao historico local sao buscados no servidor, em blocos.
 class SupImg: public QLabel
 {
 public:
   // Construtor default
   SupImg(QWidget *parent = nullptr);
+  // Destrutor
+  ~SupImg();
 
   // Escolhe exibir o nivel atual dos tanques (true) ou o grafico (false)
   void setDisplayMode(bool show_level);
@@ -22,13 +56,145 @@ public:
   // Limpa a imagem
   void clear();
 
+  // Um ponto do historico de dados recebidos
+  struct Sample
+  {
+    double t;  // Em segundos
+    SupState S;
+  };
+
   // Adiciona um ponto ao historico de dados recebidos
-  void addPoint(int T, const SupState& S);
+  // T eh o instante do ponto (em segundos)
+  void addPoint(double T, const SupState& S);
+  // Adiciona varios pontos de uma soh vez, em ordem crescente de instante
+  void addPoints(const std::vector<Sample>& P);
 
-  // Desenha a imagem
+  // Solicita que a imagem seja redesenhada
   void drawImg();
 
+  // Identificacao de um bloco do historico do servidor
+  // (ver SUP_HISTORY_BLOCK e o comando CMD_GET_HISTORY)
+  struct HistoryRequest
+  {
+    uint16_t level;   // Nivel de resolucao
+    uint64_t index;   // Indice do bloco
+    unsigned gen;     // Geracao do historico (muda a cada clear)
+  };
+  // Fixa a funcao que solicita ao servidor um bloco do historico.
+  // Eh chamada pela thread de desenho e deve retornar imediatamente;
+  // o bloco deve ser entregue depois por addHistoryBlock.
+  void setHistoryFetcher(std::function<void(const HistoryRequest&)> F);
+  // Entrega um bloco do historico do servidor (resposta CMD_HISTORY)
+  // Pode ser chamada por qualquer thread.
+  void addHistoryBlock(const HistoryRequest& Req, bool Ok, const std::vector<uint16_t>& Data);
+
 private:
+  // Construtores e operadores de atribuicao suprimidos (nao existem na classe)
+  SupImg(const SupImg& other) = delete;
+  SupImg(SupImg&& other) = delete;
+  SupImg& operator=(const SupImg& other) = delete;
+  SupImg& operator=(SupImg&& other) = delete;
+
+  //
+  // DADOS COMPARTILHADOS ENTRE A THREAD PRINCIPAL E A THREAD DE DESENHO
+  // (protegidos pelo mutex mtx_render)
+  //
+
+  // Os pontos recebidos desde o ultimo quadro desenhado
+  std::vector<Sample> newSamples;
+  // Os pontos anteriores devem ser apagados
+  bool reqClear;
+  // Modo de exibicao solicitado: nivel atual dos tanques (true) ou grafico (false)
+  bool reqLevel;
+  // Dimensoes do QLabel, onde a imagem serah exibida (pixels)
+  int reqWidthPx, reqHeightPx;
+  // Exibe todo o historico local (true) ou o intervalo de tempo escolhido (false)
+  bool reqLive;
+  // O intervalo de tempo escolhido (em segundos)
+  double reqViewT0, reqViewSpan;
+  // O intervalo de tempo do ultimo quadro desenhado, usado para o zoom
+  double shownT0, shownSpan;
+  // O instante no servidor (em segundos) correspondente ao instante 0 do grafico
+  bool hasOrigin;
+  double timeOrigin;
+  // Geracao do historico: os blocos solicitados antes de um clear sao descartados
+  unsigned histGen;
+  // Os blocos do historico do servidor recebidos e ainda nao armazenados
+  struct IncomingBlock
+  {
+    HistoryRequest req;
+    bool ok;
+    std::vector<uint16_t> data;
+  };
+  std::vector<IncomingBlock> newBlocks;
+  // Hah alguma solicitacao para a thread de desenho
+  bool hasWork;
+  // A thread de desenho deve continuar executando
+  bool render_on;
+  // O ultimo quadro pronto e se jah foi solicitada a sua exibicao
+  QImage readyFrame;
+  bool framePosted;
+  // Exclusao mutua e sinalizacao para a thread de desenho
+  std::mutex mtx_render;
+  std::condition_variable cv_render;
+  // Identificador da thread de desenho
+  std::thread thr_render;
+
+  // A funcao que solicita os blocos do historico ao servidor,
+  // com exclusao mutua propria, para poder ser trocada com seguranca
+  std::function<void(const HistoryRequest&)> fetcher;
+  std::mutex mtx_fetch;
+
+  //
+  // DADOS DA THREAD PRINCIPAL: arrasto do grafico com o mouse
+  //
+  bool dragging;
+  double dragX, dragT0, dragSpan;
+  // Solicita a exibicao do intervalo de tempo [T0, T0+Span] no grafico
+  // (deve ser chamada com mtx_render travado)
+  void requestView(double T0, double Span);
+
+  //
+  // DADOS DA THREAD DE DESENHO (soh sao acessados por ela)
+  //
+
+  // Dimensoes da imagem sendo desenhada (pixels)
+  int widthPx, heightPx;
+
+  // O intervalo de tempo exibido: todo o historico local (live==true)
+  // ou o intervalo escolhido [viewT0, viewT0+viewSpan]
+  bool live;
+  double viewT0, viewSpan;
+  // Copias de hasOrigin, timeOrigin e histGen
+  bool origin_ok;
+  double origin;
+  unsigned gen;
+
+  // Os blocos do historico do servidor, em uma cache LRU.
+  // Cada bloco guarda o minimo e o maximo dos niveis em cada intervalo
+  // (NaN nos intervalos sem dados)
+  struct HistBlock
+  {
+    std::vector<float> min1, max1, min2, max2;
+  };
+  // Chave de um bloco: indice e nivel de resolucao
+  static uint64_t blockKey(uint16_t level, uint64_t index) {return (index << 5) | level;}
+  // Os blocos, do usado mais recentemente ao usado ha mais tempo
+  std::list<uint64_t> lruOrder;
+  std::unordered_map<uint64_t, std::pair<std::list<uint64_t>::iterator, HistBlock>> lruBlocks;
+  // Os blocos solicitados ao servidor que ainda nao chegaram
+  std::set<uint64_t> inFlight;
+  // Os blocos a serem solicitados apos o desenho do quadro atual
+  std::vector<HistoryRequest> toFetch;
+  // Retorna o bloco, se estiver na cache; senao, agenda a sua solicitacao
+  const HistBlock* findBlock(uint16_t level, uint64_t index);
+  // Armazena um bloco recebido na cache
+  void storeBlock(const IncomingBlock& B);
+  // Minimo e maximo dos niveis, no historico do servidor, entre os instantes
+  // Ts0 e Ts1 (em segundos no servidor). Retorna false se nao houver dados.
+  bool serverMinMax(double Ts0, double Ts1, uint16_t level,
+                    float& Min1, float& Max1, float& Min2, float& Max2);
+
   // Exibe o nivel atual dos tanques (true) ou o grafico (false)
   bool displayLevel;
 
@@ -38,27 +204,68 @@ private:
   // Estado do transbordamento (a ser desenhado na imagem se estiver em modo "level")
   bool overflow;
 
-  // O periodo de amostragem (refresh) dos dados
-  int deltaT;
+  // O periodo de amostragem (refresh) dos dados (em segundos)
+  double deltaT;
 
-  // Um ponto a ser exibido na imagem, se estiver em modo "graph"
+  // Um ponto a ser exibido na imagem
   struct Point
   {
-    int t;  // Em segundos
+    double t;  // Em segundos
     double h1,h2;
   };
 
-  // Os pontos a serem exibidos na imagem, se estiver em modo "graph"
-  std::deque<Point> points;
+  // O historico dos pontos recebidos
+  SupHistory hist;
+  // O i-esimo ponto do historico
+  Point point(size_t i) const {return Point{hist.t(i), hist.h1(i), hist.h2(i)};}
 
   // A imagem do icone de advertencia do transbordamento
-  QPixmap alert;
+  // (criada no construtor e nao mais alterada)
+  QImage alert;
 
   // A imagem a ser exibida
-  QPixmap img;
+  QImage img;
+
+  // As camadas do grafico, para que um novo ponto nao exija redesenhar tudo.
+  // A camada estatica: fundo, eixos, linhas de referencia e legendas
+  QImage graphStatic;
+  // A camada das curvas (fundo transparente), que eh deslocada para
+  // a esquerda quando o grafico avanca no tempo
+  QImage graphPlot;
+  // A escala do eixo horizontal usada nas camadas
+  double graphT0;        // Instante correspondente ao pixel absoluto 0 (s)
+  double graphSpan;      // Intervalo de tempo exibido no grafico (s)
+  double graphPxPerSec;  // Pixels por segundo
+  int graphLeftPx;       // Pixel absoluto na borda esquerda do grafico
+
+  // A funcao que implementa a thread de desenho
+  void render_thread();
+  // Acrescenta um ponto ao historico de dados
+  // Retorna true se pontos antigos foram descartados
+  bool storePoint(const Sample& P);
+  // Desenha uma imagem vazia
+  void drawBlank();
+  // Desenha o nivel atual dos tanques
+  void drawLevel();
+  // Redesenha as camadas do grafico a partir de todo o historico
+  void drawGraph();
+  // Desenha na camada das curvas apenas o segmento entre os pontos i-1 e i,
+  // deslocando as curvas anteriores se necessario
+  void drawGraphSegment(size_t i);
+  // Compoe a imagem exibida a partir das camadas do grafico
+  void composeGraph();
+
+  // Exibe no QLabel o ultimo quadro pronto (executada na thread principal)
+  void showFrame();
 
   // Quando o objeto for redimensionado
   void resizeEvent(QResizeEvent *event) override;
+  // Zoom e deslocamento do eixo do tempo com o mouse
+  void wheelEvent(QWheelEvent *event) override;
+  void mousePressEvent(QMouseEvent *event) override;
+  void mouseMoveEvent(QMouseEvent *event) override;
+  void mouseReleaseEvent(QMouseEvent *event) override;
+  void mouseDoubleClickEvent(QMouseEvent *event) override;
 };
 
 #endif // SUP_IMG_H
@@ -0,0 +1,275 @@
+#include "supjournal.h"
+
+using namespace std;
+
+/// Funcoes dependentes do sistema operacional.
+/// file_sync espera que os dados escritos em um arquivo cheguem ao disco.
+/// file_replace renomeia um arquivo, substituindo o destino, se existir.
+/// Retornam false em caso de erro.
+static bool file_sync(FILE* f);
+static bool file_replace(const string& From, const string& To);
+
+/// Descomente o bloco a seguir para compilar no Windows
+
+///*
+
+#include <windows.h>
+#include <io.h>
+
+/// Espera pela gravacao no disco
+static bool file_sync(FILE* f)
+{
+  return _commit(_fileno(f)) == 0;
+}
+
+/// Renomeia, esperando que a alteracao chegue ao disco
+static bool file_replace(const string& From, const string& To)
+{
+  return MoveFileExA(From.c_str(), To.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+//*/
+
+/// Descomente o bloco a seguir para compilar no Linux
+
+/*
+
+#include <unistd.h>
+#include <fcntl.h>
+
+/// Espera pela gravacao no disco
+static bool file_sync(FILE* f)
+{
+  return fsync(fileno(f)) == 0;
+}
+
+/// Renomeia e sincroniza o diretorio, para que o novo nome chegue ao disco
+static bool file_replace(const string& From, const string& To)
+{
+  if (rename(From.c_str(), To.c_str()) != 0) return false;
+  size_t pos = To.find_last_of('/');
+  string dir = (pos == string::npos ? string(".") : To.substr(0, pos+1));
+  int fd = open(dir.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  bool ok = (fsync(fd) == 0);
+  ::close(fd);
+  return ok;
+}
+
+*/
+
+/// Funcoes auxiliares para gravar e ler inteiros nos arquivos, sempre com
+/// o byte menos significativo primeiro
+static void put_bytes(vector<uint8_t>& B, uint64_t num, int nbytes)
+{
+  for (int i=0; i<nbytes; ++i) B.push_back(uint8_t(num >> (8*i)));
+}
+static uint64_t get_bytes(const uint8_t* src, int nbytes)
+{
+  uint64_t num = 0;
+  for (int i=0; i<nbytes; ++i) num |= uint64_t(src[i]) << (8*i);
+  return num;
+}
+
+/// Soma de verificacao (FNV-1a de 32 bits) de N bytes
+static uint32_t checksum(const uint8_t* src, size_t N)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i=0; i<N; ++i)
+  {
+    h ^= src[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/// Numero de bytes de um registro do diario: numero (8), instante (8),
+/// comando (2), parametro (2) e soma de verificacao (4)
+static const size_t RECORD_LEN = 24;
+
+/* ========================================
+   CLASSE SUPJOURNAL
+   ======================================== */
+
+/// Construtor
+SupJournal::SupJournal(const std::string& Path, const std::string& Checkpoint)
+  : path(Path)
+  , ckpt_path(Checkpoint)
+  , file(nullptr)
+  , next_n(0)
+  , pending()
+{
+}
+
+/// Leh o ultimo ponto de restauracao e as atuacoes registradas depois dele.
+/// A leitura do diario para no primeiro registro incompleto ou corrompido.
+bool SupJournal::load(SupCheckpoint& C, std::vector<SupJournalRecord>& R)
+{
+  R.clear();
+
+  // O ponto de restauracao
+  FILE* f = fopen(ckpt_path.c_str(), "rb");
+  if (f == nullptr) return false;
+  vector<uint8_t> B(36 + SUP_CHECKPOINT_MAX_LEN + 4);
+  size_t nbytes = fread(B.data(), 1, B.size(), f);
+  fclose(f);
+  if (nbytes < 38 || get_bytes(&B[0], 4) != SUP_CHECKPOINT_MAGIC) return false;
+  C.version = uint32_t(get_bytes(&B[4], 4));
+  // Tamanho do cabecalho e numero de bytes do estado da planta: na versao 1,
+  // o tamanho tem 2 bytes e conta inteiros de 16 bits
+  size_t head, len;
+  if (C.version == SUP_CHECKPOINT_VERSION)
+  {
+    if (nbytes < 40) return false;
+    head = 36;
+    len = get_bytes(&B[32], 4);
+  }
+  else if (C.version == 1)
+  {
+    head = 34;
+    len = 2*get_bytes(&B[32], 2);
+  }
+  else return false;
+  if (len > SUP_CHECKPOINT_MAX_LEN || nbytes != head + len + 4 ||
+      get_bytes(&B[head+len], 4) != checksum(B.data(), head+len)) return false;
+  C.n = get_bytes(&B[8], 8);
+  C.t_us = get_bytes(&B[16], 8);
+  C.seq = get_bytes(&B[24], 8);
+  C.data.assign(B.begin()+head, B.begin()+head+len);
+  next_n = C.n;
+
+  // As atuacoes posteriores ao ponto de restauracao
+  f = fopen(path.c_str(), "rb");
+  if (f == nullptr) return true;
+  uint8_t D[RECORD_LEN];
+  while (fread(D, 1, RECORD_LEN, f) == RECORD_LEN &&
+         get_bytes(D+20, 4) == checksum(D, 20))
+  {
+    SupJournalRecord A;
+    A.n = get_bytes(D, 8);
+    A.t_us = get_bytes(D+8, 8);
+    A.cmd = uint16_t(get_bytes(D+16, 2));
+    A.param = uint16_t(get_bytes(D+18, 2));
+    // Registros de antes do ponto de restauracao (diario nao esvaziado)
+    if (A.n < next_n) continue;
+    // Falta algum registro: os seguintes nao sao validos
+    if (A.n != next_n) break;
+    R.push_back(A);
+    ++next_n;
+  }
+  fclose(f);
+  return true;
+}
+
+/// Grava um novo ponto de restauracao e recomeca o diario vazio
+bool SupJournal::checkpoint(SupCheckpoint& C)
+{
+  close();
+  C.n = next_n;
+  if (!saveCheckpoint(C))
+  {
+    remove();
+    return false;
+  }
+
+  // O diario recomeca vazio
+  file = fopen(path.c_str(), "wb");
+  return file != nullptr;
+}
+
+/// Grava o ponto de restauracao, sem alterar o diario
+bool SupJournal::saveCheckpoint(const SupCheckpoint& C) const
+{
+  if (C.data.size() > SUP_CHECKPOINT_MAX_LEN) return false;
+
+  vector<uint8_t> B;
+  put_bytes(B, SUP_CHECKPOINT_MAGIC, 4);
+  put_bytes(B, SUP_CHECKPOINT_VERSION, 4);
+  put_bytes(B, C.n, 8);
+  put_bytes(B, C.t_us, 8);
+  put_bytes(B, C.seq, 8);
+  put_bytes(B, C.data.size(), 4);
+  B.insert(B.end(), C.data.begin(), C.data.end());
+  put_bytes(B, checksum(B.data(), B.size()), 4);
+
+  // O novo ponto soh substitui o anterior depois de estar no disco
+  const string tmp_path = ckpt_path + ".tmp";
+  FILE* f = fopen(tmp_path.c_str(), "wb");
+  if (f == nullptr) return false;
+  bool ok = (fwrite(B.data(), 1, B.size(), f) == B.size() &&
+             fflush(f) == 0 && file_sync(f));
+  fclose(f);
+  return ok && file_replace(tmp_path, ckpt_path);
+}
+
+/// Esvazia o diario, se todas as atuacoes sao anteriores ao ponto de restauracao N
+bool SupJournal::trim(uint64_t N)
+{
+  if (file == nullptr) return false;
+  if (next_n != N) return true;
+  fclose(file);
+  file = fopen(path.c_str(), "wb");
+  if (file != nullptr) return true;
+  remove();
+  return false;
+}
+
+/// Fecha o diario
+void SupJournal::close()
+{
+  pending.clear();
+  if (file == nullptr) return;
+  fclose(file);
+  file = nullptr;
+}
+
+/// Fecha e remove os arquivos. O ponto de restauracao eh removido primeiro:
+/// sem ele, o diario nao eh usado.
+void SupJournal::remove()
+{
+  close();
+  std::remove(ckpt_path.c_str());
+  std::remove(path.c_str());
+}
+
+/// Acrescenta uma atuacao ao diario (em memoria)
+void SupJournal::append(uint64_t T_us, uint16_t Cmd, uint16_t Param)
+{
+  if (file == nullptr) return;
+  SupJournalRecord A;
+  A.n = next_n++;
+  A.t_us = T_us;
+  A.cmd = Cmd;
+  A.param = Param;
+  pending.push_back(A);
+}
+
+/// Grava no disco as atuacoes pendentes, com uma unica escrita e uma
+/// unica sincronizacao
+bool SupJournal::commit()
+{
+  if (file == nullptr) return false;
+  if (pending.empty()) return true;
+
+  vector<uint8_t> B;
+  B.reserve(RECORD_LEN*pending.size());
+  for (const auto& A : pending)
+  {
+    const size_t start = B.size();
+    put_bytes(B, A.n, 8);
+    put_bytes(B, A.t_us, 8);
+    put_bytes(B, A.cmd, 2);
+    put_bytes(B, A.param, 2);
+    put_bytes(B, checksum(&B[start], 20), 4);
+  }
+  pending.clear();
+  if (fwrite(B.data(), 1, B.size(), file) != B.size() ||
+      fflush(file) != 0 || !file_sync(file))
+  {
+    // Sem as atuacoes, o ponto de restauracao nao vale mais
+    remove();
+    return false;
+  }
+  return true;
+}
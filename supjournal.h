@@ -0,0 +1,128 @@
+#ifndef _SUP_JOURNAL_H_
+#define _SUP_JOURNAL_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Arquivos do diario de atuacoes e do ponto de restauracao, no diretorio
+/// em que o servidor eh executado
+#define SUP_JOURNAL_PATH "suptanques.journal"
+#define SUP_CHECKPOINT_PATH "suptanques.ckpt"
+
+/// Intervalo (em segundos) entre os pontos de restauracao.
+/// Cada ponto de restauracao esvazia o diario.
+#define SUP_CHECKPOINT_PERIOD 10
+/// Margem (em segundos) somada ao instante do ponto de restauracao quando os
+/// tanques sao restaurados: cobre as amostras enviadas entre o ultimo ponto
+/// gravado e a queda, que nao ficam registradas
+#define SUP_CHECKPOINT_MARGIN (2*SUP_CHECKPOINT_PERIOD)
+
+/// Numero maximo de bytes do estado da planta em um ponto de restauracao
+#define SUP_CHECKPOINT_MAX_LEN 65536
+
+/// Identificacao do formato do ponto de restauracao.
+/// Os pontos da versao 1 (estado da planta em inteiros de 16 bits) ainda sao lidos.
+#define SUP_CHECKPOINT_MAGIC 0x5355504B // "SUPK"
+#define SUP_CHECKPOINT_VERSION 2
+
+/// Uma atuacao registrada no diario
+struct SupJournalRecord
+{
+  uint64_t n;      // Numero do registro (continua de um ponto de restauracao para o seguinte)
+  uint64_t t_us;   // Instante da atuacao (mesma referencia de SupState::t_us)
+  uint16_t cmd;    // CMD_SET_PUMP, CMD_SET_V1, CMD_SET_V2 ou CMD_SET_PID...
+  uint16_t param;  // Parametro do comando
+};
+
+/// Um ponto de restauracao: o estado da planta em um instante
+struct SupCheckpoint
+{
+  uint64_t n=0;    // Numero do primeiro registro do diario posterior ao ponto
+  uint64_t t_us=0; // Instante do ponto (mesma referencia de SupState::t_us)
+  uint64_t seq=0;  // Numero de sequencia da ultima amostra enviada aos clientes
+  std::vector<uint8_t> data; // O estado da planta, no formato de quem o gravou
+  uint32_t version=SUP_CHECKPOINT_VERSION; // Versao do ponto lido (na versao 1,
+                                           // data contem inteiros de 16 bits)
+};
+
+/// O diario de atuacoes (write-ahead log) e o ponto de restauracao da planta.
+/// As atuacoes sao acrescentadas ao fim do diario em memoria (append) e
+/// gravadas no disco em grupo (commit): todas as atuacoes pendentes sao
+/// escritas e sincronizadas com um unico acesso ao disco.
+/// O ponto de restauracao eh gravado em um arquivo temporario e renomeado,
+/// para que o ponto anterior continue valido ateh o novo estar completo.
+/// Depois de um ponto de restauracao, o diario recomeca vazio; os registros
+/// de um diario que nao chegou a ser esvaziado sao identificados pelo numero.
+/// O ponto de restauracao tambem pode ser gravado por outra thread (saveCheckpoint),
+/// enquanto as atuacoes continuam sendo gravadas no diario; o diario soh eh
+/// esvaziado depois (trim).
+/// Quando o servidor eh desligado normalmente, os arquivos sao removidos (remove):
+/// os tanques soh sao restaurados depois de uma queda.
+/// Cada registro tem uma soma de verificacao: um registro incompleto no fim
+/// do diario (escrita interrompida por uma queda) eh descartado na leitura.
+class SupJournal
+{
+public:
+  // Construtor com os caminhos do diario e do ponto de restauracao
+  explicit SupJournal(const std::string& Path=SUP_JOURNAL_PATH,
+                      const std::string& Checkpoint=SUP_CHECKPOINT_PATH);
+  // Destrutor
+  ~SupJournal() {close();}
+
+  // Leh o ultimo ponto de restauracao e as atuacoes registradas depois dele.
+  // Os proximos registros continuam a numeracao lida.
+  // Retorna false se nao houver ponto de restauracao valido.
+  bool load(SupCheckpoint& C, std::vector<SupJournalRecord>& R);
+
+  // Grava um novo ponto de restauracao e recomeca o diario vazio.
+  // As atuacoes pendentes devem ter sido gravadas antes (commit).
+  // O numero do proximo registro eh preenchido em C.n.
+  // Retorna false em caso de erro (o diario eh removido).
+  bool checkpoint(SupCheckpoint& C);
+  // Grava o ponto de restauracao C sem alterar o diario. C.n deve ser o numero
+  // do proximo registro (nextRecord) no instante do estado. Pode ser executada
+  // por outra thread. Retorna false em caso de erro.
+  bool saveCheckpoint(const SupCheckpoint& C) const;
+  // Esvazia o diario depois da gravacao do ponto de restauracao com o numero N,
+  // se nenhuma atuacao foi acrescentada depois do ponto. Senao, os registros
+  // continuam no diario ateh o proximo ponto (os anteriores ao ponto sao
+  // ignorados na leitura). Retorna false em caso de erro (o diario eh removido).
+  bool trim(uint64_t N);
+  // Numero do proximo registro
+  uint64_t nextRecord() const {return next_n;}
+
+  // Testa se o diario estah aberto
+  bool isOpen() const {return file != nullptr;}
+  // Fecha o diario. As atuacoes pendentes sao descartadas.
+  void close();
+  // Fecha o diario e remove os arquivos do diario e do ponto de restauracao
+  void remove();
+
+  // Acrescenta uma atuacao ao diario. Ela soh estarah no disco depois de commit.
+  void append(uint64_t T_us, uint16_t Cmd, uint16_t Param);
+  // Testa se ha atuacoes pendentes
+  bool hasPending() const {return !pending.empty();}
+  // Grava no disco as atuacoes pendentes e espera pelo fim da gravacao.
+  // Retorna false em caso de erro (o diario eh removido).
+  bool commit();
+
+private:
+  // Construtores e operadores de atribuicao suprimidos (nao existem na classe)
+  SupJournal(const SupJournal& other) = delete;
+  SupJournal(SupJournal&& other) = delete;
+  SupJournal& operator=(const SupJournal& other) = delete;
+  SupJournal& operator=(SupJournal&& other) = delete;
+
+  // Os caminhos do diario e do ponto de restauracao
+  std::string path, ckpt_path;
+  // O arquivo do diario (nullptr se fechado)
+  FILE* file;
+  // Numero do proximo registro
+  uint64_t next_n;
+  // As atuacoes que ainda nao foram gravadas
+  std::vector<SupJournalRecord> pending;
+};
+
+#endif // _SUP_JOURNAL_H_
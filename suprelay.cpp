@@ -0,0 +1,262 @@
+#include <iostream>     /* cout, cerr */
+#include <algorithm>
+#include <memory>
+#include "suprelay.h"
+
+using namespace std;
+
+/* ========================================
+   CLASSE SUPRELAY
+   ======================================== */
+
+/// Construtor.
+/// O repetidor nao publica o quadro de estados em memoria compartilhada:
+/// os leitores locais usam o quadro do servidor da planta.
+SupRelay::SupRelay(const std::string& Porta, const std::string& Local)
+  : SupServidor(Porta, Local, false)
+  , SupCliente()
+  , up_ip()
+  , up_login()
+  , up_senha()
+  , upstream_on(false)
+  , mtx_retry()
+  , cv_retry()
+  , mtx_upstream()
+  , thr_upstream()
+  , snapshot()
+  , snapshot_count(0)
+  , mtx_snapshot()
+  , cv_snapshot()
+  , hist_cache()
+  , hist_order()
+{
+}
+
+/// Destrutor
+SupRelay::~SupRelay()
+{
+  // A thread do servidor e a sessao com o servidor da planta usam as funcoes
+  // virtuais desta classe: devem ser encerradas antes dos destrutores das bases
+  setServerOff();
+  SupRelay::virtDesligarPlanta();
+}
+
+/// Fixa o endereco do servidor da planta e o usuario da sessao
+void SupRelay::setUpstream(const std::string& IP, const std::string& Login, const std::string& Senha)
+{
+  if (serverOn()) return;
+  up_ip = IP;
+  up_login = Login;
+  up_senha = Senha;
+}
+
+/// Liga a planta: conecta ao servidor da planta, espera pelo primeiro estado
+/// e lanca a thread de reconexao
+bool SupRelay::virtLigarPlanta()
+{
+  if (SupCliente::isConnected()) return true;
+
+  {
+    lock_guard<mutex> lock(mtx_snapshot);
+    snapshot = SupState();
+  }
+  if (!conectarUpstream()) return false;
+
+  // Lanca a thread de reconexao
+  {
+    lock_guard<mutex> lock(mtx_retry);
+    upstream_on = true;
+  }
+  thr_upstream = thread( [this]()
+  {
+    this->thr_upstream_main();
+  } );
+  if (!thr_upstream.joinable())
+  {
+    cerr << "Erro ao lancar a thread de reconexao\n";
+    SupRelay::virtDesligarPlanta();
+    return false;
+  }
+  return true;
+}
+
+/// Conecta ao servidor da planta, com o protocolo com pipeline, e espera
+/// pelo primeiro estado (no maximo SUP_TIMEOUT segundos).
+/// Ao reconectar, o ultimo estado da sessao anterior continua valendo.
+bool SupRelay::conectarUpstream()
+{
+  if (SupCliente::isConnected()) return true;
+
+  // Espera pelo fim das threads de uma sessao anterior, que foi perdida
+  desconectar();
+  uint64_t count0;
+  {
+    lock_guard<mutex> lock(mtx_snapshot);
+    count0 = snapshot_count;
+  }
+  setPipelined(true);
+  // Em caso de erro, a msg jah foi exibida
+  conectar(up_ip, up_login, up_senha);
+  if (!SupCliente::isConnected()) return false;
+  // Solicita os estados o mais rapido possivel
+  setTimeRefresh(SUP_MIN_REFRESH);
+
+  unique_lock<mutex> lock(mtx_snapshot);
+  if (!cv_snapshot.wait_for(lock, chrono::seconds(SUP_TIMEOUT),
+                            [this,count0](){return snapshot_count != count0;}))
+  {
+    lock.unlock();
+    cerr << "Nenhum estado recebido do servidor " << up_ip << endl;
+    desconectar();
+    return false;
+  }
+  return true;
+}
+
+/// A thread de reconexao.
+/// A sessao perdida eh retomada pelo proprio cliente (SupCliente), se possivel;
+/// senao, esta thread faz uma nova conexao a cada SUP_RELAY_RETRY segundos.
+void SupRelay::thr_upstream_main()
+{
+  while (upstream_on)
+  {
+    // Espera pela proxima tentativa, a menos que o repetidor seja desligado
+    {
+      unique_lock<mutex> lock(mtx_retry);
+      if (cv_retry.wait_for(lock, chrono::seconds(SUP_RELAY_RETRY),
+                            [this](){return !upstream_on;})) break;
+    }
+
+    // Reconecta ao servidor da planta
+    lock_guard<mutex> lock(mtx_upstream);
+    if (upstream_on && !SupCliente::isConnected() && conectarUpstream())
+    {
+      cout << "\nReconectado ao servidor " << up_ip << endl;
+    }
+  }
+}
+
+/// Desliga a planta: encerra a thread de reconexao e desconecta do servidor
+/// da planta. A desconexao espera pelo fim de uma reconexao em andamento.
+/// Os blocos do historico jah obtidos continuam validos.
+void SupRelay::virtDesligarPlanta()
+{
+  {
+    lock_guard<mutex> lock(mtx_retry);
+    upstream_on = false;
+  }
+  cv_retry.notify_all();
+  {
+    lock_guard<mutex> lock(mtx_upstream);
+    if (SupCliente::isConnected()) desconectar();
+  }
+  if (thr_upstream.joinable()) thr_upstream.join();
+  thr_upstream = thread();
+}
+
+/// Planta ligada: sessao com o servidor da planta estabelecida.
+/// Enquanto a sessao estiver perdida, o ultimo estado nao eh atual.
+bool SupRelay::virtPlantaLigada() const
+{
+  return SupCliente::isConnected();
+}
+
+/// Leh o ultimo estado recebido do servidor da planta
+void SupRelay::virtLerEstado(SupState& S) const
+{
+  lock_guard<mutex> lock(mtx_snapshot);
+  S = snapshot;
+}
+
+/// Repassa um comando de atuacao ao servidor da planta. A thread do servidor
+/// nao espera: Done eh chamada pela thread de leitura da sessao quando chegar a
+/// resposta (ou imediatamente, se o comando nao puder ser enviado).
+void SupRelay::virtAtuarAdiado(uint16_t Cmd, uint16_t Param, std::function<void(bool)> Done)
+{
+  requestActuation(Cmd, Param, [Done](const SupReply& R){Done(R.cmd == CMD_OK);});
+}
+
+/// Monta um bloco do historico.
+/// Os blocos cobertos pelo historico registrado pelo repetidor sao montados
+/// localmente. Os demais sao pedidos ao servidor da planta, sem esperar pela
+/// resposta; os que jah terminaram nao mudam mais e sao guardados para os
+/// proximos pedidos. A lista de blocos guardados soh eh acessada pela thread
+/// do servidor: a resposta eh tratada por ela (runOnServerThread).
+void SupRelay::virtBlocoHistoricoAdiado(uint16_t Level, uint64_t Index,
+                                        std::function<void(int N, const uint16_t* Data)> Done)
+{
+  if (Level > SUP_HISTORY_MAX_LEVEL) {Done(-1, nullptr); return;}
+  const uint64_t block_us = ((uint64_t(SUP_HISTORY_PERIOD)*1000) << Level)*SUP_HISTORY_BLOCK;
+  if (Index > UINT64_MAX/block_us - 1) {Done(-1, nullptr); return;}
+
+  // Bloco registrado pelo repetidor
+  if (historyCovers(Index*block_us))
+  {
+    SupServidor::virtBlocoHistoricoAdiado(Level, Index, std::move(Done));
+    return;
+  }
+
+  // Bloco jah obtido do servidor da planta
+  const pair<uint16_t,uint64_t> key(Level, Index);
+  auto itr = hist_cache.find(key);
+  if (itr != hist_cache.end())
+  {
+    Done(int(itr->second.size()), itr->second.data());
+    return;
+  }
+
+  // Pede o bloco ao servidor da planta
+  requestHistory(Level, Index, [this, key, block_us, Done](const SupReply& R)
+  {
+    runOnServerThread([this, key, block_us, Done, R]()
+    {
+      const size_t nbuckets = R.hist.size()/SUP_HISTORY_BUCKET_LEN;
+      if (R.cmd != CMD_HISTORY || nbuckets > SUP_HISTORY_BLOCK) {Done(-1, nullptr); return;}
+
+      // O numero de intervalos, seguido pelos dados de cada intervalo
+      vector<uint16_t> B(1 + SUP_HISTORY_BUCKET_LEN*nbuckets);
+      B[0] = uint16_t(nbuckets);
+      copy(R.hist.begin(), R.hist.begin() + (B.size()-1), B.begin()+1);
+      Done(int(B.size()), B.data());
+
+      // Guarda o bloco, se ele jah terminou no servidor da planta
+      uint64_t t_now;
+      {
+        lock_guard<mutex> lock(mtx_snapshot);
+        t_now = snapshot.t_us;
+      }
+      if ((key.second+1)*block_us <= t_now && hist_cache.count(key) == 0)
+      {
+        hist_cache.emplace(key, std::move(B));
+        hist_order.push_back(key);
+        if (hist_order.size() > SUP_RELAY_CACHE_LEN)
+        {
+          hist_cache.erase(hist_order.front());
+          hist_order.pop_front();
+        }
+      }
+    });
+  });
+}
+
+/// Exibe informacao de erro da sessao com o servidor da planta
+void SupRelay::virtExibirErro(const std::string& msg) const
+{
+  cerr << "\n=================\n";
+  cerr << msg;
+  cerr << "\n=================\n";
+}
+
+/// Armazena o ultimo estado recebido do servidor da planta
+void SupRelay::storeState(const SupState& LastS)
+{
+  // Chama a funcao da classe base
+  SupCliente::storeState(LastS);
+  // Disponibiliza o estado para a thread do servidor
+  {
+    lock_guard<mutex> lock(mtx_snapshot);
+    snapshot = LastS;
+    ++snapshot_count;
+  }
+  cv_snapshot.notify_all();
+}
@@ -0,0 +1,134 @@
+#ifndef _SUP_RELAY_H_
+#define _SUP_RELAY_H_
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <deque>
+#include <vector>
+#include <utility>
+#include "supservidor.h"
+#include "supcliente.h"
+
+/// Caminho do socket local (AF_UNIX) do repetidor.
+/// Eh diferente do caminho do servidor da planta, para que os dois
+/// possam ser executados no mesmo diretorio.
+#define SUP_RELAY_LOCAL_PATH "suprelay.sock"
+
+/// Numero maximo de blocos do historico do servidor da planta guardados
+/// pelo repetidor (o mais antigo eh descartado)
+#define SUP_RELAY_CACHE_LEN 1024
+
+/// Intervalo (em segundos) entre as tentativas de reconexao ao servidor da planta
+#define SUP_RELAY_RETRY 2
+
+/// O repetidor do SupTanques.
+/// Mantem uma unica sessao com o servidor da planta, como um cliente (SupCliente),
+/// e atende os seus proprios clientes com o mesmo protocolo, como um servidor
+/// (SupServidor). O servidor da planta tem uma unica conexao, qualquer que seja
+/// o numero de clientes do repetidor.
+/// - O estado eh o ultimo recebido do servidor da planta, com o mesmo numero
+///   de sequencia e o mesmo instante da amostra.
+/// - Se a sessao com o servidor da planta for perdida (e nao puder ser retomada),
+///   o repetidor tenta reconectar a cada SUP_RELAY_RETRY segundos. Enquanto isso,
+///   o ultimo estado nao eh mais atual: os pedidos de dados e de atuacao dos
+///   seus clientes sao recusados (CMD_ERROR).
+/// - O historico de niveis eh registrado pelo proprio repetidor, desde que
+///   foi ligado. Os blocos anteriores sao pedidos ao servidor da planta uma
+///   unica vez e guardados no repetidor.
+/// - Os comandos de atuacao dos administradores do repetidor sao repassados
+///   ao servidor da planta, se o usuario da sessao for administrador.
+/// Os usuarios do repetidor sao cadastrados no proprio repetidor.
+class SupRelay: public SupServidor, protected SupCliente
+{
+public:
+  // Construtor com a porta TCP e o caminho do socket local em que o
+  // repetidor espera conexoes
+  explicit SupRelay(const std::string& Porta=SUP_PORT,
+                    const std::string& Local=SUP_RELAY_LOCAL_PATH);
+  // Destrutor
+  virtual ~SupRelay();
+
+  // Fixa o endereco do servidor da planta e o usuario da sessao.
+  // Soh tem efeito se o repetidor estiver desligado.
+  void setUpstream(const std::string& IP, const std::string& Login, const std::string& Senha);
+
+protected:
+  // Conecta ao servidor da planta, se nao estiver conectado, e espera pelo
+  // primeiro estado. Tambem usada pela thread de reconexao, apos a perda da
+  // sessao. Retorna true se OK.
+  bool conectarUpstream();
+
+  // As funcoes virtuais de acesso a planta (SupServidor):
+  // a planta eh acessada atraves da sessao com o servidor da planta.
+  // Liga a planta: conecta ao servidor, espera pelo primeiro estado
+  // e lanca a thread de reconexao
+  bool virtLigarPlanta() override;
+  // Desliga a planta: encerra a thread de reconexao e desconecta do servidor
+  void virtDesligarPlanta() override;
+  // Planta ligada: sessao com o servidor estabelecida (os dados sao atuais)
+  bool virtPlantaLigada() const override;
+  // Leh o ultimo estado recebido do servidor
+  void virtLerEstado(SupState& S) const override;
+  // Repassa um comando de atuacao ao servidor, sem esperar pela resposta
+  void virtAtuarAdiado(uint16_t Cmd, uint16_t Param, std::function<void(bool)> Done) override;
+  // Monta um bloco do historico: registrado pelo repetidor ou obtido do servidor,
+  // sem esperar pela resposta
+  void virtBlocoHistoricoAdiado(uint16_t Level, uint64_t Index,
+                                std::function<void(int N, const uint16_t* Data)> Done) override;
+
+  // As funcoes virtuais de exibicao e de armazenamento de dados (SupCliente)
+  // Exibe informacao de erro (em console)
+  void virtExibirErro(const std::string& msg) const override;
+  // O repetidor nao tem interface: o estado eh exibido apenas quando solicitado
+  void virtExibirInterface() const override {}
+  // Armazena o ultimo estado recebido do servidor
+  void storeState(const SupState& LastS) override;
+
+private:
+  // Construtores e operadores de atribuicao suprimidos (nao existem na classe)
+  SupRelay(const SupRelay& other) = delete;
+  SupRelay(SupRelay&& other) = delete;
+  SupRelay& operator=(const SupRelay& other) = delete;
+  SupRelay& operator=(SupRelay&& other) = delete;
+
+  // A thread de reconexao: reconecta ao servidor da planta, se a sessao for perdida
+  void thr_upstream_main();
+
+  // O servidor da planta e o usuario da sessao
+  std::string up_ip, up_login, up_senha;
+
+  // A thread de reconexao deve continuar em execucao. Atomico: eh testado
+  // pela thread de reconexao fora da exclusao mutua. Eh alterado com mtx_retry
+  // bloqueado, para que a espera em cv_retry nao perca o encerramento.
+  std::atomic<bool> upstream_on;
+  // Exclusao mutua na espera entre as tentativas e sinalizacao do encerramento
+  std::mutex mtx_retry;
+  std::condition_variable cv_retry;
+  // Exclusao mutua entre a reconexao (thread de reconexao) e a
+  // desconexao (programa principal)
+  std::mutex mtx_upstream;
+  // Identificador da thread de reconexao
+  std::thread thr_upstream;
+
+  // O ultimo estado recebido do servidor, compartilhado entre a thread do
+  // cliente, que o recebe, e a thread do servidor, que o envia aos clientes
+  SupState snapshot;
+  // Numero de estados recebidos, para esperar pelo primeiro estado de uma sessao
+  uint64_t snapshot_count;
+  mutable std::mutex mtx_snapshot;
+  // Sinaliza a chegada de um novo estado
+  std::condition_variable cv_snapshot;
+
+  // Os blocos do historico obtidos do servidor da planta, indexados pelo
+  // nivel de resolucao e pelo indice do bloco, no formato de virtBlocoHistorico.
+  // Soh sao usados pela thread do servidor.
+  std::map<std::pair<uint16_t,uint64_t>, std::vector<uint16_t>> hist_cache;
+  // A ordem de insercao dos blocos, para descartar o mais antigo
+  std::deque<std::pair<uint16_t,uint64_t>> hist_order;
+};
+
+#endif // _SUP_RELAY_H_
@@ -0,0 +1,188 @@
+#include <iostream>
+#include "suprelay.h"
+
+using namespace std;
+
+/// ==============================
+/// Funcao principal do repetidor:
+///   suprelay IP Login Senha [porta]
+/// IP, Login e Senha: o servidor da planta e o usuario da sessao com ele
+/// porta: a porta em que o repetidor espera conexoes (default SUP_PORT)
+/// ==============================
+
+int main(int argc, char *argv[])
+{
+  if (argc < 4 || argc > 5)
+  {
+    cerr << "Uso: " << argv[0] << " IP Login Senha [porta]\n"
+         << "porta default " << SUP_PORT << endl;
+    return 1;
+  }
+
+  // O repetidor do sistema de tanques
+  SupRelay ST_Relay(argc > 4 ? argv[4] : SUP_PORT);
+  ST_Relay.setUpstream(argv[1], argv[2], argv[3]);
+
+  // Relogio interno: primeira leitura, delta_t desde entao
+  time_t first_t,delta_t;
+
+  // Usuario a ser adicionado/removido
+  string Login, Senha;
+
+  // Variaveis auxiliares para digitacao de dados
+  string texto;
+  int opcao;
+  char C;
+
+  first_t = time(nullptr);
+  do
+  {
+    do
+    {
+      cout << "\n=================\n";
+      if (!ST_Relay.serverOn())
+      {
+        cout << " 0 - Ligar o repetidor\n";
+        cout << "=================\n";
+      }
+      if (ST_Relay.serverOn())
+      {
+        cout << " 1 - Ler e imprimir o estado atual da planta\n";
+        cout << "=================\n";
+        cout << "21 - Listar usuarios\n";
+        cout << "22 - Adicionar usuario\n";
+        cout << "23 - Remover usuario\n";
+        cout << "=================\n";
+        cout << "31 - Ligar/desligar a difusao UDP do estado\n";
+        cout << "=================\n";
+        cout << "98 - Desligar o repetidor\n";
+      }
+      cout << "99 - Sair\n";
+      cout << "=================\n";
+      cout << "Opcao: ";
+      cin >> texto;
+      try
+      {
+        opcao = stoi(texto);
+      }
+      catch(...)
+      {
+        opcao = -1;
+      }
+    }
+    while (opcao<0 || opcao>99);
+
+    if (!ST_Relay.serverOn()) // Repetidor nao estah ligado
+    {
+      if (opcao == 0)
+      {
+        if (!ST_Relay.setServerOn()) cerr << "Erro ao iniciar o repetidor!\n";
+        else first_t = time(nullptr);
+      }
+      else
+      {
+        if (opcao != 99) cout << "Repetidor estah desligado!\n";
+      }
+    }
+    else               // Repetidor estah ligado
+    {
+      // Executa a opcao escolhida
+      switch(opcao)
+      {
+      case 0:
+        cout << "Repetidor jah estah ligado!\n";
+        break;
+      case 1:
+        // Calcula e imprime o tempo decorrido desde que o repetidor foi ligado
+        delta_t = time(nullptr)-first_t;
+        cout << "T=";
+        if (delta_t >= 3600)
+        {
+          int horas = delta_t/3600;
+          delta_t -= 3600*horas;
+          cout << horas << 'h';
+        }
+        if (delta_t >= 60)
+        {
+          int minutos = delta_t/60;
+          delta_t -= 60*minutos;
+          cout << minutos << 'm';
+        }
+        cout << delta_t << "s ";
+        // Leh e imprime o estado da planta
+        ST_Relay.readPrintState();
+        break;
+      case 21:
+        cout << "USUARIOS CADASTRADOS:\n";
+        ST_Relay.printUsers();
+        break;
+      case 22:
+        do
+        {
+          cout << "Login do novo usuario [6-12 caracteres]: ";
+          cin >> Login;
+        }
+        while (Login.size()<6 || Login.size()>12);
+        do
+        {
+          cout << "Senha do novo usuario [6-12 caracteres]: ";
+          cin >> Senha;
+        }
+        while (Senha.size()<6 || Senha.size()>12);
+        do
+        {
+          cout << "Eh administrador [S/N]? ";
+          cin >> C;
+          C = toupper(C);
+        }
+        while (C!='S' && C!='N');
+        if (ST_Relay.addUser(Login, Senha, (C=='S')))
+        {
+          cout << "Usuario " << Login << " inserido\n";
+        }
+        else
+        {
+          cout << "Usuario " << Login << " invalido (nao inserido)\n";
+        }
+        break;
+      case 23:
+        do
+        {
+          cout << "Login do usuario a ser removido: ";
+          cin >> Login;
+        }
+        while (Login.size()<6 || Login.size()>12);
+        if (ST_Relay.removeUser(Login)) cout << "Usuario " << Login << " removido\n";
+        else cout << "Usuario " << Login << " inexistente (nao removido)\n";
+        break;
+      case 31:
+        texto = ST_Relay.broadcastAddress();
+        cout << "Difusao UDP " << (texto.empty() ? "desligada" : "para "+texto) << endl;
+        cout << "Endereco IP[:porta] da difusao (- para desligar): ";
+        cin >> texto;
+        if (texto == "-") texto.clear();
+        if (ST_Relay.setBroadcast(texto))
+        {
+          texto = ST_Relay.broadcastAddress();
+          cout << "Difusao UDP " << (texto.empty() ? "desligada" : "para "+texto) << endl;
+        }
+        else
+        {
+          cout << "Endereco " << texto << " invalido (difusao desligada)\n";
+        }
+        break;
+      case 98:
+      case 99:
+        first_t = time(nullptr);
+        ST_Relay.setServerOff();
+        break;
+      default:
+        // Opcao inexistente: nao faz nada
+        break;
+      }
+    }
+  }
+  while (opcao!=99);
+
+  return 0;
+}
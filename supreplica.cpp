@@ -0,0 +1,170 @@
+#include <iostream>     /* cerr */
+#include "supreplica.h"
+
+using namespace std;
+
+/* ========================================
+   CLASSE SUPREPLICA
+   ======================================== */
+
+/// Construtor
+SupReplica::SupReplica(const std::string& Porta)
+  : SupRelay(Porta, SUP_REPLICA_LOCAL_PATH)
+  , repl_pos(0)
+  , repl_queue()
+  , repl_on(false)
+  , mtx_queue()
+  , cv_repl()
+  , thr_repl()
+{
+}
+
+/// Destrutor
+SupReplica::~SupReplica()
+{
+  // A thread de replicacao usa as funcoes desta classe: deve ser encerrada
+  // antes do destrutor da classe base
+  setServerOff();
+  virtDesligarPlanta();
+}
+
+/// Liga a planta: conecta ao servidor primario, aplica a copia da lista de
+/// usuarios antes de aceitar conexoes e lanca a thread de replicacao
+bool SupReplica::virtLigarPlanta()
+{
+  if (!SupRelay::virtLigarPlanta()) return false;
+
+  try
+  {
+    // Soh um administrador do primario recebe o fluxo de replicacao
+    if (!isAdmin()) throw 1;
+    // A primeira resposta eh a copia completa da lista de usuarios
+    repl_pos = 0;
+    if (!replicate()) throw 2;
+    // A thread do servidor ainda nao estah em execucao: aplica imediatamente
+    virtTarefaPeriodica();
+
+    // Lanca a thread de replicacao
+    {
+      lock_guard<mutex> lock(mtx_queue);
+      repl_on = true;
+    }
+    thr_repl = thread( [this]()
+    {
+      this->thr_repl_main();
+    } );
+    if (!thr_repl.joinable()) throw 3;
+  }
+  catch(int i)
+  {
+    cerr << "Erro " << i << " no fluxo de replicacao do servidor primario\n";
+    {
+      lock_guard<mutex> lock(mtx_queue);
+      repl_on = false;
+    }
+    SupRelay::virtDesligarPlanta();
+    return false;
+  }
+  return true;
+}
+
+/// Desliga a planta: desconecta do primario e encerra a thread de replicacao.
+/// A desconexao encerra a solicitacao que a thread estiver esperando.
+void SupReplica::virtDesligarPlanta()
+{
+  {
+    lock_guard<mutex> lock(mtx_queue);
+    repl_on = false;
+  }
+  cv_repl.notify_all();
+  SupRelay::virtDesligarPlanta();
+  if (thr_repl.joinable()) thr_repl.join();
+  thr_repl = thread();
+}
+
+/// Solicita ao primario os eventos seguintes a posicao repl_pos.
+/// O primario retem a resposta enquanto nao houver eventos novos,
+/// no maximo por SUP_REPL_WAIT ms.
+bool SupReplica::replicate()
+{
+  future<SupReply> F = requestReplication(repl_pos);
+  if (F.wait_for(chrono::seconds(SUP_TIMEOUT)) != future_status::ready) return false;
+  SupReply R = F.get();
+  if (R.cmd != CMD_REPLICA) return false;
+
+  repl_pos = R.pos;
+  if (!R.events.empty())
+  {
+    lock_guard<mutex> lock(mtx_queue);
+    repl_queue.push_back(std::move(R.events));
+  }
+  return true;
+}
+
+/// A thread de replicacao.
+/// Se a sessao com o primario for perdida, a reconexao eh feita pela thread
+/// de reconexao do repetidor. A posicao no fluxo de replicacao eh mantida:
+/// se o primario tiver sido reiniciado, ele envia uma copia completa.
+void SupReplica::thr_repl_main()
+{
+  while (repl_on)
+  {
+    if (primaryConnected())
+    {
+      // Recebe os proximos eventos; em caso de erro com a sessao ativa
+      // (primario sem fluxo de replicacao, p.ex.), espera antes de tentar de novo
+      if (replicate() || !primaryConnected()) continue;
+    }
+
+    // Espera pela proxima tentativa, a menos que a replica seja desligada
+    unique_lock<mutex> lock(mtx_queue);
+    if (cv_repl.wait_for(lock, chrono::seconds(SUP_REPLICA_RETRY),
+                         [this](){return !repl_on;})) break;
+  }
+}
+
+/// Aplica os eventos recebidos do primario.
+/// Eh chamada pela thread do servidor, que eh a unica que percorre a
+/// lista de usuarios enquanto o servidor estah ligado.
+long SupReplica::virtTarefaPeriodica()
+{
+  deque<vector<SupReplEvent>> Q;
+  {
+    lock_guard<mutex> lock(mtx_queue);
+    Q.swap(repl_queue);
+  }
+  for (const auto& Events : Q) applyEvents(Events);
+  return SUP_REPLICA_APPLY;
+}
+
+/// Aplica um conjunto de eventos recebidos do primario
+void SupReplica::applyEvents(const std::vector<SupReplEvent>& Events)
+{
+  // Copia completa da lista de usuarios: CMD_USER_CLEAR seguido dos usuarios
+  if (!Events.empty() && Events.front().type == CMD_USER_CLEAR)
+  {
+    setUsers(vector<SupReplEvent>(Events.begin()+1, Events.end()));
+    cout << "\nLista de usuarios copiada do servidor primario ("
+         << Events.size()-1 << " usuarios)\n";
+    return;
+  }
+
+  for (const auto& E : Events)
+  {
+    switch (E.type)
+    {
+    case CMD_USER_ADD:
+      addUser(E.login, E.password, E.param != 0);
+      cout << "\nUsuario " << E.login << " inserido no servidor primario\n";
+      break;
+    case CMD_USER_DEL:
+      removeUser(E.login);
+      cout << "\nUsuario " << E.login << " removido no servidor primario\n";
+      break;
+    default:
+      // As atuacoes no primario nao sao aplicadas nem exibidas: o estado
+      // chega pela sessao com o primario. Eventos desconhecidos sao ignorados.
+      break;
+    }
+  }
+}
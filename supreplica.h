@@ -0,0 +1,91 @@
+#ifndef _SUP_REPLICA_H_
+#define _SUP_REPLICA_H_
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include "suprelay.h"
+
+/// Caminho do socket local (AF_UNIX) da replica.
+/// Eh diferente dos caminhos do servidor e do repetidor, para que todos
+/// possam ser executados no mesmo diretorio.
+#define SUP_REPLICA_LOCAL_PATH "supreplica.sock"
+
+/// Intervalo maximo (em milisegundos) entre a chegada de eventos do servidor
+/// primario e a sua aplicacao pela thread do servidor da replica
+#define SUP_REPLICA_APPLY 100
+
+/// Intervalo (em segundos) entre as tentativas de receber os eventos do servidor
+/// primario, apos um erro ou enquanto a sessao com o primario estiver perdida
+#define SUP_REPLICA_RETRY 2
+
+/// A replica somente leitura do SupTanques.
+/// Eh um repetidor (SupRelay) que segue um servidor primario pelo fluxo de
+/// replicacao (CMD_REPLICATE): alem dos estados, recebe as atuacoes e as
+/// alteracoes na lista de usuarios do primario.
+/// - A lista de usuarios eh a do primario: os visualizadores fazem login na
+///   replica, sem nenhuma carga no primario.
+/// - As atuacoes dos administradores sao repassadas ao primario e recusadas
+///   (CMD_ERROR) enquanto o primario estiver inacessivel.
+/// - Se a sessao com o primario for perdida, a replica continua aceitando os
+///   logins dos seus clientes, mas recusa os pedidos de dados ateh reconectar
+///   (a reconexao eh feita pelo repetidor).
+/// O usuario da sessao deve ser administrador do primario, pois o fluxo de
+/// replicacao inclui as senhas dos usuarios.
+class SupReplica: public SupRelay
+{
+public:
+  // Construtor com a porta TCP em que a replica espera conexoes
+  explicit SupReplica(const std::string& Porta=SUP_PORT);
+  // Destrutor
+  ~SupReplica();
+
+  // Sessao com o servidor primario estabelecida (true) ou nao (false)
+  bool primaryConnected() const {return virtPlantaLigada();}
+
+private:
+  // Construtores e operadores de atribuicao suprimidos (nao existem na classe)
+  SupReplica(const SupReplica& other) = delete;
+  SupReplica(SupReplica&& other) = delete;
+  SupReplica& operator=(const SupReplica& other) = delete;
+  SupReplica& operator=(SupReplica&& other) = delete;
+
+  // As funcoes virtuais do servidor (SupServidor)
+  // Liga a planta: conecta ao primario, copia a lista de usuarios e
+  // lanca a thread de replicacao
+  bool virtLigarPlanta() override;
+  // Desliga a planta: desconecta do primario e encerra a thread de replicacao
+  void virtDesligarPlanta() override;
+  // Aplica os eventos recebidos do primario (chamada pela thread do servidor)
+  long virtTarefaPeriodica() override;
+
+  // Solicita ao primario os eventos seguintes a posicao repl_pos e coloca-os
+  // na fila. Espera no maximo SUP_TIMEOUT segundos. Retorna true se OK.
+  bool replicate();
+  // Aplica um conjunto de eventos recebidos do primario
+  void applyEvents(const std::vector<SupReplEvent>& Events);
+  // A thread de replicacao: solicita os eventos ao primario enquanto a
+  // sessao estiver estabelecida
+  void thr_repl_main();
+
+  // A posicao no fluxo de replicacao do primario ateh a qual os eventos jah
+  // foram recebidos. Soh eh usada pela thread de replicacao.
+  uint64_t repl_pos;
+  // Os conjuntos de eventos recebidos e ainda nao aplicados
+  std::deque<std::vector<SupReplEvent>> repl_queue;
+  // A thread de replicacao deve continuar em execucao. Atomico: eh testado
+  // pela thread de replicacao fora da exclusao mutua. Eh alterado com mtx_queue
+  // bloqueado, para que a espera em cv_repl nao perca o encerramento.
+  std::atomic<bool> repl_on;
+  // Exclusao mutua no acesso a fila e sinalizacao do encerramento
+  std::mutex mtx_queue;
+  std::condition_variable cv_repl;
+  // Identificador da thread de replicacao
+  std::thread thr_repl;
+};
+
+#endif // _SUP_REPLICA_H_
@@ -0,0 +1,145 @@
+#include <iostream>
+#include "supreplica.h"
+
+using namespace std;
+
+/// ==============================
+/// Funcao principal da replica:
+///   supreplica IP Login Senha [porta]
+/// IP, Login e Senha: o servidor primario e o usuario (administrador) da sessao
+/// porta: a porta em que a replica espera conexoes (default SUP_PORT)
+/// Os usuarios sao copiados do primario: nao ha opcoes para altera-los.
+/// ==============================
+
+int main(int argc, char *argv[])
+{
+  if (argc < 4 || argc > 5)
+  {
+    cerr << "Uso: " << argv[0] << " IP Login Senha [porta]\n"
+         << "porta default " << SUP_PORT << endl;
+    return 1;
+  }
+
+  // A replica do servidor do sistema de tanques
+  SupReplica ST_Replica(argc > 4 ? argv[4] : SUP_PORT);
+  ST_Replica.setUpstream(argv[1], argv[2], argv[3]);
+
+  // Relogio interno: primeira leitura, delta_t desde entao
+  time_t first_t,delta_t;
+
+  // Variaveis auxiliares para digitacao de dados
+  string texto;
+  int opcao;
+
+  first_t = time(nullptr);
+  do
+  {
+    do
+    {
+      cout << "\n=================\n";
+      if (!ST_Replica.serverOn())
+      {
+        cout << " 0 - Ligar a replica\n";
+        cout << "=================\n";
+      }
+      if (ST_Replica.serverOn())
+      {
+        cout << " 1 - Ler e imprimir o estado atual da planta\n";
+        cout << "=================\n";
+        cout << "21 - Listar usuarios\n";
+        cout << "=================\n";
+        cout << "31 - Ligar/desligar a difusao UDP do estado\n";
+        cout << "=================\n";
+        cout << "98 - Desligar a replica\n";
+      }
+      cout << "99 - Sair\n";
+      cout << "=================\n";
+      cout << "Opcao: ";
+      cin >> texto;
+      try
+      {
+        opcao = stoi(texto);
+      }
+      catch(...)
+      {
+        opcao = -1;
+      }
+    }
+    while (opcao<0 || opcao>99);
+
+    if (!ST_Replica.serverOn()) // Replica nao estah ligada
+    {
+      if (opcao == 0)
+      {
+        if (!ST_Replica.setServerOn()) cerr << "Erro ao iniciar a replica!\n";
+        else first_t = time(nullptr);
+      }
+      else
+      {
+        if (opcao != 99) cout << "Replica estah desligada!\n";
+      }
+    }
+    else               // Replica estah ligada
+    {
+      // Executa a opcao escolhida
+      switch(opcao)
+      {
+      case 0:
+        cout << "Replica jah estah ligada!\n";
+        break;
+      case 1:
+        // Calcula e imprime o tempo decorrido desde que a replica foi ligada
+        delta_t = time(nullptr)-first_t;
+        cout << "T=";
+        if (delta_t >= 3600)
+        {
+          int horas = delta_t/3600;
+          delta_t -= 3600*horas;
+          cout << horas << 'h';
+        }
+        if (delta_t >= 60)
+        {
+          int minutos = delta_t/60;
+          delta_t -= 60*minutos;
+          cout << minutos << 'm';
+        }
+        cout << delta_t << "s ";
+        cout << "Servidor primario " << (ST_Replica.primaryConnected() ? "conectado" : "inacessivel") << endl;
+        // Leh e imprime o estado da planta
+        ST_Replica.readPrintState();
+        break;
+      case 21:
+        cout << "USUARIOS CADASTRADOS:\n";
+        ST_Replica.printUsers();
+        break;
+      case 31:
+        texto = ST_Replica.broadcastAddress();
+        cout << "Difusao UDP " << (texto.empty() ? "desligada" : "para "+texto) << endl;
+        cout << "Endereco IP[:porta] da difusao (- para desligar): ";
+        cin >> texto;
+        if (texto == "-") texto.clear();
+        if (ST_Replica.setBroadcast(texto))
+        {
+          texto = ST_Replica.broadcastAddress();
+          cout << "Difusao UDP " << (texto.empty() ? "desligada" : "para "+texto) << endl;
+        }
+        else
+        {
+          cout << "Endereco " << texto << " invalido (difusao desligada)\n";
+        }
+        break;
+      case 98:
+      case 99:
+        first_t = time(nullptr);
+        ST_Replica.setServerOff();
+        break;
+      default:
+        // Opcao inexistente: nao faz nada
+        break;
+      }
+    }
+  }
+  while (opcao!=99);
+
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include <iostream>     /* cerr */
 #include <algorithm>
+#include <cstring>
+#include <atomic>
 #include "supservidor.h"
 
 using namespace std;
@@ -8,14 +10,65 @@ using namespace std;
    CLASSE SUPSERVIDOR
    ======================================== */
 
-/// Construtor
+/// Construtor default
 SupServidor::SupServidor()
+  : SupServidor(SUP_PORT, SUP_LOCAL_PATH, false)
+{
+}
+
+/// Construtor com a porta TCP, o caminho do socket local e o uso do quadro de estados
+SupServidor::SupServidor(const std::string& Porta, const std::string& Local, bool Quadro)
   : Tanks()
   , server_on(false)
+  , port(Porta)
+  , local_path(Local)
+  , use_board(Quadro)
   , LU()
   , thr_server() 
+  , server_tid()
   , sock_server()
-  
+  , sock_local()
+  , t_on()
+  , t_sample()
+  , last_sample()
+  , sample_seq(0)
+  , history()
+  , t_history()
+  , board()
+  , sock_bcast()
+  , bcast_addr()
+  , mtx_bcast()
+  , t_publish()
+  , repl_log()
+  , repl_end(chrono::duration_cast<chrono::microseconds>(
+               chrono::system_clock::now().time_since_epoch()).count())
+  , mtx_repl()
+  , token_gen()
+  , journal()
+  , t_checkpoint()
+  , thr_checkpoint()
+  , ckpt_n(0)
+  , ckpt_ok(false)
+  , ckpt_done(false)
+  , journal_acks()
+  , t_standby()
+  , standby_on(false)
+  , standby_addr()
+  , standby_login()
+  , standby_senha()
+  , sock_feed()
+  , thr_standby()
+  , standby_plant()
+  , standby_sample()
+  , standby_has_plant(false)
+  , whatif_done()
+  , mtx_whatif()
+  , whatif_jobs(0)
+  , workers()
+  , deferred()
+  , mtx_deferred()
+  , deferred_jobs(0)
+  , deferred_gen(0)
 {
   // Inicializa a biblioteca de sockets
   mysocket_status iResult = mysocket::init();
@@ -30,16 +83,26 @@ SupServidor::SupServidor()
 /// Destrutor
 SupServidor::~SupServidor()
 {
+  // Encerra o servidor de reserva, sem assumir a porta
+  setStandbyOff();
+
   // Deve parar a thread do servidor
   server_on = false;
 
   // Fecha todos os sockets dos clientes
   for (auto& U : LU) U.close();
-  // Fecha o socket de conexoes
+  // Fecha os sockets de conexoes
   sock_server.close();
+  sock_local.close();
 
   // Espera o fim da thread do servidor
   if (thr_server.joinable()) thr_server.join();
+  // Espera o fim das previsoes em execucao
+  stopWhatIf();
+  // Descarta as respostas adiadas
+  stopDeferred();
+  // Desligamento normal: o diario eh removido
+  stopJournal();
 
   // Encerra a biblioteca de sockets
   mysocket::end();
@@ -51,18 +114,54 @@ bool SupServidor::setServerOn()
   // Se jah estah ligado, nao faz nada
   if (server_on) return true;
 
-  // Liga os tanques
-  setTanksOn();
+  // Espera pelo fim da thread de um servidor que parou sozinho
+  // (erro grave ou transferencia para um novo processo)
+  if (thr_server.joinable()) thr_server.join();
+
+  // Os tanques simulados sao ligados agora, e nao recebidos de outro servidor
+  const bool restaurar = !tanksOn();
+  // Liga a planta (os tanques)
+  if (!virtLigarPlanta()) return false;
+  // Reconstroi os tanques a partir do diario de atuacoes, se houver
+  if (restaurar && tanksOn()) restoreJournal();
 
   // Indica que o servidor estah ligado a partir de agora
   server_on = true;
 
+  // Referencia de tempo das amostras enviadas aos clientes e do historico.
+  // A referencia e a sequencia das amostras nao sao reiniciadas quando o
+  // servidor eh religado, para que os clientes nunca recebam um numero
+  // de sequencia ou um instante menor do que jah receberam
+  if (t_on == chrono::steady_clock::time_point()) t_on = chrono::steady_clock::now();
+  invalidateSample();
+  // O primeiro registro do historico e a primeira publicacao do estado
+  // sao feitos imediatamente
+  t_history = t_publish = chrono::steady_clock::now();
+
   try
   {
-    // Coloca o socket de conexoes em escuta
-   mysocket_status iResult = sock_server.listen(SUP_PORT);
+    // Coloca o socket de conexoes em escuta, se ainda nao estiver
+    // (recebido do servidor anterior em um reinicio sem interrupcao)
+    mysocket_status iResult = mysocket_status::SOCK_OK;
+    if (!sock_server.accepting()) iResult = sock_server.listen(port);
     // Em caso de erro, gera excecao
     if (iResult != mysocket_status::SOCK_OK) throw 1;
+    // Coloca o socket de conexoes locais em escuta.
+    // Em caso de erro, o servidor funciona apenas com o socket TCP
+    if (!sock_local.accepting()) iResult = sock_local.listen_local(local_path);
+    if (iResult != mysocket_status::SOCK_OK)
+    {
+      cerr << "Socket local " << local_path << " indisponivel\n";
+    }
+    // Cria o quadro de estados em memoria compartilhada.
+    // Em caso de erro, o servidor funciona sem o quadro
+    if (use_board && !board.open(port))
+    {
+      cerr << "Quadro de estados " << SUP_BOARD_NAME << "_" << port << " indisponivel\n";
+    }
+    // Recomeca o diario de atuacoes a partir do estado atual dos tanques.
+    // Em caso de erro, o servidor funciona sem o diario
+    if (tanksOn()) writeCheckpoint();
 
     // Lanca a thread do servidor que comunica com os clientes
     thr_server = thread( [this]()
@@ -79,8 +178,15 @@ bool SupServidor::setServerOn()
     // Deve parar a thread do servidor
     server_on = false;
 
-    // Fecha o socket do servidor
+    // Fecha os sockets do servidor
     sock_server.close();
+    sock_local.close();
+    // Remove o quadro de estados
+    board.close();
+    // Fecha o diario de atuacoes
+    journal.close();
+    // Desliga a planta
+    virtDesligarPlanta();
 
     return false;
   }
@@ -100,17 +206,623 @@ void SupServidor::setServerOff()
 
   // Fecha todos os sockets dos clientes
   for (auto& U : LU) U.close();
-  // Fecha o socket de conexoes
+  // Fecha os sockets de conexoes
   sock_server.close();
+  sock_local.close();
 
   // Espera pelo fim da thread do servidor
   if (thr_server.joinable()) thr_server.join();
   // Faz o identificador da thread apontar para thread vazia
   thr_server = thread();
-  
+  server_tid = thread::id();
+  // Remove o quadro de estados
+  board.close();
+  // Descarta as previsoes e as respostas adiadas
+  stopWhatIf();
+  stopDeferred();
+  // Desligamento normal: o diario eh removido
+  stopJournal();
+
+  // Desliga a planta (os tanques)
+  virtDesligarPlanta();
+}
+
+/// Funcoes auxiliares para transmitir o estado dos tanques (TanksState)
+/// em SUP_PLANT_FRAME_LEN inteiros de 16 bits.
+/// Os reais sao transmitidos com a sua representacao binaria exata.
+static void put_double(uint16_t* dest, double num)
+{
+  uint64_t bits;
+  memcpy(&bits, &num, sizeof(bits));
+  put_uint64(dest, bits);
+}
+static double get_double(const uint16_t* src)
+{
+  uint64_t bits = get_uint64(src);
+  double num;
+  memcpy(&num, &bits, sizeof(num));
+  return num;
+}
+static void put_plant(uint16_t* dest, const TanksState& P)
+{
+  put_double(dest, P.h1);
+  put_double(dest+4, P.h2);
+  put_double(dest+8, P.flow_pump);
+  put_double(dest+12, P.last_pump_input_perc);
+  put_double(dest+16, P.last_flow_pump_perc);
+  dest[20] = P.v1_open;
+  dest[21] = P.v2_open;
+  dest[22] = P.pump_input;
+  dest[23] = P.is_overflowing;
+  dest[24] = uint16_t(int16_t(P.n_steps_overflow));
+  dest[25] = uint16_t(P.pid.tank);
+  put_double(dest+26, P.pid.setpoint);
+  put_double(dest+30, P.pid.kp);
+  put_double(dest+34, P.pid.ki);
+  put_double(dest+38, P.pid.kd);
+  put_double(dest+42, P.pid.kt);
+  put_double(dest+46, P.pid.integral);
+  put_double(dest+50, P.pid.last_error);
+}
+/// Os primeiros PLANT_TANKS_LEN inteiros: o estado dos tanques sem o controlador
+/// de nivel, que eh o formato da versao 1 do ponto de restauracao
+static const size_t PLANT_TANKS_LEN = 25;
+static void get_tanks(const uint16_t* src, TanksState& P)
+{
+  P.h1 = get_double(src);
+  P.h2 = get_double(src+4);
+  P.flow_pump = get_double(src+8);
+  P.last_pump_input_perc = get_double(src+12);
+  P.last_flow_pump_perc = get_double(src+16);
+  P.v1_open = (src[20] != 0);
+  P.v2_open = (src[21] != 0);
+  P.pump_input = src[22];
+  P.is_overflowing = (src[23] != 0);
+  P.n_steps_overflow = int16_t(src[24]);
+}
+static void get_plant(const uint16_t* src, TanksState& P)
+{
+  get_tanks(src, P);
+  P.pid.tank = (src[25] <= 2 ? src[25] : 0);
+  P.pid.setpoint = get_double(src+26);
+  P.pid.kp = get_double(src+30);
+  P.pid.ki = get_double(src+34);
+  P.pid.kd = get_double(src+38);
+  P.pid.kt = get_double(src+42);
+  P.pid.integral = get_double(src+46);
+  P.pid.last_error = get_double(src+50);
+}
+
+/// Aplica um comando do controlador de nivel (CMD_SET_PID...) a configuracao C.
+/// Retorna false se o comando ou o parametro for invalido.
+static bool apply_pid(TanksPID& C, uint16_t Cmd, uint16_t Param)
+{
+  switch (Cmd)
+  {
+  case CMD_SET_PID:
+    if (Param > 2) return false;
+    C.tank = Param;
+    return true;
+  case CMD_SET_PID_SP:
+    C.setpoint = Param/65535.0;
+    return true;
+  case CMD_SET_PID_KP:
+    C.kp = Param/double(SUP_PID_GAIN_SCALE);
+    return true;
+  case CMD_SET_PID_KI:
+    C.ki = Param/double(SUP_PID_GAIN_SCALE);
+    return true;
+  case CMD_SET_PID_KD:
+    C.kd = Param/double(SUP_PID_GAIN_SCALE);
+    return true;
+  case CMD_SET_PID_KT:
+    C.kt = Param/double(SUP_PID_GAIN_SCALE);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Liga o servidor como reserva do servidor ativo no endereco "IP[:porta]"
+bool SupServidor::setStandbyOn(const std::string& Endereco, const std::string& Login, const std::string& Senha)
+{
+  if (server_on) return false;
+  if (standby_on) return true;
+
+  // Espera pelo fim da thread de um servidor de reserva anterior
+  if (thr_standby.joinable()) thr_standby.join();
+
+  standby_addr = Endereco;
+  standby_login = Login;
+  standby_senha = Senha;
+  standby_has_plant = false;
+  standby_on = true;
+
+  // Lanca a thread do servidor de reserva
+  thr_standby = thread( [this]()
+  {
+    this->thr_standby_main();
+  } );
+  if (!thr_standby.joinable())
+  {
+    standby_on = false;
+    return false;
+  }
+  return true;
+}
+
+/// Desliga o servidor de reserva, sem assumir a porta.
+/// Se o servidor de reserva jah assumiu a porta, o servidor continua ligado.
+void SupServidor::setStandbyOff()
+{
+  standby_on = false;
+  // Interrompe a espera por mensagens do servidor ativo
+  sock_feed.close();
+  if (thr_standby.joinable()) thr_standby.join();
+  thr_standby = thread();
+}
+
+/// A thread do servidor de reserva.
+/// Recebe os dados do servidor ativo enquanto a conexao estiver aberta.
+/// Quando a conexao termina, liga o servidor na mesma porta, a partir do
+/// ultimo estado recebido; se nao conseguir, volta a tentar conectar.
+void SupServidor::thr_standby_main()
+{
+  while (standby_on)
+  {
+    if (connectFeed())
+    {
+      cout << "\nServidor de reserva conectado ao servidor ativo " << standby_addr << endl;
+      while (standby_on && readFeed()) {}
+      sock_feed.close();
+      if (!standby_on) break;
+
+      cout << "\nConexao com o servidor ativo encerrada\n";
+      if (standby_has_plant && takeOver())
+      {
+        cout << "\nServidor de reserva assumiu a porta " << port << endl;
+        standby_on = false;
+        break;
+      }
+      cerr << "Servidor de reserva nao assumiu a porta " << port << endl;
+    }
+    // Espera pela proxima tentativa, testando se o servidor de reserva foi desligado
+    for (int i=0; standby_on && i<10*SUP_STANDBY_RETRY; ++i)
+    {
+      this_thread::sleep_for(chrono::milliseconds(100));
+    }
+  }
+}
+
+/// Conecta ao servidor ativo como administrador e solicita o canal do
+/// servidor de reserva (CMD_STANDBY)
+bool SupServidor::connectFeed()
+{
+  string IP, Porta;
+  uint16_t cmd;
+
+  split_address(standby_addr, IP, Porta, SUP_PORT);
+  try
+  {
+    if (sock_feed.connect(IP, Porta) != mysocket_status::SOCK_OK) throw 1;
+    if (sock_feed.write_uint16(CMD_LOGIN) != mysocket_status::SOCK_OK) throw 2;
+    if (sock_feed.write_string(standby_login) != mysocket_status::SOCK_OK) throw 2;
+    if (sock_feed.write_string(standby_senha) != mysocket_status::SOCK_OK) throw 2;
+    if (sock_feed.read_uint16(cmd, SUP_TIMEOUT*1000) != mysocket_status::SOCK_OK) throw 3;
+    if (cmd != CMD_ADMIN_OK) throw 4;
+    if (sock_feed.write_uint16(CMD_STANDBY) != mysocket_status::SOCK_OK) throw 2;
+    if (sock_feed.read_uint16(cmd, SUP_TIMEOUT*1000) != mysocket_status::SOCK_OK) throw 3;
+    if (cmd != CMD_OK) throw 5;
+  }
+  catch (int e)
+  {
+    // O servidor ativo inacessivel (erro 1) eh normal: nao exibe mensagem
+    if (e != 1) cerr << "Erro " << e << " na conexao com o servidor ativo " << standby_addr << endl;
+    sock_feed.close();
+    return false;
+  }
+  return true;
+}
+
+/// Leh e aplica uma mensagem do servidor ativo.
+/// O servidor ativo envia o estado a cada SUP_STANDBY_PERIOD ms: sem nenhuma
+/// mensagem durante SUP_TIMEOUT segundos, a conexao eh considerada perdida.
+bool SupServidor::readFeed()
+{
+  uint16_t cmd;
+  uint16_t data[SUP_MAX_REPLY_LEN];
+
+  if (sock_feed.read_uint16(cmd, SUP_TIMEOUT*1000) != mysocket_status::SOCK_OK) return false;
+  switch (cmd)
+  {
+  case CMD_REPLICA:
+  {
+    // Nova posicao, numero de eventos e eventos
+    if (sock_feed.read_uint16_array(data, 5, SUP_TIMEOUT*1000) != mysocket_status::SOCK_OK) return false;
+    const int n = data[4];
+    if (n > SUP_REPL_MAX_EVENTS) return false;
+    if (n > 0 && sock_feed.read_uint16_array(data+5, SUP_REPL_EVENT_LEN*n, SUP_TIMEOUT*1000) !=
+                 mysocket_status::SOCK_OK) return false;
+    vector<SupReplEvent> Events(n);
+    for (int i=0; i<n; ++i) Events[i].fromFrame(data + 5 + SUP_REPL_EVENT_LEN*i);
+
+    // Copia completa da lista de usuarios
+    if (!Events.empty() && Events.front().type == CMD_USER_CLEAR)
+    {
+      setUsers(vector<SupReplEvent>(Events.begin()+1, Events.end()));
+      return true;
+    }
+    for (const auto& E : Events)
+    {
+      switch (E.type)
+      {
+      case CMD_USER_ADD:
+        addUser(E.login, E.password, E.param != 0);
+        break;
+      case CMD_USER_DEL:
+        removeUser(E.login);
+        break;
+      // As atuacoes posteriores ao ultimo estado recebido
+      case CMD_SET_PUMP:
+        standby_plant.pump_input = E.param;
+        standby_plant.pid.tank = 0;
+        break;
+      case CMD_SET_V1:
+        standby_plant.v1_open = (E.param != 0);
+        break;
+      case CMD_SET_V2:
+        standby_plant.v2_open = (E.param != 0);
+        break;
+      case CMD_SET_PID:
+      case CMD_SET_PID_SP:
+      case CMD_SET_PID_KP:
+      case CMD_SET_PID_KI:
+      case CMD_SET_PID_KD:
+      case CMD_SET_PID_KT:
+        apply_pid(standby_plant.pid, E.type, E.param);
+        break;
+      default:
+        break;
+      }
+    }
+    return true;
+  }
+
+  case CMD_STANDBY_STATE:
+  {
+    // Os tanques, a ultima amostra e o numero de sessoes
+    const int len = SUP_PLANT_FRAME_LEN+9;
+    if (sock_feed.read_uint16_array(data, len, SUP_TIMEOUT*1000) != mysocket_status::SOCK_OK) return false;
+    const int n = data[len-1];
+    if (n > SUP_MAX_USERS) return false;
+    if (n > 0 && sock_feed.read_uint16_array(data+len, SUP_SESSION_FRAME_LEN*n, SUP_TIMEOUT*1000) !=
+                 mysocket_status::SOCK_OK) return false;
+
+    get_plant(data, standby_plant);
+    standby_sample.seq = get_uint64(data+SUP_PLANT_FRAME_LEN);
+    standby_sample.t_us = get_uint64(data+SUP_PLANT_FRAME_LEN+4);
+    standby_has_plant = true;
+
+    // As sessoes: os tokens dos usuarios
+    for (auto& U : LU)
+    {
+      U.token = 0;
+      for (int i=0; i<n; ++i)
+      {
+        const uint16_t* sess = data + len + SUP_SESSION_FRAME_LEN*i;
+        if (get_string12(sess) == U.login) U.token = get_uint64(sess+6);
+      }
+    }
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
+/// Liga o servidor a partir do ultimo estado recebido do servidor ativo
+bool SupServidor::takeOver()
+{
+  if (!virtLigarPlanta()) return false;
+  // Os tanques continuam a simulacao do servidor ativo
+  setState(standby_plant);
+  // As amostras continuam a sequencia e a referencia de tempo do servidor
+  // ativo: os clientes nunca recebem um numero de sequencia ou um instante
+  // menor do que jah receberam
+  sample_seq = standby_sample.seq;
+  t_on = chrono::steady_clock::now() - chrono::microseconds(standby_sample.t_us);
+  // Em caso de erro, setServerOn desliga a planta
+  return setServerOn();
+}
+
+/// Gera o token de uma nova sessao
+uint64_t SupServidor::newToken()
+{
+  uint64_t token;
+  do token = (uint64_t(token_gen()) << 32) ^ token_gen(); while (token == 0);
+  return token;
+}
+
+/// Envia aos servidores de reserva os eventos do fluxo de replicacao, logo
+/// que ocorrem, e o estado (CMD_STANDBY_STATE), a cada SUP_STANDBY_PERIOD ms.
+/// O estado inclui os tokens das sessoes (mesmo as que perderam a conexao),
+/// para que os clientes possam retomar as sessoes no servidor de reserva.
+/// Retorna o tempo (em ms) ateh o proximo envio do estado.
+long SupServidor::serveStandby()
+{
+  bool has_standby = false;
+  for (auto& U : LU)
+  {
+    if (!U.isConnected() || !U.standby) continue;
+    has_standby = true;
+    while (sendReplica(U, false)) {}
+  }
+  if (!has_standby) return long(SUP_TIMEOUT*1000);
+
+  auto now = chrono::steady_clock::now();
+  if (now >= t_standby)
+  {
+    // Os tanques, a ultima amostra e as sessoes
+    uint16_t data[SUP_MAX_REPLY_LEN];
+    const int len = SUP_PLANT_FRAME_LEN+9;
+    TanksState P;
+    getState(P);
+    put_plant(data, P);
+    SupState S;
+    sampleState(S);
+    put_uint64(data+SUP_PLANT_FRAME_LEN, S.seq);
+    put_uint64(data+SUP_PLANT_FRAME_LEN+4, S.t_us);
+    uint16_t n = 0;
+    for (const auto& U : LU)
+    {
+      if (U.token == 0) continue;
+      uint16_t* sess = data + len + SUP_SESSION_FRAME_LEN*n;
+      put_string12(sess, U.login);
+      put_uint64(sess+6, U.token);
+      ++n;
+    }
+    data[len-1] = n;
+    for (auto& U : LU)
+    {
+      if (U.isConnected() && U.standby)
+      {
+        sendReply(U, CMD_STANDBY_STATE, 0, data, len + SUP_SESSION_FRAME_LEN*n);
+      }
+    }
 
-  // Desliga os tanques
-  setTanksOff();
+    // Mantem o periodo, a menos que esteja atrasado mais de um periodo
+    t_standby += chrono::milliseconds(SUP_STANDBY_PERIOD);
+    if (t_standby <= now) t_standby = now + chrono::milliseconds(SUP_STANDBY_PERIOD);
+  }
+  return chrono::duration_cast<chrono::milliseconds>(t_standby - now).count() + 1;
+}
+
+/// Liga o servidor recebendo tudo do servidor em execucao no mesmo computador,
+/// pelo socket local deste servidor (reinicio sem interrupcao)
+bool SupServidor::setServerOnFrom(const std::string& Login, const std::string& Senha)
+{
+  if (server_on || standby_on) return false;
+
+  // A conexao com o servidor em execucao
+  tcp_mysocket C;
+  uint16_t cmd;
+  try
+  {
+    if (C.connect_local(local_path) != mysocket_status::SOCK_OK) throw 1;
+    if (C.write_uint16(CMD_LOGIN) != mysocket_status::SOCK_OK) throw 2;
+    if (C.write_string(Login) != mysocket_status::SOCK_OK) throw 2;
+    if (C.write_string(Senha) != mysocket_status::SOCK_OK) throw 2;
+    if (C.read_uint16(cmd, SUP_TIMEOUT*1000) != mysocket_status::SOCK_OK) throw 3;
+    if (cmd != CMD_ADMIN_OK) throw 4;
+    if (C.write_uint16(CMD_HANDOFF) != mysocket_status::SOCK_OK) throw 2;
+    if (C.read_uint16(cmd, SUP_TIMEOUT*1000) != mysocket_status::SOCK_OK) throw 3;
+    if (cmd != CMD_OK) throw 5;
+    if (!receiveHandoff(C)) throw 6;
+  }
+  catch (int e)
+  {
+    cerr << "Erro " << e << " na transferencia do servidor " << local_path << endl;
+    return false;
+  }
+
+  // Os sockets de conexoes recebidos jah estao em escuta
+  return setServerOn();
+}
+
+/// Transfere o servidor para o processo do outro lado da conexao do usuario U.
+/// Depois da resposta CMD_OK ao comando CMD_HANDOFF, envia:
+/// - o cabecalho (SUP_HANDOFF_HEAD_LEN inteiros): o estado dos tanques, a
+///   sequencia das amostras, o instante atual na referencia das amostras, a
+///   posicao do fluxo de replicacao e os numeros de registros do historico e de usuarios;
+/// - os registros do historico (t_us, H1, H2), em envios de SUP_HANDOFF_CHUNK registros;
+/// - se ha difusao por UDP (1) ou nao (0), seguido do seu endereco (string);
+/// - cada usuario (SUP_HANDOFF_USER_LEN inteiros), seguido da sua conexao, se houver;
+/// - se ha socket local (1) ou nao (0), seguido dos sockets de conexoes TCP e local.
+/// Os dados que os clientes jah enviaram e que ainda nao foram lidos continuam
+/// nas conexoes e serao lidos pelo novo processo.
+/// Quando o novo processo confirma (CMD_OK), este servidor para sem fechar as
+/// conexoes (fecha apenas as suas copias) e fecha a conexao com o novo processo.
+bool SupServidor::sendHandoff(User& U)
+{
+  const long tmax = SUP_TIMEOUT*1000;
+  uint16_t data[SUP_MAX_REPLY_LEN];
+  static_assert(6*SUP_HANDOFF_CHUNK <= SUP_MAX_REPLY_LEN, "SUP_HANDOFF_CHUNK muito grande");
+
+  // As atuacoes que esperam pela gravacao do diario sao respondidas antes,
+  // pois as conexoes passam para o novo processo
+  serveJournal();
+
+  // O cabecalho
+  TanksState P;
+  getState(P);
+  put_plant(data, P);
+  const auto now = chrono::steady_clock::now();
+  put_uint64(data+SUP_PLANT_FRAME_LEN, sample_seq);
+  put_uint64(data+SUP_PLANT_FRAME_LEN+4, chrono::duration_cast<chrono::microseconds>(now - t_on).count());
+  {
+    lock_guard<mutex> lock(mtx_repl);
+    put_uint64(data+SUP_PLANT_FRAME_LEN+8, repl_end);
+  }
+  put_uint64(data+SUP_PLANT_FRAME_LEN+12, history.size());
+  data[SUP_PLANT_FRAME_LEN+16] = uint16_t(LU.size());
+  if (U.sock.write_uint16_array(data, SUP_HANDOFF_HEAD_LEN) != mysocket_status::SOCK_OK) return false;
+
+  // O historico
+  for (size_t i=0; i<history.size(); )
+  {
+    int n = 0;
+    for ( ; n<SUP_HANDOFF_CHUNK && i<history.size(); ++n, ++i)
+    {
+      put_uint64(data+6*n, history[i].t_us);
+      data[6*n+4] = history[i].H1;
+      data[6*n+5] = history[i].H2;
+    }
+    if (U.sock.write_uint16_array(data, 6*n) != mysocket_status::SOCK_OK) return false;
+  }
+
+  // A difusao por UDP
+  const string baddr = broadcastAddress();
+  if (U.sock.write_uint16(baddr.empty() ? 0 : 1) != mysocket_status::SOCK_OK) return false;
+  if (!baddr.empty() && U.sock.write_string(baddr) != mysocket_status::SOCK_OK) return false;
+
+  // Os usuarios e as suas conexoes. A conexao com o novo processo nao eh transferida.
+  for (const auto& V : LU)
+  {
+    const bool conectado = (&V != &U && V.isConnected());
+    put_string12(data, V.login);
+    put_string12(data+6, V.password);
+    data[12] = V.isAdmin;
+    put_uint64(data+13, (&V != &U ? V.token : 0));
+    data[17] = (conectado ? 1 : 0) | (V.pipelined ? 2 : 0) | (V.standby ? 4 : 0) |
+               (V.repl_wait ? 8 : 0) | (V.local ? 16 : 0);
+    data[18] = V.repl_id;
+    put_uint64(data+19, V.repl_pos);
+    auto resta = chrono::duration_cast<chrono::milliseconds>(V.repl_t - now).count();
+    data[23] = uint16_t(max<long long>(0, min<long long>(resta, UINT16_MAX)));
+    if (U.sock.write_uint16_array(data, SUP_HANDOFF_USER_LEN) != mysocket_status::SOCK_OK) return false;
+    if (conectado && U.sock.write_socket(V.sock, tmax) != mysocket_status::SOCK_OK) return false;
+  }
+
+  // Os sockets de conexoes
+  if (U.sock.write_uint16(sock_local.accepting() ? 1 : 0) != mysocket_status::SOCK_OK) return false;
+  if (U.sock.write_socket(sock_server, tmax) != mysocket_status::SOCK_OK) return false;
+  if (sock_local.accepting() && U.sock.write_socket(sock_local, tmax) != mysocket_status::SOCK_OK) return false;
+
+  // A confirmacao do novo processo
+  uint16_t cmd;
+  if (U.sock.read_uint16(cmd, tmax) != mysocket_status::SOCK_OK || cmd != CMD_OK) return false;
+
+  // Para este servidor. O quadro de estados eh removido antes que o novo
+  // processo o recrie. As conexoes continuam abertas no novo processo.
+  server_on = false;
+  board.close();
+  setBroadcast("");
+  for (auto& V : LU) if (&V != &U) V.close();
+  sock_server.close();
+  sock_local.close();
+  // As previsoes em execucao e as respostas adiadas sao descartadas (nao sao transferidas)
+  stopWhatIf();
+  stopDeferred();
+  // O novo processo recomeca o diario a partir do estado recebido
+  stopJournal();
+  virtDesligarPlanta();
+  // O fim da conexao indica ao novo processo que ele pode comecar
+  U.close();
+  return true;
+}
+
+/// Recebe tudo do servidor anterior (ver sendHandoff), confirma e espera pelo
+/// fim do servidor anterior. Soh altera este servidor se tudo foi recebido.
+bool SupServidor::receiveHandoff(const tcp_mysocket& C)
+{
+  const long tmax = SUP_TIMEOUT*1000;
+  uint16_t data[SUP_MAX_REPLY_LEN];
+
+  // O cabecalho
+  if (C.read_uint16_array(data, SUP_HANDOFF_HEAD_LEN, tmax) != mysocket_status::SOCK_OK) return false;
+  TanksState P;
+  get_plant(data, P);
+  const uint64_t seq = get_uint64(data+SUP_PLANT_FRAME_LEN);
+  const uint64_t t_ref = get_uint64(data+SUP_PLANT_FRAME_LEN+4);
+  const uint64_t r_end = get_uint64(data+SUP_PLANT_FRAME_LEN+8);
+  const uint64_t nhist = get_uint64(data+SUP_PLANT_FRAME_LEN+12);
+  const uint16_t nusers = data[SUP_PLANT_FRAME_LEN+16];
+  if (nhist > SUP_HISTORY_LEN || nusers > SUP_MAX_USERS) return false;
+
+  // O historico
+  deque<HistRecord> H;
+  while (H.size() < nhist)
+  {
+    const int n = int(min<uint64_t>(SUP_HANDOFF_CHUNK, nhist - H.size()));
+    if (C.read_uint16_array(data, 6*n, tmax) != mysocket_status::SOCK_OK) return false;
+    for (int i=0; i<n; ++i)
+    {
+      HistRecord R;
+      R.t_us = get_uint64(data+6*i);
+      R.H1 = data[6*i+4];
+      R.H2 = data[6*i+5];
+      H.push_back(R);
+    }
+  }
+
+  // A difusao por UDP
+  uint16_t has_bcast;
+  string baddr;
+  if (C.read_uint16(has_bcast, tmax) != mysocket_status::SOCK_OK) return false;
+  if (has_bcast != 0 && C.read_string(baddr, tmax) != mysocket_status::SOCK_OK) return false;
+
+  // Os usuarios e as suas conexoes
+  list<User> NL;
+  const auto now = chrono::steady_clock::now();
+  for (int i=0; i<nusers; ++i)
+  {
+    if (C.read_uint16_array(data, SUP_HANDOFF_USER_LEN, tmax) != mysocket_status::SOCK_OK) return false;
+    NL.push_back(User(get_string12(data), get_string12(data+6), data[12] != 0));
+    User& V = NL.back();
+    V.token = get_uint64(data+13);
+    V.pipelined = (data[17] & 2) != 0;
+    V.standby = (data[17] & 4) != 0;
+    V.repl_wait = (data[17] & 8) != 0;
+    V.local = (data[17] & 16) != 0;
+    V.repl_id = data[18];
+    V.repl_pos = get_uint64(data+19);
+    V.repl_t = now + chrono::milliseconds(data[23]);
+    if ((data[17] & 1) != 0 && C.read_socket(V.sock, tmax) != mysocket_status::SOCK_OK) return false;
+  }
+
+  // Os sockets de conexoes
+  tcp_mysocket_server NS, NLocal;
+  uint16_t has_local;
+  if (C.read_uint16(has_local, tmax) != mysocket_status::SOCK_OK) return false;
+  if (C.read_socket(NS, tmax) != mysocket_status::SOCK_OK) return false;
+  if (has_local != 0 && C.read_socket(NLocal, tmax) != mysocket_status::SOCK_OK) return false;
+
+  // Confirma e espera pelo fim do servidor anterior, que fecha a conexao
+  uint16_t cmd;
+  if (C.write_uint16(CMD_OK) != mysocket_status::SOCK_OK) return false;
+  if (C.read_uint16(cmd, tmax) != mysocket_status::SOCK_DISCONNECTED) return false;
+
+  // Assume os usuarios, as conexoes e o estado
+  LU.swap(NL);
+  sock_server.swap(NS);
+  sock_local.swap(NLocal);
+  history.swap(H);
+  {
+    lock_guard<mutex> lock(mtx_repl);
+    repl_log.clear();
+    repl_end = r_end;
+  }
+  virtLigarPlanta();
+  setState(P);
+  // As amostras continuam a sequencia e a referencia de tempo do servidor anterior
+  sample_seq = seq;
+  t_on = chrono::steady_clock::now() - chrono::microseconds(t_ref);
+  if (!baddr.empty() && !setBroadcast(baddr))
+  {
+    cerr << "Difusao UDP para " << baddr << " indisponivel\n";
+  }
+  return true;
 }
 
 /// Leitura do estado dos tanques
@@ -130,13 +842,509 @@ void SupServidor::readStateFromSensors(SupState& S) const
   S.ovfl = isOverflowing();
 }
 
+/// Executa um comando de atuacao sobre os tanques
+bool SupServidor::virtAtuar(uint16_t Cmd, uint16_t Param)
+{
+  switch (Cmd)
+  {
+  case CMD_SET_PUMP:
+    setPumpInput(Param);
+    return true;
+  case CMD_SET_V1:
+    setV1Open(Param != 0);
+    return true;
+  case CMD_SET_V2:
+    setV2Open(Param != 0);
+    return true;
+  case CMD_SET_PID:
+  case CMD_SET_PID_SP:
+  case CMD_SET_PID_KP:
+  case CMD_SET_PID_KI:
+  case CMD_SET_PID_KD:
+  case CMD_SET_PID_KT:
+  {
+    TanksPID C;
+    getPID(C);
+    if (!apply_pid(C, Cmd, Param)) return false;
+    setPID(C);
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+/// Responde a uma atuacao executada com sucesso.
+/// Com o diario aberto, a resposta espera pela gravacao da atuacao no disco
+/// (serveJournal), feita em grupo com as demais atuacoes do mesmo ciclo.
+void SupServidor::ackActuation(const User& U, uint16_t cmd, uint16_t param, uint16_t id)
+{
+  if (!journal.isOpen())
+  {
+    sendReply(U, CMD_OK, id);
+    return;
+  }
+  journal.append(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t_on).count(),
+                 cmd, param);
+  JournalAck A;
+  A.login = U.login;
+  A.token = U.token;
+  A.id = id;
+  journal_acks.push_back(A);
+}
+
+/// Grava as atuacoes pendentes no diario e envia as respostas que esperavam
+/// pela gravacao, a cada ciclo da thread do servidor.
+/// As atuacoes jah foram executadas: as respostas sao enviadas mesmo que a
+/// gravacao falhe (o servidor continua sem o diario). A resposta soh eh enviada
+/// se a sessao que fez a atuacao continuar conectada.
+long SupServidor::serveJournal()
+{
+  if (!journal.isOpen()) return long(SUP_TIMEOUT*1000);
+
+  if (!journal.commit())
+  {
+    cerr << "Erro na gravacao do diario de atuacoes " << SUP_JOURNAL_PATH << endl;
+  }
+  for (const auto& A : journal_acks)
+  {
+    auto itr = find(LU.begin(), LU.end(), A.login);
+    if (itr != LU.end() && itr->token == A.token && itr->isConnected())
+    {
+      sendReply(*itr, CMD_OK, A.id);
+    }
+  }
+  journal_acks.clear();
+
+  // O ponto de restauracao: o anterior terminou de ser gravado
+  if (thr_checkpoint.joinable())
+  {
+    if (!ckpt_done) return SUP_CHECKPOINT_POLL;
+    finishCheckpoint();
+  }
+  if (!journal.isOpen()) return long(SUP_TIMEOUT*1000);
+  if (chrono::steady_clock::now() >= t_checkpoint) startCheckpoint();
+  if (thr_checkpoint.joinable()) return SUP_CHECKPOINT_POLL;
+  auto dt = chrono::duration_cast<chrono::milliseconds>(t_checkpoint - chrono::steady_clock::now()).count();
+  return max(0L, long(dt));
+}
+
+/// Monta um ponto de restauracao com o estado completo dos tanques (inclusive
+/// os geradores de ruido), o instante atual e a sequencia das amostras
+void SupServidor::makeCheckpoint(SupCheckpoint& C)
+{
+  TanksState P;
+  getState(P);
+  C.n = journal.nextRecord();
+  C.t_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t_on).count();
+  C.seq = sample_seq;
+  P.toBytes(C.data);
+  t_checkpoint = chrono::steady_clock::now() + chrono::seconds(SUP_CHECKPOINT_PERIOD);
+}
+
+/// Grava um ponto de restauracao e recomeca o diario vazio.
+/// Usada quando o servidor eh ligado, antes da thread do servidor.
+bool SupServidor::writeCheckpoint()
+{
+  SupCheckpoint C;
+  makeCheckpoint(C);
+  if (journal.checkpoint(C)) return true;
+  cerr << "Diario de atuacoes " << SUP_JOURNAL_PATH << " indisponivel\n";
+  return false;
+}
+
+/// Inicia a gravacao de um ponto de restauracao em segundo plano.
+/// O estado eh lido pela thread do servidor, entre duas atuacoes; somente a
+/// escrita e a sincronizacao do arquivo ficam para a outra thread.
+/// As atuacoes continuam sendo gravadas no diario durante a gravacao.
+void SupServidor::startCheckpoint()
+{
+  auto C = make_shared<SupCheckpoint>();
+  makeCheckpoint(*C);
+  ckpt_n = C->n;
+  ckpt_ok = false;
+  ckpt_done = false;
+  thr_checkpoint = thread([this,C]()
+  {
+    ckpt_ok = journal.saveCheckpoint(*C);
+    ckpt_done = true;
+  });
+  // Em caso de erro, o ponto eh gravado pela propria thread do servidor
+  if (!thr_checkpoint.joinable())
+  {
+    ckpt_ok = journal.saveCheckpoint(*C);
+    ckpt_done = true;
+  }
+}
+
+/// Espera pelo fim da gravacao em segundo plano. Se o ponto foi gravado,
+/// o diario pode ser esvaziado; senao, o diario eh removido (os registros
+/// que faltam no ponto anterior nao seriam mais gravados).
+void SupServidor::finishCheckpoint()
+{
+  if (thr_checkpoint.joinable()) thr_checkpoint.join();
+  thr_checkpoint = thread();
+  if (!ckpt_done) return;
+  ckpt_done = false;
+  if (!journal.isOpen())
+  {
+    // O diario foi removido durante a gravacao: o ponto tambem eh removido
+    journal.remove();
+    return;
+  }
+  if (!ckpt_ok || !journal.trim(ckpt_n))
+  {
+    journal.remove();
+    cerr << "Diario de atuacoes " << SUP_JOURNAL_PATH << " indisponivel\n";
+  }
+}
+
+/// Restaura os tanques a partir do ultimo ponto de restauracao e refaz as
+/// atuacoes registradas depois dele, cada uma no passo de simulacao (de 1 segundo)
+/// em que foi executada. Os tanques ficam no estado do instante da ultima
+/// atuacao (ou do ponto de restauracao, se nao houver atuacoes).
+bool SupServidor::restoreJournal()
+{
+  SupCheckpoint C;
+  vector<SupJournalRecord> R;
+  TanksState P;
+  if (!journal.load(C, R)) return false;
+  if (C.version == 1)
+  {
+    // Versao 1: os tanques em inteiros de 16 bits, sem o controlador de nivel,
+    // que fica desligado, e sem os geradores de ruido, que continuam os atuais
+    if (C.data.size() != 2*PLANT_TANKS_LEN) return false;
+    uint16_t frame[PLANT_TANKS_LEN];
+    for (size_t i=0; i<PLANT_TANKS_LEN; ++i) frame[i] = uint16_t(C.data[2*i] | (C.data[2*i+1] << 8));
+    getState(P);
+    get_tanks(frame, P);
+    P.pid = TanksPID();
+    cerr << "Ponto de restauracao " << SUP_CHECKPOINT_PATH
+         << " na versao 1: o controlador de nivel fica desligado\n";
+  }
+  else if (!P.fromBytes(C.data)) return false;
+  setState(P);
+  uint64_t t_us = C.t_us;
+  for (const auto& A : R)
+  {
+    if (A.t_us > t_us)
+    {
+      advance(unsigned(A.t_us/1000000 - t_us/1000000));
+      t_us = A.t_us;
+    }
+    SupServidor::virtAtuar(A.cmd, A.param);
+  }
+
+  // As amostras continuam a sequencia e a referencia de tempo da execucao anterior.
+  // As amostras enviadas depois do ponto de restauracao nao foram registradas:
+  // o instante avanca SUP_CHECKPOINT_MARGIN segundos alem do ponto, e a
+  // sequencia, o maior numero de amostras possivel nesse intervalo, para que
+  // os clientes nunca recebam um numero de sequencia ou um instante menor
+  const uint64_t t_ref = max(t_us, C.t_us + uint64_t(SUP_CHECKPOINT_MARGIN)*1000000);
+  sample_seq = max(sample_seq, C.seq + (t_ref - C.t_us)/(1000*SUP_SAMPLE_PERIOD) + 1);
+  if (t_on == chrono::steady_clock::time_point())
+  {
+    t_on = chrono::steady_clock::now() - chrono::microseconds(t_ref);
+  }
+  cout << "Tanques restaurados de " << SUP_CHECKPOINT_PATH << " e de "
+       << R.size() << " atuacoes em " << SUP_JOURNAL_PATH << endl;
+  return true;
+}
+
+/// Encerra o diario em um desligamento normal. Os arquivos sao removidos: quando o servidor for ligado
+/// novamente, os tanques recomecam do estado desligado, sem restauracao.
+/// As respostas pendentes sao descartadas (as conexoes jah foram fechadas).
+void SupServidor::stopJournal()
+{
+  // O diario nao foi usado por este servidor (um repetidor, por exemplo)
+  if (!journal.isOpen() && !thr_checkpoint.joinable()) return;
+  finishCheckpoint();
+  journal.remove();
+  journal_acks.clear();
+}
+
+/// Amostragem do estado dos tanques enviado aos clientes.
+/// Os sensores soh sao lidos novamente se a ultima amostra tiver mais de
+/// SUP_SAMPLE_PERIOD milisegundos: varios clientes pedindo dados ao mesmo
+/// tempo recebem a mesma amostra, identificada pelo mesmo numero de sequencia.
+/// Uma amostra que jah vem identificada da planta mantem a sua identificacao.
+void SupServidor::sampleState(SupState& S)
+{
+  auto now = chrono::steady_clock::now();
+  if (t_sample == chrono::steady_clock::time_point() ||
+      now - t_sample >= chrono::milliseconds(SUP_SAMPLE_PERIOD))
+  {
+    SupState N;
+    virtLerEstado(N);
+    if (N.seq == 0)
+    {
+      N.seq = ++sample_seq;
+      N.t_us = chrono::duration_cast<chrono::microseconds>(now - t_on).count();
+    }
+    last_sample = N;
+    t_sample = now;
+  }
+  S = last_sample;
+}
+
+/// Registra os niveis no historico, se chegou a hora.
+/// Retorna o tempo (em ms) ateh o proximo registro.
+long SupServidor::recordHistory()
+{
+  auto now = chrono::steady_clock::now();
+  if (now >= t_history)
+  {
+    SupState S;
+    virtLerEstado(S);
+    HistRecord R;
+    // O instante da amostra, na mesma referencia de SupState::t_us
+    if (S.seq != 0) R.t_us = S.t_us;
+    else R.t_us = chrono::duration_cast<chrono::microseconds>(now - t_on).count();
+    R.H1 = S.H1;
+    R.H2 = S.H2;
+    // Uma amostra repetida (a planta nao forneceu estado novo) nao eh registrada
+    if (history.empty() || R.t_us > history.back().t_us)
+    {
+      history.push_back(R);
+      if (history.size() > SUP_HISTORY_LEN) history.pop_front();
+    }
+
+    // Mantem o periodo, a menos que esteja atrasado mais de um periodo
+    t_history += chrono::milliseconds(SUP_HISTORY_PERIOD);
+    if (t_history <= now) t_history = now + chrono::milliseconds(SUP_HISTORY_PERIOD);
+  }
+  return chrono::duration_cast<chrono::milliseconds>(t_history - now).count() + 1;
+}
+
+/// Publica o estado no quadro em memoria compartilhada e no canal de difusao
+/// por UDP, se chegou a hora. O estado publicado eh a mesma amostra enviada
+/// aos clientes pelos sockets, com o mesmo numero de sequencia.
+/// O custo eh o mesmo, qualquer que seja o numero de leitores e visualizadores.
+/// Retorna o tempo (em ms) ateh a proxima publicacao.
+long SupServidor::publishState()
+{
+  lock_guard<mutex> lock(mtx_bcast);
+  if (!board.isOpen() && sock_bcast.closed()) return long(SUP_TIMEOUT*1000);
+  auto now = chrono::steady_clock::now();
+  if (now >= t_publish)
+  {
+    SupState S;
+    sampleState(S);
+    board.publish(SUP_PLANT_ID, S);
+    if (!sock_bcast.closed())
+    {
+      uint16_t frame[SUP_BCAST_FRAME_LEN];
+      frame[0] = CMD_STATE_BCAST;
+      frame[1] = SUP_PLANT_ID;
+      S.toFrameExt(frame+2);
+      // Um datagrama perdido eh substituido pelo seguinte: erros sao ignorados
+      sock_bcast.write_datagram((const mybyte*)frame, sizeof(frame));
+    }
+
+    // Mantem o periodo, a menos que esteja atrasado mais de um periodo
+    t_publish += chrono::milliseconds(SUP_SAMPLE_PERIOD);
+    if (t_publish <= now) t_publish = now + chrono::milliseconds(SUP_SAMPLE_PERIOD);
+  }
+  return chrono::duration_cast<chrono::milliseconds>(t_publish - now).count() + 1;
+}
+
+/// Liga a difusao do estado por UDP para o endereco "IP[:porta]", ou desliga,
+/// se o endereco for vazio
+bool SupServidor::setBroadcast(const std::string& Endereco)
+{
+  lock_guard<mutex> lock(mtx_bcast);
+  sock_bcast.close();
+  bcast_addr.clear();
+  if (Endereco.empty()) return true;
+
+  string IP, Porta;
+  split_address(Endereco, IP, Porta, SUP_BCAST_PORT);
+  if (sock_bcast.open_sender(IP, Porta) != mysocket_status::SOCK_OK) return false;
+  bcast_addr = IP + ':' + Porta;
+  return true;
+}
+
+/// Endereco da difusao do estado por UDP (vazio se desligada)
+std::string SupServidor::broadcastAddress() const
+{
+  lock_guard<mutex> lock(mtx_bcast);
+  return bcast_addr;
+}
+
+/// Executa F na thread do servidor. Se chamada pela propria thread do servidor,
+/// F eh executada imediatamente; se nao, eh executada por serveDeferred.
+void SupServidor::runOnServerThread(std::function<void()> F)
+{
+  if (this_thread::get_id() == server_tid)
+  {
+    F();
+    return;
+  }
+  lock_guard<mutex> lock(mtx_deferred);
+  deferred.push_back(std::move(F));
+}
+
+/// Executa as funcoes entregues pelas outras threads. As outras threads nao
+/// acordam a thread do servidor: enquanto houver respostas pendentes, a espera
+/// pelos clientes eh limitada a SUP_DEFERRED_POLL ms.
+long SupServidor::serveDeferred()
+{
+  deque<function<void()>> prontas;
+  {
+    lock_guard<mutex> lock(mtx_deferred);
+    prontas.swap(deferred);
+  }
+  for (auto& F : prontas) F();
+  return (deferred_jobs > 0 ? long(SUP_DEFERRED_POLL) : long(SUP_TIMEOUT*1000));
+}
+
+/// Descarta as respostas adiadas. As que ainda forem entregues pertencem a
+/// uma geracao anterior e serao ignoradas.
+void SupServidor::stopDeferred()
+{
+  lock_guard<mutex> lock(mtx_deferred);
+  deferred.clear();
+  deferred_jobs = 0;
+  ++deferred_gen;
+}
+
+/// Inicia uma atuacao. A resposta nao eh esperada pela thread do servidor:
+/// eh enviada por finishActuation quando a atuacao for concluida.
+void SupServidor::startActuation(const User& U, uint16_t cmd, uint16_t param, uint16_t id)
+{
+  const string login = U.login;
+  const uint64_t token = U.token;
+  const unsigned gen = deferred_gen;
+  ++deferred_jobs;
+  virtAtuarAdiado(cmd, param, [this, login, token, gen, cmd, param, id](bool ok)
+  {
+    runOnServerThread([this, login, token, gen, cmd, param, id, ok]()
+    {
+      if (gen != deferred_gen) return;
+      --deferred_jobs;
+      finishActuation(login, token, cmd, param, id, ok);
+    });
+  });
+}
+
+/// Conclui uma atuacao: registra o evento e responde ao usuario que a
+/// solicitou, se a sessao continuar conectada. A atuacao bem sucedida eh
+/// registrada mesmo que a sessao tenha sido encerrada.
+void SupServidor::finishActuation(const std::string& login, uint64_t token, uint16_t cmd,
+                                  uint16_t param, uint16_t id, bool ok)
+{
+  auto itr = find(LU.begin(), LU.end(), login);
+  const bool conectado = (itr != LU.end() && itr->token == token && itr->isConnected());
+  if (!ok)
+  {
+    if (conectado) sendReply(*itr, CMD_ERROR, id);
+    return;
+  }
+  invalidateSample();
+  logEvent(cmd, param);
+  if (conectado) ackActuation(*itr, cmd, param, id);
+  switch (cmd)
+  {
+  case CMD_SET_PUMP:
+    cout << "\nEntrada da bomba alterada para " << param << endl;
+    break;
+  case CMD_SET_V1:
+    cout << "\nAlterado o estado da valvula 1\n";
+    break;
+  case CMD_SET_V2:
+    cout << "\nAlterado o estado da valvula 2\n";
+    break;
+  default:
+    cout << "\nAlterado o controlador de nivel\n";
+    break;
+  }
+}
+
+/// Inicia o envio ao cliente de um bloco do historico (resposta ao comando
+/// CMD_GET_HISTORY). A resposta eh enviada quando o bloco estiver montado.
+void SupServidor::startHistory(const User& U, uint16_t id, uint16_t level, uint64_t index)
+{
+  const string login = U.login;
+  const uint64_t token = U.token;
+  const unsigned gen = deferred_gen;
+  ++deferred_jobs;
+  virtBlocoHistoricoAdiado(level, index, [this, login, token, gen, id](int ndata, const uint16_t* data)
+  {
+    vector<uint16_t> D;
+    if (ndata > 0) D.assign(data, data+ndata);
+    runOnServerThread([this, login, token, gen, id, ndata, D]()
+    {
+      if (gen != deferred_gen) return;
+      --deferred_jobs;
+      auto itr = find(LU.begin(), LU.end(), login);
+      if (itr == LU.end() || itr->token != token || !itr->isConnected()) return;
+      if (ndata < 0) sendReply(*itr, CMD_ERROR, id);
+      else sendReply(*itr, CMD_HISTORY, id, D.data(), int(D.size()));
+    });
+  });
+}
+
+/// Monta um bloco do historico sem bloqueio: por default, com a versao com bloqueio
+void SupServidor::virtBlocoHistoricoAdiado(uint16_t Level, uint64_t Index,
+                                           std::function<void(int N, const uint16_t* Data)> Done)
+{
+  uint16_t data[SUP_MAX_REPLY_LEN];
+  int ndata = virtBlocoHistorico(Level, Index, data);
+  Done(ndata, data);
+}
+
+/// Monta um bloco do historico registrado por este servidor.
+/// Os registros do bloco sao agrupados em intervalos de SUP_HISTORY_PERIOD*2^level ms;
+/// para cada intervalo com algum registro, inclui o minimo e o maximo de cada nivel.
+int SupServidor::virtBlocoHistorico(uint16_t level, uint64_t index, uint16_t* data)
+{
+  if (level > SUP_HISTORY_MAX_LEVEL) return -1;
+
+  // Duracao de um intervalo e do bloco (em microsegundos)
+  const uint64_t bucket_us = (uint64_t(SUP_HISTORY_PERIOD)*1000) << level;
+  const uint64_t block_us = bucket_us*SUP_HISTORY_BLOCK;
+  if (index > UINT64_MAX/block_us - 1) return -1;
+  const uint64_t t_begin = index*block_us;
+  const uint64_t t_end = t_begin + block_us;
+
+  // Numero de intervalos, seguido pelos dados de cada intervalo
+  uint16_t n = 0;
+  uint16_t* B = nullptr;
+
+  // O primeiro registro do bloco
+  auto itr = lower_bound(history.begin(), history.end(), t_begin,
+                         [](const HistRecord& R, uint64_t T){return R.t_us < T;});
+  for ( ; itr != history.end() && itr->t_us < t_end; ++itr)
+  {
+    uint16_t pos = uint16_t((itr->t_us - t_begin)/bucket_us);
+    if (n==0 || B[0]!=pos)
+    {
+      // Novo intervalo
+      B = data + 1 + SUP_HISTORY_BUCKET_LEN*n;
+      ++n;
+      B[0] = pos;
+      B[1] = B[2] = itr->H1;
+      B[3] = B[4] = itr->H2;
+    }
+    else
+    {
+      B[1] = min(B[1], itr->H1);
+      B[2] = max(B[2], itr->H1);
+      B[3] = min(B[3], itr->H2);
+      B[4] = max(B[4], itr->H2);
+    }
+  }
+  data[0] = n;
+  return 1 + SUP_HISTORY_BUCKET_LEN*n;
+}
+
 /// Leitura e impressao em console do estado da planta
 void SupServidor::readPrintState() const
 {
-  if (tanksOn())
+  if (virtPlantaLigada())
   {
     SupState S;
-    readStateFromSensors(S);
+    virtLerEstado(S);
     S.print();
   }
   else
@@ -167,9 +1375,12 @@ bool SupServidor::addUser(const string& Login, const string& Senha,
   // Testa se jah existe usuario com mesmo login
   auto itr = find(LU.begin(), LU.end(), Login);
   if (itr != LU.end()) return false;
+  // Testa se cabe mais um usuario
+  if (LU.size() >= SUP_MAX_USERS) return false;
 
   // Insere
   LU.push_back( User(Login,Senha,Admin) );
+  logEvent(CMD_USER_ADD, Admin ? 1 : 0, Login, Senha);
 
   // Insercao OK
   return true;
@@ -184,11 +1395,322 @@ bool SupServidor::removeUser(const string& Login)
 
   // Remove
   LU.erase(itr);
+  logEvent(CMD_USER_DEL, 0, Login);
 
   // Remocao OK
   return true;
 }
 
+/// Substitui a lista de usuarios (copia completa recebida de outro servidor).
+/// Soh remove os usuarios que nao existem mais ou que mudaram de senha ou de
+/// perfil: os demais continuam conectados.
+void SupServidor::setUsers(const std::vector<SupReplEvent>& Users)
+{
+  // Os usuarios que nao estao na nova lista, ou estao com outros dados
+  vector<string> removidos;
+  for (const auto& U : LU)
+  {
+    auto itr = find_if(Users.begin(), Users.end(),
+                       [&U](const SupReplEvent& E){return E.login==U.login;});
+    if (itr == Users.end() || itr->password != U.password ||
+        (itr->param != 0) != U.isAdmin) removidos.push_back(U.login);
+  }
+  for (const auto& L : removidos) removeUser(L);
+  // Os novos usuarios (os que jah existem nao sao inseridos novamente)
+  for (const auto& E : Users) addUser(E.login, E.password, E.param != 0);
+}
+
+/// Acrescenta um evento ao fluxo de replicacao
+void SupServidor::logEvent(uint16_t Type, uint16_t Param,
+                           const std::string& Login, const std::string& Senha)
+{
+  SupReplEvent E;
+  E.type = Type;
+  E.param = Param;
+  E.login = Login;
+  E.password = Senha;
+
+  lock_guard<mutex> lock(mtx_repl);
+  repl_log.push_back(E);
+  ++repl_end;
+  if (repl_log.size() > SUP_REPL_LOG_LEN) repl_log.pop_front();
+}
+
+/// Envia a resposta a uma solicitacao CMD_REPLICATE retida: os eventos
+/// seguintes a posicao pedida (no maximo SUP_REPL_MAX_EVENTS), ou uma
+/// copia completa da lista de usuarios, se a posicao for desconhecida.
+/// Sem eventos novos, soh responde (com nenhum evento) se Force==true.
+bool SupServidor::sendReplica(User& U, bool Force)
+{
+  // Nova posicao, numero de eventos e eventos
+  uint16_t data[SUP_MAX_REPLY_LEN];
+  uint16_t n = 0;
+  uint64_t pos;
+
+  {
+    lock_guard<mutex> lock(mtx_repl);
+    const uint64_t begin = repl_end - repl_log.size();
+    if (U.repl_pos >= begin && U.repl_pos <= repl_end)
+    {
+      // Os eventos seguintes a posicao pedida
+      if (U.repl_pos == repl_end && !Force) return false;
+      for (uint64_t p = U.repl_pos; p < repl_end && n < SUP_REPL_MAX_EVENTS; ++p, ++n)
+      {
+        repl_log[p-begin].toFrame(data + 5 + SUP_REPL_EVENT_LEN*n);
+      }
+      pos = U.repl_pos + n;
+    }
+    else
+    {
+      // Posicao desconhecida: copia completa da lista de usuarios
+      SupReplEvent E;
+      E.type = CMD_USER_CLEAR;
+      E.toFrame(data + 5);
+      n = 1;
+      for (const auto& V : LU)
+      {
+        E.type = CMD_USER_ADD;
+        E.param = (V.isAdmin ? 1 : 0);
+        E.login = V.login;
+        E.password = V.password;
+        E.toFrame(data + 5 + SUP_REPL_EVENT_LEN*n);
+        ++n;
+      }
+      pos = repl_end;
+    }
+  }
+
+  put_uint64(data, pos);
+  data[4] = n;
+  U.repl_pos = pos;
+  U.repl_wait = false;
+  sendReply(U, CMD_REPLICA, U.repl_id, data, 5 + SUP_REPL_EVENT_LEN*n);
+  return true;
+}
+
+/// Responde as solicitacoes CMD_REPLICATE retidas que tem eventos novos ou
+/// cujo prazo terminou.
+/// Os eventos gerados pela thread do servidor (atuacoes) sao enviados no
+/// ciclo seguinte; os gerados pelo programa principal (usuarios), ateh o
+/// proximo registro do historico.
+/// Retorna o tempo (em ms) ateh o proximo prazo.
+long SupServidor::serveReplicas()
+{
+  long next = long(SUP_TIMEOUT*1000);
+  auto now = chrono::steady_clock::now();
+  for (auto& U : LU)
+  {
+    if (!U.isConnected() || !U.repl_wait) continue;
+    if (sendReplica(U, now >= U.repl_t)) continue;
+    next = min(next, long(chrono::duration_cast<chrono::milliseconds>(U.repl_t - now).count()) + 1);
+  }
+  return next;
+}
+
+/// Simula a evolucao dos niveis na copia T dos tanques, durante Horizon
+/// segundos, executando as atuacoes previstas Ev (instante, comando e
+/// parametro) nos seus instantes. A cada Period segundos (a partir do
+/// instante 0), registra em Data os niveis reais (sem o ruido dos sensores)
+/// e os indicadores de valvulas abertas e de transbordamento, depois de
+/// executar as atuacoes do instante. Os passos entre dois pontos ou
+/// atuacoes sao simulados de uma vez (Tanks::advance).
+static void run_whatif(Tanks& T, unsigned Horizon, unsigned Period,
+                       std::vector<uint16_t> Ev, std::vector<uint16_t>& Data)
+{
+  // As atuacoes em ordem de instante (as do mesmo instante, na ordem recebida)
+  const size_t nev = Ev.size()/3;
+  vector<size_t> ordem(nev);
+  for (size_t i=0; i<nev; ++i) ordem[i] = i;
+  stable_sort(ordem.begin(), ordem.end(), [&Ev](size_t a, size_t b){return Ev[3*a] < Ev[3*b];});
+
+  const unsigned npontos = Horizon/Period + 1;
+  Data.clear();
+  Data.push_back(uint16_t(Period));
+  Data.push_back(uint16_t(npontos));
+  size_t k = 0;
+  unsigned t = 0;
+  for (unsigned i=0; i<npontos; ++i)
+  {
+    const unsigned t_ponto = i*Period;
+    while (true)
+    {
+      unsigned t_prox = t_ponto;
+      if (k < nev && Ev[3*ordem[k]] < t_prox) t_prox = Ev[3*ordem[k]];
+      if (t_prox > t)
+      {
+        T.advance(t_prox - t);
+        t = t_prox;
+      }
+      for ( ; k < nev && Ev[3*ordem[k]] <= t; ++k)
+      {
+        const uint16_t* A = Ev.data() + 3*ordem[k];
+        if (A[1] == CMD_SET_PUMP) T.setPumpInput(A[2]);
+        else if (A[1] == CMD_SET_V1) T.setV1Open(A[2] != 0);
+        else T.setV2Open(A[2] != 0);
+      }
+      if (t == t_ponto) break;
+    }
+    Data.push_back(T.hTank1Real());
+    Data.push_back(T.hTank2Real());
+    Data.push_back((T.v1isOpen() ? 1 : 0) | (T.v2isOpen() ? 2 : 0) | (T.isOverflowing() ? 4 : 0));
+  }
+}
+
+/// Inicia uma previsao: a copia dos tanques eh feita imediatamente, pela
+/// thread do servidor, e a simulacao eh executada por uma thread trabalhadora.
+/// O resultado eh enviado por serveWhatIf.
+bool SupServidor::startWhatIf(const User& U, uint16_t id, uint16_t Horizon, uint16_t Period,
+                              const std::vector<uint16_t>& Ev)
+{
+  if (!tanksOn() || whatif_jobs >= SUP_WHATIF_MAX_JOBS) return false;
+  if (Period == 0 || Horizon/Period + 1 > SUP_WHATIF_MAX_POINTS) return false;
+  if (Ev.size() > 3*size_t(SUP_WHATIF_MAX_EVENTS)) return false;
+  for (size_t i=0; i<Ev.size(); i+=3)
+  {
+    if (Ev[i+1] != CMD_SET_PUMP && Ev[i+1] != CMD_SET_V1 && Ev[i+1] != CMD_SET_V2) return false;
+  }
+
+  if (!workers) workers.reset(new SupWorkerPool());
+  shared_ptr<Tanks> T(fork());
+  WhatIfResult R;
+  R.login = U.login;
+  R.token = U.token;
+  R.id = id;
+  R.cmd = CMD_WHATIF_RESULT;
+  ++whatif_jobs;
+  workers->post([this, T, R, Horizon, Period, Ev]() mutable
+  {
+    run_whatif(*T, Horizon, Period, std::move(Ev), R.data);
+    lock_guard<mutex> lock(mtx_whatif);
+    whatif_done.push_back(std::move(R));
+  });
+  return true;
+}
+
+/// Simula o candidato K da varredura W na copia T dos tanques, segundo a segundo,
+/// e escreve o seu resumo em Resumo: instantes em que o nivel alvo foi atingido
+/// e do primeiro transbordamento, e os niveis finais (sem ruido)
+static void run_sweep(Tanks& T, const SupSweep& W, size_t K, uint16_t* Resumo)
+{
+  uint16_t pump, t1, t2;
+  W.candidate(K, pump, t1, t2);
+  T.setPumpInput(pump);
+
+  uint16_t t_alvo = SUP_SWEEP_NEVER, t_transb = SUP_SWEEP_NEVER;
+  const bool subindo = (W.tank==2 ? T.hTank2Real() : T.hTank1Real()) < W.level;
+  for (unsigned t=0; ; ++t)
+  {
+    T.setV1Open(t >= t1);
+    T.setV2Open(t >= t2);
+    const uint16_t H = (W.tank==2 ? T.hTank2Real() : T.hTank1Real());
+    if (t_alvo == SUP_SWEEP_NEVER && (subindo ? H >= W.level : H <= W.level)) t_alvo = uint16_t(t);
+    if (t_transb == SUP_SWEEP_NEVER && T.isOverflowing()) t_transb = uint16_t(t);
+    if (t >= W.horizon) break;
+    T.advance(1);
+  }
+  Resumo[0] = t_alvo;
+  Resumo[1] = t_transb;
+  Resumo[2] = T.hTank1Real();
+  Resumo[3] = T.hTank2Real();
+}
+
+/// Inicia uma varredura. A copia dos tanques eh feita pela thread do servidor;
+/// cada thread trabalhadora simula uma parte dos candidatos, cada um em uma
+/// copia dessa copia. A ultima parte a terminar entrega a resposta completa.
+bool SupServidor::startSweep(const User& U, uint16_t id, const SupSweep& W)
+{
+  if (!tanksOn() || whatif_jobs >= SUP_WHATIF_MAX_JOBS || !W.valid()) return false;
+
+  if (!workers) workers.reset(new SupWorkerPool());
+  // A varredura compartilhada pelas partes: a resposta e as partes em execucao
+  struct SweepJob
+  {
+    WhatIfResult R;
+    atomic<size_t> partes;
+  };
+  const size_t N = W.numCandidates();
+  const size_t npartes = min(N, size_t(workers->numThreads()));
+  shared_ptr<const Tanks> base(fork());
+  auto J = make_shared<SweepJob>();
+  J->R.login = U.login;
+  J->R.token = U.token;
+  J->R.id = id;
+  J->R.cmd = CMD_SWEEP_RESULT;
+  J->R.data.resize(1 + SUP_SWEEP_SUMMARY_LEN*N);
+  J->R.data[0] = uint16_t(N);
+  J->partes = npartes;
+  ++whatif_jobs;
+  for (size_t p=0; p<npartes; ++p)
+  {
+    // Os candidatos sao intercalados entre as partes, que ficam com duracoes parecidas
+    workers->post([this, base, W, J, p, npartes, N]()
+    {
+      for (size_t k=p; k<N; k+=npartes)
+      {
+        unique_ptr<Tanks> T = base->fork();
+        run_sweep(*T, W, k, J->R.data.data() + 1 + SUP_SWEEP_SUMMARY_LEN*k);
+      }
+      if (--J->partes == 0)
+      {
+        lock_guard<mutex> lock(mtx_whatif);
+        whatif_done.push_back(std::move(J->R));
+      }
+    });
+  }
+  return true;
+}
+
+/// Envia as previsoes concluidas, se a sessao que as solicitou continuar
+/// conectada. As threads trabalhadoras nao acordam a thread do servidor:
+/// enquanto houver previsoes em execucao, a espera pelos clientes eh limitada
+/// a SUP_WHATIF_POLL ms.
+long SupServidor::serveWhatIf()
+{
+  if (whatif_jobs == 0) return long(SUP_TIMEOUT*1000);
+
+  deque<WhatIfResult> prontas;
+  {
+    lock_guard<mutex> lock(mtx_whatif);
+    prontas.swap(whatif_done);
+  }
+  for (const auto& R : prontas)
+  {
+    --whatif_jobs;
+    auto itr = find(LU.begin(), LU.end(), R.login);
+    if (itr != LU.end() && itr->token == R.token && itr->isConnected() && itr->pipelined)
+    {
+      sendReply(*itr, R.cmd, R.id, R.data.data(), int(R.data.size()));
+    }
+  }
+  return (whatif_jobs > 0 ? long(SUP_WHATIF_POLL) : long(SUP_TIMEOUT*1000));
+}
+
+/// Descarta as previsoes e encerra as threads trabalhadoras, esperando
+/// pelo fim das simulacoes em execucao
+void SupServidor::stopWhatIf()
+{
+  workers.reset();
+  whatif_done.clear();
+  whatif_jobs = 0;
+}
+
+/// Envia uma resposta a um cliente, em um unico envio pelo socket.
+/// No modo com pipeline, o comando de resposta eh seguido pelo identificador
+/// de correlacao do comando que estah sendo respondido.
+/// Depois, vem os dados da resposta, se houver.
+mysocket_status SupServidor::sendReply(const User& U, uint16_t cmd, uint16_t id,
+                                       const uint16_t* data, int ndata) const
+{
+  uint16_t msg[2+SUP_MAX_REPLY_LEN];
+  int n=0;
+
+  if (ndata > SUP_MAX_REPLY_LEN) return mysocket_status::SOCK_ERROR;
+  msg[n++] = cmd;
+  if (U.pipelined) msg[n++] = id;
+  for (int i=0; i<ndata; ++i) msg[n++] = data[i];
+  return U.sock.write_uint16_array(msg, n);
+}
+
 /// A thread que implementa o servidor.
 /// Comunicacao com os clientes atraves dos sockets.
 void SupServidor::thr_server_main(void)
@@ -199,6 +1721,12 @@ void SupServidor::thr_server_main(void)
   tcp_mysocket t;
   // comando recebido/ enviado
   uint16_t cmd;
+  // identificador de correlacao do comando (modo com pipeline)
+  uint16_t id;
+  // parametro do comando recebido
+  uint16_t param;
+  // parametros do comando CMD_GET_HISTORY: nivel e indice do bloco
+  uint16_t hparam[5];
   // dados da nova conexao
   string login, password;
 
@@ -207,9 +1735,12 @@ void SupServidor::thr_server_main(void)
   mysocket_status iResult;
   // estado dos tanques
   SupState S;
+  // resposta aos comandos CMD_GET_DATA e CMD_GET_DATA_EXT: comando seguido dos dados
+  uint16_t frame[SUP_DATA_EXT_FRAME_LEN];
   // iterator para lista de usuarios
   std::list<User>::iterator iU;
 
+  server_tid = this_thread::get_id();
   while (server_on) {
     try { // Erros graves: catch encerra o servidor
       // Se socket de conexoes nao estah aceitando conexoes, encerra o servidor
@@ -218,13 +1749,36 @@ void SupServidor::thr_server_main(void)
       // Inclui na fila de sockets para o select todos os sockets que eu
       // quero monitorar para ver se houve chegada de dados
       f.clear();
-      // Inclui o socket de conexoes
+      // Inclui os sockets de conexoes
       f.include(sock_server);
+      if (sock_local.accepting()) f.include(sock_local);
       // Inclui o socket de todos os clientes conectados
       for (auto& U : LU) if (U.isConnected()) f.include(U.sock);
       
-      // Espera que chegue algum dado em qualquer dos sockets da fila
-      iResult = f.wait_read(SUP_TIMEOUT*1000);
+      // Registra os niveis no historico e publica o estado, se for a hora
+      long next_record = recordHistory();
+      long next_publish = publishState();
+      // Envia as respostas adiadas concluidas (atuacoes e blocos do historico)
+      long next_deferred = serveDeferred();
+      // Responde as solicitacoes do fluxo de replicacao e executa a tarefa
+      // das classes derivadas
+      long next_repl = serveReplicas();
+      long next_task = virtTarefaPeriodica();
+      // Envia os dados aos servidores de reserva
+      long next_standby = serveStandby();
+      // Grava as atuacoes no diario e envia as suas respostas
+      long next_journal = serveJournal();
+      // Envia as previsoes concluidas
+      long next_whatif = serveWhatIf();
+
+      // Espera que chegue algum dado em qualquer dos sockets da fila, no maximo
+      // ateh a hora do proximo registro do historico, da proxima publicacao,
+      // do proximo prazo do fluxo de replicacao, do proximo envio do estado
+      // aos servidores de reserva, do proximo ponto de restauracao ou da
+      // proxima verificacao das previsoes e das respostas adiadas em execucao
+      iResult = f.wait_read(min({long(SUP_TIMEOUT*1000), next_record, next_publish,
+                                 next_repl, next_task, next_standby, next_journal,
+                                 next_whatif, next_deferred}));
 
       switch (iResult) { //resultado do wait_read
         case mysocket_status::SOCK_ERROR:
@@ -248,6 +1802,15 @@ void SupServidor::thr_server_main(void)
 
                 if (iResult != mysocket_status::SOCK_OK) throw 1;
 
+                // No modo com pipeline, o comando eh seguido pelo identificador
+                // de correlacao, que serah devolvido junto com a resposta
+                id = 0;
+                if (iU->pipelined)
+                {
+                  iResult = iU->sock.read_uint16(id, SUP_TIMEOUT*1000);
+                  if (iResult != mysocket_status::SOCK_OK) throw 1;
+                }
+
                 // executa o comando lido
                 switch (cmd) {
                   case CMD_ADMIN_OK:
@@ -257,47 +1820,167 @@ void SupServidor::thr_server_main(void)
                     break;
 
                   case CMD_GET_DATA:
-                  // envia as informações da planta para o cliente
-                  iU->sock.write_uint16(CMD_DATA);
-                  readStateFromSensors(S);
-                  iU->sock.write_uint16(S.V1);
-                  iU->sock.write_uint16(S.V2);
-                  iU->sock.write_uint16(S.H1);
-                  iU->sock.write_uint16(S.H2);
-                  iU->sock.write_uint16(S.PumpInput);
-                  iU->sock.write_uint16(S.PumpFlow);
-                  iU->sock.write_uint16(S.ovfl);
+                  // envia as informações da planta para o cliente.
+                  // O comando e os dados vao em um unico envio pelo socket.
+                  // Com a planta desligada (sessao do repetidor com o servidor
+                  // da planta perdida), o ultimo estado nao eh atual: erro
+                  if (!virtPlantaLigada()) {sendReply(*iU, CMD_ERROR, id); break;}
+                  sampleState(S);
+                  S.toFrame(frame);
+                  sendReply(*iU, CMD_DATA, id, frame+1, SUP_DATA_FRAME_LEN-1);
+                  break;
+
+                  case CMD_GET_DATA_EXT:
+                  // idem, acrescentando o numero de sequencia e o instante da amostra
+                  if (!virtPlantaLigada()) {sendReply(*iU, CMD_ERROR, id); break;}
+                  sampleState(S);
+                  S.toFrameExt(frame);
+                  sendReply(*iU, CMD_DATA_EXT, id, frame+1, SUP_DATA_EXT_FRAME_LEN-1);
                   break;
 
+                  // Os comandos de atuacao: o parametro eh sempre lido,
+                  // mesmo que o usuario nao seja administrador, para nao
+                  // ser interpretado como um novo comando. A resposta eh
+                  // enviada quando a atuacao for concluida (finishActuation)
                   case CMD_SET_PUMP:
-                  if (!iU->isAdmin) {iU->sock.write_uint16(CMD_ERROR); break;}
-                  iResult = iU->sock.read_uint16(cmd);
+                  case CMD_SET_V1:
+                  case CMD_SET_V2:
+                  case CMD_SET_PID:
+                  case CMD_SET_PID_SP:
+                  case CMD_SET_PID_KP:
+                  case CMD_SET_PID_KI:
+                  case CMD_SET_PID_KD:
+                  case CMD_SET_PID_KT:
+                  iResult = iU->sock.read_uint16(param, SUP_TIMEOUT*1000);
                   if (iResult != mysocket_status::SOCK_OK) throw 3;
-                  setPumpInput(cmd);
-                  iU->sock.write_uint16(CMD_OK);
-                  cout << "\nEntrada da bomba alterada para " << cmd << endl;
+                  if (!iU->isAdmin) {sendReply(*iU, CMD_ERROR, id); break;}
+                  startActuation(*iU, cmd, param, id);
                   break;
 
-                  case CMD_SET_V1:
-                  if (!iU->isAdmin) {iU->sock.write_uint16(CMD_ERROR); break;}
-                  iResult = iU->sock.read_uint16(cmd);
+                  case CMD_GET_PID:
+                  // envia a configuracao do controlador de nivel; pode ser
+                  // consultado por qualquer usuario, com a planta simulada
+                  // neste servidor (nao em um repetidor)
+                  if (!tanksOn()) {sendReply(*iU, CMD_ERROR, id); break;}
+                  {
+                    TanksPID C;
+                    getPID(C);
+                    auto gain = [](double K)
+                    {
+                      return uint16_t(min(round(K*SUP_PID_GAIN_SCALE), double(UINT16_MAX)));
+                    };
+                    uint16_t P[SUP_PID_FRAME_LEN] =
+                      {uint16_t(C.tank), uint16_t(round(min(max(C.setpoint, 0.0), 1.0)*UINT16_MAX)),
+                       gain(C.kp), gain(C.ki), gain(C.kd), gain(C.kt), pumpInput()};
+                    sendReply(*iU, CMD_PID, id, P, SUP_PID_FRAME_LEN);
+                  }
+                  break;
+
+                  case CMD_GET_HISTORY:
+                  // envia um bloco do historico; pode ser consultado por
+                  // qualquer usuario
+                  iResult = iU->sock.read_uint16_array(hparam, 5, SUP_TIMEOUT*1000);
                   if (iResult != mysocket_status::SOCK_OK) throw 3;
-                  setV1Open(cmd != 0);
-                  iU->sock.write_uint16(CMD_OK);
-                  cout << "\nAlterado o estado da valvula 1\n";
+                  startHistory(*iU, id, hparam[0], get_uint64(hparam+1));
                   break;
 
-                  case CMD_SET_V2:
-                  if (!iU->isAdmin) {iU->sock.write_uint16(CMD_ERROR); break;}
-                  iResult = iU->sock.read_uint16(cmd);
+                  case CMD_REPLICATE:
+                  // solicita os eventos do fluxo de replicacao seguintes a uma
+                  // posicao. Soh administradores no modo com pipeline, pois a
+                  // resposta pode ser retida enquanto chegam outros comandos
+                  iResult = iU->sock.read_uint16_array(hparam, 4, SUP_TIMEOUT*1000);
+                  if (iResult != mysocket_status::SOCK_OK) throw 3;
+                  if (!iU->isAdmin || !iU->pipelined || iU->repl_wait) {sendReply(*iU, CMD_ERROR, id); break;}
+                  iU->repl_wait = true;
+                  iU->repl_id = id;
+                  iU->repl_pos = get_uint64(hparam);
+                  iU->repl_t = chrono::steady_clock::now() + chrono::milliseconds(SUP_REPL_WAIT);
+                  sendReplica(*iU, false);
+                  break;
+
+                  case CMD_WHATIF:
+                  // simula a evolucao dos niveis em uma copia dos tanques.
+                  // Qualquer usuario, no modo com pipeline, pois a resposta soh
+                  // eh enviada quando a simulacao termina. As atuacoes previstas
+                  // sao sempre lidas, para nao serem interpretadas como comandos
+                  iResult = iU->sock.read_uint16_array(hparam, 3, SUP_TIMEOUT*1000);
                   if (iResult != mysocket_status::SOCK_OK) throw 3;
-                  setV2Open(cmd != 0);
-                  iU->sock.write_uint16(CMD_OK);
-                  cout << "\nAlterado o estado da valvula 2\n";
+                  {
+                    vector<uint16_t> Ev(3*size_t(hparam[2]));
+                    if (!Ev.empty())
+                    {
+                      iResult = iU->sock.read_uint16_array(Ev.data(), int(Ev.size()), SUP_TIMEOUT*1000);
+                      if (iResult != mysocket_status::SOCK_OK) throw 3;
+                    }
+                    if (!iU->pipelined || !startWhatIf(*iU, id, hparam[0], hparam[1], Ev))
+                    {
+                      sendReply(*iU, CMD_ERROR, id);
+                    }
+                  }
+                  break;
+
+                  case CMD_SWEEP:
+                  // simula uma grade de atuacoes candidatas, cada uma em uma copia
+                  // dos tanques. Qualquer usuario, no modo com pipeline
+                  {
+                    uint16_t sparam[SUP_SWEEP_FRAME_LEN];
+                    iResult = iU->sock.read_uint16_array(sparam, SUP_SWEEP_FRAME_LEN, SUP_TIMEOUT*1000);
+                    if (iResult != mysocket_status::SOCK_OK) throw 3;
+                    SupSweep W;
+                    W.fromFrame(sparam);
+                    if (!iU->pipelined || !startSweep(*iU, id, W)) sendReply(*iU, CMD_ERROR, id);
+                  }
+                  break;
+
+                  case CMD_PIPELINE:
+                  // Passa a usar identificadores de correlacao nos comandos
+                  // e nas respostas. A confirmacao deste comando ainda eh
+                  // enviada no modo em que o cliente estava antes.
+                  sendReply(*iU, CMD_OK, id);
+                  iU->pipelined = true;
+                  break;
+
+                  case CMD_GET_SESSION:
+                  // envia o token da sessao, que permite retoma-la em uma nova conexao
+                  put_uint64(hparam, iU->token);
+                  sendReply(*iU, CMD_SESSION, id, hparam, 4);
+                  break;
+
+                  case CMD_STANDBY:
+                  // a conexao passa a ser o canal de um servidor de reserva.
+                  // Soh administradores sem pipeline, com a planta simulada
+                  // neste servidor (nao em um repetidor)
+                  if (!iU->isAdmin || iU->pipelined || !tanksOn()) {sendReply(*iU, CMD_ERROR, id); break;}
+                  sendReply(*iU, CMD_OK, id);
+                  // O canal nao eh uma sessao que possa ser retomada.
+                  // O fluxo de replicacao comeca com uma copia completa dos usuarios
+                  iU->token = 0;
+                  iU->standby = true;
+                  iU->repl_pos = 0;
+                  t_standby = chrono::steady_clock::now();
+                  cout << "\nServidor de reserva conectado (usuario " << iU->login << ")\n";
+                  break;
+
+                  case CMD_HANDOFF:
+                  // transfere o servidor para um novo processo no mesmo computador.
+                  // Soh administradores sem pipeline, pelo socket local, com a
+                  // planta simulada neste servidor (nao em um repetidor)
+                  if (!iU->isAdmin || iU->pipelined || !iU->local || !tanksOn()) {sendReply(*iU, CMD_ERROR, id); break;}
+                  sendReply(*iU, CMD_OK, id);
+                  if (sendHandoff(*iU))
+                  {
+                    cout << "\nServidor transferido para um novo processo\n";
+                  }
+                  else
+                  {
+                    cerr << "Erro na transferencia do servidor para um novo processo\n";
+                    iU->close();
+                  }
                   break;
 
                   case CMD_LOGOUT:
-                  // desloga kk
+                  // desloga kk. A sessao termina: nao pode mais ser retomada
+                  iU->token = 0;
                   iU->close();
                   cout << "\n Usuario " << iU->login << " se desconectou \n";
                   break;
@@ -313,69 +1996,98 @@ void SupServidor::thr_server_main(void)
         }
 
         // Depois de testar os sockets dos clientes,
-        // testa se houve atividade no socket de conexao
-        if (server_on && sock_server.connected() && f.had_activity(sock_server)) {
-          // Aceita provisoriamente a nova conexao
-          iResult = sock_server.accept(t);
-          if (iResult != mysocket_status::SOCK_OK) throw 3; // Erro grave: encerra o servidor
-
-          try { // Erros na conexao de cliente: fecha socket temporario ou desconecta novo cliente
-            // Leh o comando
-            iResult = t.read_uint16(cmd, SUP_TIMEOUT*1000);
-            if (iResult != mysocket_status::SOCK_OK) throw 1;
-
-            // Testa o comando
-            if (cmd!=CMD_LOGIN) throw 2;
-
-            // Leh o login do usuario que deseja se conectar
-            iResult = t.read_string(login, SUP_TIMEOUT*1000);
-            if (iResult != mysocket_status::SOCK_OK) throw 3;
-
-            // Leh a senha do usuario que deseja se conectar
-            iResult = t.read_string(password, SUP_TIMEOUT*1000);
-            if (iResult != mysocket_status::SOCK_OK) throw 4;
-
-            if (login.size()<6 || login.size()>12 ||
-                password.size()<6 || password.size()>12) throw 5;
-            // Verifica se jah existe um usuario cadastrado com esse login
-            iU = find(LU.begin(), LU.end(), login);
+        // testa se houve atividade nos sockets de conexao
+        // (o socket TCP e o socket local, que funcionam da mesma forma)
+        for (tcp_mysocket_server* S : {&sock_server, &sock_local}) {
+          if (server_on && S->connected() && f.had_activity(*S)) {
+            // Aceita provisoriamente a nova conexao
+            iResult = S->accept(t);
+            if (iResult != mysocket_status::SOCK_OK) throw 3; // Erro grave: encerra o servidor
+
+            try { // Erros na conexao de cliente: fecha socket temporario ou desconecta novo cliente
+              // Leh o comando
+              iResult = t.read_uint16(cmd, SUP_TIMEOUT*1000);
+              if (iResult != mysocket_status::SOCK_OK) throw 1;
+
+              // Testa o comando
+              if (cmd!=CMD_LOGIN && cmd!=CMD_RESUME) throw 2;
+
+              if (cmd==CMD_RESUME) {
+                // Leh o token e o login da sessao a ser retomada
+                iResult = t.read_uint16_array(hparam, 4, SUP_TIMEOUT*1000);
+                if (iResult != mysocket_status::SOCK_OK) throw 3;
+                iResult = t.read_string(login, SUP_TIMEOUT*1000);
+                if (iResult != mysocket_status::SOCK_OK) throw 3;
+                uint64_t token = get_uint64(hparam);
+                iU = find_if(LU.begin(), LU.end(), [token,&login](const User& U)
+                             {return token != 0 && U.token == token && U.login == login;});
+                if (iU==LU.end()) throw 6; // nao existe essa sessao
+                // Uma sessao ainda conectada nao eh tomada por outra conexao.
+                // A conexao eh fechada sem resposta: o cliente tenta novamente
+                // e consegue depois que o servidor detectar a perda da anterior.
+                if (iU->isConnected()) throw 1;
+                iU->sock.swap(t);
+                iU->local = (S == &sock_local);
+                if (iU->isAdmin) iResult = iU->sock.write_uint16(CMD_ADMIN_OK);
+                else iResult = iU->sock.write_uint16(CMD_OK);
+                if (iResult != mysocket_status::SOCK_OK) throw 9;
+                cout << "\nUsuario " << iU->login << " retomou a sessao\n";
+                continue;
+              }
+
+              // Leh o login do usuario que deseja se conectar
+              iResult = t.read_string(login, SUP_TIMEOUT*1000);
+              if (iResult != mysocket_status::SOCK_OK) throw 3;
+
+              // Leh a senha do usuario que deseja se conectar
+              iResult = t.read_string(password, SUP_TIMEOUT*1000);
+              if (iResult != mysocket_status::SOCK_OK) throw 4;
+
+              if (login.size()<6 || login.size()>12 ||
+                  password.size()<6 || password.size()>12) throw 5;
+              // Verifica se jah existe um usuario cadastrado com esse login
+              iU = find(LU.begin(), LU.end(), login);
             
-            if (iU==LU.end()) throw 6; // nao existe esse usuario na lista
-            // Testa se a senha confere
-            if (iU->password != password) throw 7; // Senha nao confere
-            // Testa se o cliente jah estah conectado
-            if (iU->isConnected()) throw 8; // User jah conectado
-            // Associa o socket que se conectou a um usuario cadastrado
-            iU->sock.swap(t);
-
-            // Envia a confirmacao de conexao para o novo cliente
-            if (iU->isAdmin) iResult = iU->sock.write_uint16(CMD_ADMIN_OK);
-            else iResult = iU->sock.write_uint16(CMD_OK);
-            if (iResult != mysocket_status::SOCK_OK) throw 9;
-            // mensagem em console confirmando que o cliente se conectou
-            cout << "\nUsuario " << iU->login << " conectado\n";
+              if (iU==LU.end()) throw 6; // nao existe esse usuario na lista
+              // Testa se a senha confere
+              if (iU->password != password) throw 7; // Senha nao confere
+              // Testa se o cliente jah estah conectado
+              if (iU->isConnected()) throw 8; // User jah conectado
+              // Associa o socket que se conectou a um usuario cadastrado
+              iU->sock.swap(t);
+              iU->local = (S == &sock_local);
+              // Uma nova sessao (a sessao anterior, se houver, termina)
+              iU->token = newToken();
+
+              // Envia a confirmacao de conexao para o novo cliente
+              if (iU->isAdmin) iResult = iU->sock.write_uint16(CMD_ADMIN_OK);
+              else iResult = iU->sock.write_uint16(CMD_OK);
+              if (iResult != mysocket_status::SOCK_OK) throw 9;
+              // mensagem em console confirmando que o cliente se conectou
+              cout << "\nUsuario " << iU->login << " conectado\n";
           
 
-          } // Fim do try para erros na conexao de cliente
-          catch (int e) { // Erros na conexao do novo cliente
-            if (e >= 5 && e < 9) { 
-              // Socket OK mas login invalido
-              t.write_uint16(CMD_ERROR);
-              t.close();
-            }
-            else {
-              // erro 1-3 ou 9 (comunicacao com socket)
-              if (e == 9) {
-                iU->close(); // erro na comunicacao com novo cliente
+            } // Fim do try para erros na conexao de cliente
+            catch (int e) { // Erros na conexao do novo cliente
+              if (e >= 5 && e < 9) { 
+                // Socket OK mas login invalido
+                t.write_uint16(CMD_ERROR);
+                t.close();
               }
               else {
-                t.close(); // socket temporario deu B.O
+                // erro 1-3 ou 9 (comunicacao com socket)
+                if (e == 9) {
+                  iU->close(); // erro na comunicacao com novo cliente
+                }
+                else {
+                  t.close(); // socket temporario deu B.O
+                }
               }
-            }
-            // Informa erro nao previsto
-              cerr << "Erro " << e << " na conexao de novo cliente" << endl;
-          } // fim catch
-        } // // fim if (had_activity) no socket de conexoes
+              // Informa erro nao previsto
+                cerr << "Erro " << e << " na conexao de novo cliente" << endl;
+            } // fim catch
+          } // // fim if (had_activity) no socket de conexoes
+        } // fim for (sockets de conexoes)
         break; // fim do case mysocket_status::SOCK_OK - resultado do wait_read
         
       } // fim do switch (iResult) - resultado do wait_read
@@ -388,8 +2100,9 @@ void SupServidor::thr_server_main(void)
       server_on = false;
       // Fecha todos os sockets dos clientes
       for (auto& U : LU) U.close();
-      // Fecha o socket de conexoes
+      // Fecha os sockets de conexoes
       sock_server.close();
+      sock_local.close();
 
       // Os tanques continuam funcionando
     }  // fim catch(const char*)
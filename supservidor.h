@@ -7,8 +7,94 @@
 #include <mutex>
 #include <string>
 #include <list>
+#include <deque>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <memory>
+#include <atomic>
+#include <functional>
 #include "tanques.h"
 #include "supdados.h"
+#include "supboard.h"
+#include "supjournal.h"
+#include "supworkers.h"
+
+/// Intervalo minimo (em milisegundos) entre duas leituras dos sensores.
+/// Clientes que pedirem dados dentro deste intervalo recebem a mesma
+/// amostra, com o mesmo numero de sequencia.
+#define SUP_SAMPLE_PERIOD 10
+
+/// Intervalo (em milisegundos) entre os testes do fim da gravacao de um ponto
+/// de restauracao em segundo plano
+#define SUP_CHECKPOINT_POLL 10
+
+/// Identificador da planta deste servidor no quadro de estados em memoria
+/// compartilhada e nos datagramas do canal de difusao por UDP
+#define SUP_PLANT_ID 0
+
+/// Numero maximo de registros do historico de niveis (o mais antigo eh descartado)
+#define SUP_HISTORY_LEN 604800 // 1 semana, se SUP_HISTORY_PERIOD == 1s
+
+/// Numero maximo de inteiros de 16 bits de dados em uma resposta
+/// (a maior eh a resposta CMD_HISTORY)
+#define SUP_MAX_REPLY_LEN (1+SUP_HISTORY_BUCKET_LEN*SUP_HISTORY_BLOCK)
+static_assert(5+SUP_REPL_EVENT_LEN*SUP_REPL_MAX_EVENTS <= SUP_MAX_REPLY_LEN,
+              "a resposta CMD_REPLICA nao cabe em uma resposta");
+
+/// Numero maximo de usuarios cadastrados no servidor.
+/// A copia completa da lista de usuarios deve caber em uma resposta CMD_REPLICA.
+#define SUP_MAX_USERS 64
+static_assert(1+SUP_MAX_USERS <= SUP_REPL_MAX_EVENTS,
+              "a lista de usuarios nao cabe em uma resposta CMD_REPLICA");
+
+/// Numero maximo de eventos guardados no fluxo de replicacao (o mais antigo
+/// eh descartado). Quem pedir eventos jah descartados recebe uma copia completa.
+#define SUP_REPL_LOG_LEN 1024
+
+/// O servidor de reserva (hot standby).
+/// Periodo (em milisegundos) de envio do estado ao servidor de reserva
+#define SUP_STANDBY_PERIOD 50
+/// Intervalo (em segundos) entre as tentativas de conexao do servidor de
+/// reserva ao servidor ativo
+#define SUP_STANDBY_RETRY 1
+/// Numero de inteiros de 16 bits do estado dos tanques (TanksState) na
+/// mensagem CMD_STANDBY_STATE: 5 reais de 64 bits, valvulas, bomba,
+/// transbordamento, passos com transbordamento e o controlador de nivel
+/// (tanque controlado e 7 reais de 64 bits)
+#define SUP_PLANT_FRAME_LEN 54
+/// Numero de inteiros de 16 bits de uma sessao na mensagem CMD_STANDBY_STATE:
+/// login (6) e token (4)
+#define SUP_SESSION_FRAME_LEN 10
+static_assert(SUP_PLANT_FRAME_LEN+9+SUP_SESSION_FRAME_LEN*SUP_MAX_USERS <= SUP_MAX_REPLY_LEN,
+              "a mensagem CMD_STANDBY_STATE nao cabe em uma resposta");
+/// Intervalo (em milisegundos) entre as verificacoes de respostas adiadas
+/// concluidas (ver SupServidor::runOnServerThread), enquanto houver respostas pendentes
+#define SUP_DEFERRED_POLL 5
+
+/// A transferencia do servidor para um novo processo (CMD_HANDOFF).
+/// Numero de inteiros de 16 bits do cabecalho: tanques, sequencia das amostras (4),
+/// referencia de tempo (4), posicao do fluxo de replicacao (4), numero de
+/// registros do historico (4) e numero de usuarios
+#define SUP_HANDOFF_HEAD_LEN (SUP_PLANT_FRAME_LEN+17)
+/// Numero de inteiros de 16 bits de um usuario: login (6), senha (6), perfil,
+/// token (4), estado da conexao, e a solicitacao CMD_REPLICATE retida:
+/// identificador, posicao (4) e prazo restante (em ms)
+#define SUP_HANDOFF_USER_LEN 24
+/// Numero de registros do historico por envio
+#define SUP_HANDOFF_CHUNK 200
+
+/// As previsoes da evolucao dos niveis (CMD_WHATIF e CMD_SWEEP).
+/// Numero maximo de previsoes em execucao ou aguardando envio, em todo o servidor
+/// (uma varredura conta como uma previsao)
+#define SUP_WHATIF_MAX_JOBS 8
+/// Intervalo (em milisegundos) entre as verificacoes de previsoes concluidas,
+/// enquanto houver previsoes em execucao
+#define SUP_WHATIF_POLL 5
+static_assert(2+SUP_WHATIF_POINT_LEN*SUP_WHATIF_MAX_POINTS <= SUP_MAX_REPLY_LEN,
+              "a resposta CMD_WHATIF_RESULT nao cabe em uma resposta");
+static_assert(1+SUP_SWEEP_SUMMARY_LEN*SUP_SWEEP_MAX_CANDIDATES <= SUP_MAX_REPLY_LEN,
+              "a resposta CMD_SWEEP_RESULT nao cabe em uma resposta");
 
 /// A classe que implementa o servidor do sistema de tanques
 class SupServidor: public Tanks
@@ -23,45 +109,158 @@ private:
     bool isAdmin;         // Pode alterar (true) ou soh consultar (false) o sistema
     // Socket de comunicacao
     tcp_mysocket sock;
+    // Comandos e respostas com identificador de correlacao (modo com pipeline)
+    bool pipelined;
+    // Token da sessao (0 se nao houver sessao), que permite retomar a sessao
+    // em uma nova conexao (CMD_RESUME). Eh mantido quando a conexao eh perdida.
+    uint64_t token;
+    // A conexao eh o canal de um servidor de reserva (CMD_STANDBY)
+    bool standby;
+    // A conexao veio pelo socket local (AF_UNIX)
+    bool local;
+    // Solicitacao CMD_REPLICATE retida, aguardando novos eventos: o seu
+    // identificador de correlacao, a posicao pedida e o prazo da resposta
+    bool repl_wait;
+    uint16_t repl_id;
+    uint64_t repl_pos;
+    std::chrono::steady_clock::time_point repl_t;
     // Construtor default
     User(const std::string& Login, const std::string& Senha, bool Admin)
       :login(Login)
       ,password(Senha)
       ,isAdmin(Admin)
       ,sock()
+      ,pipelined(false)
+      ,token(0)
+      ,standby(false)
+      ,local(false)
+      ,repl_wait(false)
+      ,repl_id(0)
+      ,repl_pos(0)
+      ,repl_t()
     {}
     // Comparacao com string (testa se a string eh igual ao login)
     bool operator==(const std::string& S) const {return login==S;}
     // Usuario estah conectado ou nao?
     inline bool isConnected() const {return sock.connected();}
     // Desconecta usuario
-    inline void close() {sock.close();}
+    inline void close() {sock.close(); pipelined=false; standby=false; repl_wait=false;}
   };
 
 public:
   // Construtor default
   SupServidor();
   // Destrutor
-  ~SupServidor();
+  virtual ~SupServidor();
 
   // Funcoes de consulta
   // Servidor ligado (true) ou desligado (false)
   bool serverOn() const {return server_on;}
 
+  // Servidor de reserva ligado (true) ou nao (false)
+  bool standbyOn() const {return standby_on;}
+
   // Funcoes de atuacao
   bool setServerOn();                // Liga o servidor: retorna true se OK
   void setServerOff();               // Desliga o servidor
 
+  // Liga o servidor recebendo do servidor em execucao no mesmo computador
+  // (reinicio sem interrupcao, CMD_HANDOFF), pelo socket local deste servidor:
+  // os sockets de conexoes, as conexoes dos clientes, os usuarios, as sessoes,
+  // o historico e o estado dos tanques. O usuario Login deve ser administrador
+  // do servidor em execucao, que termina quando a transferencia eh concluida.
+  // Retorna true se OK.
+  bool setServerOnFrom(const std::string& Login, const std::string& Senha);
+
+  // Liga o servidor como reserva (hot standby) do servidor ativo no endereco
+  // "IP[:porta]", conectando com o usuario Login (administrador do ativo).
+  // O servidor de reserva recebe continuamente o estado dos tanques, os
+  // usuarios e as sessoes do ativo e, se a conexao com ele terminar, liga-se
+  // imediatamente na mesma porta, continuando a simulacao e as sessoes.
+  // Enquanto o ativo estiver inacessivel, tenta reconectar a cada
+  // SUP_STANDBY_RETRY segundos. Retorna false se o servidor estiver ligado.
+  bool setStandbyOn(const std::string& Endereco, const std::string& Login, const std::string& Senha);
+  // Desliga o servidor de reserva, sem assumir a porta
+  void setStandbyOff();
+
   // Leitura e impressao em console do estado da planta
   void readPrintState() const;
   // Impressao em console dos usuarios do servidor
   void printUsers() const;
 
-  // Adicionar um novo usuario
+  // Adicionar um novo usuario (no maximo SUP_MAX_USERS)
   bool addUser(const std::string& Login, const std::string& Senha, bool Admin);
   // Remover um usuario
   bool removeUser(const std::string& Login);
 
+  // Liga a difusao do estado por UDP para o endereco "IP[:porta]" (porta
+  // default SUP_BCAST_PORT), ou desliga, se o endereco for vazio.
+  // O estado soh eh enviado enquanto o servidor estiver ligado.
+  // Retorna true se OK (em caso de erro, a difusao fica desligada)
+  bool setBroadcast(const std::string& Endereco);
+  // Endereco da difusao do estado por UDP (vazio se desligada)
+  std::string broadcastAddress() const;
+  // Escolhe se o estado eh publicado (true) ou nao (false, default) no quadro
+  // em memoria compartilhada, para os processos no mesmo computador.
+  // Soh tem efeito se o servidor nao estiver ligado.
+  void setBoard(bool Quadro) {if (!server_on) use_board=Quadro;}
+
+protected:
+  // Construtor com a porta TCP, o caminho do socket local e o uso (true) ou
+  // nao (false) do quadro de estados em memoria compartilhada.
+  // Usado pelas classes derivadas que nao podem usar os valores default.
+  SupServidor(const std::string& Porta, const std::string& Local, bool Quadro);
+
+  // As funcoes virtuais de acesso a planta, chamadas pelo servidor.
+  // Por default, acessam os tanques simulados (classe Tanks). Sao redefinidas
+  // nas classes derivadas que acessam a planta de outra forma.
+  // Liga a planta: retorna true se OK
+  virtual bool virtLigarPlanta() {setTanksOn(); return true;}
+  // Desliga a planta
+  virtual void virtDesligarPlanta() {setTanksOff();}
+  // Planta ligada (true) ou desligada (false)
+  virtual bool virtPlantaLigada() const {return tanksOn();}
+  // Leh o estado atual da planta. Se o estado jah vier identificado (seq != 0),
+  // o numero de sequencia e o instante da amostra sao mantidos pelo servidor.
+  virtual void virtLerEstado(SupState& S) const {readStateFromSensors(S);}
+  // Executa um comando de atuacao (CMD_SET_V1, CMD_SET_V2, CMD_SET_PUMP ou
+  // CMD_SET_PID...) e retorna true se OK. Eh chamada pela thread do servidor.
+  virtual bool virtAtuar(uint16_t Cmd, uint16_t Param);
+  // Monta um bloco do historico de niveis (ver CMD_GET_HISTORY): o numero N de
+  // intervalos, seguido de SUP_HISTORY_BUCKET_LEN inteiros por intervalo.
+  // Retorna o numero de inteiros de Data (no maximo SUP_MAX_REPLY_LEN),
+  // ou -1 se o bloco for invalido. Eh chamada pela thread do servidor.
+  virtual int virtBlocoHistorico(uint16_t Level, uint64_t Index, uint16_t* Data);
+  // As versoes sem bloqueio das duas funcoes anteriores, usadas pela thread do
+  // servidor para responder aos clientes. O resultado eh entregue a Done, que
+  // pode ser chamada depois do retorno e por outra thread: a resposta ao cliente
+  // eh enviada depois pela thread do servidor, que nao fica esperando.
+  // Sao redefinidas nas classes derivadas que dependem de outro servidor.
+  // Por default, chamam as versoes com bloqueio e Done imediatamente.
+  virtual void virtAtuarAdiado(uint16_t Cmd, uint16_t Param, std::function<void(bool)> Done)
+  {
+    Done(virtAtuar(Cmd, Param));
+  }
+  virtual void virtBlocoHistoricoAdiado(uint16_t Level, uint64_t Index,
+                                        std::function<void(int N, const uint16_t* Data)> Done);
+
+  // Tarefa das classes derivadas, executada pela thread do servidor a cada
+  // ciclo, antes de esperar pelos clientes. Retorna o tempo maximo (em ms)
+  // ateh a proxima execucao. Por default, nao faz nada.
+  virtual long virtTarefaPeriodica() {return long(SUP_TIMEOUT*1000);}
+
+  // Executa F na thread do servidor, no inicio do proximo ciclo.
+  // Pode ser chamada por qualquer thread.
+  void runOnServerThread(std::function<void()> F);
+
+  // Testa se o historico registrado por este servidor inclui o instante T_us
+  // (isto eh, se o historico comeca antes de T_us)
+  bool historyCovers(uint64_t T_us) const {return !history.empty() && history.front().t_us <= T_us;}
+
+  // Substitui a lista de usuarios pelos usuarios Users (eventos CMD_USER_ADD).
+  // Os usuarios que nao mudaram continuam conectados.
+  void setUsers(const std::vector<SupReplEvent>& Users);
+
 private:
   // Construtores e operadores de atribuicao suprimidos (nao existem na classe)
   SupServidor(const SupServidor& other) = delete;
@@ -71,17 +270,242 @@ private:
 
   // Estado do servidor como um todo (ligado/desligado)
   bool server_on;
+  // A porta TCP e o caminho do socket local em que o servidor espera conexoes
+  std::string port, local_path;
+  // O servidor publica o estado no quadro em memoria compartilhada
+  bool use_board;
 
   // Lista de usuarios do servidor
   std::list<User> LU;
   // Identificador da thread do servidor
   std::thread thr_server;
+  // O identificador da thread do servidor, enquanto ela estiver em execucao
+  // (consultado pelas outras threads em runOnServerThread)
+  std::atomic<std::thread::id> server_tid;
   // Socket de conexoes
   tcp_mysocket_server sock_server;
+  // Socket de conexoes locais (AF_UNIX), para clientes no mesmo computador
+  tcp_mysocket_server sock_local;
 
   // Leitura do estado dos tanques a partir dos sensores
   void readStateFromSensors(SupState& S) const;
 
+  // Amostragem do estado dos tanques enviado aos clientes
+  // Instante em que o servidor foi ligado (referencia para SupState::t_us)
+  std::chrono::steady_clock::time_point t_on;
+  // Instante da ultima amostra (time_point() se nao houver amostra valida)
+  std::chrono::steady_clock::time_point t_sample;
+  // Ultima amostra e seu numero de sequencia
+  SupState last_sample;
+  uint64_t sample_seq;
+  // Retorna a ultima amostra, lendo os sensores novamente se ela for
+  // mais antiga que SUP_SAMPLE_PERIOD. Soh eh chamada pela thread do servidor.
+  void sampleState(SupState& S);
+  // Invalida a ultima amostra (apos uma atuacao)
+  inline void invalidateSample() {t_sample = std::chrono::steady_clock::time_point();}
+
+  // O historico dos niveis, registrado a cada SUP_HISTORY_PERIOD ms
+  struct HistRecord
+  {
+    uint64_t t_us;   // Instante do registro (mesma referencia de SupState::t_us)
+    uint16_t H1, H2; // Niveis dos tanques
+  };
+  std::deque<HistRecord> history;
+  // Instante do proximo registro do historico
+  std::chrono::steady_clock::time_point t_history;
+  // Registra os niveis no historico, se chegou a hora.
+  // Retorna o tempo (em ms) ateh o proximo registro.
+  long recordHistory();
+  // A publicacao do estado a cada SUP_SAMPLE_PERIOD ms, sem pedido dos clientes
+  // O quadro em memoria compartilhada, para os leitores locais
+  SupBoardWriter board;
+  // O canal de difusao por UDP, para os visualizadores (fechado se desligado)
+  udp_mysocket sock_bcast;
+  // O endereco da difusao, como informado em setBroadcast
+  std::string bcast_addr;
+  // Exclusao mutua entre a configuracao da difusao e o envio pela thread do servidor
+  mutable std::mutex mtx_bcast;
+  // Instante da proxima publicacao
+  std::chrono::steady_clock::time_point t_publish;
+  // Publica o estado no quadro e no canal de difusao, se chegou a hora.
+  // Retorna o tempo (em ms) ateh a proxima publicacao.
+  long publishState();
+
+  // O fluxo de replicacao: as atuacoes e as alteracoes na lista de usuarios.
+  // Os eventos guardados ocupam as posicoes de repl_end-repl_log.size()+1 a
+  // repl_end. As posicoes comecam no instante (em microsegundos) em que o
+  // servidor foi criado: as posicoes de uma execucao anterior do servidor
+  // sao desconhecidas e levam a uma copia completa da lista de usuarios.
+  std::deque<SupReplEvent> repl_log;
+  uint64_t repl_end;
+  // Exclusao mutua entre as alteracoes na lista de usuarios (programa
+  // principal) e a thread do servidor
+  mutable std::mutex mtx_repl;
+  // Acrescenta um evento ao fluxo de replicacao
+  void logEvent(uint16_t Type, uint16_t Param,
+                const std::string& Login="", const std::string& Senha="");
+  // O gerador dos tokens das sessoes. Cada token eh sorteado diretamente do
+  // gerador do sistema, para que nao possa ser previsto a partir de outros tokens
+  std::random_device token_gen;
+  // Gera o token de uma nova sessao (diferente de 0)
+  uint64_t newToken();
+
+  // O diario de atuacoes e o ponto de restauracao dos tanques, que permitem
+  // reconstruir a planta quando o servidor eh ligado novamente, mesmo depois
+  // de uma queda. Soh sao usados quando os tanques sao simulados por este servidor.
+  SupJournal journal;
+  // Instante do proximo ponto de restauracao
+  std::chrono::steady_clock::time_point t_checkpoint;
+  // A gravacao do ponto de restauracao em segundo plano, para que a thread do
+  // servidor nao espere pelo disco: a thread, o numero do primeiro registro
+  // posterior ao ponto e o resultado (ckpt_done indica que terminou)
+  std::thread thr_checkpoint;
+  uint64_t ckpt_n;
+  bool ckpt_ok;
+  std::atomic<bool> ckpt_done;
+  // As respostas as atuacoes que esperam pela gravacao do diario: o login e
+  // o token da sessao do usuario e o identificador de correlacao
+  struct JournalAck
+  {
+    std::string login;
+    uint64_t token;
+    uint16_t id;
+  };
+  std::vector<JournalAck> journal_acks;
+  // Responde a uma atuacao executada com sucesso. Com o diario aberto, a
+  // atuacao eh registrada e a resposta soh eh enviada depois da gravacao.
+  void ackActuation(const User& U, uint16_t cmd, uint16_t param, uint16_t id);
+  // Grava as atuacoes pendentes no diario (todas com um unico acesso ao disco),
+  // envia as respostas que esperavam pela gravacao e, se chegou a hora, inicia
+  // a gravacao de um ponto de restauracao. Retorna o tempo (em ms) ateh o proximo ponto.
+  long serveJournal();
+  // Grava um ponto de restauracao com o estado atual dos tanques e recomeca
+  // o diario. Retorna true se OK (senao, o diario eh removido).
+  bool writeCheckpoint();
+  // Inicia a gravacao de um ponto de restauracao em segundo plano
+  void startCheckpoint();
+  // Espera pelo fim da gravacao em segundo plano e, se OK, esvazia o diario
+  void finishCheckpoint();
+  // Monta o ponto de restauracao com o estado atual dos tanques
+  void makeCheckpoint(SupCheckpoint& C);
+  // Restaura os tanques a partir do ultimo ponto de restauracao, refazendo as
+  // atuacoes registradas depois dele. Retorna true se OK.
+  bool restoreJournal();
+  // Grava as atuacoes pendentes, fecha o diario e remove os arquivos: os
+  // tanques nao sao restaurados depois de um desligamento normal
+  void stopJournal();
+
+  // Os dados do servidor ativo para os servidores de reserva.
+  // Instante do proximo envio do estado
+  std::chrono::steady_clock::time_point t_standby;
+  // Envia aos servidores de reserva os eventos do fluxo de replicacao e,
+  // se chegou a hora, o estado (CMD_STANDBY_STATE).
+  // Retorna o tempo (em ms) ateh o proximo envio do estado.
+  long serveStandby();
+
+  // Os dados do servidor de reserva.
+  // O servidor de reserva estah ligado
+  bool standby_on;
+  // O servidor ativo e o usuario da conexao com ele
+  std::string standby_addr, standby_login, standby_senha;
+  // A conexao com o servidor ativo
+  tcp_mysocket sock_feed;
+  // Identificador da thread do servidor de reserva
+  std::thread thr_standby;
+  // O ultimo estado recebido do servidor ativo: os tanques e a ultima amostra
+  TanksState standby_plant;
+  SupState standby_sample;
+  bool standby_has_plant;
+  // A thread do servidor de reserva: recebe os dados do servidor ativo e
+  // assume a porta quando a conexao com ele termina
+  void thr_standby_main();
+  // Conecta ao servidor ativo e solicita o canal do servidor de reserva
+  bool connectFeed();
+  // Leh e aplica uma mensagem do servidor ativo. Retorna false em caso de erro.
+  bool readFeed();
+  // Liga o servidor com o ultimo estado recebido. Retorna true se OK.
+  bool takeOver();
+
+  // A transferencia do servidor para um novo processo (CMD_HANDOFF).
+  // Envia tudo ao processo do outro lado da conexao do usuario U e, se ele
+  // confirmar, desliga este servidor sem fechar as conexoes dos clientes.
+  // Retorna true se a transferencia foi concluida.
+  bool sendHandoff(User& U);
+  // Recebe tudo do servidor anterior pela conexao C e espera pelo seu fim.
+  // Retorna true se OK (os sockets de conexoes ficam em escuta).
+  bool receiveHandoff(const tcp_mysocket& C);
+
+  // Envia ao cliente a resposta a uma solicitacao CMD_REPLICATE retida, se
+  // houver eventos depois da posicao pedida ou se Force==true.
+  // Retorna true se a resposta foi enviada.
+  bool sendReplica(User& U, bool Force);
+  // Responde as solicitacoes CMD_REPLICATE retidas que tem eventos novos ou
+  // cujo prazo terminou. Retorna o tempo (em ms) ateh o proximo prazo.
+  long serveReplicas();
+
+  // As previsoes da evolucao dos niveis (CMD_WHATIF e CMD_SWEEP), simuladas em
+  // copias dos tanques pelas threads trabalhadoras, sem bloquear a thread do servidor.
+  // As previsoes concluidas: o login e o token da sessao do usuario, o
+  // identificador de correlacao, o comando e os dados da resposta
+  struct WhatIfResult
+  {
+    std::string login;
+    uint64_t token;
+    uint16_t id;
+    uint16_t cmd;
+    std::vector<uint16_t> data;
+  };
+  std::deque<WhatIfResult> whatif_done;
+  // Exclusao mutua entre as threads trabalhadoras e a thread do servidor
+  std::mutex mtx_whatif;
+  // Numero de previsoes em execucao ou aguardando envio (thread do servidor)
+  unsigned whatif_jobs;
+  // As threads trabalhadoras, criadas na primeira previsao.
+  // Declaradas depois dos dados que as tarefas usam, para serem destruidas antes.
+  std::unique_ptr<SupWorkerPool> workers;
+  // Inicia a previsao solicitada pelo usuario U: horizonte, periodo e as N
+  // atuacoes previstas (Ev, 3 inteiros por atuacao). Retorna false se a
+  // solicitacao for invalida ou se houver previsoes demais em execucao.
+  bool startWhatIf(const User& U, uint16_t id, uint16_t Horizon, uint16_t Period,
+                   const std::vector<uint16_t>& Ev);
+  // Inicia a varredura W solicitada pelo usuario U, dividida entre as threads
+  // trabalhadoras. Retorna false se a varredura for invalida ou se houver
+  // previsoes demais em execucao.
+  bool startSweep(const User& U, uint16_t id, const SupSweep& W);
+  // Envia as previsoes concluidas. Retorna o tempo (em ms) ateh a proxima
+  // verificacao (SUP_WHATIF_POLL, se ainda houver previsoes em execucao).
+  long serveWhatIf();
+  // Descarta as previsoes em execucao e as concluidas e encerra as threads trabalhadoras
+  void stopWhatIf();
+
+  // As respostas adiadas: as funcoes entregues por outras threads para execucao
+  // pela thread do servidor (runOnServerThread). Cada atuacao ou bloco do
+  // historico solicitado conta como pendente ateh que a sua resposta seja enviada.
+  std::deque<std::function<void()>> deferred;
+  std::mutex mtx_deferred;
+  unsigned deferred_jobs;
+  // Geracao das respostas adiadas: as que chegam depois que o servidor foi
+  // desligado (de uma geracao anterior) sao descartadas
+  unsigned deferred_gen;
+  // Executa as funcoes entregues pelas outras threads. Retorna o tempo (em ms)
+  // ateh a proxima verificacao (SUP_DEFERRED_POLL, se houver respostas pendentes).
+  long serveDeferred();
+  // Descarta as respostas adiadas
+  void stopDeferred();
+  // Inicia a atuacao solicitada pelo usuario U (virtAtuarAdiado).
+  // A resposta eh enviada por finishActuation, na thread do servidor.
+  void startActuation(const User& U, uint16_t cmd, uint16_t param, uint16_t id);
+  // Conclui uma atuacao: registra e responde, se a sessao continuar conectada
+  void finishActuation(const std::string& login, uint64_t token, uint16_t cmd,
+                       uint16_t param, uint16_t id, bool ok);
+  // Inicia o envio de um bloco do historico (resposta ao comando CMD_GET_HISTORY)
+  void startHistory(const User& U, uint16_t id, uint16_t level, uint64_t index);
+
+  // Envia uma resposta a um cliente, acrescentando o identificador
+  // de correlacao se o cliente estiver no modo com pipeline
+  mysocket_status sendReply(const User& U, uint16_t cmd, uint16_t id,
+                            const uint16_t* data=nullptr, int ndata=0) const;
+
   // A funcao que implementa a thread do servidor
   // Leitura e envio de dados pelos sockets
   void thr_server_main(void);
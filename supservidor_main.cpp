@@ -4,10 +4,25 @@
 
 using namespace std;
 
-int main()
+/// ==============================
+/// Funcao principal do servidor:
+///   supservidor [-q]
+/// -q: publica o estado no quadro em memoria compartilhada, para os
+///     processos no mesmo computador (desligado por default)
+/// ==============================
+
+int main(int argc, char *argv[])
 {
+  if (argc > 2 || (argc == 2 && string(argv[1]) != "-q"))
+  {
+    cerr << "Uso: " << argv[0] << " [-q]\n"
+         << "-q: publica o estado no quadro em memoria compartilhada\n";
+    return 1;
+  }
+
   // O servidor do sistema de tanques
   SupServidor ST_Server;
+  ST_Server.setBoard(argc == 2);
 
   // Relogio interno: primeira leitura, delta_t desde entao
   time_t first_t,delta_t;
@@ -28,9 +43,17 @@ int main()
     do
     {
       cout << "\n=================\n";
-      if (!ST_Server.serverOn())
+      if (!ST_Server.serverOn() && !ST_Server.standbyOn())
       {
         cout << " 0 - Ligar o servidor\n";
+        cout << " 2 - Ligar como servidor de reserva\n";
+        cout << " 4 - Ligar recebendo do servidor em execucao (reinicio sem interrupcao)\n";
+        cout << "=================\n";
+      }
+      if (!ST_Server.serverOn() && ST_Server.standbyOn())
+      {
+        cout << "Servidor de reserva ligado\n";
+        cout << " 3 - Desligar o servidor de reserva\n";
         cout << "=================\n";
       }
       if (ST_Server.serverOn())
@@ -47,6 +70,11 @@ int main()
         cout << "22 - Adicionar usuario\n";
         cout << "23 - Remover usuario\n";
         cout << "=================\n";
+        cout << "31 - Ligar/desligar a difusao UDP do estado\n";
+        cout << "=================\n";
+        cout << "41 - Gravar o estado dos tanques em arquivo\n";
+        cout << "42 - Continuar a partir do estado gravado em arquivo\n";
+        cout << "=================\n";
         cout << "98 - Desligar o servidor\n";
       }
       cout << "99 - Sair\n";
@@ -66,11 +94,38 @@ int main()
 
     if (!ST_Server.serverOn()) // Servidor nao estah ligado
     {
-      if (opcao == 0)
+      if (opcao == 0 && !ST_Server.standbyOn())
       {
         if (!ST_Server.setServerOn()) cerr << "Erro ao iniciar o servidor!\n";
         else first_t = time(nullptr);
       }
+      else if (opcao == 2 && !ST_Server.standbyOn())
+      {
+        // O servidor de reserva assume a porta quando o servidor ativo parar
+        cout << "Endereco IP[:porta] do servidor ativo: ";
+        cin >> texto;
+        cout << "Login do administrador no servidor ativo: ";
+        cin >> Login;
+        cout << "Senha: ";
+        cin >> Senha;
+        if (!ST_Server.setStandbyOn(texto, Login, Senha)) cerr << "Erro ao iniciar o servidor de reserva!\n";
+        else first_t = time(nullptr);
+      }
+      else if (opcao == 4 && !ST_Server.standbyOn())
+      {
+        // O servidor em execucao no mesmo diretorio transfere as conexoes e o
+        // estado da planta para este processo e termina o seu servico
+        cout << "Login do administrador no servidor em execucao: ";
+        cin >> Login;
+        cout << "Senha: ";
+        cin >> Senha;
+        if (!ST_Server.setServerOnFrom(Login, Senha)) cerr << "Erro ao receber o servidor em execucao!\n";
+        else first_t = time(nullptr);
+      }
+      else if (opcao == 3 || (opcao == 99 && ST_Server.standbyOn()))
+      {
+        ST_Server.setStandbyOff();
+      }
       else
       {
         if (opcao != 99) cout << "Servidor estah desligado!\n";
@@ -177,6 +232,36 @@ int main()
         if (ST_Server.removeUser(Login)) cout << "Usuario " << Login << " removido\n";
         else cout << "Usuario " << Login << " inexistente (nao removido)\n";
         break;
+      case 31:
+        texto = ST_Server.broadcastAddress();
+        cout << "Difusao UDP " << (texto.empty() ? "desligada" : "para "+texto) << endl;
+        cout << "Endereco IP[:porta] da difusao (- para desligar): ";
+        cin >> texto;
+        if (texto == "-") texto.clear();
+        if (ST_Server.setBroadcast(texto))
+        {
+          texto = ST_Server.broadcastAddress();
+          cout << "Difusao UDP " << (texto.empty() ? "desligada" : "para "+texto) << endl;
+        }
+        else
+        {
+          cout << "Endereco " << texto << " invalido (difusao desligada)\n";
+        }
+        break;
+      case 41:
+        cout << "Arquivo: ";
+        cin >> texto;
+        if (ST_Server.saveState(texto)) cout << "Estado gravado em " << texto << endl;
+        else cout << "Erro ao gravar o estado em " << texto << endl;
+        break;
+      case 42:
+        // Os tanques passam imediatamente ao estado gravado (niveis, valvulas,
+        // bomba e geradores de ruido) e continuam a simulacao a partir dele
+        cout << "Arquivo: ";
+        cin >> texto;
+        if (ST_Server.loadState(texto)) cout << "Estado lido de " << texto << endl;
+        else cout << "Arquivo " << texto << " inexistente ou invalido\n";
+        break;
       case 98:
       case 99:
         first_t = time(nullptr);
@@ -0,0 +1,69 @@
+#include "supworkers.h"
+
+using namespace std;
+
+/* ========================================
+   CLASSE SUPWORKERPOOL
+   ======================================== */
+
+/// Construtor: lanca as threads
+SupWorkerPool::SupWorkerPool(unsigned NThreads)
+  : threads()
+  , tasks()
+  , mtx()
+  , cv()
+  , stop(false)
+{
+  if (NThreads == 0)
+  {
+    // Um processador fica para a thread do servidor
+    NThreads = thread::hardware_concurrency();
+    if (NThreads > 1) --NThreads;
+    else NThreads = 1;
+  }
+  for (unsigned i=0; i<NThreads; ++i)
+  {
+    threads.emplace_back([this](){this->worker();});
+  }
+}
+
+/// Destrutor
+SupWorkerPool::~SupWorkerPool()
+{
+  {
+    lock_guard<mutex> lock(mtx);
+    stop = true;
+    tasks.clear();
+  }
+  cv.notify_all();
+  for (auto& T : threads) if (T.joinable()) T.join();
+}
+
+/// Coloca uma tarefa na fila
+void SupWorkerPool::post(std::function<void()> Task)
+{
+  {
+    lock_guard<mutex> lock(mtx);
+    if (stop) return;
+    tasks.push_back(std::move(Task));
+  }
+  cv.notify_one();
+}
+
+/// Cada thread espera por uma tarefa, executa-a fora da exclusao mutua
+/// e volta a esperar, ateh que o grupo seja destruido
+void SupWorkerPool::worker()
+{
+  function<void()> Task;
+  while (true)
+  {
+    {
+      unique_lock<mutex> lock(mtx);
+      cv.wait(lock, [this](){return stop || !tasks.empty();});
+      if (stop) return;
+      Task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    Task();
+  }
+}
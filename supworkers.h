@@ -0,0 +1,53 @@
+#ifndef _SUP_WORKERS_H_
+#define _SUP_WORKERS_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+/// Um grupo de threads trabalhadoras que executam tarefas em paralelo.
+/// As tarefas sao executadas na ordem em que foram colocadas na fila,
+/// cada uma por uma das threads. Sao usadas para calculos demorados (por
+/// exemplo, as previsoes com copias dos tanques), para que a thread que as
+/// solicita (a do servidor) nao fique bloqueada.
+/// A tarefa eh responsavel por entregar o seu resultado (ver SupServidor::serveWhatIf).
+class SupWorkerPool
+{
+public:
+  // Construtor com o numero de threads (0: uma a menos do que o numero de
+  // processadores, e no minimo uma)
+  explicit SupWorkerPool(unsigned NThreads=0);
+  // Destrutor: descarta as tarefas que nao comecaram e espera pelo fim
+  // das que estao em execucao
+  ~SupWorkerPool();
+
+  // Numero de threads
+  unsigned numThreads() const {return unsigned(threads.size());}
+  // Coloca uma tarefa na fila. Retorna imediatamente.
+  void post(std::function<void()> Task);
+
+private:
+  // Construtores e operadores de atribuicao suprimidos (nao existem na classe)
+  SupWorkerPool(const SupWorkerPool& other) = delete;
+  SupWorkerPool(SupWorkerPool&& other) = delete;
+  SupWorkerPool& operator=(const SupWorkerPool& other) = delete;
+  SupWorkerPool& operator=(SupWorkerPool&& other) = delete;
+
+  // As threads trabalhadoras
+  std::vector<std::thread> threads;
+  // A fila de tarefas
+  std::deque<std::function<void()>> tasks;
+  // Exclusao mutua no acesso a fila e sinalizacao de nova tarefa
+  std::mutex mtx;
+  std::condition_variable cv;
+  // As threads devem terminar
+  bool stop;
+
+  // A funcao que implementa cada thread: executa as tarefas da fila
+  void worker();
+};
+
+#endif // _SUP_WORKERS_H_
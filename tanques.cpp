@@ -1,6 +1,9 @@
 #include <iostream>     /* cerr */
 #include <cmath>        /* sin, cos, log, sqrt, round */
 #include <chrono>       /* std::chrono::seconds */
+#include <sstream>      /* std::ostringstream */
+#include <cstdio>       /* fopen */
+#include <cstring>      /* memcpy */
 #include "tanques.h"
 #include "supdados.h"
 
@@ -12,28 +15,26 @@ const static double percDynamicNoise=0.01;
 /// Ruido de medicao: percentual do valor maximo medido: 0.0 a 1.0
 const static double percMeasureNoise=0.005;
 
-/// Gerador de variavel aleatoria com distribuicao normal, media 0.0, desvio padrao 1.0
-/// Aproximacao pela transformada de BoxMuller
-static double normal()
+/// Proximo valor da sequencia com distribuicao normal, media 0.0, desvio padrao 1.0
+double TanksNoise::normal()
 {
   double u1,z1;
-  static double u2=-1.0, z2=0.0;
-  int n_rand;
+  uint32_t n_rand;
 
   if (u2 < 0.0)
   {
     do
     {
-      n_rand = rand();     // 0 a RAND_MAX
+      n_rand = gen();      // 0 a gen.max()
     }
-    while (n_rand == 0);   // 1 a RAND_MAX
-    u1 = double(n_rand)/RAND_MAX;   // maior que 0.0 ateh igual a 1.0
+    while (n_rand == 0);   // 1 a gen.max()
+    u1 = double(n_rand)/gen.max();  // maior que 0.0 ateh igual a 1.0
     do
     {
-      n_rand = rand();     // 0 a RAND_MAX
+      n_rand = gen();      // 0 a gen.max()
     }
-    while (n_rand == 0);   // 1 a RAND_MAX
-    u2 = double(n_rand)/RAND_MAX;   // maior que 0.0 ateh igual a 1.0
+    while (n_rand == 0);   // 1 a gen.max()
+    u2 = double(n_rand)/gen.max();  // maior que 0.0 ateh igual a 1.0
 
     double raio=sqrt(-2.0*log(u1)); // 0.0 a <inf
     double angulo=2.0*M_PI*u2;      // >0.0 a 2PI
@@ -46,9 +47,46 @@ static double normal()
   return z2;
 }
 
+/// Funcoes auxiliares para converter reais na sua representacao binaria exata
+static uint64_t double_bits(double num)
+{
+  uint64_t bits;
+  memcpy(&bits, &num, sizeof(bits));
+  return bits;
+}
+static double bits_double(uint64_t bits)
+{
+  double num;
+  memcpy(&num, &bits, sizeof(num));
+  return num;
+}
+
+/// Estado do gerador: o estado do std::mt19937 (no formato da biblioteca
+/// padrao), seguido dos valores guardados da transformada
+std::string TanksNoise::getState() const
+{
+  std::ostringstream out;
+  out << gen << ' ' << double_bits(u2) << ' ' << double_bits(z2);
+  return out.str();
+}
+
+/// Restaura o estado do gerador
+bool TanksNoise::setState(const std::string& S)
+{
+  std::istringstream in(S);
+  std::mt19937 new_gen;
+  uint64_t bits_u2, bits_z2;
+  if (!(in >> new_gen >> bits_u2 >> bits_z2)) return false;
+  gen = new_gen;
+  u2 = bits_double(bits_u2);
+  z2 = bits_double(bits_z2);
+  return true;
+}
+
 /// Construtor default
 Tanks::Tanks():
   tanks_on(false),
+  realtime(true),
   h1(0.0),
   h2(0.0),
   v1_open(false),
@@ -56,10 +94,16 @@ Tanks::Tanks():
   pump_input(0),
   flow_pump(0.0),
   is_overflowing(false),
+  n_steps_overflow(0),
+  last_pump_input_perc(0.0),
+  last_flow_pump_perc(0.0),
+  pid(),
+  noise_dyn(std::random_device{}()),
+  noise_meas(std::random_device{}()),
+  mtx_simul(),
   last_t(0),
   thr_simul()
 {
-  srand(time(nullptr));
 }
 
 /// Destrutor
@@ -91,8 +135,9 @@ uint16_t Tanks::v2isOpen() const
 }
 
 /// Funcao auxiliar (privada) para medicao do nivel de um dos tanques: 1 ou 2.
-/// Valor real mais ruido, quantizado para 16 bits.
-uint16_t Tanks::getH(int I) const
+/// Valor real mais ruido (se Noise==true), quantizado para 16 bits.
+/// Sem ruido, o gerador do ruido de medicao nao eh usado.
+uint16_t Tanks::getH(int I, bool Noise) const
 {
   if (!tanks_on) return 0;
 
@@ -100,8 +145,9 @@ uint16_t Tanks::getH(int I) const
   simulate();
 
   // Retorna a saida com ruido e quantizada
-  double h_medida = (I==2 ? h2 : h1) +
-                    MaxTankLevelMeasurement*percMeasureNoise*normal();
+  std::lock_guard<std::mutex> lock(mtx_simul);
+  double h_medida = (I==2 ? h2 : h1);
+  if (Noise) h_medida += MaxTankLevelMeasurement*percMeasureNoise*noise_meas.normal();
   if (h_medida<0.0) h_medida = 0.0;
   else if (h_medida>MaxTankLevelMeasurement) h_medida = MaxTankLevelMeasurement;
   return uint16_t(round(UINT16_MAX*(h_medida/MaxTankLevelMeasurement)));
@@ -119,10 +165,26 @@ uint16_t Tanks::hTank2() const
   return getH(2);
 }
 
+/// Nivel real do tanque 1, sem o ruido do sensor
+uint16_t Tanks::hTank1Real() const
+{
+  return getH(1, false);
+}
+
+/// Nivel real do tanque 2, sem o ruido do sensor
+uint16_t Tanks::hTank2Real() const
+{
+  return getH(2, false);
+}
+
 /// Entrada da bomba: 0 a 65535
 uint16_t Tanks::pumpInput() const
 {
   if (!tanks_on) return 0;
+
+  // Com o controlador de nivel ligado, a entrada muda a cada passo
+  simulate();
+
   return pump_input;
 }
 
@@ -135,8 +197,9 @@ uint16_t Tanks::pumpFlow() const
   simulate();
 
   // Retorna a saida com ruido e quantizada
+  std::lock_guard<std::mutex> lock(mtx_simul);
   double flow_medido = flow_pump +
-                       MaxPumpFlowMeasurement*percMeasureNoise*normal();
+                       MaxPumpFlowMeasurement*percMeasureNoise*noise_meas.normal();
   if (flow_medido<0.0) flow_medido = 0.0;
   else if (flow_medido>MaxPumpFlowMeasurement) flow_medido = MaxPumpFlowMeasurement;
   return uint16_t(round(UINT16_MAX*(flow_medido/MaxPumpFlowMeasurement)));
@@ -186,6 +249,7 @@ void Tanks::setTanksOff()
   v1_open = false;
   v2_open = false;
   pump_input = 0;
+  pid.tank = 0;
 
   // Espera pelo fim da thread
   if (thr_simul.joinable()) thr_simul.join();
@@ -221,8 +285,255 @@ void Tanks::setPumpInput(uint16_t Input)
 
   // Simula os tanques ateh o instante atual com entrada anterior da bomba
   simulate();
-  // Fixa a nova entrada da bomba para simular a partir de agora
+  // Fixa a nova entrada da bomba para simular a partir de agora.
+  // A atuacao manual na bomba desliga o controlador de nivel.
+  std::lock_guard<std::mutex> lock(mtx_simul);
   pump_input = Input;
+  pid.tank = 0;
+}
+
+/// Leh a configuracao e a memoria do controlador de nivel
+void Tanks::getPID(TanksPID& C) const
+{
+  if (!tanks_on) return;
+
+  // Simula os tanques ateh o instante atual (a memoria muda a cada passo)
+  simulate();
+
+  std::lock_guard<std::mutex> lock(mtx_simul);
+  C = pid;
+}
+
+/// Fixa a configuracao do controlador de nivel. A memoria eh mantida se a
+/// configuracao nao mudar. Se o controlador for ligado, mudar de tanque ou
+/// mudar o nivel desejado ou algum ganho, a memoria eh reiniciada para que a
+/// saida continue igual a entrada atual da bomba (transferencia sem salto).
+/// O erro anterior eh recalculado com o novo nivel desejado: a derivada
+/// continua sendo a do nivel, sem o salto da mudanca do nivel desejado.
+void Tanks::setPID(const TanksPID& C)
+{
+  if (!tanks_on) return;
+
+  // Simula os tanques ateh o instante atual com a configuracao anterior
+  simulate();
+
+  std::lock_guard<std::mutex> lock(mtx_simul);
+  const bool iniciar = (C.tank != 0 &&
+                        (C.tank != pid.tank || C.setpoint != pid.setpoint ||
+                         C.kp != pid.kp || C.ki != pid.ki || C.kd != pid.kd || C.kt != pid.kt));
+  const double integral = pid.integral, last_error = pid.last_error;
+  pid = C;
+  if (pid.tank != 1 && pid.tank != 2) pid.tank = 0;
+  if (iniciar)
+  {
+    pid.last_error = pid.setpoint - (pid.tank==2 ? h2 : h1)/MaxTankLevelMeasurement;
+    pid.integral = double(pump_input)/UINT16_MAX - pid.kp*pid.last_error;
+  }
+  else
+  {
+    pid.integral = integral;
+    pid.last_error = last_error;
+  }
+}
+
+/// Leh o estado dos tanques, simulados ateh o instante atual
+void Tanks::getState(TanksState& S) const
+{
+  if (!tanks_on) return;
+
+  // Simula os tanques ateh o instante atual
+  simulate();
+
+  std::lock_guard<std::mutex> lock(mtx_simul);
+  S.h1 = h1;
+  S.h2 = h2;
+  S.v1_open = v1_open;
+  S.v2_open = v2_open;
+  S.pump_input = pump_input;
+  S.flow_pump = flow_pump;
+  S.is_overflowing = is_overflowing;
+  S.n_steps_overflow = n_steps_overflow;
+  S.last_pump_input_perc = last_pump_input_perc;
+  S.last_flow_pump_perc = last_flow_pump_perc;
+  S.noise_dyn = noise_dyn.getState();
+  S.noise_meas = noise_meas.getState();
+  S.pid = pid;
+}
+
+/// Continua a simulacao a partir do estado S, lido de outro objeto
+void Tanks::setState(const TanksState& S)
+{
+  if (!tanks_on) return;
+
+  // Simula os tanques ateh o instante atual com o estado anterior,
+  // para que a simulacao continue a partir de agora com o novo estado
+  simulate();
+
+  std::lock_guard<std::mutex> lock(mtx_simul);
+  h1 = S.h1;
+  h2 = S.h2;
+  v1_open = S.v1_open;
+  v2_open = S.v2_open;
+  pump_input = S.pump_input;
+  flow_pump = S.flow_pump;
+  is_overflowing = S.is_overflowing;
+  n_steps_overflow = S.n_steps_overflow;
+  last_pump_input_perc = S.last_pump_input_perc;
+  last_flow_pump_perc = S.last_flow_pump_perc;
+  // Os geradores soh sao substituidos se o estado for conhecido
+  if (!S.noise_dyn.empty()) noise_dyn.setState(S.noise_dyn);
+  if (!S.noise_meas.empty()) noise_meas.setState(S.noise_meas);
+  pid = S.pid;
+}
+
+/// Simula imediatamente mais Seconds segundos, alem do instante atual, com o
+/// estado atual das valvulas e da bomba (reconstrucao do estado a partir das
+/// atuacoes registradas). A simulacao continua em tempo real depois disso.
+void Tanks::advance(unsigned Seconds)
+{
+  if (!tanks_on || Seconds == 0) return;
+  simulate(Seconds);
+}
+
+/// Grava o estado completo dos tanques em arquivo (formato binario)
+bool Tanks::saveState(const std::string& Arquivo) const
+{
+  if (!tanks_on) return false;
+  TanksState S;
+  getState(S);
+  std::vector<uint8_t> B;
+  S.toBytes(B);
+
+  FILE* f = fopen(Arquivo.c_str(), "wb");
+  if (f == nullptr) return false;
+  bool ok = (fwrite(B.data(), 1, B.size(), f) == B.size());
+  if (fclose(f) != 0) ok = false;
+  return ok;
+}
+
+/// Continua a simulacao a partir do estado gravado em arquivo
+bool Tanks::loadState(const std::string& Arquivo)
+{
+  if (!tanks_on) return false;
+  FILE* f = fopen(Arquivo.c_str(), "rb");
+  if (f == nullptr) return false;
+  std::vector<uint8_t> B;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) B.insert(B.end(), buffer, buffer+n);
+  fclose(f);
+
+  TanksState S;
+  if (!S.fromBytes(B)) return false;
+  setState(S);
+  return true;
+}
+
+/// Cria uma copia independente dos tanques, com o mesmo estado e os mesmos
+/// geradores de ruido. A copia jah estah ligada, mas nao segue o relogio:
+/// soh eh simulada por advance, tao rapido quanto possivel. Assim, uma
+/// mesma copia sempre produz a mesma simulacao.
+std::unique_ptr<Tanks> Tanks::fork() const
+{
+  std::unique_ptr<Tanks> T(new Tanks());
+  T->realtime = false;
+  T->tanks_on = true;
+  if (tanks_on)
+  {
+    TanksState S;
+    getState(S);
+    T->setState(S);
+  }
+  return T;
+}
+
+/// Funcoes auxiliares para o formato binario do estado, sempre com o byte
+/// menos significativo primeiro
+static void put_bytes(std::vector<uint8_t>& B, uint64_t num, int nbytes)
+{
+  for (int i=0; i<nbytes; ++i) B.push_back(uint8_t(num >> (8*i)));
+}
+static uint64_t get_bytes(const std::vector<uint8_t>& B, size_t& pos, int nbytes)
+{
+  uint64_t num = 0;
+  for (int i=0; i<nbytes; ++i) num |= uint64_t(B[pos++]) << (8*i);
+  return num;
+}
+
+/// Converte o estado para o formato binario
+void TanksState::toBytes(std::vector<uint8_t>& B) const
+{
+  B.clear();
+  put_bytes(B, TANKS_STATE_MAGIC, 4);
+  put_bytes(B, TANKS_STATE_VERSION, 4);
+  put_bytes(B, double_bits(h1), 8);
+  put_bytes(B, double_bits(h2), 8);
+  put_bytes(B, v1_open, 1);
+  put_bytes(B, v2_open, 1);
+  put_bytes(B, pump_input, 2);
+  put_bytes(B, double_bits(flow_pump), 8);
+  put_bytes(B, is_overflowing, 1);
+  put_bytes(B, uint32_t(n_steps_overflow), 4);
+  put_bytes(B, double_bits(last_pump_input_perc), 8);
+  put_bytes(B, double_bits(last_flow_pump_perc), 8);
+  put_bytes(B, uint8_t(pid.tank), 1);
+  for (double x : {pid.setpoint, pid.kp, pid.ki, pid.kd, pid.kt, pid.integral, pid.last_error})
+  {
+    put_bytes(B, double_bits(x), 8);
+  }
+  for (const std::string* S : {&noise_dyn, &noise_meas})
+  {
+    put_bytes(B, S->size(), 4);
+    B.insert(B.end(), S->begin(), S->end());
+  }
+}
+
+/// Leh o estado do formato binario.
+/// Tambem aceita a versao 1, sem o controlador de nivel (que fica desligado).
+bool TanksState::fromBytes(const std::vector<uint8_t>& B)
+{
+  // Campos de tamanho fixo (a versao 2 acrescenta os do controlador)
+  if (B.size() < 8) return false;
+  size_t pos = 0;
+  if (get_bytes(B, pos, 4) != TANKS_STATE_MAGIC) return false;
+  const uint64_t version = get_bytes(B, pos, 4);
+  if (version != 1 && version != TANKS_STATE_VERSION) return false;
+  const size_t fixed_len = (version == 1 ? 57 : 114);
+  if (B.size() < fixed_len + 8) return false;
+  TanksState S;
+  S.h1 = bits_double(get_bytes(B, pos, 8));
+  S.h2 = bits_double(get_bytes(B, pos, 8));
+  S.v1_open = get_bytes(B, pos, 1) != 0;
+  S.v2_open = get_bytes(B, pos, 1) != 0;
+  S.pump_input = uint16_t(get_bytes(B, pos, 2));
+  S.flow_pump = bits_double(get_bytes(B, pos, 8));
+  S.is_overflowing = get_bytes(B, pos, 1) != 0;
+  S.n_steps_overflow = int32_t(get_bytes(B, pos, 4));
+  S.last_pump_input_perc = bits_double(get_bytes(B, pos, 8));
+  S.last_flow_pump_perc = bits_double(get_bytes(B, pos, 8));
+  // O controlador de nivel
+  if (version >= 2)
+  {
+    S.pid.tank = int(get_bytes(B, pos, 1));
+    for (double* x : {&S.pid.setpoint, &S.pid.kp, &S.pid.ki, &S.pid.kd, &S.pid.kt,
+                      &S.pid.integral, &S.pid.last_error})
+    {
+      *x = bits_double(get_bytes(B, pos, 8));
+    }
+    if (S.pid.tank != 1 && S.pid.tank != 2) S.pid.tank = 0;
+  }
+  // Os geradores de ruido
+  for (std::string* N : {&S.noise_dyn, &S.noise_meas})
+  {
+    if (B.size() - pos < 4) return false;
+    size_t len = get_bytes(B, pos, 4);
+    if (B.size() - pos < len) return false;
+    N->assign(B.begin()+pos, B.begin()+pos+len);
+    pos += len;
+  }
+  if (pos != B.size()) return false;
+  *this = S;
+  return true;
 }
 
 inline double pow2(double x)
@@ -230,8 +541,26 @@ inline double pow2(double x)
   return x*x;
 }
 
-/// Simula os tanques do instante da ultima simulacao ateh o instante atual
-void Tanks::simulate() const
+/// Um passo do controlador PID de nivel.
+/// O termo derivativo eh calculado sobre o nivel (o nivel anterior eh
+/// setpoint - last_error), e nao sobre o erro: uma mudanca do nivel desejado
+/// nao gera um pico na saida.
+/// Anti-windup por realimentacao: a diferenca entre a saida saturada e a
+/// calculada, multiplicada por kt, eh descontada do termo integral.
+uint16_t TanksPID::step(double H, double Dt)
+{
+  const double error = setpoint - H;
+  const double last_H = setpoint - last_error;
+  const double u = kp*error + integral + kd*(last_H - H)/Dt;
+  const double u_sat = (u < 0.0 ? 0.0 : (u > 1.0 ? 1.0 : u));
+  integral += (ki*error + kt*(u_sat - u))*Dt;
+  last_error = error;
+  return uint16_t(round(UINT16_MAX*u_sat));
+}
+
+/// Simula os tanques do instante da ultima simulacao ateh o instante atual.
+/// Os Extra passos a mais sao simulados como se tivessem ocorrido antes.
+void Tanks::simulate(unsigned Extra) const
 {
   // Constantes gerais
   const static double G=9.81;               // Aceleracao da gravidade (em m/s2)
@@ -255,18 +584,14 @@ void Tanks::simulate() const
   // Simulacao
   const static double eps=1.0;              // Passo de simulacao (sempre 1 segundo)
 
-  // Numero de passos de simulacao com transbordamento
-  static int NStepsOverflow=0;
-  // Variaveis para calculo do comportamento com histerese da bomba
-  static double last_pump_input_perc=0.0;   // Entrada % anterior da bomba: 0 a 1.0
-  static double last_flow_pump_perc=0.0;    // Vazao % anterior da bomba: 0 a 1.0
-
-  // Mutex para simular como regiao critica
-  static std::mutex mtx;
-
   // Soh simula se os tanques estiverem ligados
   if (!tanks_on) return;
 
+  // Entra na regiao critica (mutex do objeto): bloqueia o semaforo antes de
+  // copiar os dados membros, para que duas simulacoes simultaneas nao
+  // partam do mesmo estado
+  mtx_simul.lock();
+
   // As variaveis de simulacao que sao copias dos dados membros da classe.
   // A simulacao serah feita com essas copias.
   // Depois, os novos valores simulados serao copiados para os dados membros.
@@ -276,6 +601,14 @@ void Tanks::simulate() const
   double h1_internal = h1;
   double h2_internal = h2;
   time_t last_t_internal = last_t;
+  // Numero de passos de simulacao com transbordamento
+  int NStepsOverflow = n_steps_overflow;
+  // Variaveis para calculo do comportamento com histerese da bomba
+  double last_pump_input_perc = this->last_pump_input_perc;  // Entrada % anterior da bomba: 0 a 1.0
+  double last_flow_pump_perc = this->last_flow_pump_perc;    // Vazao % anterior da bomba: 0 a 1.0
+  // A entrada da bomba e o controlador de nivel, que a altera a cada passo
+  uint16_t pump_input_internal = pump_input;
+  TanksPID pid_internal = pid;
 
   // As variaveis exclusivamente da simulacao (nao sao dados da classe)
   // As vazoes
@@ -288,27 +621,33 @@ void Tanks::simulate() const
   // As derivadas dos niveis
   double dh1, dh2;
 
-  // Entra na regiao critica: bloqueia o semaforo
-  mtx.lock();
-
-  // Quando for iniciar a simulacao, mede o instante de tempo atual
-  time_t current_t = time(nullptr);
+  // Quando for iniciar a simulacao, mede o instante de tempo atual.
+  // As copias (fork) nao seguem o relogio: soh simulam os passos a mais.
+  time_t current_t = (realtime ? time(nullptr) : last_t_internal);
+  last_t_internal -= time_t(Extra);
   if (current_t <= last_t_internal)
   {
     // Libera o semaforo
-    mtx.unlock();
+    mtx_simul.unlock();
     return;
   }
 
   while (last_t_internal < current_t)
   {
+    // O controlador de nivel fixa a entrada da bomba para este passo
+    if (pid_internal.tank != 0)
+    {
+      pump_input_internal = pid_internal.step((pid_internal.tank==2 ? h2_internal : h1_internal)/
+                                              MaxTankLevelMeasurement, eps);
+    }
+
     // Calculo das vazoes
 
     // Escoamento do tanque 1 pela valvula 1
     if (v1_open)
     {
       flow1 = Cd*Valv1Area*sqrt(2.0*G*h1_internal);
-      flow1 += fabs(flow1)*percDynamicNoise*normal();
+      flow1 += fabs(flow1)*percDynamicNoise*noise_dyn.normal();
       if (flow1<0.0) flow1 = 0.0;
 
     }
@@ -321,7 +660,7 @@ void Tanks::simulate() const
     if (v2_open)
     {
       flow2 = Cd*Valv2Area*sqrt(2.0*G*h2_internal);
-      flow2 += fabs(flow2)*percDynamicNoise*normal();
+      flow2 += fabs(flow2)*percDynamicNoise*noise_dyn.normal();
       if (flow2<0.0) flow2 = 0.0;
     }
     else
@@ -359,13 +698,13 @@ void Tanks::simulate() const
         flow12 = 0.0;
       }
     }
-    flow12 += fabs(flow12)*percDynamicNoise*normal();
+    flow12 += fabs(flow12)*percDynamicNoise*noise_dyn.normal();
 
     // Escoamento por transbordamento
     if (h1_internal>OverflowHeight)
     {
       flow_over = Cd*OverflowArea*sqrt(2.0*G*(h1_internal-OverflowHeight));
-      flow_over += fabs(flow_over)*percDynamicNoise*normal();
+      flow_over += fabs(flow_over)*percDynamicNoise*noise_dyn.normal();
       if (flow_over<0.0) flow_over = 0.0;
     }
     else
@@ -406,9 +745,9 @@ void Tanks::simulate() const
     }
 
     // Vazao de entrada da bomba para tanque 1
-    if (pump_input > 0)
+    if (pump_input_internal > 0)
     {
-      pump_input_perc = double(pump_input)/UINT16_MAX;
+      pump_input_perc = double(pump_input_internal)/UINT16_MAX;
       // Histerese da bomba
       if (pump_input_perc == last_pump_input_perc)
       {
@@ -449,7 +788,7 @@ void Tanks::simulate() const
         }
       }
       flow_pump_internal = FlowPumpMax*flow_pump_perc;
-      flow_pump_internal += fabs(flow_pump_internal)*percDynamicNoise*normal();
+      flow_pump_internal += fabs(flow_pump_internal)*percDynamicNoise*noise_dyn.normal();
       if (flow_pump_internal<0.0) flow_pump_internal = 0.0;
     }
     else
@@ -495,9 +834,19 @@ void Tanks::simulate() const
   *pt_double = h2_internal;
   time_t* pt_time = (time_t*)&last_t;
   *pt_time = last_t_internal;
+  int* pt_int = (int*)&n_steps_overflow;
+  *pt_int = NStepsOverflow;
+  pt_double = (double*)&this->last_pump_input_perc;
+  *pt_double = last_pump_input_perc;
+  pt_double = (double*)&this->last_flow_pump_perc;
+  *pt_double = last_flow_pump_perc;
+  uint16_t* pt_uint16 = (uint16_t*)&pump_input;
+  *pt_uint16 = pump_input_internal;
+  TanksPID* pt_pid = (TanksPID*)&pid;
+  *pt_pid = pid_internal;
 
   // Sai da regiao critica: libera o semaforo
-  mtx.unlock();
+  mtx_simul.unlock();
 }
 
 /// Chama periodicamente a funcao "simulate" enquanto os tanques estiverem ligados
@@ -4,9 +4,92 @@
 #include <ctime>        /* time_t */
 #include <thread>       /* std::thread */
 #include <mutex>        /* std::mutex */
+#include <random>       /* std::mt19937 */
+#include <string>
+#include <vector>
+#include <memory>       /* std::unique_ptr */
 #include "tanques-param.h"
 #include <cstdint>
 
+/// Identificacao do formato binario do estado dos tanques (arquivos de estado)
+#define TANKS_STATE_MAGIC 0x53555054 // "SUPT"
+#define TANKS_STATE_VERSION 2
+
+/// Gerador de variavel aleatoria com distribuicao normal, media 0.0, desvio padrao 1.0.
+/// Aproximacao pela transformada de BoxMuller.
+/// O estado do gerador pode ser lido e restaurado, para que outro objeto
+/// (ou outro processo) continue exatamente a mesma sequencia.
+class TanksNoise
+{
+public:
+  // Construtor com a semente
+  explicit TanksNoise(uint32_t Seed): gen(Seed), u2(-1.0), z2(0.0) {}
+
+  // Proximo valor da sequencia
+  double normal();
+
+  // Estado do gerador (texto)
+  std::string getState() const;
+  // Restaura o estado lido por getState. Retorna false se o estado for invalido.
+  bool setState(const std::string& S);
+
+private:
+  // O gerador de numeros inteiros
+  std::mt19937 gen;
+  // O segundo valor de cada par da transformada (u2 < 0.0: nenhum valor guardado)
+  double u2, z2;
+};
+
+/// O controlador PID do nivel de um dos tanques, que atua na entrada da bomba.
+/// Eh executado a cada passo da simulacao (1 segundo), inclusive nos passos
+/// simulados de uma vez, sem depender das leituras dos sensores. O nivel eh
+/// o real (sem ruido de medicao) e os valores sao normalizados: o nivel como
+/// fracao de MaxTankLevelMeasurement e a saida como fracao da entrada maxima.
+struct TanksPID
+{
+  // Tanque controlado (1 ou 2), ou 0 se o controlador estiver desligado
+  int tank=0;
+  // Nivel desejado (0.0 a 1.0)
+  double setpoint=0.0;
+  // Ganhos proporcional, integral (por s) e derivativo (em s)
+  double kp=0.0, ki=0.0, kd=0.0;
+  // Ganho (por s) do anti-windup por realimentacao da saturacao da saida
+  // (0.0: sem anti-windup)
+  double kt=0.0;
+  // A memoria do controlador: termo integral e erro do passo anterior
+  double integral=0.0, last_error=0.0;
+
+  // Executa um passo de Dt segundos com o nivel H (0.0 a 1.0).
+  // Retorna a entrada da bomba: 0 a 65535
+  uint16_t step(double H, double Dt);
+};
+
+/// O estado dinamico do sistema com 2 tanques: tudo o que eh necessario
+/// para continuar a simulacao em outro objeto (ou em outro processo)
+struct TanksState
+{
+  double h1=0.0, h2=0.0;             // Niveis dos tanques (em metros)
+  bool v1_open=false, v2_open=false; // Estados das valvulas
+  uint16_t pump_input=0;             // Entrada da bomba: 0 a 65535
+  double flow_pump=0.0;              // Vazao da bomba para tanque 1 (em m3/s)
+  bool is_overflowing=false;         // Transbordamento
+  // A memoria da simulacao: passos com (ou sem) transbordamento e
+  // entrada e vazao % anteriores da bomba (histerese)
+  int n_steps_overflow=0;
+  double last_pump_input_perc=0.0, last_flow_pump_perc=0.0;
+  // Os estados dos geradores dos ruidos dinamico e de medicao (TanksNoise).
+  // Vazios se desconhecidos: os tanques continuam com os seus geradores.
+  std::string noise_dyn, noise_meas;
+  // O controlador de nivel (configuracao e memoria)
+  TanksPID pid;
+
+  // Conversao de/para o formato binario dos arquivos de estado
+  // (TANKS_STATE_MAGIC, TANKS_STATE_VERSION e os campos acima)
+  void toBytes(std::vector<uint8_t>& B) const;
+  // Retorna false se os dados nao estiverem no formato
+  bool fromBytes(const std::vector<uint8_t>& B);
+};
+
 /// Classe que representa o sistema com 2 tanques
 class Tanks
 {
@@ -26,13 +109,29 @@ public:
   uint16_t pumpInput() const;        // Entrada da bomba: 0 a 65535
   uint16_t pumpFlow() const;         // Medida do sensor de vazao da bomba: 0 a 65535
   uint16_t isOverflowing() const;    // Estah transbordando: sim (!=0) ou nao (==0)
+  uint16_t hTank1Real() const;       // Nivel real (sem ruido de medicao) do tanque 1: 0 a 65535
+  uint16_t hTank2Real() const;       // Nivel real (sem ruido de medicao) do tanque 2: 0 a 65535
 
   // Funcoes de atuacao
   void setTanksOn();                 // Liga os tanques
   void setTanksOff();                // Desliga os tanques
   void setV1Open(bool Open);         // Fixa o estado da valvula 1: aberta (true) ou fechada (false)
   void setV2Open(bool Open);         // Fixa o estado da valvula 2: aberta (true) ou fechada (false)
-  void setPumpInput(uint16_t Input); // Fixa a entrada da bomba: 0 a 65535
+  void setPumpInput(uint16_t Input); // Fixa a entrada da bomba: 0 a 65535 (desliga o controlador)
+
+  // Funcoes do controlador de nivel (somente com os tanques ligados)
+  void getPID(TanksPID& C) const;       // Leh a configuracao e a memoria do controlador
+  void setPID(const TanksPID& C);       // Fixa a configuracao (ao ligar, sem salto na bomba)
+
+  // Funcoes de transferencia do estado (somente com os tanques ligados)
+  void getState(TanksState& S) const;   // Leh o estado, simulado ateh o instante atual
+  void setState(const TanksState& S);   // Continua a simulacao a partir do estado S
+  void advance(unsigned Seconds);       // Simula imediatamente mais Seconds segundos
+
+  // Funcoes de copia do estado completo (somente com os tanques ligados)
+  bool saveState(const std::string& Arquivo) const; // Grava o estado em arquivo: true se OK
+  bool loadState(const std::string& Arquivo);       // Continua a partir do estado gravado: true se OK
+  std::unique_ptr<Tanks> fork() const;              // Copia independente, simulada soh por advance
 
 private:
   // Construtores e operadores de atribuicao suprimidos (nao existem na classe)
@@ -43,6 +142,8 @@ private:
 
   // Estado dos tanques como um todo (ligado/desligado)
   bool tanks_on;
+  // Simulacao em tempo real (true) ou somente por advance (false: copias de fork)
+  bool realtime;
   // Nivel dos tanques 1 e 2
   double h1,h2;                      // Niveis dos tanques (em metros)
   // Valvulas 1 e 2
@@ -52,9 +153,22 @@ private:
   double flow_pump;                  // Vazao da bomba para tanque 1 (em m3/s)
   // Transbordamento
   bool is_overflowing;
+  // A memoria da simulacao
+  int n_steps_overflow;              // Passos consecutivos com (ou sem) transbordamento
+  double last_pump_input_perc;       // Entrada % anterior da bomba: 0 a 1.0
+  double last_flow_pump_perc;        // Vazao % anterior da bomba: 0 a 1.0
+  // O controlador de nivel, que altera a entrada da bomba a cada passo
+  TanksPID pid;
 
   // Funcao privada de consulta
-  uint16_t getH(int I) const;        // Medida do sensor I (1 ou 2) de nivel: 0 a 65535
+  uint16_t getH(int I, bool Noise=true) const; // Medida do sensor I (1 ou 2) de nivel: 0 a 65535
+
+  // Geradores dos ruidos dinamico (simulacao) e de medicao (sensores).
+  // Sao separados para que as leituras dos sensores nao alterem a simulacao.
+  mutable TanksNoise noise_dyn, noise_meas;
+  // Exclusao mutua entre a simulacao, as leituras dos sensores e as
+  // transferencias do estado (cada objeto tem a sua)
+  mutable std::mutex mtx_simul;
 
   // Instante da ultima simulacao
   time_t last_t;
@@ -62,7 +176,7 @@ private:
   std::thread thr_simul;
 
   // Funcoes privadas de simulacao
-  void simulate() const;             // Simula os tanques ateh o instante atual
+  void simulate(unsigned Extra=0) const; // Simula ateh o instante atual, mais Extra passos
   void periodically_simulate() const;// Chama periodicamente a funcao "simulate"
 };
 
@@ -0,0 +1,15 @@
+#ifndef _SUP_TESTES_H_
+#define _SUP_TESTES_H_
+
+#include <iostream>
+
+/// Verifica uma condicao do teste. Em caso de falha, exibe a condicao e a
+/// linha e conta a falha em "falhas" (variavel local da funcao de teste).
+#define SUP_CHECK(cond) \
+  do { if (!(cond)) { std::cerr << __FILE__ << ":" << __LINE__ << ": falhou " #cond "\n"; ++falhas; } } while (0)
+
+/// As funcoes de teste: cada uma retorna o numero de falhas
+int testeDiario();
+int testeQuadro();
+
+#endif // _SUP_TESTES_H_
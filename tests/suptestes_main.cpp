@@ -0,0 +1,34 @@
+#include <iostream>
+#include "suptestes.h"
+
+using namespace std;
+
+/// ==============================
+/// Funcao principal dos testes:
+///   suptestes
+/// Executa os testes e exibe o numero de falhas de cada um.
+/// Retorna 0 se todos os testes passaram.
+/// ==============================
+
+int main()
+{
+  struct Teste
+  {
+    const char* nome;
+    int (*funcao)();
+  };
+  const Teste testes[] =
+  {
+    {"diario de atuacoes", testeDiario},
+    {"quadro de estados", testeQuadro}
+  };
+
+  int total = 0;
+  for (const auto& T : testes)
+  {
+    int falhas = T.funcao();
+    cout << T.nome << ": " << (falhas == 0 ? "OK" : to_string(falhas) + " falha(s)") << endl;
+    total += falhas;
+  }
+  return (total == 0 ? 0 : 1);
+}
@@ -0,0 +1,179 @@
+#include <cstdio>
+#include <vector>
+#include "supjournal.h"
+#include "supdados.h"
+#include "suptestes.h"
+
+using namespace std;
+
+/// Arquivos usados pelo teste, no diretorio em que ele eh executado
+#define TESTE_JOURNAL_PATH "suptestes.journal"
+#define TESTE_CHECKPOINT_PATH "suptestes.ckpt"
+
+/// Numero de bytes de um registro do diario (ver supjournal.cpp)
+static const long RECORD_LEN = 24;
+
+/// Acrescenta N bytes quaisquer ao fim do diario (escrita interrompida)
+static void acrescentar_lixo(long N)
+{
+  FILE* f = fopen(TESTE_JOURNAL_PATH, "ab");
+  if (f == nullptr) return;
+  for (long i=0; i<N; ++i) fputc(0x5A, f);
+  fclose(f);
+}
+
+/// Grava um ponto de restauracao na versao 1 (estado da planta em N inteiros
+/// de 16 bits, com o tamanho em 2 bytes), como os gravados antes da versao 2
+static void gravar_versao1(uint64_t Num, uint64_t T_us, uint64_t Seq, uint16_t N)
+{
+  vector<uint8_t> B;
+  auto put = [&B](uint64_t num, int nbytes)
+  {
+    for (int i=0; i<nbytes; ++i) B.push_back(uint8_t(num >> (8*i)));
+  };
+  put(SUP_CHECKPOINT_MAGIC, 4);
+  put(1, 4);
+  put(Num, 8);
+  put(T_us, 8);
+  put(Seq, 8);
+  put(N, 2);
+  for (uint16_t i=0; i<N; ++i) put(0x0100 + i, 2);
+  // Soma de verificacao FNV-1a de 32 bits (ver supjournal.cpp)
+  uint32_t h = 2166136261u;
+  for (uint8_t c : B) h = (h ^ c) * 16777619u;
+  put(h, 4);
+  FILE* f = fopen(TESTE_CHECKPOINT_PATH, "wb");
+  if (f == nullptr) return;
+  fwrite(B.data(), 1, B.size(), f);
+  fclose(f);
+}
+
+/// Altera um byte do diario na posicao Pos (registro corrompido)
+static void corromper(long Pos)
+{
+  FILE* f = fopen(TESTE_JOURNAL_PATH, "r+b");
+  if (f == nullptr) return;
+  fseek(f, Pos, SEEK_SET);
+  int c = fgetc(f);
+  fseek(f, Pos, SEEK_SET);
+  fputc(c ^ 0xFF, f);
+  fclose(f);
+}
+
+/// Testa a gravacao e a leitura (replay) do diario de atuacoes e do ponto de
+/// restauracao: as atuacoes posteriores ao ponto sao lidas na ordem; registros
+/// incompletos ou corrompidos, e os seguintes a eles, sao descartados; o ponto
+/// gravado por outra thread soh descarta as atuacoes anteriores a ele.
+int testeDiario()
+{
+  int falhas = 0;
+  SupCheckpoint C, L;
+  vector<SupJournalRecord> R;
+
+  std::remove(TESTE_CHECKPOINT_PATH);
+  std::remove(TESTE_JOURNAL_PATH);
+  {
+    // Sem ponto de restauracao, nao hah o que ler
+    SupJournal J(TESTE_JOURNAL_PATH, TESTE_CHECKPOINT_PATH);
+    SUP_CHECK(!J.load(L, R));
+
+    // Ponto de restauracao seguido de tres atuacoes
+    C.t_us = 1000000;
+    C.seq = 100;
+    C.data = {1, 2, 3, 4};
+    SUP_CHECK(J.checkpoint(C));
+    SUP_CHECK(J.isOpen());
+    J.append(1100000, CMD_SET_PUMP, 40000);
+    J.append(1200000, CMD_SET_V1, 1);
+    SUP_CHECK(J.hasPending());
+    SUP_CHECK(J.commit());
+    SUP_CHECK(!J.hasPending());
+    J.append(1300000, CMD_SET_V2, 0);
+    SUP_CHECK(J.commit());
+    SUP_CHECK(J.nextRecord() == C.n + 3);
+    // O diario eh fechado sem remover os arquivos (queda do servidor)
+    J.close();
+  }
+  {
+    SupJournal J(TESTE_JOURNAL_PATH, TESTE_CHECKPOINT_PATH);
+    SUP_CHECK(J.load(L, R));
+    SUP_CHECK(L.n == C.n && L.t_us == C.t_us && L.seq == C.seq && L.data == C.data);
+    SUP_CHECK(L.version == SUP_CHECKPOINT_VERSION);
+    SUP_CHECK(R.size() == 3);
+    if (R.size() == 3)
+    {
+      SUP_CHECK(R[0].n == C.n && R[1].n == C.n+1 && R[2].n == C.n+2);
+      SUP_CHECK(R[0].t_us == 1100000 && R[0].cmd == CMD_SET_PUMP && R[0].param == 40000);
+      SUP_CHECK(R[1].t_us == 1200000 && R[1].cmd == CMD_SET_V1 && R[1].param == 1);
+      SUP_CHECK(R[2].t_us == 1300000 && R[2].cmd == CMD_SET_V2 && R[2].param == 0);
+    }
+    // A numeracao continua a partir do que foi lido
+    SUP_CHECK(J.nextRecord() == C.n + 3);
+  }
+
+  // Registro incompleto no fim do diario: eh descartado
+  acrescentar_lixo(RECORD_LEN/2);
+  {
+    SupJournal J(TESTE_JOURNAL_PATH, TESTE_CHECKPOINT_PATH);
+    SUP_CHECK(J.load(L, R));
+    SUP_CHECK(R.size() == 3);
+  }
+
+  // Registro corrompido: ele e os seguintes sao descartados
+  corromper(RECORD_LEN + 10);
+  {
+    SupJournal J(TESTE_JOURNAL_PATH, TESTE_CHECKPOINT_PATH);
+    SUP_CHECK(J.load(L, R));
+    SUP_CHECK(R.size() == 1);
+  }
+
+  // Ponto de restauracao gravado sem esvaziar o diario (como pela thread do
+  // ponto de restauracao), com uma atuacao acrescentada antes do trim
+  {
+    SupJournal J(TESTE_JOURNAL_PATH, TESTE_CHECKPOINT_PATH);
+    C.data = {5, 6};
+    SUP_CHECK(J.checkpoint(C));
+    J.append(2000000, CMD_SET_PUMP, 1);
+    SUP_CHECK(J.commit());
+
+    SupCheckpoint P;
+    P.n = J.nextRecord();
+    P.t_us = 2100000;
+    P.seq = 200;
+    P.data = {7};
+    SUP_CHECK(J.saveCheckpoint(P));
+    J.append(2200000, CMD_SET_PUMP, 2);
+    SUP_CHECK(J.commit());
+    // Hah uma atuacao posterior ao ponto: o diario nao eh esvaziado
+    SUP_CHECK(J.trim(P.n));
+    J.close();
+
+    SupJournal K(TESTE_JOURNAL_PATH, TESTE_CHECKPOINT_PATH);
+    SUP_CHECK(K.load(L, R));
+    SUP_CHECK(L.n == P.n && L.t_us == P.t_us && L.seq == P.seq && L.data == P.data);
+    // Soh a atuacao posterior ao ponto eh lida
+    SUP_CHECK(R.size() == 1 && R[0].n == P.n && R[0].param == 2);
+  }
+
+  // Ponto de restauracao na versao 1: eh lido, com os inteiros de 16 bits em data
+  gravar_versao1(5, 3000000, 300, 25);
+  std::remove(TESTE_JOURNAL_PATH);
+  {
+    SupJournal J(TESTE_JOURNAL_PATH, TESTE_CHECKPOINT_PATH);
+    SUP_CHECK(J.load(L, R));
+    SUP_CHECK(L.version == 1 && L.n == 5 && L.t_us == 3000000 && L.seq == 300);
+    SUP_CHECK(L.data.size() == 50 && L.data[0] == 0x00 && L.data[1] == 0x01 &&
+              L.data[48] == 24 && L.data[49] == 0x01);
+    SUP_CHECK(R.empty() && J.nextRecord() == 5);
+  }
+
+  // Desligamento normal: os arquivos sao removidos
+  {
+    SupJournal J(TESTE_JOURNAL_PATH, TESTE_CHECKPOINT_PATH);
+    SUP_CHECK(J.checkpoint(C));
+    J.remove();
+    SUP_CHECK(!J.isOpen());
+    SUP_CHECK(!J.load(L, R));
+  }
+  return falhas;
+}
@@ -0,0 +1,103 @@
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "supboard.h"
+#include "suptestes.h"
+
+using namespace std;
+
+/// Porta ficticia: o quadro do teste nao se confunde com o de um servidor
+#define TESTE_BOARD_PORT "suptestes"
+
+/// Duracao (em milisegundos) do teste concorrente: quanto maior, mais
+/// vezes uma leitura eh interrompida por uma publicacao (e repetida)
+#define TESTE_BOARD_DURACAO 1000
+
+/// O estado publicado na publicacao de numero N: todos os campos dependem de N,
+/// de modo que uma copia com campos de publicacoes diferentes eh detectada
+static SupState estado(uint64_t N)
+{
+  SupState S;
+  S.seq = N;
+  S.t_us = N*1000 + (N << 40);
+  S.V1 = uint16_t(N & 1);
+  S.V2 = uint16_t((N >> 1) & 1);
+  S.H1 = uint16_t(N);
+  S.H2 = uint16_t(~N);
+  S.PumpInput = uint16_t(N*3);
+  S.PumpFlow = uint16_t(N*5);
+  S.ovfl = uint16_t((N >> 2) & 1);
+  return S;
+}
+
+/// Testa se S eh exatamente um estado publicado por "estado"
+static bool consistente(const SupState& S)
+{
+  const SupState E = estado(S.seq);
+  return S.t_us == E.t_us && S.V1 == E.V1 && S.V2 == E.V2 && S.H1 == E.H1 &&
+         S.H2 == E.H2 && S.PumpInput == E.PumpInput && S.PumpFlow == E.PumpFlow &&
+         S.ovfl == E.ovfl;
+}
+
+/// Testa o quadro de estados: a leitura antes da primeira publicacao e depois
+/// do fechamento; e a leitura com repeticao (seqlock) enquanto o escritor
+/// publica continuamente em outra thread: nenhuma copia pode misturar
+/// campos de publicacoes diferentes, e a sequencia lida nunca volta.
+int testeQuadro()
+{
+  int falhas = 0;
+  SupBoardWriter W;
+  SupBoardReader Rd;
+  SupState S;
+
+  // Sem servidor, o quadro nao existe
+  SUP_CHECK(!Rd.open(TESTE_BOARD_PORT));
+
+  SUP_CHECK(W.open(TESTE_BOARD_PORT, 2));
+  SUP_CHECK(Rd.open(TESTE_BOARD_PORT));
+  SUP_CHECK(Rd.numPlants() == 2);
+  // Nenhum estado publicado ainda; planta inexistente
+  SUP_CHECK(Rd.generation(0) == 0);
+  SUP_CHECK(!Rd.read(0, S));
+  SUP_CHECK(!Rd.read(2, S));
+
+  W.publish(0, estado(1));
+  SUP_CHECK(Rd.generation(0) == 1);
+  SUP_CHECK(Rd.read(0, S) && S.seq == 1 && consistente(S));
+  // A outra planta continua sem estado
+  SUP_CHECK(!Rd.read(1, S));
+
+  // Leituras concorrentes com as publicacoes
+  atomic<bool> fim(false);
+  uint64_t publicacoes = 1;
+  thread escritor([&W, &fim, &publicacoes]()
+  {
+    while (!fim) W.publish(0, estado(++publicacoes));
+  });
+  uint64_t leituras = 0, ultima = 0;
+  int inconsistentes = 0, regressoes = 0;
+  const auto t_fim = chrono::steady_clock::now() + chrono::milliseconds(TESTE_BOARD_DURACAO);
+  while (chrono::steady_clock::now() < t_fim)
+  {
+    if (!Rd.read(0, S)) continue;
+    ++leituras;
+    if (!consistente(S)) ++inconsistentes;
+    if (S.seq < ultima) ++regressoes;
+    ultima = S.seq;
+  }
+  fim = true;
+  escritor.join();
+  SUP_CHECK(leituras > 0);
+  SUP_CHECK(inconsistentes == 0);
+  SUP_CHECK(regressoes == 0);
+  SUP_CHECK(Rd.read(0, S) && S.seq == publicacoes && consistente(S));
+  SUP_CHECK(Rd.generation(0) == uint32_t(publicacoes));
+
+  // Depois que o servidor fecha o quadro, o leitor deixa de aceitar os estados
+  W.close();
+  SUP_CHECK(Rd.numPlants() == 0);
+  SUP_CHECK(!Rd.read(0, S));
+  Rd.close();
+  SUP_CHECK(!Rd.open(TESTE_BOARD_PORT));
+  return falhas;
+}